@@ -207,6 +207,35 @@ void try_compile(const char* path) {
     tests_working++;
 }
 
+// compiles the files together (.c is added), the TUs get parsed and checked in parallel
+// with each other so this is mostly here to catch them stepping on each other's toes.
+// flags is tacked onto the end of the command line.
+void try_compile_together(size_t count, const char* paths[], const char* flags) {
+    number_of_tests++;
+
+    printf("Attempt %-80s", paths[0]);
+
+    int code;
+    char cmd[1024];
+
+    // Compile
+    int len = snprintf(cmd, 1024, "cuik");
+    for (size_t i = 0; i < count; i++) {
+        len += snprintf(cmd + len, 1024 - len, " %s.c", paths[i]);
+    }
+    snprintf(cmd + len, 1024 - len, " %s", flags);
+
+    code = system(cmd);
+    if (code != 0) {
+        printf("Fail to compile! (code: %d)\n", code);
+        return;
+    }
+
+    // Success!
+    printf("Success!\n");
+    tests_working++;
+}
+
 // delete .obj, .pdb and .exe
 void delete_crap_in_dir(const char* dir_path) {
     char temp[PATH_MAX];
@@ -355,6 +384,27 @@ int main(int argc, char** argv) {
             //try_compile("tests"SLASH"the_increment"SLASH"inria"SLASH"function_parameter_scope");
             //try_compile("tests"SLASH"the_increment"SLASH"inria"SLASH"function_parameter_scope_extends");
             try_compile("tests"SLASH"the_increment"SLASH"inria"SLASH"dangling_else");
+            try_compile("tests"SLASH"the_increment"SLASH"cuik"SLASH"attribute_stmt");
+
+            // Multiple TUs at once
+            try_compile_together(4, (const char*[]) {
+                    "tests"SLASH"the_increment"SLASH"cuik"SLASH"multi_tu_main",
+                    "tests"SLASH"the_increment"SLASH"cuik"SLASH"multi_tu_1",
+                    "tests"SLASH"the_increment"SLASH"cuik"SLASH"multi_tu_2",
+                    "tests"SLASH"the_increment"SLASH"cuik"SLASH"multi_tu_3",
+                }, "-c");
+
+            // --gc needs the whole program so these get linked, both call into libc
+            try_compile_together(1, (const char*[]) {
+                    "tests"SLASH"the_increment"SLASH"cuik"SLASH"gc_extern",
+                }, "--gc");
+
+            try_compile_together(4, (const char*[]) {
+                    "tests"SLASH"the_increment"SLASH"cuik"SLASH"multi_tu_main",
+                    "tests"SLASH"the_increment"SLASH"cuik"SLASH"multi_tu_1",
+                    "tests"SLASH"the_increment"SLASH"cuik"SLASH"multi_tu_2",
+                    "tests"SLASH"the_increment"SLASH"cuik"SLASH"multi_tu_3",
+                }, "--gc");
 
             printf("===============   Tests (%d succeeded out of %d)   ===============\n", tests_working, number_of_tests);
 
@@ -435,6 +485,41 @@ int main(int argc, char** argv) {
             }
 
             printf("===============   Tests (%d succeeded out of %d)   ===============\n", successes, INPUT_FILE_COUNT);
+        #ifndef ONLY_LIBRARY
+        } else if (strcmp(argv[1], "bench") == 0) {
+            printf("\n\n\n");
+            printf("Running frontend benchmarks...\n");
+
+            // the benchmarks have their own driver, see drivers/bench_driver.c
+            static const char* BENCH_INPUTS[] = {
+                #if ON_WINDOWS
+                "bin"SLASH"bench_driver.obj", "bin"SLASH"libcuik.lib", "deps"SLASH"tb"SLASH"tildebackend.lib",
+                #else
+                "bin"SLASH"bench_driver.o", "bin"SLASH"libcuik.a", "deps"SLASH"tb"SLASH"tildebackend.a",
+                #endif
+            };
+
+            cc_invoke(&options, "drivers"SLASH"bench_driver.c", NULL);
+            cmd_wait_for_all();
+
+            ld_invoke("bin"SLASH"cuik_bench",
+                COUNTOF(BENCH_INPUTS), BENCH_INPUTS,
+                COUNTOF(EXTERNALS), EXTERNALS
+            );
+
+            clean("bin"SLASH);
+
+            // ld_invoke tacks on .exe when it's linking with clang
+            const char* bench_cmd = ON_CLANG
+                ? "bin"SLASH"cuik_bench.exe -o bin"SLASH"bench.json"
+                : "bin"SLASH"cuik_bench -o bin"SLASH"bench.json";
+
+            if (system(bench_cmd) == 0) {
+                printf("Results written to bin"SLASH"bench.json\n");
+            } else {
+                printf("Benchmarks failed to run!\n");
+            }
+        #endif
         } else {
             printf("What's '%s' supposed to mean?\n", argv[1]);
         }
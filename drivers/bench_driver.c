@@ -0,0 +1,404 @@
+// Frontend throughput benchmarks
+//
+// usage: cuik_bench [-n iterations] [-o output.json] [files...]
+//
+// For every file it times the lexer alone (lexer_read over the file), the preprocessor
+// alone (cuikpp_run) and parsing + semantic analysis, then writes the results as JSON
+// (to stdout unless there's a -o). Each stage reports the best of N runs as MB/s and
+// tokens/s along with the peak RSS and how many allocations a single run made. With
+// no files it runs the corpus below, the paths are relative to the repo root.
+//
+// On POSIX each stage runs in its own process, that way the peak RSS is just that
+// stage and if the frontend crashes on a file it's reported as a failed stage instead
+// of taking down the whole run.
+#include <cuik.h>
+#include "helper.h"
+#include "preproc/lexer.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+static const char* DEFAULT_CORPUS[] = {
+    "tests/the_pile/sqlite3.h",
+    "tests/the_pile/cosmopolitan.h",
+    "tests/stb_image.h",
+    "tests/the_martins/win32_gl/glcorearb.h",
+};
+
+typedef struct {
+    bool ok;
+    char error[64];
+
+    // best run
+    double seconds;
+    size_t bytes, tokens;
+
+    // a single run, -1 if we can't count them
+    long long allocations, allocated_bytes;
+    long long peak_rss_kb;
+} BenchResult;
+
+typedef bool (*BenchStage)(const char* path, BenchResult* r);
+
+static int iterations = 5;
+static Cuik_Target target_desc;
+
+////////////////////////////////
+// Allocation counting
+////////////////////////////////
+// glibc lets the program replace malloc as long as the whole family comes along, we
+// just count the calls and forward them to the real thing. Arenas are made of pages
+// so they don't show up here.
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static size_t alloc_count, alloc_bytes;
+
+void* malloc(size_t size) {
+    alloc_count += 1, alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    alloc_count += 1, alloc_bytes += count * size;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    alloc_count += 1, alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+    __libc_free(ptr);
+}
+
+static void alloc_counter_reset(void) {
+    alloc_count = alloc_bytes = 0;
+}
+
+static void alloc_counter_read(BenchResult* r) {
+    r->allocations = alloc_count;
+    r->allocated_bytes = alloc_bytes;
+}
+#else
+static void alloc_counter_reset(void) {}
+static void alloc_counter_read(BenchResult* r) {}
+#endif
+
+////////////////////////////////
+// Stages
+////////////////////////////////
+static bool bench_fail(BenchResult* r, const char* msg) {
+    snprintf(r->error, sizeof(r->error), "%s", msg);
+    return false;
+}
+
+static void bench_time(BenchResult* r, uint64_t start, uint64_t end) {
+    double t = (end - start) / 1000000000.0;
+    if (r->seconds == 0.0 || t < r->seconds) {
+        r->seconds = t;
+    }
+}
+
+static void init_preprocessor(Cuik_CPP* cpp) {
+    cuik_init_preprocessor(cpp, &cuik_default_fs, &target_desc, true, 0, NULL);
+}
+
+// everything the preprocessor read (headers that got included twice count twice)
+static size_t preprocessed_bytes(Cuik_CPP* cpp) {
+    size_t count = cuikpp_get_file_table_count(cpp);
+    Cuik_FileEntry* files = cuikpp_get_file_table(cpp);
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (files[i].content != NULL) bytes += strlen((const char*)files[i].content);
+    }
+    return bytes;
+}
+
+static bool bench_lex(const char* path, BenchResult* r) {
+    // the file system normalizes the whitespace (which the lexer expects) and pads
+    // the end with zeroes
+    Cuik_File file = CUIK_CALL(&cuik_default_fs, get_file, false, path);
+    if (!file.found) {
+        return bench_fail(r, "could not read file");
+    }
+
+    const unsigned char* text = (const unsigned char*)file.data;
+    for (int i = 0; i < iterations; i++) {
+        alloc_counter_reset();
+        uint64_t start = cuik_time_in_nanos();
+
+        Lexer l = { path, text, text, 1 };
+        size_t count = 0;
+        for (;;) {
+            lexer_read(&l);
+            if (l.token_type == 0) break;
+            count++;
+        }
+
+        bench_time(r, start, cuik_time_in_nanos());
+        alloc_counter_read(r);
+        r->tokens = count;
+    }
+
+    r->bytes = file.length;
+    return true;
+}
+
+static bool bench_preprocess(const char* path, BenchResult* r) {
+    for (int i = 0; i < iterations; i++) {
+        Cuik_CPP cpp;
+        init_preprocessor(&cpp);
+
+        alloc_counter_reset();
+        uint64_t start = cuik_time_in_nanos();
+        TokenStream tokens = cuikpp_run(&cpp, path);
+        bench_time(r, start, cuik_time_in_nanos());
+        alloc_counter_read(r);
+
+        r->bytes = preprocessed_bytes(&cpp);
+        r->tokens = tokens_count(&tokens);
+
+        tokens_free(&tokens);
+        arrfree(tokens.locations);
+        arrfree(tokens.file_locs);
+        arrfree(tokens.file_runs);
+        cuikpp_deinit(&cpp);
+    }
+
+    return true;
+}
+
+static bool bench_parse(const char* path, BenchResult* r) {
+    for (int i = 0; i < iterations; i++) {
+        Cuik_CPP cpp;
+        init_preprocessor(&cpp);
+
+        TokenStream tokens = cuikpp_run(&cpp, path);
+        cuikpp_finalize(&cpp);
+
+        r->bytes = preprocessed_bytes(&cpp);
+        r->tokens = tokens_count(&tokens);
+
+        // single threaded & without an IR module, we only care about the frontend
+        alloc_counter_reset();
+        uint64_t start = cuik_time_in_nanos();
+
+        Cuik_ErrorStatus errors;
+        TranslationUnit* tu = cuik_parse_translation_unit(&(Cuik_TranslationUnitDesc){
+                .tokens = &tokens,
+                .errors = &errors,
+                .target = &target_desc,
+            });
+
+        bench_time(r, start, cuik_time_in_nanos());
+        alloc_counter_read(r);
+
+        if (tu == NULL) {
+            return bench_fail(r, "failed to parse");
+        }
+
+        // the parser already freed the tokens, just not the locations
+        cuik_destroy_translation_unit(tu);
+        arrfree(tokens.locations);
+        arrfree(tokens.file_locs);
+        arrfree(tokens.file_runs);
+        cuikpp_deinit(&cpp);
+    }
+
+    return true;
+}
+
+static BenchResult run_stage(BenchStage stage, const char* path) {
+    BenchResult r = { .allocations = -1, .allocated_bytes = -1, .peak_rss_kb = -1 };
+
+    #ifdef _WIN32
+    r.ok = stage(path, &r);
+    return r;
+    #else
+    int fds[2];
+    if (pipe(fds) < 0) {
+        bench_fail(&r, "could not create pipe");
+        return r;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]), close(fds[1]);
+        bench_fail(&r, "could not fork");
+        return r;
+    } else if (pid == 0) {
+        close(fds[0]);
+
+        // diagnostics go to stdout, keep them out of the JSON
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+
+        r.ok = stage(path, &r);
+        _exit(write(fds[1], &r, sizeof(r)) == sizeof(r) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    BenchResult child;
+    ssize_t got = read(fds[0], &child, sizeof(child));
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        bench_fail(&r, "could not wait on child");
+        return r;
+    }
+
+    if (got == sizeof(child)) {
+        r = child;
+    } else if (WIFSIGNALED(status)) {
+        snprintf(r.error, sizeof(r.error), "killed by signal %d (%s)", WTERMSIG(status), strsignal(WTERMSIG(status)));
+    } else {
+        snprintf(r.error, sizeof(r.error), "exited with code %d", WEXITSTATUS(status));
+    }
+
+    #ifdef __APPLE__
+    r.peak_rss_kb = usage.ru_maxrss / 1024;
+    #else
+    r.peak_rss_kb = usage.ru_maxrss;
+    #endif
+    return r;
+    #endif
+}
+
+////////////////////////////////
+// JSON output
+////////////////////////////////
+static void print_json_string(FILE* out, const char* str) {
+    fputc('\"', out);
+    for (; *str; str++) {
+        if (*str == '\"' || *str == '\\') {
+            fprintf(out, "\\%c", *str);
+        } else if ((unsigned char)*str < 0x20) {
+            fprintf(out, "\\u%04x", *str);
+        } else {
+            fputc(*str, out);
+        }
+    }
+    fputc('\"', out);
+}
+
+static void print_json_count(FILE* out, long long x) {
+    if (x < 0) fprintf(out, "null");
+    else fprintf(out, "%lld", x);
+}
+
+static void print_result(FILE* out, const char* name, const BenchResult* r, bool last) {
+    fprintf(out, "      \"%s\": {\"ok\": %s", name, r->ok ? "true" : "false");
+
+    if (r->ok) {
+        double mb_per_sec = r->seconds > 0.0 ? (r->bytes / r->seconds) / 1000000.0 : 0.0;
+        double tokens_per_sec = r->seconds > 0.0 ? r->tokens / r->seconds : 0.0;
+
+        fprintf(out, ", \"seconds\": %.9f, \"bytes\": %zu, \"tokens\": %zu", r->seconds, r->bytes, r->tokens);
+        fprintf(out, ", \"mb_per_sec\": %.3f, \"tokens_per_sec\": %.0f", mb_per_sec, tokens_per_sec);
+    } else {
+        fprintf(out, ", \"error\": ");
+        print_json_string(out, r->error);
+    }
+
+    fprintf(out, ", \"peak_rss_kb\": ");
+    print_json_count(out, r->peak_rss_kb);
+    fprintf(out, ", \"allocations\": ");
+    print_json_count(out, r->ok ? r->allocations : -1);
+    fprintf(out, ", \"allocated_bytes\": ");
+    print_json_count(out, r->ok ? r->allocated_bytes : -1);
+    fprintf(out, "}%s\n", last ? "" : ",");
+}
+
+int main(int argc, char** argv) {
+    const char* output_path = NULL;
+
+    size_t file_count = 0;
+    const char** files = malloc(argc * sizeof(const char*));
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+            if (iterations <= 0) {
+                fprintf(stderr, "error: expected a positive iteration count\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-n iterations] [-o output.json] [files...]\n", argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            files[file_count++] = argv[i];
+        }
+    }
+
+    if (file_count == 0) {
+        files = DEFAULT_CORPUS;
+        file_count = sizeof(DEFAULT_CORPUS) / sizeof(DEFAULT_CORPUS[0]);
+    }
+
+    FILE* out = stdout;
+    if (output_path != NULL) {
+        out = fopen(output_path, "wb");
+        if (out == NULL) {
+            fprintf(stderr, "error: could not open '%s' for writing\n", output_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    cuik_init();
+    find_system_deps();
+
+    #if defined(_WIN32)
+    target_desc.sys = TB_SYSTEM_WINDOWS;
+    #elif defined(__linux) || defined(linux)
+    target_desc.sys = TB_SYSTEM_LINUX;
+    #elif defined(__APPLE__) || defined(__MACH__) || defined(macintosh)
+    target_desc.sys = TB_SYSTEM_MACOS;
+    #endif
+    target_desc.arch = cuik_get_x64_target_desc();
+
+    fprintf(out, "{\n");
+    #ifdef NDEBUG
+    fprintf(out, "  \"release\": true,\n");
+    #else
+    fprintf(out, "  \"release\": false,\n");
+    #endif
+    fprintf(out, "  \"iterations\": %d,\n", iterations);
+    fprintf(out, "  \"files\": [\n");
+
+    for (size_t i = 0; i < file_count; i++) {
+        BenchResult lex = run_stage(bench_lex, files[i]);
+        BenchResult pp = run_stage(bench_preprocess, files[i]);
+        BenchResult parse = run_stage(bench_parse, files[i]);
+
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"path\": ");
+        print_json_string(out, files[i]);
+        fprintf(out, ",\n");
+        print_result(out, "lex", &lex, false);
+        print_result(out, "preprocess", &pp, false);
+        print_result(out, "parse", &parse, true);
+        fprintf(out, "    }%s\n", i + 1 < file_count ? "," : "");
+    }
+
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+
+    if (out != stdout) fclose(out);
+    return EXIT_SUCCESS;
+}
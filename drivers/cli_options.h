@@ -7,15 +7,25 @@ OPTION(HELP,    h, help,        0, "print all the options and exit")
 OPTION(OUT,     o, output,      1, "set the output path")
 OPTION(INCLUDE, I, include,     1, "add include directory")
 OPTION(PREPROC, P, preprocess,  0, "preprocess file and output to stdout")
+OPTION(PREFIX,  p, prefix,      1, "precompile a header and include it before every file")
 OPTION(RUN,     r, run,         0, "execute compiled program")
 OPTION(LIB,     l, lib,         1, "add library to compilation unit")
 OPTION(TIME,    T, time,        0, "profile the compile times")
 OPTION(OBJ,     c, obj,         0, "dont link, only emit the object file")
 OPTION(OPT,     O, optimize,    0, "optimize the generated IR")
+OPTION(PASSES,  _, passes,      1, "optimize with a custom pass list (--passes=O1,load_elim...)")
+OPTION(TIER,    _, tier,        1, "pick the compile tier: debug (default), hybrid or release (same as -O)")
+OPTION(HOT,     _, hot,         1, "file with the names of hot functions (one per line) for --tier=hybrid")
+OPTION(PROFILE_GENERATE, _, profile-generate, 0, "count function entries, running the program appends them to <output>.cuikprof")
+OPTION(PROFILE_USE, _, profile-use, 1, "use a profile from --profile-generate to pick the hot functions (implies --tier=hybrid)")
 OPTION(ASM,     S, assembly,    0, "emit assembly in stdout")
 OPTION(AST,     _, ast,         0, "emit AST into stdout")
 OPTION(TYPES,   t, typecheck,   0, "type check only")
 OPTION(IR,      _, ir,          0, "compile up until the IR generation")
 OPTION(VERBOSE, _, verbose,     0, "verbose")
+OPTION(GC,      _, gc,          0, "only compile the functions reachable from main (executables only)")
+OPTION(INCREMENTAL, _, incremental, 0, "reuse the last object file if the preprocessed code and flags haven't changed")
+OPTION(SERVER,  _, server,      0, "stay alive and run the compiles sent by --connect")
+OPTION(CONNECT, _, connect,     0, "send the compile to a running --server (compiles locally if there isn't one)")
 
 #undef OPTION
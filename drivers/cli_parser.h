@@ -35,11 +35,11 @@ static Arg get_cli_arg(int* index, int argc, char** argv) {
                 if (n == 0) {                                                                 \
                     return (Arg){ ARG_ ## type, arg_is_set };                                 \
                 } else {                                                                      \
-                    if (argv[i][sizeof("--" #long_name "=")] == '\0') {                       \
-                        fprintf(stderr, "error: expected argument after --" #long_name "\n"); \
+                    if (argv[i][sizeof("--" #long_name) - 1] != '=' ||                        \
+                        argv[i][sizeof("--" #long_name)] == '\0') {                           \
+                        fprintf(stderr, "error: expected argument after --" #long_name "=\n"); \
                         exit(1);                                                              \
                     }                                                                         \
-                    *index += 1;                                                              \
                     return (Arg){ ARG_ ## type, argv[i] + sizeof("--" #long_name) };          \
                 }                                                                             \
             }
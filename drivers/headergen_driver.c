@@ -7,19 +7,18 @@ static void dump_tokens(FILE* out_file, TokenStream* s) {
     const char* last_file = NULL;
     int last_line = 0;
 
-    Token* tokens = cuik_get_tokens(s);
     size_t count = cuik_get_token_count(s);
 
     for (size_t i = 0; i < count; i++) {
-        Token* t = &tokens[i];
-        SourceLoc* loc = &s->locations[SOURCE_LOC_GET_DATA(t->location)];
+        Token t = cuik_get_token(s, i);
+        SourceLoc loc = cuik_get_location(s, t.location);
 
-        if (last_file != loc->line->filepath && strcmp(loc->line->filepath, "<temp>") != 0) {
+        if (last_file != loc.line->filepath && strcmp(loc.line->filepath, "<temp>") != 0) {
             char str[MAX_PATH];
 
             // TODO(NeGate): Kinda shitty but i just wanna duplicate
             // the backslashes to avoid them being treated as an escape
-            const char* in = (const char*)loc->line->filepath;
+            const char* in = (const char*)loc.line->filepath;
             char* out = str;
 
             while (*in) {
@@ -33,16 +32,16 @@ static void dump_tokens(FILE* out_file, TokenStream* s) {
             }
             *out++ = '\0';
 
-            fprintf(out_file, "\n#line %d \"%s\"\t", loc->line->line, str);
-            last_file = loc->line->filepath;
+            fprintf(out_file, "\n#line %d \"%s\"\t", loc.line->line, str);
+            last_file = loc.line->filepath;
         }
 
-        if (last_line != loc->line->line) {
-            fprintf(out_file, "\n/* line %3d */\t", loc->line->line);
-            last_line = loc->line->line;
+        if (last_line != loc.line->line) {
+            fprintf(out_file, "\n/* line %3d */\t", loc.line->line);
+            last_line = loc.line->line;
         }
 
-        fprintf(out_file, "%.*s ", (int)(t->end - t->start), t->start);
+        fprintf(out_file, "%.*s ", (int)(t.end - t.start), t.start);
     }
 }
 
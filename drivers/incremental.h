@@ -0,0 +1,128 @@
+// Incremental builds (--incremental)
+//
+// After preprocessing every input we hash the token streams (so comments, whitespace
+// and touched files don't count as changes) along with the flags that affect codegen.
+// If that matches the key of the last build the cached object file is reused and we
+// skip parsing, type checking, IR gen and codegen entirely.
+//
+// NOTE(NeGate): TB doesn't let us get at the machine code for a single function so
+// the cache is per output object instead of per function. For the same reason the
+// object can't be streamed out as functions finish, tb_module_export builds the whole
+// image before writing it.
+#include <stdio.h>
+#include <stdint.h>
+
+#define INCREMENTAL_MAGIC   "CUIKINC"
+#define INCREMENTAL_VERSION 1
+
+enum {
+    // the entrypoint was WinMain so we link as a windows subsystem program
+    INCREMENTAL_FLAG_WINMAIN = 1,
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+
+    uint64_t key;
+    uint64_t object_size;
+} IncrementalHeader;
+
+static uint64_t incremental__fnv(uint64_t hash, const void* data, size_t length) {
+    const uint8_t* p = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+// the per-file hashes are combined with addition so the order the threads
+// finish in doesn't matter, this mixes them up first so they don't cancel out.
+static uint64_t incremental__mix(uint64_t x) {
+    x ^= x >> 30, x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27, x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t incremental_hash_tokens(const char* path, TokenStream* s) {
+    uint64_t hash = incremental__fnv(0xcbf29ce484222325ull, path, strlen(path) + 1);
+
+    size_t count = cuik_get_token_count(s);
+    for (size_t i = 0; i < count; i++) {
+        Token t = cuik_get_token(s, i);
+
+        uint32_t header[2] = { t.type, t.end - t.start };
+        hash = incremental__fnv(hash, header, sizeof(header));
+        hash = incremental__fnv(hash, t.start, t.end - t.start);
+    }
+
+    return incremental__mix(hash);
+}
+
+// copies the cached object into obj_path if the key matches
+static bool incremental_load(const char* cache_path, uint64_t key, const char* obj_path, uint32_t* out_flags) {
+    FILE* file = fopen(cache_path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    IncrementalHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, INCREMENTAL_MAGIC, sizeof(INCREMENTAL_MAGIC)) != 0 ||
+        header.version != INCREMENTAL_VERSION ||
+        header.key != key) {
+        fclose(file);
+        return false;
+    }
+
+    void* object = malloc(header.object_size);
+    bool success = fread(object, 1, header.object_size, file) == header.object_size;
+    fclose(file);
+
+    if (success) {
+        FILE* out = fopen(obj_path, "wb");
+        success = out != NULL && fwrite(object, 1, header.object_size, out) == header.object_size;
+        if (out != NULL) fclose(out);
+    }
+
+    free(object);
+    *out_flags = header.flags;
+    return success;
+}
+
+static void incremental_save(const char* cache_path, uint64_t key, uint32_t flags, const char* obj_path) {
+    FILE* in = fopen(obj_path, "rb");
+    if (in == NULL) {
+        return;
+    }
+
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    void* object = malloc(size);
+    bool success = fread(object, 1, size, in) == (size_t)size;
+    fclose(in);
+
+    FILE* out = success ? fopen(cache_path, "wb") : NULL;
+    if (out != NULL) {
+        IncrementalHeader header = {
+            .magic = INCREMENTAL_MAGIC,
+            .version = INCREMENTAL_VERSION,
+            .flags = flags,
+            .key = key,
+            .object_size = size,
+        };
+
+        if (fwrite(&header, sizeof(header), 1, out) != 1 || fwrite(object, 1, size, out) != (size_t)size) {
+            fprintf(stderr, "warning: could not write incremental cache '%s'\n", cache_path);
+        }
+        fclose(out);
+    }
+
+    free(object);
+}
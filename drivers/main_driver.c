@@ -3,12 +3,22 @@
 #include "cli_parser.h"
 #include "json_perf.h"
 #include "threadpool.h"
+#include "incremental.h"
+#include "server.h"
+#include "passes.h"
+#include "profile.h"
+#include "shared_includes.h"
 
 // compiler arguments
 static DynArray(const char*) include_directories;
 static DynArray(const char*) input_libraries;
 static DynArray(const char*) input_files;
 static const char* output_name;
+static const char* prefix_header;
+static char prefix_pch_path[FILENAME_MAX];
+
+// the leading #includes every input file has in common, preprocessed once
+static Cuik_CPPSnapshot* shared_snapshot;
 static char output_path_no_ext[FILENAME_MAX];
 
 static bool args_ir;
@@ -19,15 +29,59 @@ static bool args_assembly;
 static bool args_time;
 static bool args_verbose;
 static bool args_preprocess;
-static bool args_optimize;
+static Cuik_CompileTier args_tier;
 static bool args_object_only;
+static bool args_incremental;
+static bool args_profile_generate;
+static bool args_gc;
+static PassPipeline pass_pipeline;
+
+// anything that picks hot functions mixes their names in here for the incremental key
+static uint64_t hot_functions_hash;
 
+static bool is_server;
+
+// set when any of the TUs fail to parse, the compile bails once the frontend is done
+// (instead of exiting) so the server can keep going.
+static atomic_bool parse_failed;
 static TB_Module* mod;
 static threadpool_t* thread_pool;
 static Cuik_IThreadpool ithread_pool;
 static Cuik_Target target_desc;
 static CompilationUnit compilation_unit;
 
+// when the backend is pipelined each TU starts IR gen as soon as it's through
+// sema, functions that refer to externals we haven't seen a definition for yet
+// are put aside until the rest of the frontend is done.
+//
+// NOTE(NeGate): externals that no TU defines (printf, memcpy, malloc...) never show
+// up in the export table so anything calling into libc always waits for the barrier,
+// in most real code that's the majority of functions. --verbose prints how many
+// got deferred.
+typedef struct {
+    TranslationUnit* tu;
+    Stmt* stmt;
+} DeferredStmt;
+
+// roughly how many tokens worth of function bodies go into each task
+#define DEFERRED_BATCH_COST 4096
+
+typedef struct {
+    size_t start, end;
+} DeferredTask;
+
+static bool pipeline_backend;
+static mtx_t deferred_mutex;
+static DynArray(DeferredStmt) deferred_stmts;
+
+// for --verbose, how many functions went through IR gen and how many of those waited
+static atomic_size_t irgen_funcs, deferred_funcs;
+
+// --incremental preprocesses everything up front so it can check the cache
+// before doing any of the real work (see incremental.h)
+static TokenStream* preprocessed_files;
+static uint64_t* preprocessed_hashes;
+
 static int calculate_worker_thread_count(void) {
     #ifdef _WIN32
     SYSTEM_INFO sysinfo;
@@ -43,31 +97,39 @@ static int calculate_worker_thread_count(void) {
     #endif
 }
 
-static void tp_submit(void* user_data, void fn(void*), void* arg) {
-    threadpool_submit((threadpool_t*) user_data, fn, arg);
+static void tp_submit(void* user_data, Cuik_TaskGroup* group, void fn(void*), void* arg) {
+    if (group != NULL) {
+        threadpool_group_submit((threadpool_t*) user_data, group, fn, arg);
+    } else {
+        threadpool_submit((threadpool_t*) user_data, fn, arg);
+    }
 }
 
-static void tp_work_one_job(void* user_data) {
-    threadpool_work_one_job((threadpool_t*) user_data);
+static void tp_wait(void* user_data, Cuik_TaskGroup* group) {
+    threadpool_group_wait((threadpool_t*) user_data, group);
 }
 
 static void dump_tokens(FILE* out_file, TokenStream* s) {
     const char* last_file = NULL;
     int last_line = 0;
 
-    Token* tokens = cuik_get_tokens(s);
     size_t count = cuik_get_token_count(s);
 
     for (size_t i = 0; i < count; i++) {
-        Token* t = &tokens[i];
-        SourceLoc* loc = &s->locations[SOURCE_LOC_GET_DATA(t->location)];
+        Token t = cuik_get_token(s, i);
+        SourceLoc loc = cuik_get_location(s, t.location);
+
+        // macro expansions go on the line they were expanded at
+        while (loc.line->filepath[0] == '<' && loc.line->parent != 0) {
+            loc = cuik_get_location(s, loc.line->parent);
+        }
 
-        if (last_file != loc->line->filepath && strcmp(loc->line->filepath, "<temp>") != 0) {
+        if (last_file != loc.line->filepath && strcmp(loc.line->filepath, "<temp>") != 0) {
             char str[FILENAME_MAX];
 
             // TODO(NeGate): Kinda shitty but i just wanna duplicate
             // the backslashes to avoid them being treated as an escape
-            const char* in = (const char*)loc->line->filepath;
+            const char* in = (const char*)loc.line->filepath;
             char* out = str;
 
             while (*in) {
@@ -81,55 +143,126 @@ static void dump_tokens(FILE* out_file, TokenStream* s) {
             }
             *out++ = '\0';
 
-            fprintf(out_file, "\n#line %d \"%s\"\t", loc->line->line, str);
-            last_file = loc->line->filepath;
+            fprintf(out_file, "\n#line %d \"%s\"\t", loc.line->line, str);
+            last_file = loc.line->filepath;
         }
 
-        if (last_line != loc->line->line) {
-            fprintf(out_file, "\n/* line %3d */\t", loc->line->line);
-            last_line = loc->line->line;
+        if (last_line != loc.line->line) {
+            fprintf(out_file, "\n/* line %3d */\t", loc.line->line);
+            last_line = loc.line->line;
         }
 
-        fprintf(out_file, "%.*s ", (int)(t->end - t->start), t->start);
+        fprintf(out_file, "%.*s ", (int)(t.end - t.start), t.start);
     }
 }
 
+// the pipeline is a single sweep over its passes so we rerun it until it stops
+// finding work, the cap is just in case a pair of passes keep undoing each other.
+#define OPTIMIZER_MAX_SWEEPS 16
+
+// user_data is an extra counter to bump for every function (or NULL)
 static void irgen_visitor(TranslationUnit* restrict tu, Stmt* restrict s, void* user_data) {
     TB_Module* mod = cuik_get_tb_module(tu);
     TB_Function* func = cuik_stmt_gen_ir(tu, s);
 
     if (func != NULL) {
-        if (args_optimize) {
-            tb_function_optimize(func);
+        atomic_fetch_add_explicit(&irgen_funcs, 1, memory_order_relaxed);
+        if (user_data != NULL) {
+            atomic_fetch_add_explicit((atomic_size_t*) user_data, 1, memory_order_relaxed);
+        }
+
+        // only the functions which get the good isel are worth optimizing
+        TB_ISelMode isel_mode = cuik_stmt_get_isel_mode(s);
+
+        if (isel_mode == TB_ISEL_COMPLEX) {
+            // every function reaches its own fixpoint right here on the worker that
+            // generated it, nothing else is ever revisited because of it
+            for (int i = 0; i < OPTIMIZER_MAX_SWEEPS && pipeline_run(&pass_pipeline, func); i++) {}
         }
 
         if (args_ir) {
             tb_function_print(func, tb_default_print_callback, stdout);
             printf("\n\n");
         } else {
-            tb_module_compile_func(mod, func, args_optimize ? TB_ISEL_COMPLEX : TB_ISEL_FAST);
+            tb_module_compile_func(mod, func, isel_mode);
         }
 
         tb_function_free(func);
     }
 }
 
-static void compile_file(void* arg) {
-    const char* input = (const char*)arg;
+static void pipelined_irgen_visitor(TranslationUnit* restrict tu, Stmt* restrict s, void* user_data) {
+    if (cuik_stmt_has_pending_link(tu, s)) {
+        mtx_lock(&deferred_mutex);
+        dyn_array_put(deferred_stmts, ((DeferredStmt){ tu, s }));
+        mtx_unlock(&deferred_mutex);
+        return;
+    }
 
-    // preproc
-    Cuik_CPP cpp;
-    TokenStream tokens = cuik_preprocess_simple(
-        &cpp, input, &cuik_default_fs, &target_desc,
+    irgen_visitor(tu, s, user_data);
+}
+
+static void deferred_irgen_task(void* arg) {
+    DeferredTask task = *((DeferredTask*)arg);
+    free(arg);
+
+    CUIK_TIMED_BLOCK("deferred IR gen (%zu - %zu)", task.start, task.end) {
+        for (size_t i = task.start; i < task.end; i++) {
+            irgen_visitor(deferred_stmts[i].tu, deferred_stmts[i].stmt, &deferred_funcs);
+        }
+    }
+}
+
+static void init_preprocessor(Cuik_CPP* cpp) {
+    cuik_init_preprocessor(
+        cpp, &cuik_default_fs, &target_desc,
         true, dyn_array_length(include_directories), &include_directories[0]
     );
 
-    cuikpp_finalize(&cpp);
+    if (prefix_header != NULL) {
+        cuikpp_set_prefix_header(cpp, prefix_header, prefix_pch_path);
+    }
+
+    if (thread_pool != NULL) {
+        cuikpp_set_thread_pool(cpp, &ithread_pool);
+    }
+}
+
+static TokenStream preprocess(Cuik_CPP* cpp, const char* input) {
+    if (shared_snapshot != NULL) {
+        // the prefix header is already in the snapshot
+        cuikpp_init_from_snapshot(cpp, shared_snapshot);
+
+        if (thread_pool != NULL) {
+            cuikpp_set_thread_pool(cpp, &ithread_pool);
+        }
+    } else {
+        init_preprocessor(cpp);
+    }
+
+    return cuikpp_run(cpp, input);
+}
+
+static void make_shared_snapshot(void) {
+    Cuik_CPP cpp;
+    init_preprocessor(&cpp);
+
+    size_t count = count_shared_includes(&cpp, dyn_array_length(input_files), input_files);
+    if (count > 0) {
+        shared_snapshot = cuikpp_make_snapshot(&cpp, input_files[0], count);
+    }
 
-    // parse
+    if (shared_snapshot == NULL) {
+        cuikpp_deinit(&cpp);
+    } else if (args_verbose) {
+        printf("Sharing %zu leading #includes...\n", count);
+    }
+}
+
+static void parse_file(TokenStream* tokens) {
     Cuik_ErrorStatus errors;
     TranslationUnit* tu = cuik_parse_translation_unit(&(Cuik_TranslationUnitDesc){
-            .tokens      = &tokens,
+            .tokens      = tokens,
             .errors      = &errors,
             .ir_module   = mod,
             .target      = &target_desc,
@@ -138,10 +271,85 @@ static void compile_file(void* arg) {
 
     if (tu == NULL) {
         printf("Failed to parse with errors...");
-        exit(1);
+        atomic_store(&parse_failed, true);
+        return;
     }
 
     cuik_add_to_compilation_unit(&compilation_unit, tu);
+
+    if (pipeline_backend) {
+        // publish our exports and get started on whatever can already be linked
+        cuik_internal_link_translation_unit(&compilation_unit, tu);
+        cuik_visit_top_level_threaded(tu, &ithread_pool, NULL, pipelined_irgen_visitor);
+    }
+}
+
+static void compile_file(void* arg) {
+    const char* input = (const char*)arg;
+
+    // preproc
+    Cuik_CPP cpp;
+    TokenStream tokens = preprocess(&cpp, input);
+
+    cuikpp_finalize(&cpp);
+
+    parse_file(&tokens);
+}
+
+static void preprocess_file_task(void* arg) {
+    size_t i = (uintptr_t)arg;
+
+    Cuik_CPP cpp;
+    preprocessed_files[i] = preprocess(&cpp, input_files[i]);
+    cuikpp_finalize(&cpp);
+
+    preprocessed_hashes[i] = incremental_hash_tokens(input_files[i], &preprocessed_files[i]);
+}
+
+static void parse_file_task(void* arg) {
+    parse_file(&preprocessed_files[(uintptr_t)arg]);
+}
+
+// runs fn on every input file, in parallel if we've got threads
+static void for_each_input(work_routine* fn) {
+    if (thread_pool != NULL) {
+        dyn_array_for(i, input_files) {
+            threadpool_submit(thread_pool, fn, (void*)(uintptr_t)i);
+        }
+
+        threadpool_work_while_wait(thread_pool);
+    } else {
+        dyn_array_for(i, input_files) {
+            fn((void*)(uintptr_t)i);
+        }
+    }
+}
+
+// one name per line, blank lines and lines starting with # are skipped
+static bool load_hot_functions(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "error: could not open hot function list '%s'\n", path);
+        return false;
+    }
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        char* start = line;
+        while (*start == ' ' || *start == '\t') start++;
+
+        char* end = start + strlen(start);
+        while (end > start && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) end--;
+        *end = '\0';
+
+        if (*start != '\0' && *start != '#') {
+            cuik_add_hot_function(start);
+            hot_functions_hash = incremental__fnv(hot_functions_hash, start, strlen(start) + 1);
+        }
+    }
+
+    fclose(file);
+    return true;
 }
 
 // we can do a bit of filter such as '*.c' where it'll take all
@@ -196,14 +404,53 @@ static void append_input_path(const char* path) {
     }
 }
 
-int main(int argc, char** argv) {
-    cuik_init();
-    find_system_deps();
+static void start_thread_pool(void) {
+    thread_pool = threadpool_create(calculate_worker_thread_count(), 4096);
+    ithread_pool = (Cuik_IThreadpool){
+        .user_data = thread_pool,
+        // the main thread helps out while it waits
+        .thread_count = threadpool_get_thread_count(thread_pool) + 1,
+        .submit = tp_submit,
+        .wait = tp_wait
+    };
+}
 
-    program_name = argv[0];
+// the compile server runs this more than once per process so
+// nothing from the last compile can leak into the next
+static void reset_driver_state(void) {
     include_directories = dyn_array_create(const char*);
     input_libraries = dyn_array_create(const char*);
     input_files = dyn_array_create(const char*);
+    output_name = NULL;
+    prefix_header = NULL;
+    prefix_pch_path[0] = '\0';
+    shared_snapshot = NULL;
+    output_path_no_ext[0] = '\0';
+
+    args_ir = args_ast = args_types = args_run = false;
+    args_assembly = args_time = args_verbose = args_preprocess = false;
+    args_object_only = args_incremental = args_profile_generate = args_gc = false;
+    args_tier = CUIK_TIER_DEBUG;
+    memset(&pass_pipeline, 0, sizeof(pass_pipeline));
+    cuik_clear_hot_functions();
+    hot_functions_hash = 0;
+
+    mod = NULL;
+    compilation_unit = (CompilationUnit){ 0 };
+    target_desc = (Cuik_Target){ 0 };
+
+    atomic_store(&parse_failed, false);
+    pipeline_backend = false;
+    deferred_stmts = NULL;
+    atomic_store(&irgen_funcs, 0);
+    atomic_store(&deferred_funcs, 0);
+    preprocessed_files = NULL;
+    preprocessed_hashes = NULL;
+}
+
+static int compile(int argc, char** argv) {
+    program_name = argv[0];
+    reset_driver_state();
 
     // parse arguments
     int i = 1;
@@ -252,16 +499,62 @@ int main(int argc, char** argv) {
                 break;
             }
             case ARG_OUT: output_name = arg.value; break;
+            case ARG_PREFIX: {
+                // the precompiled version goes right next to it
+                prefix_header = arg.value;
+                sprintf_s(prefix_pch_path, FILENAME_MAX, "%s.pch", arg.value);
+                break;
+            }
             case ARG_OBJ: args_object_only = true; break;
             case ARG_RUN: args_run = true; break;
             case ARG_PREPROC: args_preprocess = true; break;
-            case ARG_OPT: args_optimize = true; break;
+            case ARG_OPT: args_tier = CUIK_TIER_RELEASE; break;
+            case ARG_PASSES: {
+                if (!pipeline_parse(&pass_pipeline, arg.value)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case ARG_TIER: {
+                if (strcmp(arg.value, "debug") == 0) {
+                    args_tier = CUIK_TIER_DEBUG;
+                } else if (strcmp(arg.value, "hybrid") == 0) {
+                    args_tier = CUIK_TIER_HYBRID;
+                } else if (strcmp(arg.value, "release") == 0) {
+                    args_tier = CUIK_TIER_RELEASE;
+                } else {
+                    fprintf(stderr, "error: unknown tier '%s' (debug, hybrid or release)\n", arg.value);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case ARG_HOT: {
+                if (!load_hot_functions(arg.value)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case ARG_PROFILE_GENERATE: args_profile_generate = true; break;
+            case ARG_PROFILE_USE: {
+                if (!load_profile(arg.value, &hot_functions_hash)) {
+                    return EXIT_FAILURE;
+                }
+
+                // a profile is only useful if the hot functions get treated differently
+                if (args_tier == CUIK_TIER_DEBUG) args_tier = CUIK_TIER_HYBRID;
+                break;
+            }
             case ARG_TIME: args_time = true; break;
             case ARG_ASM: args_assembly = true; break;
             case ARG_AST: args_ast = true; break;
             case ARG_TYPES: args_types = true; break;
             case ARG_IR: args_ir = true; break;
             case ARG_VERBOSE: args_verbose = true; break;
+            case ARG_INCREMENTAL: args_incremental = true; break;
+            case ARG_GC: args_gc = true; break;
+            // handled in main
+            case ARG_SERVER: break;
+            case ARG_CONNECT: break;
             case ARG_HELP: {
                 print_help();
                 return EXIT_SUCCESS;
@@ -281,6 +574,27 @@ int main(int argc, char** argv) {
         return EXIT_FAILURE;
     }
 
+    if (args_gc && args_object_only) {
+        fprintf(stderr, "error: --gc needs to see the whole program, it can't be used with -c\n");
+        return EXIT_FAILURE;
+    }
+
+    if (args_profile_generate && args_object_only) {
+        fprintf(stderr, "error: --profile-generate needs to see the whole program, it can't be used with -c\n");
+        return EXIT_FAILURE;
+    }
+
+    // asking for passes without a tier means you want them everywhere
+    if (pass_pipeline.count > 0 && args_tier == CUIK_TIER_DEBUG) {
+        args_tier = CUIK_TIER_RELEASE;
+    }
+
+    if (args_tier != CUIK_TIER_DEBUG && pass_pipeline.count == 0) {
+        pipeline_parse(&pass_pipeline, "O1");
+    }
+
+    cuik_set_compile_tier(args_tier);
+
     {
         if (output_name == NULL) {
             output_name = input_files[0];
@@ -307,14 +621,6 @@ int main(int argc, char** argv) {
         cuik_start_global_profiler(&jsonperf_profiler, true);
     }
 
-    // spin up worker threads
-    thread_pool = threadpool_create(calculate_worker_thread_count(), 4096);
-    ithread_pool = (Cuik_IThreadpool){
-        .user_data = thread_pool,
-        .submit = tp_submit,
-        .work_one_job = tp_work_one_job
-    };
-
     cuik_create_compilation_unit(&compilation_unit);
 
     // get default system
@@ -337,10 +643,7 @@ int main(int argc, char** argv) {
     if (args_preprocess) {
         // preproc only
         Cuik_CPP cpp;
-        TokenStream tokens = cuik_preprocess_simple(
-            &cpp, input_files[0], &cuik_default_fs, &target_desc,
-            true, dyn_array_length(include_directories), &include_directories[0]
-        );
+        TokenStream tokens = preprocess(&cpp, input_files[0]);
 
         cuikpp_finalize(&cpp);
 
@@ -348,20 +651,95 @@ int main(int argc, char** argv) {
         return EXIT_SUCCESS;
     }
 
+    // place into a temporary directory if we don't need the obj file
+    char obj_output_path[FILENAME_MAX];
+    if (target_desc.sys == TB_SYSTEM_WINDOWS){
+        sprintf_s(obj_output_path, FILENAME_MAX, "%s.obj", output_path_no_ext);
+    } else {
+        sprintf_s(obj_output_path, FILENAME_MAX, "%s.o", output_path_no_ext);
+    }
+
+    char profile_path[FILENAME_MAX] = "";
+    if (args_profile_generate) {
+        get_profile_path(profile_path, output_path_no_ext);
+    }
+
     ////////////////////////////////
     // frontend work
     ////////////////////////////////
     if (args_verbose) printf("Frontend...\n");
 
-    if (thread_pool != NULL) {
-        // dispatch multithreaded
-        dyn_array_for(i, input_files) {
-            threadpool_submit(thread_pool, compile_file, (void*) input_files[i]);
+    if (dyn_array_length(input_files) > 1) {
+        CUIK_TIMED_BLOCK("shared includes") {
+            make_shared_snapshot();
+        }
+    }
+
+    // the cache only stands in for the object file so anything that
+    // wants to look at the AST or IR has to do the real work
+    bool use_cache = args_incremental && !args_ast && !args_types && !args_ir;
+    bool cache_hit = false;
+    uint32_t cache_flags = 0;
+    uint64_t cache_key = 0;
+    char cache_path[FILENAME_MAX];
+
+    if (use_cache) {
+        size_t count = dyn_array_length(input_files);
+        preprocessed_files = calloc(count, sizeof(TokenStream));
+        preprocessed_hashes = calloc(count, sizeof(uint64_t));
+
+        CUIK_TIMED_BLOCK("preprocess") {
+            for_each_input(preprocess_file_task);
         }
 
+        // anything that changes the codegen goes into the key too, the build
+        // date stands in for the compiler's version
+        cache_key = incremental__fnv(0xcbf29ce484222325ull, __DATE__ " " __TIME__, sizeof(__DATE__ " " __TIME__));
+        cache_key = incremental__fnv(cache_key, pass_pipeline.passes, pass_pipeline.count * sizeof(int));
+        cache_key = incremental__fnv(cache_key, profile_path, strlen(profile_path) + 1);
+        cache_key ^= hot_functions_hash;
+        cache_key = incremental__mix(cache_key ^ ((uint64_t)args_tier << 32) ^ ((uint64_t)args_gc << 40) ^ target_desc.sys);
+        for (size_t i = 0; i < count; i++) {
+            cache_key += preprocessed_hashes[i];
+        }
+
+        sprintf_s(cache_path, FILENAME_MAX, "%s.cuikcache", output_path_no_ext);
+        CUIK_TIMED_BLOCK("incremental load") {
+            cache_hit = incremental_load(cache_path, cache_key, obj_output_path, &cache_flags);
+        }
+
+        if (args_verbose && cache_hit) printf("Reusing %s...\n", cache_path);
+    }
+
+    if (args_profile_generate && mod != NULL && !cache_hit) {
+        cuik_begin_profile_instrumentation(mod);
+    }
+
+    if (cache_hit) {
+        // nothing to do, the object file is already in place
+    } else if (thread_pool != NULL) {
+        // IR gen overlaps with the frontend unless we're just dumping the AST (or
+        // need to see the whole program before we know what to compile)
+        if (!args_ast && !args_types && !args_gc) {
+            pipeline_backend = true;
+            mtx_init(&deferred_mutex, mtx_plain);
+            deferred_stmts = dyn_array_create(DeferredStmt);
+        }
+
+        // dispatch multithreaded
         CUIK_TIMED_BLOCK("wait") {
-            threadpool_work_while_wait(thread_pool);
+            if (use_cache) {
+                for_each_input(parse_file_task);
+            } else {
+                dyn_array_for(i, input_files) {
+                    threadpool_submit(thread_pool, compile_file, (void*) input_files[i]);
+                }
+
+                threadpool_work_while_wait(thread_pool);
+            }
         }
+    } else if (use_cache) {
+        for_each_input(parse_file_task);
     } else {
         // emit-ast is single threaded just to make it nicer to read
         dyn_array_for(i, input_files) {
@@ -369,10 +747,23 @@ int main(int argc, char** argv) {
         }
     }
 
+    if (atomic_load(&parse_failed)) {
+        if (args_time) cuik_stop_global_profiler();
+        return EXIT_FAILURE;
+    }
+
     if (args_verbose) printf("Internal link...\n");
 
-    CUIK_TIMED_BLOCK("internal link") {
-        cuik_internal_link_compilation_unit(&compilation_unit);
+    if (!pipeline_backend && !cache_hit) {
+        CUIK_TIMED_BLOCK("internal link") {
+            cuik_internal_link_compilation_unit(&compilation_unit);
+        }
+
+        if (args_gc && !args_ast && !args_types) {
+            CUIK_TIMED_BLOCK("reachability") {
+                cuik_mark_reachable_compilation_unit(&compilation_unit);
+            }
+        }
     }
 
     if (args_ast) {
@@ -385,16 +776,36 @@ int main(int argc, char** argv) {
         ////////////////////////////////
         if (args_verbose) printf("Backend...\n");
 
-        if (thread_pool != NULL) {
-            FOR_EACH_TU(tu, &compilation_unit) {
-                if (!args_ast && !args_types) {
-                    cuik_visit_top_level_threaded(tu, &ithread_pool, 16384, NULL, irgen_visitor);
+        if (cache_hit) {
+            // no IR to generate
+        } else if (pipeline_backend) {
+            // every TU is linked now, finish off what was waiting on them
+            size_t count = dyn_array_length(deferred_stmts);
+            size_t start = 0, cost = 0;
+            for (size_t i = 0; i < count; i++) {
+                cost += cuik_stmt_get_cost(deferred_stmts[i].stmt);
+
+                if (cost >= DEFERRED_BATCH_COST || i + 1 == count) {
+                    DeferredTask* task = malloc(sizeof(DeferredTask));
+                    task->start = start;
+                    task->end = i + 1;
+                    threadpool_submit(thread_pool, deferred_irgen_task, task);
+
+                    start = i + 1, cost = 0;
                 }
             }
 
             threadpool_work_while_wait(thread_pool);
-            threadpool_free(thread_pool);
-            thread_pool = NULL;
+
+            if (args_verbose) {
+                printf("  %zu of %zu functions waited on the link\n", atomic_load(&deferred_funcs), atomic_load(&irgen_funcs));
+            }
+        } else if (thread_pool != NULL) {
+            FOR_EACH_TU(tu, &compilation_unit) {
+                cuik_visit_top_level_threaded(tu, &ithread_pool, NULL, irgen_visitor);
+            }
+
+            threadpool_work_while_wait(thread_pool);
         } else {
             FOR_EACH_TU(tu, &compilation_unit) {
                 if (!args_ast && !args_types) {
@@ -403,21 +814,47 @@ int main(int argc, char** argv) {
             }
         }
 
-        // place into a temporary directory if we don't need the obj file
-        char obj_output_path[FILENAME_MAX];
-        if (target_desc.sys == TB_SYSTEM_WINDOWS){
-            sprintf_s(obj_output_path, FILENAME_MAX, "%s.obj", output_path_no_ext);
+        if (args_profile_generate && !cache_hit) {
+            TB_Function* dump = cuik_finish_profile_instrumentation(mod, profile_path);
+
+            if (args_ir) {
+                tb_function_print(dump, tb_default_print_callback, stdout);
+                printf("\n\n");
+            } else {
+                tb_module_compile_func(mod, dump, TB_ISEL_FAST);
+            }
+
+            tb_function_free(dump);
+        }
+
+        if (args_tier != CUIK_TIER_DEBUG && !cache_hit) {
+            pipeline_report(&pass_pipeline);
+        }
+
+        bool subsystem_windows = false;
+        if (cache_hit) {
+            subsystem_windows = cache_flags & INCREMENTAL_FLAG_WINMAIN;
         } else {
-            sprintf_s(obj_output_path, FILENAME_MAX, "%s.o", output_path_no_ext);
+            FOR_EACH_TU(tu, &compilation_unit) {
+                if (cuik_get_entrypoint_status(tu) == CUIK_ENTRYPOINT_WINMAIN) {
+                    subsystem_windows = true;
+                }
+            }
         }
 
         if (args_object_only) {
-            if (args_verbose) printf("Exporting object file...\n");
+            if (!cache_hit) {
+                if (args_verbose) printf("Exporting object file...\n");
 
-            CUIK_TIMED_BLOCK("export") {
-                if (!tb_module_export(mod, obj_output_path)) {
-                    fprintf(stderr, "error: tb_module_export failed!\n");
-                    abort();
+                CUIK_TIMED_BLOCK("export") {
+                    if (!tb_module_export(mod, obj_output_path)) {
+                        fprintf(stderr, "error: tb_module_export failed!\n");
+                        abort();
+                    }
+                }
+
+                if (use_cache) {
+                    incremental_save(cache_path, cache_key, subsystem_windows ? INCREMENTAL_FLAG_WINMAIN : 0, obj_output_path);
                 }
             }
         } else {
@@ -466,11 +903,18 @@ int main(int argc, char** argv) {
                     abort();
                 }
             } else {
-                if (args_verbose) printf("Exporting object file...\n");
+                if (!cache_hit) {
+                    if (args_verbose) printf("Exporting object file...\n");
 
-                if (!tb_module_export(mod, obj_output_path)) {
-                    fprintf(stderr, "error: tb_module_export failed!\n");
-                    abort();
+                    if (!tb_module_export(mod, obj_output_path)) {
+                        fprintf(stderr, "error: tb_module_export failed!\n");
+                        abort();
+                    }
+
+                    // save it before the linker step deletes it
+                    if (use_cache) {
+                        incremental_save(cache_path, cache_key, subsystem_windows ? INCREMENTAL_FLAG_WINMAIN : 0, obj_output_path);
+                    }
                 }
 
                 if (args_verbose) printf("Linking...\n");
@@ -478,13 +922,6 @@ int main(int argc, char** argv) {
                 // Invoke system linker
                 Cuik_Linker l;
                 if (cuiklink_init(&l)) {
-                    bool subsystem_windows = false;
-                    FOR_EACH_TU(tu, &compilation_unit) {
-                        if (cuik_get_entrypoint_status(tu) == CUIK_ENTRYPOINT_WINMAIN) {
-                            subsystem_windows = true;
-                        }
-                    }
-
                     if (subsystem_windows) {
                         cuiklink_subsystem_windows(&l);
                     }
@@ -526,12 +963,12 @@ int main(int argc, char** argv) {
         }
 
         tb_free_thread_resources();
-        tb_module_destroy(mod);
-    }
 
-    if (thread_pool != NULL) {
-        threadpool_free(thread_pool);
-        thread_pool = NULL;
+        // NOTE(NeGate): destroying a module also frees TB's global string arena for good,
+        // so the server leaks them instead (it restarts itself every so often anyways)
+        if (!is_server) {
+            tb_module_destroy(mod);
+        }
     }
 
     //cuik_destroy_translation_unit(tu);
@@ -541,3 +978,32 @@ int main(int argc, char** argv) {
     if (args_time) cuik_stop_global_profiler();
     return 0;
 }
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--connect") == 0) {
+            // the client doesn't need to warm anything up
+            int exit_code;
+            if (server_connect(argc, argv, &exit_code)) {
+                return exit_code;
+            }
+        } else if (strcmp(argv[i], "--server") == 0) {
+            is_server = true;
+        }
+    }
+
+    cuik_init();
+    find_system_deps();
+
+    if (is_server) {
+        return server_run(start_thread_pool, compile);
+    }
+
+    // spin up worker threads
+    start_thread_pool();
+
+    int exit_code = compile(argc, argv);
+    threadpool_free(thread_pool);
+    thread_pool = NULL;
+    return exit_code;
+}
@@ -0,0 +1,161 @@
+// Optimization pass pipelines (-O & --passes)
+//
+// tb_function_optimize is a fixed list of passes, this lets you pick your own with
+// --passes=mem2reg,fold,dce,... (names are from pass_table, presets from pass_presets
+// can be mixed in too like --passes=Og,load_elim). -O is just the O1 preset which is
+// the same list TB uses.
+//
+// Every pass run is timed and counted, pipeline_report sends the totals to the
+// profiler (-T) as one region per pass so you can see which ones pay for themselves.
+//
+// NOTE(NeGate): tb_opt_branchless and tb_opt_inline are in tb.h but the backend we
+// link against doesn't have them yet.
+#include <stdatomic.h>
+
+// enough for a few presets stacked together
+#define PIPELINE_MAX_PASSES 64
+
+static const TB_FunctionPass pass_table[] = {
+    { "hoist_locals",       tb_opt_hoist_locals       },
+    { "merge_rets",         tb_opt_merge_rets         },
+    { "hoist_invariants",   tb_opt_hoist_invariants   },
+    { "canonicalize",       tb_opt_canonicalize       },
+    { "mem2reg",            tb_opt_mem2reg            },
+    { "remove_pass_node",   tb_opt_remove_pass_node   },
+    { "dead_expr_elim",     tb_opt_dead_expr_elim     },
+    { "dead_block_elim",    tb_opt_dead_block_elim    },
+    { "compact_dead_regs",  tb_opt_compact_dead_regs  },
+    { "fold",               tb_opt_fold               },
+    { "load_elim",          tb_opt_load_elim          },
+    { "subexpr_elim",       tb_opt_subexpr_elim       },
+    { "strength_reduction", tb_opt_strength_reduction },
+    { "copy_elision",       tb_opt_copy_elision       },
+    { "deshort_circuit",    tb_opt_deshort_circuit    },
+
+    // shorthands
+    { "dce",                tb_opt_dead_expr_elim     },
+    { "cse",                tb_opt_subexpr_elim       },
+};
+enum { PASS_TABLE_COUNT = sizeof(pass_table) / sizeof(pass_table[0]) };
+
+typedef struct {
+    const char* name;
+    const char* spec;
+} PassPreset;
+
+static const PassPreset pass_presets[] = {
+    // same as tb_function_optimize
+    { "O1", "hoist_locals,merge_rets,hoist_invariants,canonicalize,mem2reg,remove_pass_node,canonicalize,dead_expr_elim,dead_block_elim,compact_dead_regs" },
+    // cleans up the obvious waste but leaves the locals in memory for the debugger
+    { "Og", "merge_rets,canonicalize,dead_expr_elim,dead_block_elim,compact_dead_regs" },
+};
+enum { PASS_PRESET_COUNT = sizeof(pass_presets) / sizeof(pass_presets[0]) };
+
+typedef struct {
+    atomic_uint_least64_t time;
+    atomic_uint_least64_t runs;
+    atomic_uint_least64_t changes;
+} PassStats;
+
+typedef struct {
+    size_t count;
+    // indices into pass_table
+    int passes[PIPELINE_MAX_PASSES];
+
+    PassStats stats[PASS_TABLE_COUNT];
+} PassPipeline;
+
+static int pipeline__find_pass(const char* name, size_t length) {
+    for (int i = 0; i < PASS_TABLE_COUNT; i++) {
+        if (strlen(pass_table[i].name) == length && memcmp(pass_table[i].name, name, length) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// appends the passes in the comma separated spec, returns false (and complains) if it's bad
+static bool pipeline_parse(PassPipeline* p, const char* spec) {
+    while (*spec) {
+        const char* end = strchr(spec, ',');
+        if (end == NULL) end = spec + strlen(spec);
+
+        size_t length = end - spec;
+        bool found = false;
+        for (int i = 0; i < PASS_PRESET_COUNT; i++) {
+            if (strlen(pass_presets[i].name) == length && memcmp(pass_presets[i].name, spec, length) == 0) {
+                if (!pipeline_parse(p, pass_presets[i].spec)) return false;
+
+                found = true;
+                break;
+            }
+        }
+
+        if (!found && length > 0) {
+            int pass = pipeline__find_pass(spec, length);
+            if (pass < 0) {
+                fprintf(stderr, "error: unknown pass '%.*s' (", (int)length, spec);
+                for (int i = 0; i < PASS_TABLE_COUNT; i++) {
+                    fprintf(stderr, "%s, ", pass_table[i].name);
+                }
+                for (int i = 0; i < PASS_PRESET_COUNT; i++) {
+                    fprintf(stderr, i + 1 < PASS_PRESET_COUNT ? "%s, " : "%s)\n", pass_presets[i].name);
+                }
+                return false;
+            }
+
+            if (p->count >= PIPELINE_MAX_PASSES) {
+                fprintf(stderr, "error: too many passes (max is %d)\n", PIPELINE_MAX_PASSES);
+                return false;
+            }
+
+            p->passes[p->count++] = pass;
+        }
+
+        spec = *end ? end + 1 : end;
+    }
+
+    return true;
+}
+
+// one sweep over the pipeline, returns true if any pass changed something
+static bool pipeline_run(PassPipeline* p, TB_Function* f) {
+    bool changes = false;
+    for (size_t i = 0; i < p->count; i++) {
+        int pass = p->passes[i];
+
+        uint64_t start = cuik_time_in_nanos();
+        bool changed = pass_table[pass].execute(f);
+        uint64_t elapsed = cuik_time_in_nanos() - start;
+
+        PassStats* stats = &p->stats[pass];
+        atomic_fetch_add_explicit(&stats->time, elapsed, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->runs, 1, memory_order_relaxed);
+        if (changed) {
+            atomic_fetch_add_explicit(&stats->changes, 1, memory_order_relaxed);
+            changes = true;
+        }
+    }
+
+    return changes;
+}
+
+// each pass shows up as a region as long as its total time (ending now), the
+// label has the rest of the numbers
+static void pipeline_report(PassPipeline* p) {
+    uint64_t now = cuik_time_in_nanos();
+
+    for (int i = 0; i < PASS_TABLE_COUNT; i++) {
+        PassStats* stats = &p->stats[i];
+        if (stats->runs == 0) {
+            continue;
+        }
+
+        cuik_profile_region(
+            now - stats->time, "pass %s (%llu runs, %llu changed, %.3f ms)",
+            pass_table[i].name, (unsigned long long)stats->runs,
+            (unsigned long long)stats->changes, stats->time / 1000000.0
+        );
+    }
+}
@@ -0,0 +1,143 @@
+// Profile guided builds (--profile-generate & --profile-use)
+//
+// --profile-generate makes every function count its entries and the program appends
+// the counts to <output>.cuikprof when it exits (see cuik_begin_profile_instrumentation).
+// --profile-use reads that back and marks the functions that make up most of the
+// entries as hot, those get TB_ISEL_COMPLEX and the optimizer while everything else
+// goes through fast isel (the hybrid tier).
+//
+// NOTE(NeGate): entry counts are a pretty rough idea of where the time goes, a function
+// that's called once and loops forever looks cold. It's good enough for picking out
+// the small stuff that gets hammered.
+//
+// NOTE(NeGate): every object gets its own private counter table and dump function but
+// only main registers the dump with atexit, so an object built without main would count
+// into a table nobody ever writes out. That's why --profile-generate can't be used with
+// -c, the whole program has to go through one compile.
+#include <stdio.h>
+#include <stdint.h>
+
+// how much of all function entries the hot functions should cover
+#define PROFILE_HOT_COVERAGE 0.9
+
+typedef struct {
+    char* name;
+    uint64_t count;
+} ProfileEntry;
+
+static int profile__compare_name(const void* a, const void* b) {
+    return strcmp(((const ProfileEntry*)a)->name, ((const ProfileEntry*)b)->name);
+}
+
+static int profile__compare_count(const void* a, const void* b) {
+    uint64_t x = ((const ProfileEntry*)a)->count, y = ((const ProfileEntry*)b)->count;
+    return (x < y) - (x > y);
+}
+
+// reads every record in the profile and marks the hottest functions, the names
+// are also mixed into *hash since they change the codegen.
+static bool load_profile(const char* path, uint64_t* hash) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "error: could not open profile '%s'\n", path);
+        return false;
+    }
+
+    DynArray(ProfileEntry) entries = dyn_array_create(ProfileEntry);
+
+    Cuik_ProfileHeader header;
+    bool success = true;
+    size_t read;
+    while ((read = fread(&header, 1, sizeof(header), file)) != 0) {
+        if (read != sizeof(header) || memcmp(header.magic, CUIK_PROFILE_MAGIC, sizeof(CUIK_PROFILE_MAGIC)) != 0) {
+            success = false;
+            break;
+        }
+
+        char* names = malloc(header.names_size + 1);
+        uint64_t* counts = malloc(header.name_count * sizeof(uint64_t));
+        if (fread(names, 1, header.names_size, file) != header.names_size ||
+            fread(counts, sizeof(uint64_t), header.name_count, file) != header.name_count) {
+            free(names), free(counts);
+            success = false;
+            break;
+        }
+        names[header.names_size] = '\0';
+
+        const char* name = names;
+        for (size_t i = 0; i < header.name_count && name < names + header.names_size; i++) {
+            ProfileEntry e = { strdup(name), counts[i] };
+            dyn_array_put(entries, e);
+
+            name += strlen(name) + 1;
+        }
+
+        free(names), free(counts);
+    }
+    fclose(file);
+
+    if (!success) {
+        fprintf(stderr, "error: '%s' is not a valid profile\n", path);
+
+        dyn_array_for(i, entries) {
+            free(entries[i].name);
+        }
+    } else {
+        // the same function shows up once per run
+        size_t count = dyn_array_length(entries);
+        qsort(entries, count, sizeof(ProfileEntry), profile__compare_name);
+
+        size_t unique = 0;
+        uint64_t total = 0;
+        for (size_t i = 0; i < count; i++) {
+            total += entries[i].count;
+
+            if (unique > 0 && strcmp(entries[unique - 1].name, entries[i].name) == 0) {
+                entries[unique - 1].count += entries[i].count;
+                free(entries[i].name);
+            } else {
+                entries[unique++] = entries[i];
+            }
+        }
+
+        // hottest first until we've covered enough of the entries
+        qsort(entries, unique, sizeof(ProfileEntry), profile__compare_count);
+
+        uint64_t covered = 0;
+        for (size_t i = 0; i < unique; i++) {
+            if (entries[i].count > 0 && covered < total * PROFILE_HOT_COVERAGE) {
+                covered += entries[i].count;
+
+                cuik_add_hot_function(entries[i].name);
+                *hash = incremental__fnv(*hash, entries[i].name, strlen(entries[i].name) + 1);
+            }
+
+            free(entries[i].name);
+        }
+    }
+
+    dyn_array_destroy(entries);
+    return success;
+}
+
+// the program could be run from anywhere so the profile path needs to be absolute
+static void get_profile_path(char output[FILENAME_MAX], const char* output_path_no_ext) {
+    char path[FILENAME_MAX];
+    sprintf_s(path, FILENAME_MAX, "%s.cuikprof", output_path_no_ext);
+
+    #ifdef _WIN32
+    char* filepart;
+    if (GetFullPathNameA(path, FILENAME_MAX, output, &filepart) == 0) {
+        strcpy(output, path);
+    }
+    #else
+    char cwd[FILENAME_MAX];
+    if (path[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL && strlen(cwd) + strlen(path) + 2 <= FILENAME_MAX) {
+        strcpy(output, cwd);
+        strcat(output, "/");
+        strcat(output, path);
+    } else {
+        strcpy(output, path);
+    }
+    #endif
+}
@@ -0,0 +1,398 @@
+// Compile server (--server & --connect)
+//
+// Build systems tend to launch thousands of tiny compiles and each one pays for
+// cuik_init, finding the system libraries, spinning up the thread pool and reading
+// every system header from scratch. `cuik --server` stays alive on a unix socket
+// and runs the compiles it's sent in-process so the file cache, directory listings,
+// resolved includes and thread pool stay warm between them. `cuik --connect ...`
+// is the thin client, it forwards its argv, working directory and stdio to the
+// server and exits with whatever the compile returned, if there's no server it just
+// compiles locally.
+//
+// Compiles are run one at a time, the thread pool handles the parallelism within one
+// and anyone else waits in the listen backlog. Before each compile the caches are
+// revalidated by mtime (see cuik_revalidate_fs_cache).
+//
+// Ordinary compile errors just return a failing exit code and the caches stay warm.
+//
+// The client hands the server its stdio so the socket lives in a directory only we can
+// get into ($XDG_RUNTIME_DIR or /tmp/cuik-<uid>/) and both ends check that the other
+// side is running as the same user before anything is sent.
+//
+// NOTE(NeGate): the library still aborts (or exits) on fatal errors, so the server
+// really runs in a child process which the parent restarts when it dies. The child
+// hands the client it was compiling for the exit code on the way down so it doesn't
+// look like a crash. The child also retires itself after a while since every compile
+// leaks a bit (TB modules mostly, see main_driver.c).
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
+typedef int server_compile_fn(int argc, char** argv);
+
+// request: [u32 length] [cwd \0] [argc x arg \0], stdin/stdout/stderr ride along as SCM_RIGHTS
+// response: [i32 exit code]
+#define SERVER_MAX_REQUEST (1u << 20)
+
+// how many compiles a server process handles before we replace it
+#define SERVER_MAX_COMPILES 1000
+
+#ifndef _WIN32
+// the directory has to be ours and closed off to everyone else, lstat so
+// nobody can point us somewhere else with a symlink
+static bool server__is_private_dir(const char* path) {
+    struct stat st;
+    return lstat(path, &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid() && (st.st_mode & 077) == 0;
+}
+
+// the server makes the directory if it's missing, returns false if
+// there's no private place to put the socket
+static bool server_get_path(struct sockaddr_un* addr, bool create) {
+    char dir[FILENAME_MAX];
+    const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir != NULL && runtime_dir[0] == '/') {
+        snprintf(dir, sizeof(dir), "%s", runtime_dir);
+    } else {
+        snprintf(dir, sizeof(dir), "/tmp/cuik-%d", (int)getuid());
+        if (create) mkdir(dir, 0700);
+    }
+
+    if (!server__is_private_dir(dir)) {
+        if (create) fprintf(stderr, "error: %s isn't a directory only we can access\n", dir);
+        return false;
+    }
+
+    *addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+    int length = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/cuik.sock", dir);
+    if (length < 0 || (size_t)length >= sizeof(addr->sun_path)) {
+        if (create) fprintf(stderr, "error: socket path in %s is too long\n", dir);
+        return false;
+    }
+
+    return true;
+}
+
+// only talk to processes running as the same user as us
+static bool server__peer_is_us(int fd) {
+    #ifdef __linux__
+    // struct ucred is hidden behind _GNU_SOURCE and the system headers are already in by now
+    struct { pid_t pid; uid_t uid; gid_t gid; } cred;
+    socklen_t length = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0 && length == sizeof(cred) && cred.uid == getuid();
+    #else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+    #endif
+}
+
+static bool server__write_all(int fd, const void* data, size_t length) {
+    const char* p = data;
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        p += n, length -= n;
+    }
+
+    return true;
+}
+
+static bool server__read_all(int fd, void* data, size_t length) {
+    char* p = data;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        p += n, length -= n;
+    }
+
+    return true;
+}
+
+// returns false if we couldn't reach a server, out_exit_code is only set if it succeeds
+static bool server_connect(int argc, char** argv, int* out_exit_code) {
+    struct sockaddr_un addr;
+    if (!server_get_path(&addr, false)) {
+        return false;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return false;
+    }
+
+    // our stdio is going over this socket so it better be us on the other end
+    if (!server__peer_is_us(fd)) {
+        fprintf(stderr, "warning: the compile server on %s isn't running as us, compiling locally\n", addr.sun_path);
+        close(fd);
+        return false;
+    }
+
+    // build the request
+    char cwd[FILENAME_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        close(fd);
+        return false;
+    }
+
+    size_t length = strlen(cwd) + 1;
+    for (int i = 0; i < argc; i++) {
+        length += strlen(argv[i]) + 1;
+    }
+
+    if (length > SERVER_MAX_REQUEST) {
+        close(fd);
+        return false;
+    }
+
+    char* request = malloc(sizeof(uint32_t) + length);
+    *(uint32_t*)request = length;
+
+    char* p = request + sizeof(uint32_t);
+    p += sprintf(p, "%s", cwd) + 1;
+    for (int i = 0; i < argc; i++) {
+        p += sprintf(p, "%s", argv[i]) + 1;
+    }
+
+    // the first byte carries our stdio
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(sizeof(fds))] = { 0 };
+
+    struct iovec iov = { request, 1 };
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control, .msg_controllen = sizeof(control),
+    };
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    fflush(stdout);
+    fflush(stderr);
+
+    bool sent = sendmsg(fd, &msg, 0) == 1 && server__write_all(fd, request + 1, sizeof(uint32_t) + length - 1);
+    free(request);
+
+    if (!sent) {
+        close(fd);
+        return false;
+    }
+
+    // the compile has started so from here on we can't fall back
+    int32_t exit_code;
+    if (!server__read_all(fd, &exit_code, sizeof(exit_code))) {
+        fprintf(stderr, "error: the compile server died while compiling\n");
+        exit_code = EXIT_FAILURE;
+    }
+
+    close(fd);
+    *out_exit_code = exit_code;
+    return true;
+}
+
+// the client whose compile is running, if the child goes down
+// mid compile it's told why.
+static volatile int server_client = -1;
+
+static void server__send_exit_code(int32_t exit_code) {
+    int client = server_client;
+    server_client = -1;
+
+    if (client >= 0) {
+        server__write_all(client, &exit_code, sizeof(exit_code));
+    }
+}
+
+// someone called exit() during the compile, they all mean failure
+static void server__on_exit(void) {
+    fflush(stdout);
+    fflush(stderr);
+    server__send_exit_code(EXIT_FAILURE);
+}
+
+// aborts & crashes, the client exits like a shell would report it
+static void server__on_fatal_signal(int sig) {
+    server__send_exit_code(128 + sig);
+
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void server_handle(int client, server_compile_fn* compile) {
+    // the stdio descriptors come in with the first byte
+    char first;
+    char control[CMSG_SPACE(3 * sizeof(int))];
+
+    struct iovec iov = { &first, 1 };
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control, .msg_controllen = sizeof(control),
+    };
+
+    ssize_t n;
+    do {
+        n = recvmsg(client, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+
+    int fds[3] = { -1, -1, -1 };
+    struct cmsghdr* cmsg = n == 1 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        return;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    // read the rest of the length and then the payload
+    uint32_t length;
+    ((char*)&length)[0] = first;
+
+    char* request = NULL;
+    if (!server__read_all(client, (char*)&length + 1, sizeof(length) - 1) ||
+        length == 0 || length > SERVER_MAX_REQUEST ||
+        !server__read_all(client, (request = malloc(length + 1)), length)) {
+        goto done;
+    }
+    request[length] = '\0';
+
+    // split up the strings, first is the working directory
+    DynArray(char*) args = dyn_array_create(char*);
+
+    const char* cwd = request;
+    for (char* p = request + strlen(request) + 1; p < request + length; p += strlen(p) + 1) {
+        dyn_array_put(args, p);
+    }
+
+    int argc = dyn_array_length(args);
+    dyn_array_put(args, NULL);
+
+    int32_t exit_code = EXIT_FAILURE;
+    if (argc > 0 && chdir(cwd) == 0) {
+        // compile with the client's stdio
+        int saved_stdout = dup(STDOUT_FILENO);
+        int saved_stderr = dup(STDERR_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[2], STDERR_FILENO);
+
+        cuik_revalidate_fs_cache();
+
+        server_client = client;
+        exit_code = compile(argc, args);
+        server_client = -1;
+
+        fflush(stdout);
+        fflush(stderr);
+        dup2(saved_stdout, STDOUT_FILENO);
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stdout);
+        close(saved_stderr);
+    }
+
+    server__write_all(client, &exit_code, sizeof(exit_code));
+    dyn_array_destroy(args);
+
+    done:
+    free(request);
+    for (int i = 0; i < 3; i++) close(fds[i]);
+}
+
+// init is run once in the process that'll do the compiles (after the fork)
+static int server_run(void init(void), server_compile_fn* compile) {
+    struct sockaddr_un addr;
+    if (!server_get_path(&addr, true)) {
+        return EXIT_FAILURE;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        fprintf(stderr, "error: could not create the server socket\n");
+        return EXIT_FAILURE;
+    }
+
+    // clear out whatever was left by a dead server, if one is still
+    // around then connecting to it works and we bail
+    if (connect(listener, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "error: there's already a server running on %s\n", addr.sun_path);
+        return EXIT_FAILURE;
+    }
+    remove(addr.sun_path);
+
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        fprintf(stderr, "error: could not listen on %s\n", addr.sun_path);
+        return EXIT_FAILURE;
+    }
+
+    // clients hanging up shouldn't take us down
+    signal(SIGPIPE, SIG_IGN);
+    printf("Listening on %s...\n", addr.sun_path);
+    fflush(stdout);
+
+    for (;;) {
+        pid_t child = fork();
+        if (child < 0) {
+            fprintf(stderr, "error: could not fork the server\n");
+            return EXIT_FAILURE;
+        }
+
+        if (child == 0) {
+            init();
+
+            atexit(server__on_exit);
+            signal(SIGABRT, server__on_fatal_signal);
+            signal(SIGSEGV, server__on_fatal_signal);
+            signal(SIGILL, server__on_fatal_signal);
+            signal(SIGFPE, server__on_fatal_signal);
+            // a source file that shrinks under the file cache's mappings
+            signal(SIGBUS, server__on_fatal_signal);
+
+            for (int i = 0; i < SERVER_MAX_COMPILES; i++) {
+                int client = accept(listener, NULL, NULL);
+                if (client < 0) {
+                    if (errno == EINTR) continue;
+
+                    fprintf(stderr, "error: accept failed (%s)\n", strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+
+                if (server__peer_is_us(client)) {
+                    server_handle(client, compile);
+                }
+                close(client);
+            }
+
+            exit(EXIT_SUCCESS);
+        }
+
+        // restart it if it died (or retired)
+        int status;
+        while (waitpid(child, &status, 0) < 0 && errno == EINTR) {}
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            fprintf(stderr, "warning: compile server died (status %d), restarting...\n", status);
+        }
+    }
+}
+#else
+static bool server_connect(int argc, char** argv, int* out_exit_code) {
+    return false;
+}
+
+static int server_run(void init(void), server_compile_fn* compile) {
+    fprintf(stderr, "error: the compile server isn't supported on windows yet\n");
+    return EXIT_FAILURE;
+}
+#endif
@@ -0,0 +1,138 @@
+// Shared leading includes
+//
+// If every input file opens with the same #includes we preprocess them once into a
+// snapshot (see cuikpp_make_snapshot) and each file starts from that instead. Only
+// the directives at the very top count, anything between them besides whitespace
+// and comments ends the run since it could change what the headers expand into.
+//
+// An include is only shared if it would find the same header from every file: the
+// quoted ones look next to the file first so those need the same directory, the
+// angle ones are fine as long as they're found in the include directories.
+#define SHARED_INCLUDES_MAX 64
+
+typedef struct {
+    bool is_lib_include;
+    // only checked for the first file's angle includes
+    bool in_include_dirs;
+    size_t length;
+    const char* name;
+} SharedInclude;
+
+static const char* shared_includes__skip_space(const char* p) {
+    for (;;) {
+        if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '\v' || *p == '\f') {
+            p++;
+        } else if (p[0] == '/' && p[1] == '/') {
+            while (*p && *p != '\n') p++;
+        } else if (p[0] == '/' && p[1] == '*') {
+            p += 2;
+            while (*p && !(p[0] == '*' && p[1] == '/')) p++;
+            if (*p) p += 2;
+        } else {
+            return p;
+        }
+    }
+}
+
+// fills out up to max leading #includes, returns how many it found
+static size_t shared_includes__scan(const char* text, SharedInclude* out, size_t max) {
+    const char* p = text;
+    size_t count = 0;
+
+    while (count < max) {
+        p = shared_includes__skip_space(p);
+        if (*p != '#') break;
+
+        p++;
+        while (*p == ' ' || *p == '\t') p++;
+        if (strncmp(p, "include", 7) != 0) break;
+
+        p += 7;
+        while (*p == ' ' || *p == '\t') p++;
+
+        char close = *p == '<' ? '>' : *p == '"' ? '"' : 0;
+        if (close == 0) break;
+
+        const char* name = ++p;
+        while (*p && *p != close && *p != '\n') p++;
+        if (*p != close) break;
+
+        out[count] = (SharedInclude){ close == '>', false, p - name, name };
+        p++;
+
+        // nothing else on the line (we also don't bother with line continuations)
+        while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+        if (*p != '\n' && *p != '\0' && !(p[0] == '/' && (p[1] == '/' || p[1] == '*'))) break;
+
+        count++;
+    }
+
+    return count;
+}
+
+static bool shared_includes__same_dir(const char* a, const char* b) {
+    const char* a_slash = step_out_dir(a, 1);
+    const char* b_slash = step_out_dir(b, 1);
+    if (a_slash == NULL || b_slash == NULL) {
+        return a_slash == b_slash;
+    }
+
+    size_t a_len = a_slash - a, b_len = b_slash - b;
+    return a_len == b_len && memcmp(a, b, a_len) == 0;
+}
+
+// how many #includes every file starts with, cpp is only used to look up the
+// angle includes so it should have the include directories set up.
+static size_t count_shared_includes(Cuik_CPP* cpp, size_t file_count, const char** files) {
+    if (file_count < 2) {
+        return 0;
+    }
+
+    // the names point into the first file so we hold onto it
+    SharedInclude first[SHARED_INCLUDES_MAX], other[SHARED_INCLUDES_MAX];
+    Cuik_File first_file = CUIK_CALL(&cuik_default_fs, get_file, false, files[0]);
+    if (!first_file.found) {
+        return 0;
+    }
+
+    size_t shared = shared_includes__scan(first_file.data, first, SHARED_INCLUDES_MAX);
+
+    // if any of them end up in a different directory the angle includes need to be
+    // in the include directories, if not we stop right before it.
+    for (size_t i = 0; i < shared; i++) {
+        if (!first[i].is_lib_include) continue;
+
+        char name[FILENAME_MAX], path[FILENAME_MAX];
+        snprintf(name, FILENAME_MAX, "%.*s", (int)first[i].length, first[i].name);
+        first[i].in_include_dirs = cuikpp_find_include_include(cpp, path, name);
+    }
+
+    for (size_t i = 1; i < file_count && shared > 0; i++) {
+        Cuik_File file = CUIK_CALL(&cuik_default_fs, get_file, false, files[i]);
+        if (!file.found) {
+            shared = 0;
+            break;
+        }
+
+        size_t count = shared_includes__scan(file.data, other, shared);
+        if (!file.is_shared) free(file.data);
+
+        bool same_dir = shared_includes__same_dir(files[0], files[i]);
+        size_t j = 0;
+        for (; j < count; j++) {
+            if (first[j].is_lib_include != other[j].is_lib_include || first[j].length != other[j].length ||
+                memcmp(first[j].name, other[j].name, first[j].length) != 0) {
+                break;
+            }
+
+            if (!same_dir && !first[j].in_include_dirs) {
+                break;
+            }
+        }
+
+        shared = j;
+    }
+
+    if (!first_file.is_shared) free(first_file.data);
+    return shared;
+}
@@ -6,8 +6,6 @@
 #include <string.h>
 
 #ifndef _WIN32
-#include <semaphore.h>
-
 #include <dirent.h>
 #include <errno.h>
 #include <unistd.h>
@@ -19,55 +17,294 @@
 // HACK(NeGate): i wanna call tb_free_thread_resources on thread exit...
 extern void tb_free_thread_resources(void);
 
+// how many times an idle thread looks for work before parking
+#define THREADPOOL_SPIN_COUNT 64
+
+// Each worker owns a Chase-Lev deque, it pushes and pops at the bottom while
+// everyone else steals from the top. Threads which aren't workers (or workers
+// with a full deque) put their jobs into the shared queue.
+//
+// NOTE(NeGate): the deques don't grow so we never have to worry about a thief
+// reading a buffer that's been freed, when it's full we spill.
+typedef struct {
+    _Atomic(int64_t) top;
+    _Atomic(int64_t) bottom;
+    work_t* work;
+} WorkDeque;
+
 struct threadpool_t {
     atomic_bool running;
-    atomic_uint read_pointer;  // Read
-    atomic_uint write_pointer; // Write
-
-    atomic_uint completion_goal;
-    atomic_uint completion_count;
 
     int thread_count;
-    unsigned int queue_size_mask;
-
-    #ifdef _WIN32
-    HANDLE sem;
-    #else
-    sem_t sem;
-    #endif
-
+    int64_t deque_capacity;
+    WorkDeque* deques;
     thrd_t* threads;
-    work_t* work;
-    mtx_t mutex;
+
+    // shared queue (ring buffer, grows as needed)
+    mtx_t shared_mutex;
+    size_t shared_head, shared_count, shared_capacity;
+    work_t* shared_work;
+    atomic_size_t shared_pending;
+
+    // idle threads park on this, epoch is bumped on every new job or
+    // finished group so they know to look again
+    mtx_t park_mutex;
+    cnd_t park_cond;
+    atomic_uint epoch;
+    atomic_int sleepers;
+
+    // used by threadpool_submit
+    threadpool_group_t default_group;
 };
 
-static bool do_work(threadpool_t* threadpool) {
-    uint32_t read_ptr = threadpool->read_pointer;
-    uint32_t new_read_ptr = (read_ptr + 1) & threadpool->queue_size_mask;
+typedef struct {
+    threadpool_t* threadpool;
+    int index;
+} WorkerInfo;
+
+// which deque belongs to the current thread, -1 if it's not a worker
+static thread_local threadpool_t* tp_current;
+static thread_local int tp_worker_index = -1;
+static thread_local uint32_t tp_rng = 0;
+
+static void notify(threadpool_t* threadpool) {
+    threadpool->epoch++;
+
+    if (threadpool->sleepers > 0) {
+        mtx_lock(&threadpool->park_mutex);
+        cnd_broadcast(&threadpool->park_cond);
+        mtx_unlock(&threadpool->park_mutex);
+    }
+}
+
+static bool deque_push(threadpool_t* threadpool, WorkDeque* dq, work_t job) {
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    if (b - t >= threadpool->deque_capacity) {
+        return false;
+    }
+
+    dq->work[b & (threadpool->deque_capacity - 1)] = job;
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    return true;
+}
+
+static bool deque_pop(threadpool_t* threadpool, WorkDeque* dq, work_t* out) {
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+    if (t > b) {
+        // empty
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return false;
+    }
+
+    *out = dq->work[b & (threadpool->deque_capacity - 1)];
+    if (t == b) {
+        // last job, race the thieves for it
+        bool success = atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        return success;
+    }
+
+    return true;
+}
+
+// only pops if the bottom job is from the group (NULL means any), we're the only
+// ones touching the bottom so it can't change between the peek and the pop.
+static bool deque_pop_group(threadpool_t* threadpool, WorkDeque* dq, threadpool_group_t* group, work_t* out) {
+    if (group != NULL) {
+        int64_t b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+        int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+        if (t >= b || dq->work[(b - 1) & (threadpool->deque_capacity - 1)].group != group) {
+            return false;
+        }
+    }
+
+    return deque_pop(threadpool, dq, out);
+}
+
+static bool deque_steal(threadpool_t* threadpool, WorkDeque* dq, threadpool_group_t* group, work_t* out) {
+    int64_t t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+
+    if (t >= b) {
+        return false;
+    }
+
+    // the owner can't overwrite this slot until top moves past it
+    work_t job = dq->work[t & (threadpool->deque_capacity - 1)];
+    if (group != NULL && job.group != group) {
+        return false;
+    }
+
+    if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return false;
+    }
+
+    *out = job;
+    return true;
+}
+
+static void shared_push(threadpool_t* threadpool, work_t job) {
+    mtx_lock(&threadpool->shared_mutex);
+    if (threadpool->shared_count == threadpool->shared_capacity) {
+        size_t new_capacity = threadpool->shared_capacity * 2;
+        work_t* new_work = malloc(new_capacity * sizeof(work_t));
+
+        for (size_t i = 0; i < threadpool->shared_count; i++) {
+            new_work[i] = threadpool->shared_work[(threadpool->shared_head + i) % threadpool->shared_capacity];
+        }
+
+        free(threadpool->shared_work);
+        threadpool->shared_work = new_work;
+        threadpool->shared_head = 0;
+        threadpool->shared_capacity = new_capacity;
+    }
+
+    size_t slot = (threadpool->shared_head + threadpool->shared_count) % threadpool->shared_capacity;
+    threadpool->shared_work[slot] = job;
+    threadpool->shared_count++;
+    threadpool->shared_pending++;
+    mtx_unlock(&threadpool->shared_mutex);
+}
+
+// takes the oldest job from the group (NULL means any)
+static bool shared_pop(threadpool_t* threadpool, threadpool_group_t* group, work_t* out) {
+    // quick check so idle threads don't hammer the lock
+    if (threadpool->shared_pending == 0) {
+        return false;
+    }
+
+    bool success = false;
+    mtx_lock(&threadpool->shared_mutex);
+    size_t head = threadpool->shared_head, cap = threadpool->shared_capacity;
+    for (size_t i = 0; i < threadpool->shared_count; i++) {
+        if (group != NULL && threadpool->shared_work[(head + i) % cap].group != group) {
+            continue;
+        }
+
+        // close the gap, the queue is short and this isn't the common case
+        *out = threadpool->shared_work[(head + i) % cap];
+        for (; i > 0; i--) {
+            threadpool->shared_work[(head + i) % cap] = threadpool->shared_work[(head + i - 1) % cap];
+        }
+
+        threadpool->shared_head = (head + 1) % cap;
+        threadpool->shared_count--;
+        threadpool->shared_pending--;
+        success = true;
+        break;
+    }
+    mtx_unlock(&threadpool->shared_mutex);
+    return success;
+}
+
+static bool find_work(threadpool_t* threadpool, threadpool_group_t* group, work_t* out) {
+    int self = tp_current == threadpool ? tp_worker_index : -1;
+    if (self >= 0 && deque_pop_group(threadpool, &threadpool->deques[self], group, out)) {
+        return true;
+    }
+
+    if (shared_pop(threadpool, group, out)) {
+        return true;
+    }
 
-    if (read_ptr != threadpool->write_pointer) {
-        if (atomic_compare_exchange_strong(&threadpool->read_pointer, &read_ptr, new_read_ptr)) {
-            threadpool->work[read_ptr].fn(threadpool->work[read_ptr].arg);
-            threadpool->completion_count++;
+    // start stealing at a random victim so the thieves spread out
+    if (tp_rng == 0) tp_rng = (uint32_t)(uintptr_t)&tp_rng | 1;
+    tp_rng ^= tp_rng << 13, tp_rng ^= tp_rng >> 17, tp_rng ^= tp_rng << 5;
+
+    int n = threadpool->thread_count;
+    int start = tp_rng % n;
+    for (int i = 0; i < n; i++) {
+        int victim = (start + i) % n;
+        if (victim != self && deque_steal(threadpool, &threadpool->deques[victim], group, out)) {
+            return true;
         }
+    }
+
+    return false;
+}
 
+// runs a job from the group (NULL means any)
+static bool do_work(threadpool_t* threadpool, threadpool_group_t* group) {
+    work_t job;
+    if (!find_work(threadpool, group, &job)) {
         return false;
     }
 
+    job.fn(job.arg);
+
+    if (atomic_fetch_sub(&job.group->pending, 1) == 1) {
+        // someone might be parked on this group
+        notify(threadpool);
+    }
+
     return true;
 }
 
+// sleeps until there's new work (or a group finished) or the condition is met,
+// done_fn returning true means stop waiting.
+static void park(threadpool_t* threadpool, bool done_fn(threadpool_t*, void*), void* ctx) {
+    threadpool->sleepers++;
+    unsigned int epoch = threadpool->epoch;
+
+    if (!done_fn(threadpool, ctx)) {
+        mtx_lock(&threadpool->park_mutex);
+        while (threadpool->epoch == epoch) {
+            cnd_wait(&threadpool->park_cond, &threadpool->park_mutex);
+        }
+        mtx_unlock(&threadpool->park_mutex);
+    }
+
+    threadpool->sleepers--;
+}
+
+static bool has_work_or_stopped(threadpool_t* threadpool, void* ctx) {
+    if (!threadpool->running || threadpool->shared_pending > 0) {
+        return true;
+    }
+
+    for (int i = 0; i < threadpool->thread_count; i++) {
+        WorkDeque* dq = &threadpool->deques[i];
+        if (atomic_load(&dq->top) < atomic_load(&dq->bottom)) return true;
+    }
+
+    return false;
+}
+
+static bool group_done_or_has_work(threadpool_t* threadpool, void* ctx) {
+    threadpool_group_t* group = ctx;
+    return group->pending == 0 || has_work_or_stopped(threadpool, NULL);
+}
+
+static bool group_done(threadpool_t* threadpool, void* ctx) {
+    threadpool_group_t* group = ctx;
+    return group->pending == 0;
+}
+
 static int threadpool_thread(void* arg) {
-    threadpool_t* threadpool = arg;
+    WorkerInfo info = *(WorkerInfo*)arg;
+    free(arg);
+
+    threadpool_t* threadpool = info.threadpool;
+    tp_current = threadpool;
+    tp_worker_index = info.index;
 
     CUIK_TIMED_BLOCK("thread") {
+        int idle = 0;
         while (threadpool->running) {
-            if (do_work(threadpool)) {
-                #ifdef _WIN32
-                WaitForSingleObjectEx(threadpool->sem, -1, false); // wait for jobs
-                #else
-                sem_wait(&threadpool->sem);
-                #endif
+            if (do_work(threadpool, NULL)) {
+                idle = 0;
+            } else if (++idle < THREADPOOL_SPIN_COUNT) {
+                thrd_yield();
+            } else {
+                park(threadpool, has_work_or_stopped, NULL);
+                idle = 0;
             }
         }
     }
@@ -84,109 +321,114 @@ threadpool_t* threadpool_create(size_t worker_count, size_t workqueue_size) {
         return NULL;
 
     threadpool_t* threadpool = calloc(1, sizeof(threadpool_t));
-    threadpool->work = malloc(workqueue_size * sizeof(work_t));
-    threadpool->threads = malloc(worker_count * sizeof(thrd_t));
     threadpool->thread_count = worker_count;
+    threadpool->deque_capacity = workqueue_size;
     threadpool->running = true;
-    threadpool->queue_size_mask = workqueue_size - 1;
 
-    #if _WIN32
-    threadpool->sem = CreateSemaphoreExA(0, worker_count, worker_count, 0, 0, SEMAPHORE_ALL_ACCESS);
-    #else
-    if (sem_init(&threadpool->sem, 0 /* shared between threads */, worker_count) != 0) {
-        fprintf(stderr, "error: could not create semaphore!\n");
-        abort();
+    threadpool->deques = calloc(worker_count, sizeof(WorkDeque));
+    for (size_t i = 0; i < worker_count; i++) {
+        threadpool->deques[i].work = malloc(workqueue_size * sizeof(work_t));
     }
-    #endif
 
+    threadpool->shared_capacity = workqueue_size;
+    threadpool->shared_work = malloc(workqueue_size * sizeof(work_t));
+
+    mtx_init(&threadpool->shared_mutex, mtx_plain);
+    mtx_init(&threadpool->park_mutex, mtx_plain);
+    cnd_init(&threadpool->park_cond);
+
+    threadpool->threads = malloc(worker_count * sizeof(thrd_t));
     for (int i = 0; i < worker_count; i++) {
-        if (thrd_create(&threadpool->threads[i], threadpool_thread, threadpool) != thrd_success) {
+        WorkerInfo* info = malloc(sizeof(WorkerInfo));
+        *info = (WorkerInfo){ threadpool, i };
+
+        if (thrd_create(&threadpool->threads[i], threadpool_thread, info) != thrd_success) {
             fprintf(stderr, "error: could not create worker threads!\n");
             abort();
         }
     }
 
-    mtx_init(&threadpool->mutex, mtx_plain);
-
     return threadpool;
 }
 
-void threadpool_submit(threadpool_t* threadpool, work_routine fn, void* arg) {
-    mtx_lock(&threadpool->mutex);
-    {
-        uint32_t write_ptr = threadpool->write_pointer;
-        uint32_t new_write_ptr = (write_ptr + 1) & threadpool->queue_size_mask;
-        while (new_write_ptr == threadpool->read_pointer) {
-            // Power nap lmao
-            thrd_yield();
-        }
+void threadpool_group_submit(threadpool_t* threadpool, threadpool_group_t* group, work_routine fn, void* arg) {
+    work_t job = { .fn = fn, .arg = arg, .group = group };
+    group->pending++;
 
-        threadpool->work[write_ptr] = (work_t){.fn = fn, .arg = arg};
+    // workers keep their own jobs local, everyone else goes through the shared queue
+    if (tp_current != threadpool || !deque_push(threadpool, &threadpool->deques[tp_worker_index], job)) {
+        shared_push(threadpool, job);
+    }
+
+    notify(threadpool);
+}
 
-        threadpool->completion_goal++;
-        threadpool->write_pointer = new_write_ptr;
+// if help_anyone is false we only run the group's own jobs, the rest are left for the
+// workers. Jobs from the group which got buried under other work in our deque are
+// left for the thieves too, we only ever pop from the bottom.
+static void group_wait(threadpool_t* threadpool, threadpool_group_t* group, bool help_anyone) {
+    int idle = 0;
+    while (group->pending != 0) {
+        if (do_work(threadpool, help_anyone ? NULL : group)) {
+            idle = 0;
+        } else if (++idle < THREADPOOL_SPIN_COUNT) {
+            thrd_yield();
+        } else {
+            // new jobs we're allowed to take all come from the group's own jobs which
+            // are running right now, so we only need to wake up when it's finished or
+            // someone submitted something (the epoch also moves on every submit).
+            park(threadpool, help_anyone ? group_done_or_has_work : group_done, group);
+            idle = 0;
+        }
     }
+}
 
-    #ifdef _WIN32
-    ReleaseSemaphore(threadpool->sem, 1, 0);
-    #else
-    sem_post(&threadpool->sem);
-    #endif
+void threadpool_group_wait(threadpool_t* threadpool, threadpool_group_t* group) {
+    group_wait(threadpool, group, false);
+}
 
-    mtx_unlock(&threadpool->mutex);
+void threadpool_submit(threadpool_t* threadpool, work_routine fn, void* arg) {
+    threadpool_group_submit(threadpool, &threadpool->default_group, fn, arg);
 }
 
 void threadpool_work_one_job(threadpool_t* threadpool) {
-    do_work(threadpool);
+    do_work(threadpool, NULL);
 }
 
 void threadpool_work_while_wait(threadpool_t* threadpool) {
-    while (threadpool->completion_goal != threadpool->completion_count) {
-        if (do_work(threadpool)) {
-            thrd_yield();
-        }
-    }
-
-    threadpool->completion_goal = 0;
-    threadpool->completion_count = 0;
+    group_wait(threadpool, &threadpool->default_group, true);
 }
 
 void threadpool_wait(threadpool_t* threadpool) {
-    while (threadpool->completion_goal != threadpool->completion_count) {
-        thrd_yield();
-    }
-
-    threadpool->completion_goal = 0;
-    threadpool->completion_count = 0;
+    group_wait(threadpool, &threadpool->default_group, true);
 }
 
 void threadpool_free(threadpool_t* threadpool) {
     threadpool->running = false;
 
-    #ifdef _WIN32
-    ReleaseSemaphore(threadpool->sem, threadpool->thread_count, 0);
-    #else
     // wake everyone
-    for (size_t i = 0; i < threadpool->thread_count; i++) {
-        sem_post(&threadpool->sem);
-    }
-    #endif
+    notify(threadpool);
 
     #ifdef _WIN32
     WaitForMultipleObjects(threadpool->thread_count, threadpool->threads, TRUE, INFINITE);
 
     for (int i = 0; i < threadpool->thread_count; i++) CloseHandle(threadpool->threads[i]);
-    CloseHandle(threadpool->sem);
     #else
     for (int i = 0; i < threadpool->thread_count; i++) {
         thrd_join(threadpool->threads[i], NULL);
     }
-    sem_destroy(&threadpool->sem);
     #endif
 
-    mtx_destroy(&threadpool->mutex);
+    for (int i = 0; i < threadpool->thread_count; i++) {
+        free(threadpool->deques[i].work);
+    }
+
+    cnd_destroy(&threadpool->park_cond);
+    mtx_destroy(&threadpool->park_mutex);
+    mtx_destroy(&threadpool->shared_mutex);
+    free(threadpool->shared_work);
+    free(threadpool->deques);
     free(threadpool->threads);
-    free(threadpool->work);
     free(threadpool);
 }
 
@@ -1,20 +1,37 @@
 #pragma once
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <cuik.h>
 
 typedef struct threadpool_t threadpool_t;
 typedef void work_routine(void*);
 
+// tracks a set of jobs so you can wait on just those, jobs can submit more work
+// into their own group (or any other). It's safe to wait on a group from inside a
+// job, the waiter only helps with jobs from that group so it never ends up running
+// some unrelated job on top of whatever the caller was doing.
+typedef Cuik_TaskGroup threadpool_group_t;
+
 typedef struct {
     work_routine* fn;
     void* arg;
+    threadpool_group_t* group;
 } work_t;
 
+// workqueue_size is the capacity of each worker's deque (power of two), once a
+// deque is full the extra jobs spill into the shared queue
 threadpool_t* threadpool_create(size_t worker_count, size_t workqueue_size);
 void threadpool_submit(threadpool_t* threadpool, work_routine fn, void* arg);
+
+// waits on the jobs from threadpool_submit, it'll run any job while it waits so it's
+// meant for the top level (outside of any job).
 void threadpool_wait(threadpool_t* threadpool);
 void threadpool_work_one_job(threadpool_t* threadpool);
 void threadpool_work_while_wait(threadpool_t* threadpool);
 void threadpool_free(threadpool_t* threadpool);
 int threadpool_get_thread_count(threadpool_t* threadpool);
+
+void threadpool_group_submit(threadpool_t* threadpool, threadpool_group_t* group, work_routine fn, void* arg);
+void threadpool_group_wait(threadpool_t* threadpool, threadpool_group_t* group);
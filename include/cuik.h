@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include <tb.h>
 
 #define CUIK_API extern
@@ -25,6 +26,10 @@ typedef struct CompilationUnit CompilationUnit;
 typedef struct Cuik_File {
     bool found;
 
+    // if true the buffer is owned by the file system and shared between preprocessor
+    // instances, it's read-only and the weird whitespace is already normalized.
+    bool is_shared;
+
     size_t length;
     char* data;
 } Cuik_File;
@@ -32,22 +37,36 @@ typedef struct Cuik_File {
 ////////////////////////////////////////////
 // Interfaces
 ////////////////////////////////////////////
+// a set of jobs which can be waited on together, zero it before the first submit
+typedef struct Cuik_TaskGroup {
+    atomic_size_t pending;
+} Cuik_TaskGroup;
+
 typedef struct Cuik_IThreadpool {
     // fed into the member functions here
     void* user_data;
 
-    // runs the function fn with arg as the parameter on a thread
-    void (*submit)(void* user_data, void fn(void*), void* arg);
+    // how many threads are running jobs (0 if unknown), it's used
+    // to decide how finely to split up work
+    int thread_count;
+
+    // runs the function fn with arg as the parameter on a thread, if group
+    // is non-NULL the job is counted in it.
+    void (*submit)(void* user_data, Cuik_TaskGroup* group, void fn(void*), void* arg);
 
-    // tries to work one job before returning (can also not work at all)
-    void (*work_one_job)(void* user_data);
+    // returns once every job in the group is done. It can help out while it
+    // waits but only with jobs from the same group, the caller might be in
+    // the middle of some job and anything else (like another file's compile)
+    // would be running on top of its thread locals.
+    void (*wait)(void* user_data, Cuik_TaskGroup* group);
 } Cuik_IThreadpool;
 
 typedef struct Cuik_IFileSystem {
     void* user_data;
 
     // is_query will only set .found if it finds a file, if it's not is_query then it attempts to
-    // read the file and return a valid memory buffer (with at least 16 extra bytes on the end zeroed)
+    // read the file and return a valid memory buffer (with at least 16 extra bytes on the end zeroed),
+    // the default file system hands out shared buffers which are cached for the whole process.
     Cuik_File (*get_file)(void* user_data, bool is_query, const char* path);
 
     // converts into an absolute path (powers the #pragma once subsystem)
@@ -68,6 +87,12 @@ typedef struct Cuik_IProfiler {
 // default file system (just OS crap)
 CUIK_API Cuik_IFileSystem cuik_default_fs;
 
+// the default file system checks file contents by mtime on every read but it trusts
+// the directory listings (and resolved includes) it's seen, long running hosts should
+// call this between compiles to throw out any that changed. Nothing can be
+// preprocessing while it runs.
+CUIK_API void cuik_revalidate_fs_cache(void);
+
 ////////////////////////////////////////////
 // Target descriptor
 ////////////////////////////////////////////
@@ -123,6 +148,7 @@ CUIK_API bool cuik_lex_is_keyword(size_t length, const char* str);
 ////////////////////////////////////////////
 typedef unsigned int SourceLocIndex;
 typedef struct Cuik_CPP Cuik_CPP;
+typedef struct Cuik_CPPSnapshot Cuik_CPPSnapshot;
 
 #define SOURCE_LOC_GET_DATA(loc) ((loc) & ~0xC0000000u)
 #define SOURCE_LOC_GET_TYPE(loc) (((loc) & 0xC0000000u) >> 30u)
@@ -132,6 +158,8 @@ typedef enum SourceLocType {
     SOURCE_LOC_UNKNOWN = 0,
     SOURCE_LOC_NORMAL = 1,
     SOURCE_LOC_MACRO = 2,
+    // tokens straight out of a file, these are only resolved into a SourceLoc when
+    // asked for (see cuik_get_location)
     SOURCE_LOC_FILE = 3
 } SourceLocType;
 
@@ -159,6 +187,9 @@ typedef struct Cuik_FileEntry {
 
     const char* filepath;
     uint8_t* content;
+
+    // shared content is owned by the file system, not the preprocessor
+    bool is_shared;
 } Cuik_FileEntry;
 
 typedef struct Cuik_DefineRef {
@@ -205,9 +236,33 @@ CUIK_API void cuikpp_define_empty(Cuik_CPP* ctx, const char key[]);
 // Basically just `#define key value`
 CUIK_API void cuikpp_define(Cuik_CPP* ctx, const char key[], const char value[]);
 
+// Preprocesses `header` ahead of every file passed to cuikpp_run (like a forced
+// #include at the top). If pch_path is non-NULL the result is cached there as a
+// precompiled header and reloaded on later runs as long as the defines, include
+// directories and the files it read haven't changed.
+CUIK_API void cuikpp_set_prefix_header(Cuik_CPP* ctx, const char* header, const char* pch_path);
+
+// While cuikpp_run walks the main file it'll farm out the headers it might include
+// to the thread pool, they get loaded and their #includes resolved ahead of time. The
+// output doesn't change, this just hides the file IO.
+CUIK_API void cuikpp_set_thread_pool(Cuik_CPP* ctx, const Cuik_IThreadpool* thread_pool);
+
 // Convert C preprocessor state and an input file into a final preprocessed stream
 CUIK_API TokenStream cuikpp_run(Cuik_CPP* ctx, const char filepath[FILENAME_MAX]);
 
+// Runs just the first include_count #includes of filepath (and the prefix header
+// if one is set) and captures the result, ctx belongs to the snapshot after this.
+// Returns NULL if the file doesn't start with that many #includes.
+CUIK_API Cuik_CPPSnapshot* cuikpp_make_snapshot(Cuik_CPP* ctx, const char* filepath, size_t include_count);
+
+// Sets up ctx to continue from the snapshot, cuikpp_run on it will skip the first
+// #includes of the file since the snapshot has already run them. It's up to the
+// caller to make sure the file starts with the same ones (and that they'd resolve
+// to the same headers), the snapshot can't be freed until everyone using the
+// tokens is done.
+CUIK_API void cuikpp_init_from_snapshot(Cuik_CPP* ctx, const Cuik_CPPSnapshot* snapshot);
+CUIK_API void cuikpp_free_snapshot(Cuik_CPPSnapshot* snapshot);
+
 // Used to make iterators for the define list, for example:
 //
 // Cuik_DefineRef it, curr = cuikpp_first_define(cpp);
@@ -218,6 +273,16 @@ CUIK_API bool cuikpp_next_define(Cuik_CPP* ctx, Cuik_DefineRef* src);
 // Get the information from a define reference
 CUIK_API Cuik_Define cuikpp_get_define(Cuik_CPP* ctx, Cuik_DefineRef src);
 
+// initializes out_cpp with the default defines (same as cuik_preprocess_simple) but
+// doesn't run it, use this if you need to configure the preprocessor any further.
+//
+// if fs is NULL, it'll default to cuik_default_fs.
+// if target is non-NULL it'll add predefined macros based on the target.
+CUIK_API void cuik_init_preprocessor(
+    Cuik_CPP* restrict out_cpp, const Cuik_IFileSystem* fs, const Cuik_Target* target,
+    bool system_includes, size_t include_count, const char* includes[]
+);
+
 // this will return a Cuik_CPP through out_cpp that you have to free once you're
 // done with it (after all frontend work is done), the out_cpp can also be finalized if
 // you dont need the defines table.
@@ -295,10 +360,11 @@ CUIK_API void cuik_destroy_translation_unit(TranslationUnit* restrict tu);
 ////////////////////////////////////////////
 // Token stream
 ////////////////////////////////////////////
+CUIK_API SourceLoc cuik_get_location(TokenStream* restrict s, SourceLocIndex loc);
 CUIK_API const char* cuik_get_location_file(TokenStream* restrict s, SourceLocIndex loc);
 CUIK_API int cuik_get_location_line(TokenStream* restrict s, SourceLocIndex loc);
 
-CUIK_API Token* cuik_get_tokens(TokenStream* restrict s);
+CUIK_API Token cuik_get_token(TokenStream* restrict s, size_t i);
 CUIK_API size_t cuik_get_token_count(TokenStream* restrict s);
 
 ////////////////////////////////////////////
@@ -309,13 +375,59 @@ CUIK_API size_t cuik_get_token_count(TokenStream* restrict s);
 CUIK_API TB_Module* cuik_get_tb_module(TranslationUnit* restrict tu);
 CUIK_API TB_Function* cuik_stmt_gen_ir(TranslationUnit* restrict tu, Stmt* restrict s);
 
+// rough guess of how much work a top level statement is (about one unit per token),
+// useful for splitting them up into tasks.
+CUIK_API size_t cuik_stmt_get_cost(Stmt* restrict s);
+
+// Compile tiers trade code quality for compile speed, the tier picks the instruction
+// selector for each function and anything it gives TB_ISEL_COMPLEX is worth optimizing.
+typedef enum Cuik_CompileTier {
+    // fast isel everywhere, for debug builds
+    CUIK_TIER_DEBUG,
+    // fast isel except for hot functions
+    CUIK_TIER_HYBRID,
+    // complex isel everywhere
+    CUIK_TIER_RELEASE,
+} Cuik_CompileTier;
+
+CUIK_API void cuik_set_compile_tier(Cuik_CompileTier tier);
+CUIK_API Cuik_CompileTier cuik_get_compile_tier(void);
+
+// hot functions are the ones marked __attribute__((hot)) or named here (say from
+// a profile), these can't be changed while IR gen is running.
+CUIK_API void cuik_add_hot_function(const char* name);
+CUIK_API void cuik_clear_hot_functions(void);
+
+CUIK_API bool cuik_stmt_is_hot(Stmt* restrict s);
+CUIK_API TB_ISelMode cuik_stmt_get_isel_mode(Stmt* restrict s);
+
+// Profile instrumentation makes every function count how many times it's entered and
+// has main dump the counters when the program exits, the profile file is appended to
+// so multiple runs add up. Each run writes a record like:
+//
+//   [Cuik_ProfileHeader] [name_count names, each NULL terminated] [name_count x u64 counts]
+//
+// Functions from the module generated between begin & finish are instrumented, finish
+// returns the function that writes out the profile, it still needs to be compiled.
+#define CUIK_PROFILE_MAGIC "CUIKPRF"
+
+typedef struct Cuik_ProfileHeader {
+    char magic[8];
+    uint32_t name_count;
+    uint32_t names_size;
+} Cuik_ProfileHeader;
+
+CUIK_API void cuik_begin_profile_instrumentation(TB_Module* m);
+CUIK_API TB_Function* cuik_finish_profile_instrumentation(TB_Module* m, const char* profile_path);
+
 ////////////////////////////////////////////
 // Translation unit management
 ////////////////////////////////////////////
 typedef void Cuik_TopLevelVisitor(TranslationUnit* restrict tu, Stmt* restrict s, void* user_data);
 
 CUIK_API void cuik_visit_top_level(TranslationUnit* restrict tu, void* user_data, Cuik_TopLevelVisitor* visitor);
-CUIK_API void cuik_visit_top_level_threaded(TranslationUnit* restrict tu, const Cuik_IThreadpool* thread_pool, int batch_size, void* user_data, Cuik_TopLevelVisitor* visitor);
+// the statements are split into tasks of about the same amount of work, a few per thread
+CUIK_API void cuik_visit_top_level_threaded(TranslationUnit* restrict tu, const Cuik_IThreadpool* thread_pool, void* user_data, Cuik_TopLevelVisitor* visitor);
 
 CUIK_API void cuik_dump_translation_unit(FILE* stream, TranslationUnit* tu, bool minimalist);
 
@@ -338,9 +450,23 @@ CUIK_API void cuik_create_compilation_unit(CompilationUnit* restrict cu);
 CUIK_API void cuik_lock_compilation_unit(CompilationUnit* restrict cu);
 CUIK_API void cuik_unlock_compilation_unit(CompilationUnit* restrict cu);
 CUIK_API void cuik_add_to_compilation_unit(CompilationUnit* restrict cu, TranslationUnit* restrict tu);
+
 CUIK_API void cuik_destroy_compilation_unit(CompilationUnit* restrict cu);
 CUIK_API void cuik_internal_link_compilation_unit(CompilationUnit* restrict cu);
 
+// Publishes the exports of a single TU, this way a TU can be linked (and IR generated)
+// as soon as it's done instead of waiting on the whole compilation unit.
+CUIK_API void cuik_internal_link_translation_unit(CompilationUnit* restrict cu, TranslationUnit* restrict tu);
+
+// true if the function refers to an external symbol which no TU has exported (yet), if
+// the rest of the compilation unit isn't done it might still be defined there.
+CUIK_API bool cuik_stmt_has_pending_link(TranslationUnit* restrict tu, Stmt* restrict s);
+
+// walks everything reachable from the entrypoints (main, WinMain...) through every TU and
+// marks the rest as unreachable so IR gen skips it. Only makes sense when the output is an
+// executable and it has to be called after the internal link.
+CUIK_API void cuik_mark_reachable_compilation_unit(CompilationUnit* restrict cu);
+
 ////////////////////////////////////////////
 // Linker
 ////////////////////////////////////////////
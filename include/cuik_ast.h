@@ -55,6 +55,8 @@ typedef struct {
     bool is_inline : 1;
     bool is_extern : 1;
     bool is_tls : 1;
+    // __attribute__((hot))
+    bool is_hot : 1;
 
     // NOTE(NeGate): In all honesty, this should probably not be
     // here since it's used in cases that aren't relevant to attribs.
@@ -62,6 +64,8 @@ typedef struct {
     // so we can garbage collect the symbol later.
     bool is_root : 1;
     bool is_used : 1;
+    // set by cuik_mark_reachable_compilation_unit on anything main can't get to
+    bool is_unreachable : 1;
 } Attribs;
 
 typedef struct {
@@ -391,6 +395,10 @@ struct Stmt {
             };
 
             Attribs attrs;
+
+            // how many tokens are in the function body, it's used to
+            // guess how much work the function is when splitting up tasks
+            uint32_t body_tokens;
         } decl;
         struct StmtFor {
             Stmt* first;
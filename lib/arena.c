@@ -90,7 +90,13 @@ void arena_trim(Arena* arena) {
 }
 
 void arena_append(Arena* arena, Arena* other) {
-    if (arena->top != NULL && other != NULL) {
+    if (other == NULL || other->base == NULL) {
+        return;
+    }
+
+    if (arena->top == NULL) {
+        *arena = *other;
+    } else {
         arena->top->next = other->base;
         arena->top = other->top;
     }
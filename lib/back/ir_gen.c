@@ -195,6 +195,36 @@ TB_Register irgen_as_lvalue(TranslationUnit* tu, TB_Function* func, Expr* e) {
     }
 }
 
+// string literals go through the compilation unit's constant pool so identical ones share
+// a global, a TU on its own just makes a new one every time.
+static TB_GlobalID irgen_string_global(TranslationUnit* tu, Expr* e) {
+    size_t length = e->str.end - e->str.start;
+    size_t align = e->type != NULL && e->type->kind == KIND_ARRAY ? e->type->array_of->align : 1;
+
+    if (tu->parent != NULL) {
+        return cuik__intern_constant(tu->parent, tu->ir_mod, length, align, e->str.start);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "str@%d", tu->id_gen++);
+
+    TB_InitializerID init = tb_initializer_create(tu->ir_mod, length, align, 1);
+    memcpy(tb_initializer_add_region(tu->ir_mod, init, 0, length), e->str.start, length);
+
+    TB_GlobalID global = tb_global_create(tu->ir_mod, name, TB_STORAGE_DATA, TB_LINKAGE_PRIVATE);
+    tb_global_set_initializer(tu->ir_mod, global, init);
+    return global;
+}
+
+// copies the string into an array, it's cut off or zero padded to fit
+static void irgen_string_copy(char* dst, size_t size, Expr* e) {
+    size_t length = e->str.end - e->str.start;
+    if (length > size) length = size;
+
+    memcpy(dst, e->str.start, length);
+    memset(dst + length, 0, size - length);
+}
+
 InitNode* count_max_tb_init_objects(int node_count, InitNode* node, int* out_count) {
     for (int i = 0; i < node_count; i++) {
         if (node->kids_count == 0) {
@@ -265,31 +295,13 @@ InitNode* eval_initializer_objects(TranslationUnit* tu, TB_Function* func, Sourc
                     if (!func) {
                         Expr* e = node->expr;
 
-                        char* dst = NULL;
                         if (child_type->kind == KIND_PTR) {
-                            // if it's a string pointer, then we make a dummy string array
-                            // and point to that with another initializer
-                            char temp[1024];
-                            snprintf(temp, 1024, "DUMMY@%d", tu->id_gen++);
-
-                            TB_InitializerID dummy_init = tb_initializer_create(tu->ir_mod, child_type->size, 2, 1);
-                            dst = tb_initializer_add_region(tu->ir_mod, dummy_init, 0, child_type->size);
-
-                            TB_GlobalID dummy = tb_global_create(tu->ir_mod, temp, TB_STORAGE_DATA, TB_LINKAGE_PRIVATE);
-                            tb_global_set_initializer(tu->ir_mod, dummy, dummy_init);
-
-                            tb_initializer_add_global(tu->ir_mod, init, 0, dummy);
+                            // string pointers point into the constant pool
+                            tb_initializer_add_global(tu->ir_mod, init, offset, irgen_string_global(tu, e));
                         } else {
-                            dst = tb_initializer_add_region(tu->ir_mod, init, 0, child_type->size);
-                        }
-
-                        // write out string bytes with the nice zeroes at the end
-                        size_t src_size = e->str.end - e->str.start;
-
-                        memcpy(dst, e->str.start, src_size);
-                        if (child_type->size > src_size) {
-                            size_t rem = child_type->size - src_size;
-                            memset(dst + child_type->size - rem, 0, rem);
+                            // write out string bytes with the nice zeroes at the end
+                            char* dst = tb_initializer_add_region(tu->ir_mod, init, offset, child_type->size);
+                            irgen_string_copy(dst, child_type->size, e);
                         }
                         break;
                     }
@@ -371,23 +383,17 @@ static TB_InitializerID gen_global_initializer(TranslationUnit* tu, SourceLocInd
 
     if (initial != NULL) {
         if (initial->op == EXPR_STR || initial->op == EXPR_WSTR) {
-            TB_InitializerID init = tb_initializer_create(tu->ir_mod, type->size, type->align, 1);
-            char* dst = tb_initializer_add_region(tu->ir_mod, init, 0, type->size);
-            memcpy(dst, initial->str.start, initial->str.end - initial->str.start);
-
             if (type->kind == KIND_PTR) {
-                // if it's a string pointer, then we make a dummy string array
-                // and point to that with another initializer
-                char temp[1024];
-                snprintf(temp, 1024, "%s@%d", name, tu->id_gen++);
-
-                TB_GlobalID dummy = tb_global_create(tu->ir_mod, temp, TB_STORAGE_DATA, TB_LINKAGE_PRIVATE);
-                tb_global_set_initializer(tu->ir_mod, dummy, init);
-
-                init = tb_initializer_create(tu->ir_mod, 8, 8, 1);
-                tb_initializer_add_global(tu->ir_mod, init, 0, dummy);
+                // string pointers point into the constant pool
+                TB_InitializerID init = tb_initializer_create(tu->ir_mod, 8, 8, 1);
+                tb_initializer_add_global(tu->ir_mod, init, 0, irgen_string_global(tu, initial));
+                return init;
             }
 
+            // arrays get their own copy since they can be written to
+            TB_InitializerID init = tb_initializer_create(tu->ir_mod, type->size, type->align, 1);
+            char* dst = tb_initializer_add_region(tu->ir_mod, init, 0, type->size);
+            irgen_string_copy(dst, type->size, initial);
             return init;
         } else if (initial->op == EXPR_INITIALIZER) {
             if (initial->init.type->kind == KIND_VOID) {
@@ -512,10 +518,20 @@ IRVal irgen_expr(TranslationUnit* tu, TB_Function* func, Expr* e) {
         case EXPR_STR:
         case EXPR_WSTR: {
             // The string is preprocessed to be a flat and nice byte buffer by the semantics pass
+            //
+            // NOTE(NeGate): TB's ELF writer doesn't relocate global addresses in code yet so
+            // we can't use the constant pool there, the initializers can though.
+            TB_Register reg;
+            if (tu->parent != NULL && tu->target.sys != TB_SYSTEM_LINUX) {
+                reg = tb_inst_get_global_address(func, irgen_string_global(tu, e));
+            } else {
+                reg = tb_inst_string(func, e->str.end - e->str.start, (char*)e->str.start);
+            }
+
             return (IRVal){
                 .value_type = RVALUE,
                 .type = e->type,
-                .reg = tb_inst_string(func, e->str.end - e->str.start, (char*)e->str.start)};
+                .reg = reg};
         }
         case EXPR_INITIALIZER: {
             Cuik_Type* type = e->init.type;
@@ -581,73 +597,52 @@ IRVal irgen_expr(TranslationUnit* tu, TB_Function* func, Expr* e) {
                 if (stmt->decl.attrs.is_extern) is_external_sym = true;
 
                 if (is_external_sym) {
-                    IRVal val = {0};
-
-                    if (tu->parent != NULL) {
-                        if (stmt->backing.e != 0) {
-                            val = (IRVal){
-                                .value_type = LVALUE_EFUNC,
-                                .type = type,
-                                .ext = stmt->backing.e
-                            };
-                        } else {
-                            // It's either a proper external or links to
-                            // a file within the compilation unit, we don't
-                            // know yet
-                            CompilationUnit* restrict cu = tu->parent;
-                            cuik_lock_compilation_unit(cu);
-
-                            ptrdiff_t temp;
-                            ptrdiff_t search = shgeti_ts(cu->export_table, name, temp);
-
-                            if (search >= 0) {
-                                // Figure out what the symbol is and link it together
-                                Stmt* real_symbol = cu->export_table[search].value;
-
-                                if (real_symbol->op == STMT_FUNC_DECL) {
-                                    val = (IRVal){
-                                        .value_type = LVALUE_FUNC,
-                                        .type = type,
-                                        .func = tb_function_from_id(tu->ir_mod, real_symbol->backing.f),
-                                    };
-                                } else if (real_symbol->op == STMT_GLOBAL_DECL) {
-                                    val = (IRVal){
-                                        .value_type = LVALUE,
-                                        .type = type,
-                                        .reg = tb_inst_get_global_address(func, real_symbol->backing.g),
-                                    };
-                                } else {
-                                    abort();
-                                }
-                            } else {
-                                // Always creates a real external in this case
-                                stmt->backing.e = tb_extern_create(tu->ir_mod, name);
-
-                                val = (IRVal){
-                                    .value_type = LVALUE_EFUNC,
+                    // the first thread to reach it makes the external and everyone after
+                    // that reuses it, TB hands out the IDs per thread so there's no lock.
+                    _Atomic(TB_ExternalID)* backing = (_Atomic(TB_ExternalID)*) &stmt->backing.e;
+                    TB_ExternalID ext = atomic_load_explicit(backing, memory_order_acquire);
+
+                    if (ext == 0 && tu->parent != NULL) {
+                        // It's either a proper external or links to
+                        // a file within the compilation unit, we don't
+                        // know yet
+                        Stmt* real_symbol = cuik__find_export(tu->parent, stmt->decl.name);
+
+                        if (real_symbol != NULL) {
+                            // Figure out what the symbol is and link it together
+                            if (real_symbol->op == STMT_FUNC_DECL) {
+                                return (IRVal){
+                                    .value_type = LVALUE_FUNC,
+                                    .type = type,
+                                    .func = tb_function_from_id(tu->ir_mod, real_symbol->backing.f),
+                                };
+                            } else if (real_symbol->op == STMT_GLOBAL_DECL) {
+                                return (IRVal){
+                                    .value_type = LVALUE,
                                     .type = type,
-                                    .ext = stmt->backing.e
+                                    .reg = tb_inst_get_global_address(func, real_symbol->backing.g),
                                 };
+                            } else {
+                                abort();
                             }
-
-                            // NOTE(NeGate): we might wanna move this mutex unlock earlier
-                            // it doesn't seem like we might need it honestly...
-                            cuik_unlock_compilation_unit(cu);
                         }
-                    } else {
-                        mtx_lock(&tu->arena_mutex);
-                        stmt->backing.e = tb_extern_create(tu->ir_mod, name);
-
-                        val = (IRVal){
-                            .value_type = LVALUE_EFUNC,
-                            .type = type,
-                            .ext = stmt->backing.e
-                        };
+                    }
 
-                        mtx_unlock(&tu->arena_mutex);
+                    if (ext == 0) {
+                        // Always creates a real external in this case, if another
+                        // thread beat us to it then ours just goes unused
+                        TB_ExternalID expected = 0;
+                        ext = tb_extern_create(tu->ir_mod, name);
+                        if (!atomic_compare_exchange_strong(backing, &expected, ext)) {
+                            ext = expected;
+                        }
                     }
 
-                    return val;
+                    return (IRVal){
+                        .value_type = LVALUE_EFUNC,
+                        .type = type,
+                        .ext = ext
+                    };
                 } else {
                     // Global defined within the TU
                     return (IRVal){
@@ -1565,8 +1560,7 @@ void irgen_stmt(TranslationUnit* tu, TB_Function* func, Stmt* restrict s) {
         static thread_local TB_FileID last_file_id = 0;
         static thread_local const char* last_filepath = NULL;
 
-        SourceLoc* l = &tu->tokens.locations[s->loc];
-        SourceLine* line = l->line;
+        SourceLine* line = cuik_get_location(&tu->tokens, s->loc).line;
 
         if ((const char*)line->filepath != last_filepath) {
             last_filepath = line->filepath;
@@ -1909,6 +1903,128 @@ void irgen_stmt(TranslationUnit* tu, TB_Function* func, Stmt* restrict s) {
     }
 }
 
+////////////////////////////////
+// Profile instrumentation
+////////////////////////////////
+// every instrumented function bumps its own slot in the counter table on entry,
+// main registers the dump function with atexit (see cuik_finish_profile_instrumentation)
+static struct {
+    TB_Module* module;
+    TB_GlobalID counters;
+    TB_Function* dump;
+
+    // the names are in counter order
+    mtx_t lock;
+    char** names;
+} profile;
+
+CUIK_API void cuik_begin_profile_instrumentation(TB_Module* m) {
+    assert(profile.module == NULL && "already instrumenting a module");
+
+    profile.module = m;
+    profile.counters = tb_global_create(m, "__cuik_profile_counters", TB_STORAGE_DATA, TB_LINKAGE_PRIVATE);
+    profile.names = NULL;
+    mtx_init(&profile.lock, mtx_plain);
+
+    TB_FunctionPrototype* proto = tb_prototype_create(m, TB_CDECL, TB_TYPE_VOID, 0, false);
+    profile.dump = tb_prototype_build(m, proto, "__cuik_profile_dump", TB_LINKAGE_PRIVATE);
+}
+
+static void irgen_profile_entry(TranslationUnit* tu, TB_Function* func, const char* name) {
+    mtx_lock(&profile.lock);
+    size_t index = arrlen(profile.names);
+    arrput(profile.names, strdup(name));
+    mtx_unlock(&profile.lock);
+
+    TB_Register slot = tb_inst_member_access(func, tb_inst_get_global_address(func, profile.counters), index * sizeof(uint64_t));
+    tb_inst_atomic_add(func, slot, tb_inst_uint(func, TB_TYPE_I64, 1), TB_MEM_ORDER_RELAXED);
+
+    if (strcmp(name, "main") == 0) {
+        TB_Register dump = tb_inst_get_func_address(func, profile.dump);
+        tb_inst_ecall(func, TB_TYPE_I32, tb_extern_create(tu->ir_mod, "atexit"), 1, &dump);
+    }
+}
+
+CUIK_API TB_Function* cuik_finish_profile_instrumentation(TB_Module* m, const char* profile_path) {
+    assert(profile.module == m && "cuik_begin_profile_instrumentation wasn't called on this module");
+
+    size_t count = arrlen(profile.names);
+    size_t names_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        names_size += strlen(profile.names[i]) + 1;
+    }
+
+    // counters start zeroed
+    size_t counters_size = (count ? count : 1) * sizeof(uint64_t);
+    TB_InitializerID init = tb_initializer_create(m, counters_size, sizeof(uint64_t), 1);
+    memset(tb_initializer_add_region(m, init, 0, counters_size), 0, counters_size);
+    tb_global_set_initializer(m, profile.counters, init);
+
+    // the header and names are written out as is before the counters
+    Cuik_ProfileHeader header = { CUIK_PROFILE_MAGIC, count, names_size };
+    size_t record_size = sizeof(header) + names_size;
+
+    TB_GlobalID record = tb_global_create(m, "__cuik_profile_record", TB_STORAGE_DATA, TB_LINKAGE_PRIVATE);
+    init = tb_initializer_create(m, record_size, 8, 1);
+
+    char* dst = tb_initializer_add_region(m, init, 0, record_size);
+    memcpy(dst, &header, sizeof(header));
+    dst += sizeof(header);
+    for (size_t i = 0; i < count; i++) {
+        size_t length = strlen(profile.names[i]) + 1;
+        memcpy(dst, profile.names[i], length);
+        dst += length;
+
+        free(profile.names[i]);
+    }
+    tb_global_set_initializer(m, record, init);
+
+    // void __cuik_profile_dump(void) {
+    //     FILE* file = fopen(profile_path, "ab");
+    //     if (file != NULL) {
+    //         fwrite(&record, 1, record_size, file);
+    //         fwrite(&counters, 8, count, file);
+    //         fclose(file);
+    //     }
+    // }
+    TB_Function* func = profile.dump;
+    TB_Label write_label = tb_inst_new_label_id(func);
+    TB_Label exit_label = tb_inst_new_label_id(func);
+
+    TB_Register open_args[2] = { tb_inst_cstring(func, profile_path), tb_inst_cstring(func, "ab") };
+    TB_Register file = tb_inst_ecall(func, TB_TYPE_PTR, tb_extern_create(m, "fopen"), 2, open_args);
+    tb_inst_if(func, tb_inst_cmp_ne(func, file, tb_inst_ptr(func, 0)), write_label, exit_label);
+
+    tb_inst_label(func, write_label);
+    {
+        TB_ExternalID fwrite_extern = tb_extern_create(m, "fwrite");
+
+        TB_Register record_args[4] = {
+            tb_inst_get_global_address(func, record),
+            tb_inst_uint(func, TB_TYPE_I64, 1), tb_inst_uint(func, TB_TYPE_I64, record_size), file
+        };
+        tb_inst_ecall(func, TB_TYPE_I64, fwrite_extern, 4, record_args);
+
+        TB_Register counter_args[4] = {
+            tb_inst_get_global_address(func, profile.counters),
+            tb_inst_uint(func, TB_TYPE_I64, sizeof(uint64_t)), tb_inst_uint(func, TB_TYPE_I64, count), file
+        };
+        tb_inst_ecall(func, TB_TYPE_I64, fwrite_extern, 4, counter_args);
+
+        tb_inst_ecall(func, TB_TYPE_I32, tb_extern_create(m, "fclose"), 1, &file);
+        tb_inst_goto(func, exit_label);
+    }
+
+    tb_inst_label(func, exit_label);
+    tb_inst_ret(func, TB_NULL_REG);
+
+    arrfree(profile.names);
+    mtx_destroy(&profile.lock);
+    profile.module = NULL;
+    profile.dump = NULL;
+    return func;
+}
+
 static TB_Function* gen_func_body(TranslationUnit* tu, Cuik_Type* type, Stmt* restrict s) {
     // Clear TLS
     tls_init();
@@ -1941,6 +2057,10 @@ static TB_Function* gen_func_body(TranslationUnit* tu, Cuik_Type* type, Stmt* re
         }
     }
 
+    if (profile.module == tu->ir_mod) {
+        irgen_profile_entry(tu, func, (const char*)s->decl.name);
+    }
+
     // compile body
     {
         function_type = type;
@@ -1981,6 +2101,15 @@ CUIK_API TB_Function* cuik_stmt_gen_ir(TranslationUnit* restrict tu, Stmt* restr
             if (!s->decl.attrs.is_used) return NULL;
         }
 
+        // sema already built a TB function for it and the object writer numbers
+        // the symbols as if every function in the module got compiled, so instead of
+        // skipping it we give it a body that's just a return.
+        if (s->decl.attrs.is_unreachable) {
+            TB_Function* func = tb_function_from_id(tu->ir_mod, s->backing.f);
+            tb_inst_ret(func, TB_NULL_REG);
+            return func;
+        }
+
         return gen_func_body(tu, type, s);
     } else if (s->op == STMT_DECL || s->op == STMT_GLOBAL_DECL) {
         if (s->decl.name == NULL     ||
@@ -1991,10 +2120,12 @@ CUIK_API TB_Function* cuik_stmt_gen_ir(TranslationUnit* restrict tu, Stmt* restr
             return NULL;
         }
 
+        // nobody can see an unreachable global but it's already in the module, it's
+        // left zeroed so it doesn't refer to any of the functions we've skipped.
         TB_GlobalID global = s->backing.g;
         TB_InitializerID init = gen_global_initializer(tu, s->loc,
             s->decl.type,
-            s->decl.initial,
+            s->decl.attrs.is_unreachable ? NULL : s->decl.initial,
             s->decl.name);
 
         tb_global_set_initializer(tu->ir_mod, global, init);
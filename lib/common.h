@@ -65,6 +65,16 @@ void tls_restore(void* p);
 void* cuik__valloc(size_t sz);
 void cuik__vfree(void* p, size_t sz);
 
+// Splits [0, count) into ranges of roughly equal cost, about 4 per thread so the
+// work stealing has some room to even out bad guesses. Ranges are at least min_cost
+// (except the last one) so tiny inputs don't get chopped into tiny tasks. Returns
+// the exclusive end of each range (free it when you're done).
+typedef uint64_t Cuik_CostFn(void* ctx, size_t i);
+size_t* cuik__split_work(size_t count, int thread_count, uint64_t min_cost, Cuik_CostFn* cost_fn, void* ctx, size_t* out_count);
+
+// estimated cost of a top level statement, ctx is the Stmt** array
+uint64_t cuik__stmt_cost(void* ctx, size_t i);
+
 inline static bool cstr_equals(const unsigned char* str1, const unsigned char* str2) {
     return strcmp((const char*)str1, (const char*)str2) == 0;
 }
@@ -1,10 +1,183 @@
 #include "compilation_unit.h"
 #include <timer.h>
+#include <stdatomic.h>
+
+// Exported symbols
+//
+// When the backend is pipelined IR gen looks these up from every thread while other TUs
+// are still being linked in, so it's an insert-only open addressing table where readers
+// never take the lock. Writers still hold the CU lock and when it gets too full they
+// publish a copy twice the size, the old copies live until the CU is destroyed.
+#define EXPORT_TABLE_INIT_EXP 10
+
+static size_t export_hash(Atom name) {
+    // atoms are interned so the pointer is the identity
+    uint64_t x = (uintptr_t) name;
+    x ^= x >> 33, x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return x;
+}
+
+static ExportTable* export_table_create(size_t exp, ExportTable* prev) {
+    size_t cap = (size_t)1 << exp;
+    ExportTable* table = calloc(1, sizeof(ExportTable) + cap * sizeof(table->entries[0]));
+    table->prev = prev;
+    table->exp = exp;
+    return table;
+}
+
+// returns false if it was a new key, the table must have room for it
+static bool export_table_insert(ExportTable* table, Atom name, Stmt* s) {
+    size_t mask = ((size_t)1 << table->exp) - 1;
+    for (size_t i = export_hash(name) & mask;; i = (i + 1) & mask) {
+        Atom key = atomic_load_explicit(&table->entries[i].key, memory_order_relaxed);
+
+        if (key == name) {
+            // later definitions win (like hmput)
+            atomic_store_explicit(&table->entries[i].value, s, memory_order_release);
+            return true;
+        } else if (key == NULL) {
+            // the value needs to be visible by the time anyone can find the key
+            atomic_store_explicit(&table->entries[i].value, s, memory_order_relaxed);
+            atomic_store_explicit(&table->entries[i].key, name, memory_order_release);
+            table->count++;
+            return false;
+        }
+    }
+}
+
+// must hold the CU lock
+static void export_put(CompilationUnit* restrict cu, Atom name, Stmt* s) {
+    ExportTable* table = atomic_load_explicit(&cu->export_table, memory_order_relaxed);
+    if (table == NULL) {
+        table = export_table_create(EXPORT_TABLE_INIT_EXP, NULL);
+        atomic_store_explicit(&cu->export_table, table, memory_order_release);
+    } else if ((table->count + 1) * 4 > ((size_t)3 << table->exp)) {
+        // 75% full, readers can keep using the old one until we publish
+        ExportTable* bigger = export_table_create(table->exp + 1, table);
+        size_t cap = (size_t)1 << table->exp;
+        for (size_t i = 0; i < cap; i++) {
+            Atom key = atomic_load_explicit(&table->entries[i].key, memory_order_relaxed);
+            if (key != NULL) {
+                export_table_insert(bigger, key, atomic_load_explicit(&table->entries[i].value, memory_order_relaxed));
+            }
+        }
+
+        atomic_store_explicit(&cu->export_table, bigger, memory_order_release);
+        table = bigger;
+    }
+
+    export_table_insert(table, name, s);
+}
+
+Stmt* cuik__find_export(CompilationUnit* restrict cu, Atom name) {
+    ExportTable* table = atomic_load_explicit(&cu->export_table, memory_order_acquire);
+    if (table == NULL) {
+        return NULL;
+    }
+
+    size_t mask = ((size_t)1 << table->exp) - 1;
+    for (size_t i = export_hash(name) & mask;; i = (i + 1) & mask) {
+        Atom key = atomic_load_explicit(&table->entries[i].key, memory_order_acquire);
+
+        if (key == name) {
+            return atomic_load_explicit(&table->entries[i].value, memory_order_acquire);
+        } else if (key == NULL) {
+            return NULL;
+        }
+    }
+}
+
+// Constant pool
+//
+// The TUs in a compilation unit share a module so identical literals (__FILE__ and format
+// strings mostly) can share a single private global. It's keyed by the bytes and the
+// alignment and split into shards so IR gen threads rarely fight over a lock.
+#define CONST_POOL_SHARDS 64
+
+typedef struct ConstPoolEntry {
+    struct ConstPoolEntry* next;
+
+    size_t length, align;
+    TB_GlobalID global;
+    char data[];
+} ConstPoolEntry;
+
+typedef struct {
+    uint64_t key;
+    ConstPoolEntry* value;
+} ConstPoolBucket;
+
+typedef struct {
+    mtx_t lock;
+
+    // hash -> chain of entries which share it
+    ConstPoolBucket* table;
+} ConstPoolShard;
+
+struct ConstPool {
+    atomic_size_t id_gen;
+    ConstPoolShard shards[CONST_POOL_SHARDS];
+};
+
+static uint64_t const_pool_hash(size_t length, size_t align, const void* data) {
+    uint64_t hash = 0xcbf29ce484222325ull ^ (align * 0x9E3779B97F4A7C15ull);
+
+    const uint8_t* p = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+TB_GlobalID cuik__intern_constant(CompilationUnit* restrict cu, TB_Module* m, size_t length, size_t align, const void* data) {
+    struct ConstPool* pool = cu->const_pool;
+    uint64_t hash = const_pool_hash(length, align, data);
+
+    // the top bits pick the shard since the low ones pick the bucket
+    ConstPoolShard* shard = &pool->shards[hash >> 58];
+    mtx_lock(&shard->lock);
+
+    ConstPoolEntry* head = hmget(shard->table, hash);
+    for (ConstPoolEntry* e = head; e != NULL; e = e->next) {
+        if (e->length == length && e->align == align && memcmp(e->data, data, length) == 0) {
+            mtx_unlock(&shard->lock);
+            return e->global;
+        }
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "str@%zu", atomic_fetch_add(&pool->id_gen, 1));
+
+    TB_InitializerID init = tb_initializer_create(m, length, align, 1);
+    memcpy(tb_initializer_add_region(m, init, 0, length), data, length);
+
+    TB_GlobalID global = tb_global_create(m, name, TB_STORAGE_DATA, TB_LINKAGE_PRIVATE);
+    tb_global_set_initializer(m, global, init);
+
+    ConstPoolEntry* e = malloc(sizeof(ConstPoolEntry) + length);
+    e->next = head;
+    e->length = length;
+    e->align = align;
+    e->global = global;
+    memcpy(e->data, data, length);
+    hmput(shard->table, hash, e);
+
+    mtx_unlock(&shard->lock);
+    return global;
+}
 
 CUIK_API void cuik_create_compilation_unit(CompilationUnit* restrict cu) {
     *cu = (CompilationUnit){0};
     cu->lock = malloc(sizeof(mtx_t));
     mtx_init((mtx_t*) cu->lock, mtx_plain);
+
+    cu->const_pool = calloc(1, sizeof(struct ConstPool));
+    for (size_t i = 0; i < CONST_POOL_SHARDS; i++) {
+        mtx_init(&cu->const_pool->shards[i].lock, mtx_plain);
+    }
 }
 
 CUIK_API void cuik_lock_compilation_unit(CompilationUnit* restrict cu) {
@@ -37,37 +210,155 @@ CUIK_API void cuik_destroy_compilation_unit(CompilationUnit* restrict cu) {
         tu = next;
     }
 
+    ExportTable* table = atomic_load_explicit(&cu->export_table, memory_order_relaxed);
+    while (table != NULL) {
+        ExportTable* prev = table->prev;
+        free(table);
+        table = prev;
+    }
+
+    for (size_t i = 0; i < CONST_POOL_SHARDS; i++) {
+        ConstPoolBucket* buckets = cu->const_pool->shards[i].table;
+        for (size_t j = 0, count = hmlen(buckets); j < count; j++) {
+            ConstPoolEntry* e = buckets[j].value;
+            while (e != NULL) {
+                ConstPoolEntry* next = e->next;
+                free(e);
+                e = next;
+            }
+        }
+
+        hmfree(buckets);
+        mtx_destroy(&cu->const_pool->shards[i].lock);
+    }
+    free(cu->const_pool);
+
     mtx_destroy((mtx_t*) cu->lock);
     free(cu->lock);
     *cu = (CompilationUnit){0};
 }
 
+CUIK_API void cuik_internal_link_translation_unit(CompilationUnit* restrict cu, TranslationUnit* restrict tu) {
+    cuik_lock_compilation_unit(cu);
+
+    size_t count = arrlen(tu->top_level_stmts);
+    for (size_t i = 0; i < count; i++) {
+        Stmt* s = tu->top_level_stmts[i];
+
+        if (s->op == STMT_FUNC_DECL) {
+            if (!s->decl.attrs.is_static &&
+                !s->decl.attrs.is_inline) {
+                //printf("Export! %s (Function: %d)\n", s->decl.name, s->backing.f);
+
+                export_put(cu, s->decl.name, s);
+            }
+        } else if (s->op == STMT_GLOBAL_DECL ||
+            s->op == STMT_DECL) {
+            if (!s->decl.attrs.is_static &&
+                !s->decl.attrs.is_extern &&
+                !s->decl.attrs.is_typedef &&
+                !s->decl.attrs.is_inline &&
+                s->decl.initial != 0) {
+                //printf("Export! %s (Global: %d)\n", s->decl.name, s->backing.g);
+
+                export_put(cu, s->decl.name, s);
+            }
+        }
+    }
+
+    cuik_unlock_compilation_unit(cu);
+}
+
 CUIK_API void cuik_internal_link_compilation_unit(CompilationUnit* restrict cu) {
+    FOR_EACH_TU(tu, cu) {
+        cuik_internal_link_translation_unit(cu, tu);
+    }
+}
+
+CUIK_API bool cuik_stmt_has_pending_link(TranslationUnit* restrict tu, Stmt* restrict s) {
+    CompilationUnit* restrict cu = tu->parent;
+    if (cu == NULL || s->op != STMT_FUNC_DECL) {
+        return false;
+    }
+
+    bool pending = false;
+    for (Expr* sym = s->decl.first_symbol; sym != NULL && !pending; sym = sym->next_symbol_in_chain) {
+        if (sym->op != EXPR_SYMBOL || sym->symbol->op != STMT_GLOBAL_DECL) continue;
+
+        // same check as the IR gen uses to decide if something is external
+        Stmt* restrict decl = sym->symbol;
+        bool is_external_sym = (decl->decl.type->kind == KIND_FUNC && decl->decl.initial_as_stmt == NULL);
+        if (decl->decl.attrs.is_extern) is_external_sym = true;
+
+        if (is_external_sym && atomic_load_explicit((_Atomic(TB_ExternalID)*) &decl->backing.e, memory_order_relaxed) == 0 &&
+            cuik__find_export(cu, decl->decl.name) == NULL) {
+            pending = true;
+        }
+    }
+
+    return pending;
+}
+
+static bool is_entrypoint(Stmt* restrict s) {
+    static const char* names[] = { "main", "wmain", "WinMain", "wWinMain" };
+
+    if (s->op != STMT_FUNC_DECL || s->decl.name == NULL || s->decl.attrs.is_static) {
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp((const char*) s->decl.name, names[i]) == 0) return true;
+    }
+
+    return false;
+}
+
+static void reach(Stmt*** stack, Stmt* restrict s) {
+    if (s->decl.attrs.is_unreachable) {
+        s->decl.attrs.is_unreachable = false;
+        arrput(*stack, s);
+    }
+}
+
+CUIK_API void cuik_mark_reachable_compilation_unit(CompilationUnit* restrict cu) {
+    // everything starts off unreachable, local declarations never get the flag so
+    // the walk treats them like they've already been visited (their uses are part
+    // of the function's symbol chain anyways)
     FOR_EACH_TU(tu, cu) {
         size_t count = arrlen(tu->top_level_stmts);
+        for (size_t i = 0; i < count; i++) {
+            tu->top_level_stmts[i]->decl.attrs.is_unreachable = true;
+        }
+    }
 
+    Stmt** stack = NULL;
+    FOR_EACH_TU(tu, cu) {
+        size_t count = arrlen(tu->top_level_stmts);
         for (size_t i = 0; i < count; i++) {
-            Stmt* s = tu->top_level_stmts[i];
-
-            if (s->op == STMT_FUNC_DECL) {
-                if (!s->decl.attrs.is_static &&
-                    !s->decl.attrs.is_inline) {
-                    //printf("Export! %s (Function: %d)\n", s->decl.name, s->backing.f);
-
-                    shput(cu->export_table, s->decl.name, s);
-                }
-            } else if (s->op == STMT_GLOBAL_DECL ||
-                s->op == STMT_DECL) {
-                if (!s->decl.attrs.is_static &&
-                    !s->decl.attrs.is_extern &&
-                    !s->decl.attrs.is_typedef &&
-                    !s->decl.attrs.is_inline &&
-                    s->decl.initial != 0) {
-                    //printf("Export! %s (Global: %d)\n", s->decl.name, s->backing.g);
-
-                    shput(cu->export_table, s->decl.name, s);
-                }
+            if (is_entrypoint(tu->top_level_stmts[i])) reach(&stack, tu->top_level_stmts[i]);
+        }
+    }
+
+    while (arrlen(stack) > 0) {
+        Stmt* restrict s = arrpop(stack);
+
+        for (Expr* sym = s->decl.first_symbol; sym != NULL; sym = sym->next_symbol_in_chain) {
+            if (sym->op != EXPR_SYMBOL) continue;
+
+            Stmt* restrict target = sym->symbol;
+            if (target->op != STMT_FUNC_DECL && target->op != STMT_DECL && target->op != STMT_GLOBAL_DECL) {
+                continue;
+            }
+
+            // declarations might be defined in another TU, same lookup as the IR gen
+            if (target->op == STMT_GLOBAL_DECL && target->decl.name != NULL) {
+                Stmt* def = cuik__find_export(cu, target->decl.name);
+                if (def != NULL) reach(&stack, def);
             }
+
+            reach(&stack, target);
         }
     }
+
+    arrfree(stack);
 }
@@ -3,3 +3,10 @@
 #include <cuik.h>
 #include <threads.h>
 #include <front/parser.h>
+
+// returns a private global holding the bytes, identical constants (same bytes and
+// alignment) from anywhere in the compilation unit share the same one.
+TB_GlobalID cuik__intern_constant(CompilationUnit* restrict cu, TB_Module* m, size_t length, size_t align, const void* data);
+
+// lock-free, can be called while other TUs are being linked in
+Stmt* cuik__find_export(CompilationUnit* restrict cu, Atom name);
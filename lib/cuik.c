@@ -1,6 +1,7 @@
 #include <cuik.h>
 
 #include "settings.h"
+#include <stb_ds.h>
 #include "targets/targets.h"
 #include "timer.h"
 
@@ -242,9 +243,8 @@ static void set_defines(Cuik_CPP* cpp, const Cuik_Target* target, bool system_li
     }
 }
 
-CUIK_API TokenStream cuik_preprocess_simple(
-    Cuik_CPP* restrict out_cpp, const char* filepath,
-    const Cuik_IFileSystem* fs, const Cuik_Target* target,
+CUIK_API void cuik_init_preprocessor(
+    Cuik_CPP* restrict out_cpp, const Cuik_IFileSystem* fs, const Cuik_Target* target,
     bool system_includes, size_t include_count, const char* includes[]
 ) {
     // defaults
@@ -257,7 +257,14 @@ CUIK_API TokenStream cuik_preprocess_simple(
     for (size_t i = 0; i < include_count; i++) {
         cuikpp_add_include_directory(out_cpp, includes[i]);
     }
+}
 
+CUIK_API TokenStream cuik_preprocess_simple(
+    Cuik_CPP* restrict out_cpp, const char* filepath,
+    const Cuik_IFileSystem* fs, const Cuik_Target* target,
+    bool system_includes, size_t include_count, const char* includes[]
+) {
+    cuik_init_preprocessor(out_cpp, fs, target, system_includes, include_count, includes);
     return cuikpp_run(out_cpp, filepath);
 }
 
@@ -270,6 +277,91 @@ CUIK_API void cuik_visit_top_level(TranslationUnit* restrict tu, void* user_data
     }
 }
 
+#define TASKS_PER_THREAD 4
+#define VISITOR_MIN_TASK_COST 4096
+
+size_t* cuik__split_work(size_t count, int thread_count, uint64_t min_cost, Cuik_CostFn* cost_fn, void* ctx, size_t* out_count) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += cost_fn(ctx, i);
+    }
+
+    size_t target_tasks = (thread_count > 0 ? thread_count : 1) * TASKS_PER_THREAD;
+    uint64_t target = (total + target_tasks - 1) / target_tasks;
+    if (target < min_cost) target = min_cost;
+
+    // every range but the last costs at least the target so we
+    // can't make more than target_tasks + 1 of them
+    size_t* ends = malloc((target_tasks + 1) * sizeof(size_t));
+    size_t n = 0;
+
+    uint64_t acc = 0;
+    for (size_t i = 0; i < count; i++) {
+        acc += cost_fn(ctx, i);
+
+        if (acc >= target) {
+            ends[n++] = i + 1;
+            acc = 0;
+        }
+    }
+
+    if (n == 0 || ends[n - 1] != count) {
+        ends[n++] = count;
+    }
+
+    *out_count = n;
+    return ends;
+}
+
+CUIK_API size_t cuik_stmt_get_cost(Stmt* restrict s) {
+    // unreachable functions are skipped so they're basically free
+    return s->op == STMT_FUNC_DECL && !s->decl.attrs.is_unreachable ? 1 + s->decl.body_tokens : 1;
+}
+
+CUIK_API void cuik_set_compile_tier(Cuik_CompileTier tier) {
+    settings.tier = tier;
+}
+
+CUIK_API Cuik_CompileTier cuik_get_compile_tier(void) {
+    return settings.tier;
+}
+
+CUIK_API void cuik_add_hot_function(const char* name) {
+    if (settings.hot_functions == NULL) {
+        sh_new_strdup(settings.hot_functions);
+    }
+
+    shput(settings.hot_functions, name, 0);
+}
+
+CUIK_API void cuik_clear_hot_functions(void) {
+    shfree(settings.hot_functions);
+}
+
+CUIK_API bool cuik_stmt_is_hot(Stmt* restrict s) {
+    if (s->op != STMT_FUNC_DECL) {
+        return false;
+    }
+
+    return s->decl.attrs.is_hot || (settings.hot_functions != NULL && shgeti(settings.hot_functions, (const char*) s->decl.name) >= 0);
+}
+
+CUIK_API TB_ISelMode cuik_stmt_get_isel_mode(Stmt* restrict s) {
+    // the stubs --gc leaves behind aren't worth anything more
+    if (s->decl.attrs.is_unreachable) return TB_ISEL_FAST;
+
+    switch (settings.tier) {
+        case CUIK_TIER_RELEASE: return TB_ISEL_COMPLEX;
+        case CUIK_TIER_HYBRID: return cuik_stmt_is_hot(s) ? TB_ISEL_COMPLEX : TB_ISEL_FAST;
+        default: return TB_ISEL_FAST;
+    }
+}
+
+uint64_t cuik__stmt_cost(void* ctx, size_t i) {
+    Stmt** stmts = ctx;
+    return cuik_stmt_get_cost(stmts[i]);
+}
+
 static void task_caller(void* arg) {
     TaskInfo task = *((TaskInfo*)arg);
     free(arg);
@@ -281,49 +373,73 @@ static void task_caller(void* arg) {
     }
 }
 
-CUIK_API void cuik_visit_top_level_threaded(TranslationUnit* restrict tu, const Cuik_IThreadpool* thread_pool, int batch_size, void* user_data, Cuik_TopLevelVisitor* visitor) {
+CUIK_API void cuik_visit_top_level_threaded(TranslationUnit* restrict tu, const Cuik_IThreadpool* thread_pool, void* user_data, Cuik_TopLevelVisitor* visitor) {
     assert(thread_pool != NULL);
-    assert((batch_size & (batch_size-1)) == 0);
 
-    // split up the top level statement tasks into
-    // chunks to avoid spawning too many tiny tasks
+    // split up the top level statement tasks into chunks of about
+    // the same amount of work, each function costs about as much as
+    // it has tokens.
     size_t count = arrlen(tu->top_level_stmts);
-    size_t padded = (count + (batch_size - 1)) & ~(batch_size - 1);
+    if (count == 0) return;
 
-    for (size_t i = 0; i < padded; i += batch_size) {
-        size_t limit = i + batch_size;
-        if (limit > count) limit = count;
+    size_t task_count;
+    size_t* ends = cuik__split_work(count, thread_pool->thread_count, VISITOR_MIN_TASK_COST, cuik__stmt_cost, tu->top_level_stmts, &task_count);
 
+    for (size_t j = 0; j < task_count; j++) {
         TaskInfo* t = malloc(sizeof(TaskInfo));
-        *t = (TaskInfo){tu, visitor, user_data, i, limit};
-        CUIK_CALL(thread_pool, submit, task_caller, t);
+        *t = (TaskInfo){tu, visitor, user_data, j ? ends[j - 1] : 0, ends[j]};
+        CUIK_CALL(thread_pool, submit, NULL, task_caller, t);
     }
+
+    free(ends);
 }
 
 CUIK_API Cuik_Entrypoint cuik_get_entrypoint_status(TranslationUnit* restrict tu) {
     return tu->entrypoint_status;
 }
 
+CUIK_API SourceLoc cuik_get_location(TokenStream* restrict s, SourceLocIndex loc) {
+    if (SOURCE_LOC_GET_TYPE(loc) != SOURCE_LOC_FILE) {
+        return s->locations[SOURCE_LOC_GET_DATA(loc)];
+    }
+
+    // find the last run which starts at or before us
+    uint32_t i = SOURCE_LOC_GET_DATA(loc);
+    size_t lo = 0, hi = arrlen(s->file_runs);
+    assert(hi > 0 && s->file_runs[0].first <= i);
+
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (s->file_runs[mid].first <= i) lo = mid;
+        else hi = mid;
+    }
+
+    uint32_t packed = s->file_locs[i];
+    return (SourceLoc){
+        .line = s->file_runs[lo].line,
+        .columns = packed & ((1u << FILE_LOC_COLUMN_BITS) - 1),
+        .length = packed >> FILE_LOC_COLUMN_BITS,
+    };
+}
+
 CUIK_API const char* cuik_get_location_file(TokenStream* restrict s, SourceLocIndex loc) {
-    SourceLoc* l = &s->locations[SOURCE_LOC_GET_DATA(loc)];
-    return l->line->filepath;
+    return cuik_get_location(s, loc).line->filepath;
 }
 
 CUIK_API int cuik_get_location_line(TokenStream* restrict s, SourceLocIndex loc) {
-    SourceLoc* l = &s->locations[SOURCE_LOC_GET_DATA(loc)];
-    return l->line->line;
+    return cuik_get_location(s, loc).line->line;
 }
 
 CUIK_API TokenStream* cuik_get_token_stream_from_tu(TranslationUnit* restrict tu) {
     return &tu->tokens;
 }
 
-CUIK_API Token* cuik_get_tokens(TokenStream* restrict s) {
-    return &s->tokens[0];
+CUIK_API Token cuik_get_token(TokenStream* restrict s, size_t i) {
+    return tokens_at(s, i);
 }
 
 CUIK_API size_t cuik_get_token_count(TokenStream* restrict s) {
-    return arrlen(s->tokens);
+    return tokens_count(s);
 }
 
 #ifndef _WIN32
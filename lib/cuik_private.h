@@ -2,12 +2,12 @@
 // here...
 #include "big_array.h"
 
-#define SLOTS_PER_MACRO_BUCKET 1024
-#define MACRO_BUCKET_COUNT 1024
-
 #define THE_SHTUFFS_SIZE (16 << 20)
 
 typedef enum TknType TknType;
+
+// NOTE(NeGate): this is just a view of a single token, the token stream
+// itself doesn't store these (see TokenStream)
 typedef struct Token {
     int type /* TknType but GCC doesn't like incomplete enums */;
     SourceLocIndex location;
@@ -15,6 +15,18 @@ typedef struct Token {
     const unsigned char* end;
 } Token;
 
+// tokens read straight out of a file don't get a SourceLoc, their SOURCE_LOC_FILE
+// location is just the column & length packed into 32bits. The line is whichever
+// run it falls into, there's one of these every time the line changes.
+#define FILE_LOC_COLUMN_BITS 20
+#define FILE_LOC_LENGTH_BITS 12
+
+typedef struct FileLocRun {
+    // index of the first file location on this line
+    uint32_t first;
+    struct SourceLine* line;
+} FileLocRun;
+
 typedef struct PragmaOnceEntry {
     char* key;
     int value;
@@ -25,8 +37,34 @@ typedef struct IncludeOnceEntry {
     int value;
 } IncludeOnceEntry;
 
+// the controlling macro of a file which is entirely wrapped in an
+// #ifndef X ... #endif, we can skip reopening said file if X is still
+// defined by the time someone includes it again.
+typedef struct IncludeGuard {
+    const unsigned char* name;
+    size_t length;
+} IncludeGuard;
+
+typedef struct IncludeGuardEntry {
+    char* key;
+    IncludeGuard value;
+} IncludeGuardEntry;
+
 enum { CPP_MAX_SCOPE_DEPTH = 4096 };
 
+// a single #define, see cpp_symtab.h for the table itself
+typedef struct MacroEntry {
+    const unsigned char* key;
+    // set to 0 while the macro is being expanded so it can't be found
+    size_t key_length;
+
+    const unsigned char* value_start;
+    const unsigned char* value_end;
+    struct MacroBody* body;
+
+    SourceLocIndex loc;
+} MacroEntry;
+
 struct Cuik_CPP {
     // used to store macro expansion results
     size_t the_shtuffs_size;
@@ -37,22 +75,50 @@ struct Cuik_CPP {
     // hashmap
     IncludeOnceEntry* include_once;
 
+    // hashmap (multiple-include optimization)
+    IncludeGuardEntry* include_guards;
+
     // system libraries
     char** system_include_dirs;
 
+    // identifies the include search order, 0 if it needs to be recomputed
+    uint64_t include_dirs_signature;
+
+    // include resolution stats (reported to the profiler)
+    size_t include_cache_hits, include_cache_misses;
+
+    // preprocessed ahead of the main file, if the pch path is set
+    // it'll be cached there (see cpp_pch.h)
+    const char* prefix_header;
+    const char* prefix_pch_path;
+
+    // if set, the includes are speculatively loaded & resolved on it
+    const Cuik_IThreadpool* thread_pool;
+
+    // if set, cuikpp_run starts with the snapshot's tokens (see cpp_snapshot.h)
+    const struct Cuik_CPPSnapshot* snapshot;
+
+    // only counts the #includes in the main file, the first skip_includes are
+    // dropped since the snapshot already ran them and the file stops after
+    // stop_includes (that's how the snapshot is made, the locations of the
+    // directives go into include_locs). 0 turns them off.
+    size_t skip_includes, stop_includes;
+    SourceLocIndex* include_locs;
+
     DynArray(Cuik_FileEntry) files;
 
     // how deep into directive scopes (#if, #ifndef, #ifdef) is it
     int depth;
     struct SourceLine* current_source_line;
 
-    // TODO(NeGate): Remove this and put a proper hash map or literally anything else
-    const unsigned char** macro_bucket_keys;
-    size_t* macro_bucket_keys_length;
-    const unsigned char** macro_bucket_values_start;
-    const unsigned char** macro_bucket_values_end;
-    SourceLocIndex* macro_bucket_source_locs;
-    int macro_bucket_count[MACRO_BUCKET_COUNT];
+    // open addressing hash table, each slot has a tag byte which is either
+    // 7 bits of the hash or marks it as empty/deleted (see cpp_symtab.h).
+    size_t macro_capacity;
+    size_t macro_count;
+    // live entries + tombstones, it's what decides when we rehash
+    size_t macro_used;
+    uint8_t* macro_tags;
+    MacroEntry* macros;
 
     // tells you if the current scope has had an entry evaluated,
     // this is important for choosing when to check #elif and #endif
@@ -62,12 +128,22 @@ struct Cuik_CPP {
 struct TokenStream {
     const char* filepath;
 
-    // stb_ds array
-    struct Token* tokens;
+    // the tokens are stored as a structure of arrays (18 bytes per token instead
+    // of 24), the parser mostly just checks the types so those are packed tightly
+    // and the rest is only touched when it needs the text or location. Use the
+    // tokens_* helpers in lexer.h instead of poking at these directly.
+    size_t count, capacity;
+    uint16_t* types;
+    SourceLocIndex* token_locs;
+    const unsigned char** starts;
+    uint32_t* lengths;
+
     size_t current;
 
-    // stb_ds array
+    // stb_ds arrays, use cuik_get_location to read them
     struct SourceLoc* locations;
+    uint32_t* file_locs;
+    FileLocRun* file_runs;
 };
 
 struct Cuik_Linker {
@@ -93,10 +169,17 @@ struct Cuik_Linker {
     size_t libpaths_count;
 };
 
-typedef struct {
-    Atom key;
-    Stmt* value;
-} ExportedSymbolEntry;
+// insert-only hash table (see compilation_unit.c), readers don't lock
+typedef struct ExportTable {
+    // the smaller copy this one replaced, someone might still be reading it
+    struct ExportTable* prev;
+
+    size_t exp, count;
+    struct {
+        _Atomic(Atom) key;
+        _Atomic(Stmt*) value;
+    } entries[];
+} ExportTable;
 
 struct CompilationUnit {
     // avoid exposing the mtx_t since it's messy
@@ -104,7 +187,10 @@ struct CompilationUnit {
 
     // anything extern might map to a different translation unit within
     // the same compilation unit which means it's not technically external
-    ExportedSymbolEntry* export_table;
+    _Atomic(ExportTable*) export_table;
+
+    // identical string literals from every TU share one global (see compilation_unit.c)
+    struct ConstPool* const_pool;
 
     // linked list of all TUs referenced
     TranslationUnit* head;
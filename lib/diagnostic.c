@@ -9,7 +9,7 @@
 #include <windows.h>
 #endif
 
-#define GET_SOURCE_LOC(loc) (&tokens->locations[SOURCE_LOC_GET_DATA(loc)])
+#define GET_SOURCE_LOC(loc) cuik_get_location(tokens, loc)
 
 static const char* report_names[] = {
     "verbose",
@@ -69,29 +69,29 @@ static void print_level_name(Cuik_ReportLevel level) {
 }
 
 static SourceLocIndex try_for_nicer_loc(TokenStream* tokens, SourceLocIndex loci) {
-    const SourceLoc* loc = GET_SOURCE_LOC(loci);
+    SourceLoc loc = GET_SOURCE_LOC(loci);
 
-    while (loc->line->filepath[0] == '<' && loc->line->parent != 0) {
-        loci = loc->line->parent;
+    while (loc.line->filepath[0] == '<' && loc.line->parent != 0) {
+        loci = loc.line->parent;
         loc = GET_SOURCE_LOC(loci);
     }
 
     return loci;
 }
 
-static void display_line(Cuik_ReportLevel level, TokenStream* tokens, SourceLoc* loc) {
+static void display_line(Cuik_ReportLevel level, TokenStream* tokens, SourceLoc loc) {
     SourceLocIndex loci = 0;
-    while (loc->line->filepath[0] == '<' && loc->line->parent != 0) {
-        loci = loc->line->parent;
+    while (loc.line->filepath[0] == '<' && loc.line->parent != 0) {
+        loci = loc.line->parent;
         loc = GET_SOURCE_LOC(loci);
     }
 
     if (report_using_thin_errors) {
-        printf("%s:%d:%d: ", loc->line->filepath, loc->line->line, loc->columns);
+        printf("%s:%d:%d: ", loc.line->filepath, loc.line->line, loc.columns);
         print_level_name(level);
     } else {
         print_level_name(level);
-        printf("%s:%d:%d: ", loc->line->filepath, loc->line->line, loc->columns);
+        printf("%s:%d:%d: ", loc.line->filepath, loc.line->line, loc.columns);
     }
 }
 
@@ -125,7 +125,7 @@ static void tally_report_counter(Cuik_ReportLevel level, Cuik_ErrorStatus* err)
 }
 
 static size_t draw_line(TokenStream* tokens, SourceLocIndex loc_index) {
-    SourceLine* line = GET_SOURCE_LOC(loc_index)->line;
+    SourceLine* line = GET_SOURCE_LOC(loc_index).line;
 
     // display line
     const char* line_start = (const char*)line->line_str;
@@ -153,32 +153,32 @@ static void draw_line_horizontal_pad() {
 }
 
 static SourceLoc merge_source_locations(TokenStream* tokens, SourceLocIndex starti, SourceLocIndex endi) {
-    SourceLine* line = GET_SOURCE_LOC(starti)->line;
+    SourceLine* line = GET_SOURCE_LOC(starti).line;
 
     starti = try_for_nicer_loc(tokens, starti);
     endi = try_for_nicer_loc(tokens, endi);
 
-    const SourceLoc* start = GET_SOURCE_LOC(starti);
-    const SourceLoc* end = GET_SOURCE_LOC(endi);
+    SourceLoc start = GET_SOURCE_LOC(starti);
+    SourceLoc end = GET_SOURCE_LOC(endi);
 
-    if (start->line->filepath != end->line->filepath &&
-        start->line->line != end->line->line) {
-        return *start;
+    if (start.line->filepath != end.line->filepath &&
+        start.line->line != end.line->line) {
+        return start;
     }
 
     // We can only merge if it's on the same line... for now...
-    size_t start_columns = start->columns;
-    size_t end_columns = end->columns + end->length;
+    size_t start_columns = start.columns;
+    size_t end_columns = end.columns + end.length;
     if (start_columns >= end_columns) {
-        return *start;
+        return start;
     }
 
     return (SourceLoc){line, start_columns, end_columns - start_columns};
 }
 
 static int print_backtrace(TokenStream* tokens, SourceLocIndex loc_index, SourceLine* kid) {
-    SourceLoc* loc = GET_SOURCE_LOC(loc_index);
-    SourceLine* line = loc->line;
+    SourceLoc loc = GET_SOURCE_LOC(loc_index);
+    SourceLine* line = loc.line;
 
     int line_bias = 0;
     if (line->parent != 0) {
@@ -188,9 +188,9 @@ static int print_backtrace(TokenStream* tokens, SourceLocIndex loc_index, Source
     switch (SOURCE_LOC_GET_TYPE(loc_index)) {
         case SOURCE_LOC_MACRO: {
             if (line->filepath[0] == '<') {
-                printf("In macro '%.*s' expanded at line %d:\n", (int)loc->length, line->line_str + loc->columns, line_bias + line->line);
+                printf("In macro '%.*s' expanded at line %d:\n", (int)loc.length, line->line_str + loc.columns, line_bias + line->line);
             } else {
-                printf("In macro '%.*s' expanded at %s:%d:%d:\n", (int)loc->length, line->line_str + loc->columns, line->filepath, line->line, loc->columns);
+                printf("In macro '%.*s' expanded at %s:%d:%d:\n", (int)loc.length, line->line_str + loc.columns, line->filepath, line->line, loc.columns);
             }
 
             if (!report_using_thin_errors) {
@@ -203,10 +203,10 @@ static int print_backtrace(TokenStream* tokens, SourceLocIndex loc_index, Source
                 #endif
 
                 // idk man
-                size_t start_pos = loc->columns > dist_from_line_start ? loc->columns - dist_from_line_start : 0;
+                size_t start_pos = loc.columns > dist_from_line_start ? loc.columns - dist_from_line_start : 0;
 
                 // draw underline
-                size_t tkn_len = loc->length;
+                size_t tkn_len = loc.length;
                 for (size_t i = 0; i < start_pos; i++) printf(" ");
                 printf("^");
                 for (size_t i = 1; i < tkn_len; i++) printf("~");
@@ -233,7 +233,7 @@ void report_ranged(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream* t
         print_backtrace(tokens, loc.line->parent, loc.line);
     }
 
-    display_line(level, tokens, &loc);
+    display_line(level, tokens, loc);
 
     va_list ap;
     va_start(ap, fmt);
@@ -271,11 +271,11 @@ void report_ranged(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream* t
 }
 
 void report(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream* tokens, SourceLocIndex loc_index, const char* fmt, ...) {
-    SourceLoc* loc = GET_SOURCE_LOC(loc_index);
+    SourceLoc loc = GET_SOURCE_LOC(loc_index);
 
     mtx_lock(&report_mutex);
-    if (!report_using_thin_errors && loc->line->parent != 0) {
-        print_backtrace(tokens, loc->line->parent, loc->line);
+    if (!report_using_thin_errors && loc.line->parent != 0) {
+        print_backtrace(tokens, loc.line->parent, loc.line);
     }
 
     display_line(level, tokens, loc);
@@ -296,10 +296,10 @@ void report(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream* tokens,
         #endif
 
         // idk man
-        size_t start_pos = loc->columns > dist_from_line_start ? loc->columns - dist_from_line_start : 0;
+        size_t start_pos = loc.columns > dist_from_line_start ? loc.columns - dist_from_line_start : 0;
 
         // draw underline
-        size_t tkn_len = loc->length;
+        size_t tkn_len = loc.length;
         for (size_t i = 0; i < start_pos; i++) printf(" ");
         printf("^");
         for (size_t i = 1; i < tkn_len; i++) printf("~");
@@ -317,11 +317,11 @@ void report(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream* tokens,
 }
 
 void report_fix(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream* tokens, SourceLocIndex loc_index, const char* tip, const char* fmt, ...) {
-    SourceLoc* loc = GET_SOURCE_LOC(loc_index);
+    SourceLoc loc = GET_SOURCE_LOC(loc_index);
 
     mtx_lock(&report_mutex);
-    if (!report_using_thin_errors && loc->line->parent != 0) {
-        print_backtrace(tokens, loc->line->parent, loc->line);
+    if (!report_using_thin_errors && loc.line->parent != 0) {
+        print_backtrace(tokens, loc.line->parent, loc.line);
     }
 
     display_line(level, tokens, loc);
@@ -342,10 +342,10 @@ void report_fix(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream* toke
         #endif
 
         // idk man
-        size_t start_pos = loc->columns > dist_from_line_start ? loc->columns - dist_from_line_start : 0;
+        size_t start_pos = loc.columns > dist_from_line_start ? loc.columns - dist_from_line_start : 0;
 
         // one after the token
-        start_pos += loc->length;
+        start_pos += loc.length;
 
         // draw underline
         for (size_t i = 0; i < start_pos; i++) printf(" ");
@@ -368,13 +368,13 @@ void report_fix(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream* toke
 }
 
 void report_two_spots(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream* tokens, SourceLocIndex loc_index, SourceLocIndex loc2_index, const char* msg, const char* loc_msg, const char* loc_msg2, const char* interjection) {
-    SourceLoc* loc = GET_SOURCE_LOC(loc_index);
-    SourceLoc* loc2 = GET_SOURCE_LOC(loc2_index);
+    SourceLoc loc = GET_SOURCE_LOC(loc_index);
+    SourceLoc loc2 = GET_SOURCE_LOC(loc2_index);
 
     mtx_lock(&report_mutex);
 
-    if (!interjection && loc->line->line == loc2->line->line) {
-        assert(loc->columns < loc2->columns);
+    if (!interjection && loc.line->line == loc2.line->line) {
+        assert(loc.columns < loc2.columns);
 
         display_line(level, tokens, loc);
         printf("%s\n", msg);
@@ -388,11 +388,11 @@ void report_two_spots(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream
             #endif
 
             // draw underline
-            size_t first_start_pos = loc->columns > dist_from_line_start ? loc->columns - dist_from_line_start : 0;
-            size_t first_end_pos = first_start_pos + loc->length;
+            size_t first_start_pos = loc.columns > dist_from_line_start ? loc.columns - dist_from_line_start : 0;
+            size_t first_end_pos = first_start_pos + loc.length;
 
-            size_t second_start_pos = loc2->columns > dist_from_line_start ? loc2->columns - dist_from_line_start : 0;
-            size_t second_end_pos = second_start_pos + loc2->length;
+            size_t second_start_pos = loc2.columns > dist_from_line_start ? loc2.columns - dist_from_line_start : 0;
+            size_t second_end_pos = second_start_pos + loc2.length;
 
             // First
             for (size_t i = 0; i < first_start_pos; i++) printf(" ");
@@ -434,9 +434,9 @@ void report_two_spots(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream
                 #endif
 
                 // draw underline
-                size_t start_pos = loc->columns > dist_from_line_start ? loc->columns - dist_from_line_start : 0;
+                size_t start_pos = loc.columns > dist_from_line_start ? loc.columns - dist_from_line_start : 0;
 
-                size_t tkn_len = loc->length;
+                size_t tkn_len = loc.length;
                 for (size_t i = 0; i < start_pos; i++) printf(" ");
                 printf("^");
                 for (size_t i = 1; i < tkn_len; i++) printf("~");
@@ -453,8 +453,8 @@ void report_two_spots(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream
                 }
             }
 
-            if (loc->line->filepath != loc2->line->filepath) {
-                printf("  meanwhile in... %s\n", loc2->line->filepath);
+            if (loc.line->filepath != loc2.line->filepath) {
+                printf("  meanwhile in... %s\n", loc2.line->filepath);
                 draw_line_horizontal_pad();
                 printf("\n");
             }
@@ -477,10 +477,10 @@ void report_two_spots(Cuik_ReportLevel level, Cuik_ErrorStatus* err, TokenStream
                 #endif
 
                 // draw underline
-                size_t start_pos = loc2->columns > dist_from_line_start
-                    ? loc2->columns - dist_from_line_start : 0;
+                size_t start_pos = loc2.columns > dist_from_line_start
+                    ? loc2.columns - dist_from_line_start : 0;
 
-                size_t tkn_len = loc2->length;
+                size_t tkn_len = loc2.length;
                 for (size_t i = 0; i < start_pos; i++) printf(" ");
                 printf("^");
                 for (size_t i = 1; i < tkn_len; i++) printf("~");
@@ -560,9 +560,9 @@ void ast_dump_type(TranslationUnit* tu, Cuik_Type* ty, int depth, int offset) {
             ty->record.name ? (char*)ty->record.name : "<unnamed>");
 
         if (ty->loc) {
-            SourceLoc* loc = &tu->tokens.locations[ty->loc];
+            SourceLoc loc = cuik_get_location(&tu->tokens, ty->loc);
 
-            printf("// %s:%d\n", loc->line->filepath, loc->line->line);
+            printf("// %s:%d\n", loc.line->filepath, loc.line->line);
         } else {
             printf("\n");
         }
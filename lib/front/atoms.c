@@ -1,18 +1,128 @@
 #include "atoms.h"
+#include <threads.h>
 
-thread_local static Arena atoms_arena;
+// The table is split into shards (picked by the top bits of the hash) each with
+// its own lock, the parser threads are mostly hammering on different names so
+// they rarely fight over one.
+#define ATOM_SHARD_BITS 6
+#define ATOM_SHARD_COUNT (1u << ATOM_SHARD_BITS)
+#define ATOM_SHARD_INITIAL_CAP 256
+
+typedef struct AtomSlot {
+    uint32_t hash;
+    uint32_t length;
+    Atom str;
+} AtomSlot;
+
+typedef struct AtomShard {
+    mtx_t lock;
+
+    // open addressing (linear probing), always a power of two
+    size_t count, capacity;
+    AtomSlot* slots;
+} AtomShard;
+
+static once_flag atoms_once = ONCE_FLAG_INIT;
+static AtomShard atom_shards[ATOM_SHARD_COUNT];
+
+// the string storage is shared by all shards
+static mtx_t atoms_arena_lock;
+static Arena atoms_arena;
+
+static void atoms_init_once(void) {
+    mtx_init(&atoms_arena_lock, mtx_plain);
+
+    for (size_t i = 0; i < ATOM_SHARD_COUNT; i++) {
+        mtx_init(&atom_shards[i].lock, mtx_plain);
+    }
+}
+
+static uint32_t atoms_hash(size_t len, const unsigned char* str) {
+    uint32_t hash = 0x811c9dc5;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint32_t)str[i];
+        hash *= 0x01000193; // 32bit magic shit
+    }
+
+    return hash;
+}
+
+static void atoms_grow(AtomShard* shard) {
+    size_t new_cap = shard->capacity ? shard->capacity * 2 : ATOM_SHARD_INITIAL_CAP;
+    AtomSlot* new_slots = calloc(new_cap, sizeof(AtomSlot));
+    if (new_slots == NULL) {
+        printf("error: atom table is out of memory!\n");
+        abort();
+    }
+
+    size_t mask = new_cap - 1;
+    for (size_t i = 0; i < shard->capacity; i++) {
+        AtomSlot slot = shard->slots[i];
+        if (slot.str == NULL) continue;
+
+        size_t j = slot.hash & mask;
+        while (new_slots[j].str != NULL) j = (j + 1) & mask;
+        new_slots[j] = slot;
+    }
+
+    free(shard->slots);
+    shard->slots = new_slots;
+    shard->capacity = new_cap;
+}
 
 void atoms_init() {
+    call_once(&atoms_once, atoms_init_once);
 }
+
 void atoms_deinit() {
-    arena_free(&atoms_arena);
+    // NOTE(NeGate): atoms are shared between every translation unit (the
+    // compilation unit links symbols by them) so they stay alive.
 }
 
 Atom atoms_put(size_t len, const unsigned char* str) {
-    Atom newstr = arena_alloc(&atoms_arena, len + 1, 1);
-    memcpy(newstr, str, len);
-    newstr[len] = 0;
-    return newstr;
+    call_once(&atoms_once, atoms_init_once);
+    assert(len <= UINT32_MAX);
+
+    uint32_t hash = atoms_hash(len, str);
+    AtomShard* shard = &atom_shards[hash >> (32 - ATOM_SHARD_BITS)];
+
+    mtx_lock(&shard->lock);
+
+    // keep the load factor under 1/2
+    if ((shard->count + 1) * 2 > shard->capacity) {
+        atoms_grow(shard);
+    }
+
+    size_t mask = shard->capacity - 1;
+    size_t i = hash & mask;
+    for (;;) {
+        AtomSlot* slot = &shard->slots[i];
+
+        if (slot->str == NULL) {
+            // insert new atom
+            mtx_lock(&atoms_arena_lock);
+            Atom newstr = arena_alloc(&atoms_arena, len + 1, 1);
+            mtx_unlock(&atoms_arena_lock);
+
+            memcpy(newstr, str, len);
+            newstr[len] = 0;
+
+            *slot = (AtomSlot){ hash, len, newstr };
+            shard->count += 1;
+
+            mtx_unlock(&shard->lock);
+            return newstr;
+        }
+
+        if (slot->hash == hash && slot->length == len && memcmp(slot->str, str, len) == 0) {
+            Atom result = slot->str;
+            mtx_unlock(&shard->lock);
+            return result;
+        }
+
+        i = (i + 1) & mask;
+    }
 }
 
 Atom atoms_putc(const unsigned char* str) {
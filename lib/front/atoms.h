@@ -2,6 +2,10 @@
 #include "arena.h"
 #include "common.h"
 
+// Atoms are interned strings, equal names always give back the same pointer
+// so you can compare them with == and hash them by address. They're still
+// null terminated so they work as normal C strings and live until the process
+// exits (every translation unit shares the same table).
 typedef unsigned char* Atom;
 
 void atoms_init();
@@ -1,33 +1,58 @@
 ////////////////////////////////
 // TYPES
 ////////////////////////////////
-static bool parse_attributes(TranslationUnit* restrict tu, TokenStream* restrict s, Stmt* restrict n) {
-    if (tokens_get(s)->type == TOKEN_KW_attribute ||
-        tokens_get(s)->type == TOKEN_KW_asm) {
-        tokens_next(s);
-        expect(s, '(');
+// skips over the parenthesized body of an __attribute__ or asm label, picking out
+// the few attributes we care about along the way
+static void parse_attribute_body(TokenStream* restrict s, Attribs* attr) {
+    expect(s, '(');
+
+    // TODO(NeGate): Correctly parse the rest of the attributes
+    // instead of ignoring them.
+    int depth = 1;
+    while (depth) {
+        Token t = tokens_get(s);
+        if (t.type == '(') {
+            depth++;
+        } else if (t.type == ')') {
+            depth--;
+        } else if (attr != NULL && depth == 2 && t.type == TOKEN_IDENTIFIER) {
+            size_t len = t.end - t.start;
+            if ((len == 3 && memcmp(t.start, "hot", 3) == 0) || (len == 7 && memcmp(t.start, "__hot__", 7) == 0)) {
+                attr->is_hot = true;
+            }
+        }
 
-        // TODO(NeGate): Correctly parse attributes instead of
-        // ignoring them.
-        int depth = 1;
-        while (depth) {
-            if (tokens_get(s)->type == '(')
-                depth++;
-            else if (tokens_get(s)->type == ')')
-                depth--;
+        tokens_next(s);
+    }
+}
 
-            tokens_next(s);
-        }
+static bool parse_attributes(TranslationUnit* restrict tu, TokenStream* restrict s, Stmt* restrict n) {
+    if (tokens_get_type(s) == TOKEN_KW_attribute ||
+        tokens_get_type(s) == TOKEN_KW_asm) {
+        bool is_attribute = tokens_get_type(s) == TOKEN_KW_attribute;
+        tokens_next(s);
 
+        parse_attribute_body(s, is_attribute && n != NULL ? &n->decl.attrs : NULL);
         return true;
     }
 
     return false;
 }
 
+// statement attributes like __attribute__((fallthrough)); don't mean anything to us
+// yet, they're just a null statement
+static void skip_statement_attributes(TokenStream* restrict s) {
+    while (tokens_get_type(s) == TOKEN_KW_attribute) {
+        tokens_next(s);
+        parse_attribute_body(s, NULL);
+    }
+
+    expect(s, ';');
+}
+
 static bool skip_over_declspec(TokenStream* restrict s) {
-    if (tokens_get(s)->type == TOKEN_KW_declspec ||
-        tokens_get(s)->type == TOKEN_KW_Pragma) {
+    if (tokens_get_type(s) == TOKEN_KW_declspec ||
+        tokens_get_type(s) == TOKEN_KW_Pragma) {
         tokens_next(s);
         expect(s, '(');
 
@@ -35,9 +60,9 @@ static bool skip_over_declspec(TokenStream* restrict s) {
         // ignoring them.
         int depth = 1;
         while (depth) {
-            if (tokens_get(s)->type == '(')
+            if (tokens_get_type(s) == '(')
                 depth++;
-            else if (tokens_get(s)->type == ')')
+            else if (tokens_get_type(s) == ')')
                 depth--;
 
             tokens_next(s);
@@ -55,7 +80,7 @@ static Decl parse_declarator(TranslationUnit* tu, TokenStream* restrict s, Cuik_
     // handle calling convention
     // TODO(NeGate): Actually pass these to the AST
     parse_another_qualifier2 : {
-        switch (tokens_get(s)->type) {
+        switch (tokens_get_type(s)) {
             case TOKEN_KW_cdecl:
             case TOKEN_KW_stdcall:
             tokens_next(s);
@@ -66,12 +91,12 @@ static Decl parse_declarator(TranslationUnit* tu, TokenStream* restrict s, Cuik_
     }
 
     // handle pointers
-    while (tokens_get(s)->type == '*') {
+    while (tokens_get_type(s) == '*') {
         type = type ? new_pointer(tu, type) : 0;
         tokens_next(s);
 
         parse_another_qualifier : {
-            switch (tokens_get(s)->type) {
+            switch (tokens_get_type(s)) {
                 case TOKEN_KW_Atomic: {
                     type->is_atomic = true;
                     tokens_next(s);
@@ -99,7 +124,7 @@ static Decl parse_declarator(TranslationUnit* tu, TokenStream* restrict s, Cuik_
 
     skip_over_declspec(s);
 
-    bool is_nested_declarator = tokens_get(s)->type == '(';
+    bool is_nested_declarator = tokens_get_type(s) == '(';
 
     // disambiguate
     if (!out_of_order_mode && is_nested_declarator && is_abstract) {
@@ -161,10 +186,10 @@ static Decl parse_declarator(TranslationUnit* tu, TokenStream* restrict s, Cuik_
     }
 
     Atom name = NULL;
-    Token* t = tokens_get(s);
+    Token t = tokens_get(s);
     SourceLocIndex loc = tokens_get_location_index(s);
-    if (!is_abstract && t->type == TOKEN_IDENTIFIER) {
-        name = atoms_put(t->end - t->start, t->start);
+    if (!is_abstract && t.type == TOKEN_IDENTIFIER) {
+        name = atoms_put(t.end - t.start, t.start);
         tokens_next(s);
     }
 
@@ -185,7 +210,7 @@ static Cuik_Type* parse_type_suffix(TranslationUnit* tu, TokenStream* restrict s
     SourceLocIndex loc = tokens_get_last_location_index(s);
 
     // type suffixes like array [] and function ()
-    if (tokens_get(s)->type == '(') {
+    if (tokens_get_type(s) == '(') {
         tokens_next(s);
 
         Cuik_Type* return_type = type;
@@ -194,7 +219,7 @@ static Cuik_Type* parse_type_suffix(TranslationUnit* tu, TokenStream* restrict s
         type->func.name = name;
         type->func.return_type = return_type;
 
-        if (tokens_get(s)->type == TOKEN_KW_void && tokens_peek(s)->type == ')') {
+        if (tokens_get_type(s) == TOKEN_KW_void && tokens_peek(s).type == ')') {
             tokens_next(s);
             tokens_next(s);
 
@@ -207,9 +232,9 @@ static Cuik_Type* parse_type_suffix(TranslationUnit* tu, TokenStream* restrict s
         void* params = tls_save();
         bool has_varargs = false;
 
-        while (tokens_get(s)->type != ')') {
+        while (tokens_get_type(s) != ')') {
             if (param_count) {
-                if (tokens_get(s)->type != ',') {
+                if (tokens_get_type(s) != ',') {
                     tokens_prev(s);
                     SourceLocIndex loc = tokens_get_last_location_index(s);
 
@@ -220,7 +245,7 @@ static Cuik_Type* parse_type_suffix(TranslationUnit* tu, TokenStream* restrict s
                 tokens_next(s);
             }
 
-            if (tokens_get(s)->type == TOKEN_TRIPLE_DOT) {
+            if (tokens_get_type(s) == TOKEN_TRIPLE_DOT) {
                 tokens_next(s);
 
                 has_varargs = true;
@@ -248,7 +273,7 @@ static Cuik_Type* parse_type_suffix(TranslationUnit* tu, TokenStream* restrict s
             param_count++;
         }
 
-        if (tokens_get(s)->type != ')') {
+        if (tokens_get_type(s) != ')') {
             generic_error(s, "Unclosed parameter list!");
         }
         tokens_next(s);
@@ -262,16 +287,16 @@ static Cuik_Type* parse_type_suffix(TranslationUnit* tu, TokenStream* restrict s
         type->func.has_varargs = has_varargs;
 
         tls_restore(params);
-    } else if (tokens_get(s)->type == '[') {
+    } else if (tokens_get_type(s) == '[') {
         if (out_of_order_mode) {
             // in the out of order case we defer expression parsing
             SourceLocIndex open_brace = tokens_get_location_index(s);
             tokens_next(s);
 
             size_t current = 0;
-            if (tokens_get(s)->type == ']') {
+            if (tokens_get_type(s) == ']') {
                 tokens_next(s);
-            } else if (tokens_get(s)->type == '*') {
+            } else if (tokens_get_type(s) == '*') {
                 tokens_next(s);
                 expect(s, ']');
             } else {
@@ -279,16 +304,16 @@ static Cuik_Type* parse_type_suffix(TranslationUnit* tu, TokenStream* restrict s
 
                 int depth = 1;
                 while (depth) {
-                    Token* t = tokens_get(s);
+                    Token t = tokens_get(s);
 
-                    if (t->type == '\0') {
-                        REPORT(ERROR, t->location, "Array declaration ended in EOF");
+                    if (t.type == '\0') {
+                        REPORT(ERROR, t.location, "Array declaration ended in EOF");
                         abort();
-                    } else if (t->type == '[') {
+                    } else if (t.type == '[') {
                         depth++;
-                    } else if (t->type == ']') {
+                    } else if (t.type == ']') {
                         if (depth == 0) {
-                            report_two_spots(REPORT_ERROR, tu->errors, s, open_brace, t->location,
+                            report_two_spots(REPORT_ERROR, tu->errors, s, open_brace, t.location,
                                 "Unbalanced brackets", "open", "close?", NULL);
                             abort();
                         }
@@ -319,10 +344,10 @@ static Cuik_Type* parse_type_suffix(TranslationUnit* tu, TokenStream* restrict s
                 tokens_next(s);
 
                 long long count;
-                if (tokens_get(s)->type == ']') {
+                if (tokens_get_type(s) == ']') {
                     count = 0;
                     tokens_next(s);
-                } else if (tokens_get(s)->type == '*') {
+                } else if (tokens_get_type(s) == '*') {
                     count = 0;
                     tokens_next(s);
                     expect(s, ']');
@@ -333,7 +358,7 @@ static Cuik_Type* parse_type_suffix(TranslationUnit* tu, TokenStream* restrict s
 
                 tls_push(sizeof(size_t));
                 counts[depth++] = count;
-            } while (tokens_get(s)->type == '[');
+            } while (tokens_get_type(s) == '[');
 
             size_t expected_size = type->size;
             while (depth--) {
@@ -388,7 +413,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
     PendingExpr* alignas_pending_expr = NULL;
 
     do {
-        TknType tkn_type = tokens_get(s)->type;
+        TknType tkn_type = tokens_get_type(s);
         switch (tkn_type) {
             case TOKEN_KW_void:
             counter += VOID;
@@ -449,7 +474,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
 
             case TOKEN_KW_Complex:
             case TOKEN_KW_Imaginary: {
-                SourceLocIndex loc = tokens_get(s)->location;
+                SourceLocIndex loc = tokens_get(s).location;
                 REPORT(ERROR, loc, "Complex types are not supported in CuikC");
                 break;
             }
@@ -504,7 +529,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
             }
             case TOKEN_KW_Atomic: {
                 tokens_next(s);
-                if (tokens_get(s)->type == '(') {
+                if (tokens_get_type(s) == '(') {
                     SourceLocIndex opening_loc = tokens_get_location_index(s);
                     tokens_next(s);
 
@@ -513,7 +538,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                     is_atomic = true;
 
                     SourceLocIndex closing_loc = tokens_get_location_index(s);
-                    if (tokens_get(s)->type != ')') {
+                    if (tokens_get_type(s) != ')') {
                         report_two_spots(REPORT_ERROR, tu->errors, s, opening_loc, closing_loc, "expected closing parenthesis for _Atomic", "open", "close?", NULL);
                         return NULL;
                     }
@@ -536,7 +561,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                 SourceLocIndex loc = tokens_get_location_index(s);
 
                 tokens_next(s);
-                if (tokens_get(s)->type != '(') {
+                if (tokens_get_type(s) != '(') {
                     REPORT(ERROR, loc, "expected opening parenthesis for _Typeof");
                     return NULL;
                 }
@@ -565,7 +590,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                         type = new_typeof(tu, src);
                     }
 
-                    if (tokens_get(s)->type != ')') {
+                    if (tokens_get_type(s) != ')') {
                         REPORT(ERROR, loc, "expected closing parenthesis for _Typeof");
                         return NULL;
                     }
@@ -618,7 +643,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                         }
                     }
 
-                    if (tokens_get(s)->type != ')') {
+                    if (tokens_get_type(s) != ')') {
                         REPORT(ERROR, loc, "expected closing parenthesis for _Alignas");
                         return NULL;
                     }
@@ -626,6 +651,13 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                 break;
             }
 
+            case TOKEN_KW_attribute: {
+                tokens_next(s);
+                parse_attribute_body(s, attr);
+                tokens_prev(s);
+                break;
+            }
+
             case TOKEN_KW_declspec: {
                 // TODO(NeGate): Correctly parse declspec instead of
                 // ignoring them.
@@ -634,9 +666,9 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
 
                 int depth = 1;
                 while (depth) {
-                    if (tokens_get(s)->type == '(')
+                    if (tokens_get_type(s) == '(')
                         depth++;
-                    else if (tokens_get(s)->type == ')')
+                    else if (tokens_get_type(s) == ')')
                         depth--;
 
                     tokens_next(s);
@@ -659,19 +691,19 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                 }
 
                 Atom name = NULL;
-                if (tokens_get(s)->type == TOKEN_IDENTIFIER) {
+                if (tokens_get_type(s) == TOKEN_IDENTIFIER) {
                     record_loc = tokens_get_location_index(s);
 
-                    Token* t = tokens_get(s);
-                    name = atoms_put(t->end - t->start, t->start);
+                    Token t = tokens_get(s);
+                    name = atoms_put(t.end - t.start, t.start);
 
                     tokens_next(s);
                 }
 
-                if (tokens_get(s)->type == '{') {
+                if (tokens_get_type(s) == '{') {
                     tokens_next(s);
 
-                    type = name ? find_tag((char*)name) : 0;
+                    type = name ? find_tag(name) : 0;
                     if (type) {
                         // can't re-complete a struct
                         //assert(!type->is_incomplete);
@@ -684,7 +716,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                         // don't track it
                         if (name) {
                             if (out_of_order_mode) {
-                                shput(global_tags, name, type);
+                                hmput(global_tags, name, type);
                             } else {
                                 if (local_tag_count + 1 >= MAX_LOCAL_TAGS) {
                                     SourceLocIndex loc = tokens_get_location_index(s);
@@ -702,7 +734,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                     size_t member_count = 0;
                     Member* members = tls_save();
 
-                    while (tokens_get(s)->type != '}') {
+                    while (tokens_get_type(s) != '}') {
                         if (skip_over_declspec(s)) continue;
 
                         // in case we have unnamed declarators and we somewhere for them to point to
@@ -713,7 +745,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
 
                         // error recovery, if we couldn't parse the typename we skip the declaration
                         if (member_base_type == 0) {
-                            while (tokens_get(s)->type != ';') tokens_next(s);
+                            while (tokens_get_type(s) != ';') tokens_next(s);
 
                             tokens_next(s);
                             continue;
@@ -729,8 +761,8 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
 
                             // not all members have declarators for example
                             // char : 3; or struct { ... };
-                            if (tokens_get(s)->type != ';' &&
-                                tokens_get(s)->type != ':') {
+                            if (tokens_get_type(s) != ';' &&
+                                tokens_get_type(s) != ':') {
                                 decl = parse_declarator(tu, s, member_base_type, false, false);
                                 member_type = decl.type;
                             } else {
@@ -746,7 +778,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                                 .type = member_type,
                                 .name = decl.name};
 
-                            if (tokens_get(s)->type == ':') {
+                            if (tokens_get_type(s) == ':') {
                                 if (is_union) {
                                     REPORT(WARNING, tokens_get_location_index(s), "Bitfield... unions... huh?!");
                                 }
@@ -758,16 +790,16 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                             }
 
                             // i just wanted to logically split this from the top stuff, this is a breather comment
-                            if (tokens_get(s)->type == ',') {
+                            if (tokens_get_type(s) == ',') {
                                 tokens_next(s);
                                 continue;
-                            } else if (tokens_get(s)->type == ';') break;
+                            } else if (tokens_get_type(s) == ';') break;
                         } while (true);
 
                         expect(s, ';');
                     }
 
-                    if (tokens_get(s)->type != '}') {
+                    if (tokens_get_type(s) != '}') {
                         generic_error(s, "Unclosed member list!");
                     }
 
@@ -790,7 +822,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                     // TODO(NeGate): must be a forward decl, handle it
                     if (name == NULL) generic_error(s, "Cannot have unnamed forward struct reference.");
 
-                    type = find_tag((const char*)name);
+                    type = find_tag(name);
                     if (type == NULL) {
                         type = new_record(tu, is_union);
                         type->loc = record_loc;
@@ -798,7 +830,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                         type->is_incomplete = true;
 
                         if (out_of_order_mode) {
-                            shput(global_tags, name, type);
+                            hmput(global_tags, name, type);
                         } else {
                             if (local_tag_count + 1 >= MAX_LOCAL_TAGS) {
                                 SourceLocIndex loc = tokens_get_location_index(s);
@@ -822,17 +854,17 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                 if (counter) goto done;
                 tokens_next(s);
 
-                Token* t = tokens_get(s);
+                Token t = tokens_get(s);
                 Atom name = NULL;
-                if (tokens_get(s)->type == TOKEN_IDENTIFIER) {
-                    name = atoms_put(t->end - t->start, t->start);
+                if (tokens_get_type(s) == TOKEN_IDENTIFIER) {
+                    name = atoms_put(t.end - t.start, t.start);
                     tokens_next(s);
                 }
 
-                if (tokens_get(s)->type == '{') {
+                if (tokens_get_type(s) == '{') {
                     tokens_next(s);
 
-                    type = name ? find_tag((char*)name) : 0;
+                    type = name ? find_tag(name) : 0;
                     if (type) {
                         // can't re-complete a enum
                         // TODO(NeGate): error messages
@@ -847,7 +879,7 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
 
                         if (name) {
                             if (out_of_order_mode)
-                                shput(global_tags, name, type);
+                                hmput(global_tags, name, type);
                             else {
                                 if (local_tag_count + 1 >= MAX_LOCAL_TAGS) {
                                     SourceLocIndex loc = tokens_get_location_index(s);
@@ -876,18 +908,18 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                     type->enumerator.entries = start;
                     type->enumerator.count = 0;
 
-                    while (tokens_get(s)->type != '}') {
+                    while (tokens_get_type(s) != '}') {
                         // parse name
-                        Token* t = tokens_get(s);
-                        if (t->type != TOKEN_IDENTIFIER) {
+                        Token t = tokens_get(s);
+                        if (t.type != TOKEN_IDENTIFIER) {
                             generic_error(s, "expected identifier for enum name entry.");
                         }
 
-                        Atom name = atoms_put(t->end - t->start, t->start);
+                        Atom name = atoms_put(t.end - t.start, t.start);
                         tokens_next(s);
 
                         int lexer_pos = 0;
-                        if (tokens_get(s)->type == '=') {
+                        if (tokens_get_type(s) == '=') {
                             tokens_next(s);
 
                             if (out_of_order_mode) {
@@ -911,22 +943,22 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                         Symbol sym = {
                             .name = name,
                             .type = type,
-                            .loc = t->location,
+                            .loc = t.location,
                             .storage_class = STORAGE_ENUM,
                             .enum_value = count};
 
                         if (out_of_order_mode) {
-                            shput(global_symbols, name, sym);
+                            hmput(global_symbols, name, sym);
                         } else {
                             local_symbols[local_symbol_count++] = sym;
                             cursor += 1;
                         }
 
-                        if (tokens_get(s)->type == ',') tokens_next(s);
+                        if (tokens_get_type(s) == ',') tokens_next(s);
                         count += 1;
                     }
 
-                    if (tokens_get(s)->type != '}') {
+                    if (tokens_get_type(s) != '}') {
                         generic_error(s, "Unclosed enum list!");
                     }
 
@@ -946,14 +978,14 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                         type_layout(tu, type);
                     }
                 } else {
-                    type = find_tag((char*)name);
+                    type = find_tag(name);
                     if (!type) {
                         type = new_enum(tu);
                         type->record.name = name;
                         type->is_incomplete = true;
 
                         if (out_of_order_mode)
-                            shput(global_tags, name, type);
+                            hmput(global_tags, name, type);
                         else {
                             if (local_tag_count + 1 >= MAX_LOCAL_TAGS) {
                                 SourceLocIndex loc = tokens_get_location_index(s);
@@ -978,11 +1010,11 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                 if (counter) goto done;
 
                 if (out_of_order_mode) {
-                    Token* t = tokens_get(s);
-                    Atom name = atoms_put(t->end - t->start, t->start);
+                    Token t = tokens_get(s);
+                    Atom name = atoms_put(t.end - t.start, t.start);
 
                     // if the typename is already defined, then reuse that type index
-                    Symbol* sym = find_global_symbol((const char*)name);
+                    Symbol* sym = find_global_symbol(name);
                     // if not, we assume this must be a typedef'd type and reserve space
                     if (sym != NULL) {
                         if (sym->storage_class != STORAGE_TYPEDEF) {
@@ -1000,14 +1032,14 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                         Symbol sym = {
                             .name = name,
                             .type = new_blank_type(tu),
-                            .loc = t->location,
+                            .loc = t.location,
                             .storage_class = STORAGE_TYPEDEF};
                         type = sym.type;
-                        type->loc = t->location;
+                        type->loc = t.location;
                         type->placeholder.name = name;
                         counter += OTHER;
 
-                        shput(global_symbols, name, sym);
+                        hmput(global_symbols, name, sym);
                     }
 
                     break;
@@ -1019,10 +1051,10 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
                         break;
                     }
 
-                    Token* t = tokens_get(s);
-                    Atom name = atoms_put(t->end - t->start, t->start);
+                    Token t = tokens_get(s);
+                    Atom name = atoms_put(t.end - t.start, t.start);
 
-                    sym = find_global_symbol((const char*)name);
+                    sym = find_global_symbol(name);
                     if (sym != NULL && sym->storage_class == STORAGE_TYPEDEF) {
                         type = sym->type;
                         counter += OTHER;
@@ -1138,9 +1170,9 @@ static Cuik_Type* parse_declspec(TranslationUnit* tu, TokenStream* restrict s, A
 }
 
 static bool is_typename(TokenStream* restrict s) {
-    Token* t = tokens_get(s);
+    Token t = tokens_get(s);
 
-    switch (t->type) {
+    switch (t.type) {
         case TOKEN_KW_void:
         case TOKEN_KW_char:
         case TOKEN_KW_short:
@@ -1170,10 +1202,33 @@ static bool is_typename(TokenStream* restrict s) {
         case TOKEN_KW_Typeof:
         return true;
 
+        case TOKEN_KW_attribute: {
+            // it's only a declaration specifier if there's a type after it, otherwise
+            // it's a statement attribute like __attribute__((fallthrough));
+            size_t saved = s->current;
+            while (tokens_get_type(s) == TOKEN_KW_attribute) {
+                tokens_next(s);
+                if (tokens_get_type(s) != '(') break;
+                tokens_next(s);
+
+                int depth = 1;
+                while (depth && tokens_get_type(s) != '\0') {
+                    if (tokens_get_type(s) == '(') depth++;
+                    else if (tokens_get_type(s) == ')') depth--;
+
+                    tokens_next(s);
+                }
+            }
+
+            bool result = tokens_get_type(s) != TOKEN_KW_attribute && is_typename(s);
+            s->current = saved;
+            return result;
+        }
+
         case TOKEN_IDENTIFIER: {
             // good question...
-            Token* t = tokens_get(s);
-            Atom name = atoms_put(t->end - t->start, t->start);
+            Token t = tokens_get(s);
+            Atom name = atoms_put(t.end - t.start, t.start);
 
             Symbol* loc = find_local_symbol(s);
             if (loc != NULL) {
@@ -1190,7 +1245,7 @@ static bool is_typename(TokenStream* restrict s) {
                 return (loc->storage_class == STORAGE_TYPEDEF);
             }
 
-            Symbol* glob = find_global_symbol((const char*)name);
+            Symbol* glob = find_global_symbol(name);
             if (glob != NULL && glob->storage_class == STORAGE_TYPEDEF) return true;
 
             return false;
@@ -12,7 +12,7 @@ static Expr* parse_expr(TranslationUnit* tu, TokenStream* restrict s);
 
 static Expr* parse_function_literal(TranslationUnit* tu, TokenStream* restrict s, Cuik_Type* type) {
     // if the literal doesn't have a parameter list it will inherit from the `type`
-    if (tokens_get(s)->type == '(') {
+    if (tokens_get_type(s) == '(') {
         tokens_next(s);
 
         // this might break on typeof because it's fucking weird...
@@ -74,7 +74,7 @@ static void parse_initializer_member(TranslationUnit* tu, TokenStream* restrict
     // .identifier
     InitNode* current = NULL;
     try_again: {
-        if (tokens_get(s)->type == '[') {
+        if (tokens_get_type(s) == '[') {
             SourceLocIndex loc = tokens_get_location_index(s);
             tokens_next(s);
 
@@ -86,7 +86,7 @@ static void parse_initializer_member(TranslationUnit* tu, TokenStream* restrict
 
             // GNU-extension: array range initializer
             int count = 1;
-            if (tokens_get(s)->type == TOKEN_TRIPLE_DOT) {
+            if (tokens_get_type(s) == TOKEN_TRIPLE_DOT) {
                 tokens_next(s);
 
                 count = parse_const_expr(tu, s) - start;
@@ -108,12 +108,12 @@ static void parse_initializer_member(TranslationUnit* tu, TokenStream* restrict
             goto try_again;
         }
 
-        if (tokens_get(s)->type == '.') {
+        if (tokens_get_type(s) == '.') {
             tokens_next(s);
             SourceLocIndex loc = tokens_get_location_index(s);
 
-            Token* t = tokens_get(s);
-            Atom name = atoms_put(t->end - t->start, t->start);
+            Token t = tokens_get(s);
+            Atom name = atoms_put(t.end - t.start, t.start);
             tokens_next(s);
 
             current = (InitNode*)tls_push(sizeof(InitNode));
@@ -136,19 +136,19 @@ static void parse_initializer_member(TranslationUnit* tu, TokenStream* restrict
 
     // it can either be a normal expression
     // or a nested designated initializer
-    if (tokens_get(s)->type == '{') {
+    if (tokens_get_type(s) == '{') {
         tokens_next(s);
 
         size_t local_count = 0;
 
         // don't expect one the first time
         bool expect_comma = false;
-        while (tokens_get(s)->type != '}') {
+        while (tokens_get_type(s) != '}') {
             if (expect_comma) {
                 expect(s, ',');
 
                 // we allow for trailing commas like ballers do
-                if (tokens_get(s)->type == '}') break;
+                if (tokens_get_type(s) == '}') break;
             } else expect_comma = true;
 
             parse_initializer_member(tu, s);
@@ -172,11 +172,11 @@ static Expr* parse_initializer(TranslationUnit* tu, TokenStream* restrict s, Cui
 
     // don't expect one the first time
     bool expect_comma = false;
-    while (tokens_get(s)->type != '}') {
+    while (tokens_get_type(s) != '}') {
         if (expect_comma) {
             expect(s, ',');
 
-            if (tokens_get(s)->type == '}') break;
+            if (tokens_get_type(s) == '}') break;
         } else
             expect_comma = true;
 
@@ -201,9 +201,9 @@ static Expr* parse_initializer(TranslationUnit* tu, TokenStream* restrict s, Cui
 }
 
 static Expr* parse_expr_l0(TranslationUnit* tu, TokenStream* restrict s) {
-    Token* t = tokens_get(s);
+    Token t = tokens_get(s);
 
-    if (t->type == '(') {
+    if (t.type == '(') {
         SourceLocIndex start_loc = tokens_get_location_index(s);
         tokens_next(s);
 
@@ -220,10 +220,10 @@ static Expr* parse_expr_l0(TranslationUnit* tu, TokenStream* restrict s) {
     Expr* e = make_expr(tu);
     SourceLocIndex start_loc = tokens_get_location_index(s);
 
-    switch (t->type) {
+    switch (t.type) {
         case TOKEN_IDENTIFIER: {
-            const unsigned char* name = t->start;
-            size_t length = t->end - t->start;
+            const unsigned char* name = t.start;
+            size_t length = t.end - t.start;
 
             if (length == sizeof("__va_arg") - 1 && memcmp(name, "__va_arg", length) == 0) {
                 tokens_next(s);
@@ -262,8 +262,8 @@ static Expr* parse_expr_l0(TranslationUnit* tu, TokenStream* restrict s) {
                 }
             } else {
                 // We'll defer any global identifier resolution
-                Token* t = tokens_get(s);
-                Atom name = atoms_put(t->end - t->start, t->start);
+                Token t = tokens_get(s);
+                Atom name = atoms_put(t.end - t.start, t.start);
 
                 // check if it's builtin
                 ptrdiff_t temp;
@@ -274,7 +274,7 @@ static Expr* parse_expr_l0(TranslationUnit* tu, TokenStream* restrict s) {
                         .builtin_sym = {name},
                     };
                 } else {
-                    Symbol* symbol_search = find_global_symbol((const char*)name);
+                    Symbol* symbol_search = find_global_symbol(name);
                     if (symbol_search != NULL) {
                         if (symbol_search->storage_class == STORAGE_ENUM) {
                             *e = (Expr){
@@ -313,9 +313,9 @@ static Expr* parse_expr_l0(TranslationUnit* tu, TokenStream* restrict s) {
         }
 
         case TOKEN_FLOAT: {
-            Token* t = tokens_get(s);
-            bool is_float32 = t->end[-1] == 'f';
-            double i = parse_float(t->end - t->start, (const char*)t->start);
+            Token t = tokens_get(s);
+            bool is_float32 = t.end[-1] == 'f';
+            double i = parse_float(t.end - t.start, (const char*)t.start);
 
             *e = (Expr){
                 .op = is_float32 ? EXPR_FLOAT32 : EXPR_FLOAT64,
@@ -324,9 +324,9 @@ static Expr* parse_expr_l0(TranslationUnit* tu, TokenStream* restrict s) {
         }
 
         case TOKEN_INTEGER: {
-            Token* t = tokens_get(s);
+            Token t = tokens_get(s);
             Cuik_IntSuffix suffix;
-            uint64_t i = parse_int(t->end - t->start, (const char*)t->start, &suffix);
+            uint64_t i = parse_int(t.end - t.start, (const char*)t.start, &suffix);
 
             *e = (Expr){
                 .op = EXPR_INT,
@@ -336,14 +336,14 @@ static Expr* parse_expr_l0(TranslationUnit* tu, TokenStream* restrict s) {
 
         case TOKEN_STRING_SINGLE_QUOTE:
         case TOKEN_STRING_WIDE_SINGLE_QUOTE: {
-            Token* t = tokens_get(s);
+            Token t = tokens_get(s);
 
             int ch = 0;
-            intptr_t distance = parse_char((t->end - t->start) - 2, (const char*)&t->start[1], &ch);
+            intptr_t distance = parse_char((t.end - t.start) - 2, (const char*)&t.start[1], &ch);
             if (distance < 0) abort();
 
             *e = (Expr){
-                .op = t->type == TOKEN_STRING_SINGLE_QUOTE ? EXPR_CHAR : EXPR_WCHAR,
+                .op = t.type == TOKEN_STRING_SINGLE_QUOTE ? EXPR_CHAR : EXPR_WCHAR,
                 .char_lit = ch,
             };
             break;
@@ -351,26 +351,26 @@ static Expr* parse_expr_l0(TranslationUnit* tu, TokenStream* restrict s) {
 
         case TOKEN_STRING_DOUBLE_QUOTE:
         case TOKEN_STRING_WIDE_DOUBLE_QUOTE: {
-            Token* t = tokens_get(s);
-            bool is_wide = (tokens_get(s)->type == TOKEN_STRING_WIDE_DOUBLE_QUOTE);
+            Token t = tokens_get(s);
+            bool is_wide = (tokens_get_type(s) == TOKEN_STRING_WIDE_DOUBLE_QUOTE);
 
             *e = (Expr){
                 .op = is_wide ? EXPR_WSTR : EXPR_STR,
-                .str.start = t->start,
-                .str.end = t->end};
+                .str.start = t.start,
+                .str.end = t.end};
 
             size_t saved_lexer_pos = s->current;
             tokens_next(s);
 
-            if (tokens_get(s)->type == TOKEN_STRING_DOUBLE_QUOTE ||
-                tokens_get(s)->type == TOKEN_STRING_WIDE_DOUBLE_QUOTE) {
+            if (tokens_get_type(s) == TOKEN_STRING_DOUBLE_QUOTE ||
+                tokens_get_type(s) == TOKEN_STRING_WIDE_DOUBLE_QUOTE) {
                 // Precompute length
                 s->current = saved_lexer_pos;
-                size_t total_len = (t->end - t->start);
-                while (tokens_get(s)->type == TOKEN_STRING_DOUBLE_QUOTE ||
-                    tokens_get(s)->type == TOKEN_STRING_WIDE_DOUBLE_QUOTE) {
-                    Token* segment = tokens_get(s);
-                    total_len += (segment->end - segment->start) - 2;
+                size_t total_len = (t.end - t.start);
+                while (tokens_get_type(s) == TOKEN_STRING_DOUBLE_QUOTE ||
+                    tokens_get_type(s) == TOKEN_STRING_WIDE_DOUBLE_QUOTE) {
+                    Token segment = tokens_get(s);
+                    total_len += (segment.end - segment.start) - 2;
                     tokens_next(s);
                 }
 
@@ -381,12 +381,12 @@ static Expr* parse_expr_l0(TranslationUnit* tu, TokenStream* restrict s) {
 
                 // Fill up the buffer
                 s->current = saved_lexer_pos;
-                while (tokens_get(s)->type == TOKEN_STRING_DOUBLE_QUOTE ||
-                    tokens_get(s)->type == TOKEN_STRING_WIDE_DOUBLE_QUOTE) {
-                    Token* segment = tokens_get(s);
+                while (tokens_get_type(s) == TOKEN_STRING_DOUBLE_QUOTE ||
+                    tokens_get_type(s) == TOKEN_STRING_WIDE_DOUBLE_QUOTE) {
+                    Token segment = tokens_get(s);
 
-                    size_t len = segment->end - segment->start;
-                    memcpy(&buffer[curr], segment->start + 1, len - 2);
+                    size_t len = segment.end - segment.start;
+                    memcpy(&buffer[curr], segment.start + 1, len - 2);
                     curr += len - 2;
 
                     tokens_next(s);
@@ -421,8 +421,8 @@ static Expr* parse_expr_l0(TranslationUnit* tu, TokenStream* restrict s) {
             C11GenericEntry* entries = tls_save();
 
             SourceLocIndex default_loc = 0;
-            while (tokens_get(s)->type != ')') {
-                if (tokens_get(s)->type == TOKEN_KW_default) {
+            while (tokens_get_type(s) != ')') {
+                if (tokens_get_type(s) == TOKEN_KW_default) {
                     if (default_loc) {
                         report_two_spots(REPORT_ERROR, tu->errors, s,
                             default_loc, tokens_get_location_index(s),
@@ -458,7 +458,7 @@ static Expr* parse_expr_l0(TranslationUnit* tu, TokenStream* restrict s) {
                 }
 
                 // exit if it's not a comma
-                if (tokens_get(s)->type != ',') break;
+                if (tokens_get_type(s) != ',') break;
                 tokens_next(s);
             }
 
@@ -490,14 +490,14 @@ static Expr* parse_expr_l1(TranslationUnit* tu, TokenStream* restrict s) {
     SourceLocIndex start_loc = tokens_get_location_index(s);
 
     Expr* e = 0;
-    if (tokens_get(s)->type == '(') {
+    if (tokens_get_type(s) == '(') {
         tokens_next(s);
 
         if (is_typename(s)) {
             Cuik_Type* type = parse_typename(tu, s);
             expect(s, ')');
 
-            if (tokens_get(s)->type == '{') {
+            if (tokens_get_type(s) == '{') {
                 tokens_next(s);
 
                 e = parse_initializer(tu, s, type);
@@ -522,7 +522,7 @@ static Expr* parse_expr_l1(TranslationUnit* tu, TokenStream* restrict s) {
     // it'll restart and take a shot at matching another
     // piece of the expression.
     try_again : {
-        if (tokens_get(s)->type == '[') {
+        if (tokens_get_type(s) == '[') {
             Expr* base = e;
             e = make_expr(tu);
 
@@ -542,16 +542,16 @@ static Expr* parse_expr_l1(TranslationUnit* tu, TokenStream* restrict s) {
         }
 
         // Pointer member access
-        if (tokens_get(s)->type == TOKEN_ARROW) {
+        if (tokens_get_type(s) == TOKEN_ARROW) {
             tokens_next(s);
-            if (tokens_get(s)->type != TOKEN_IDENTIFIER) {
+            if (tokens_get_type(s) != TOKEN_IDENTIFIER) {
                 generic_error(s, "Expected identifier after member access a.b");
             }
 
             SourceLocIndex end_loc = tokens_get_location_index(s);
 
-            Token* t = tokens_get(s);
-            Atom name = atoms_put(t->end - t->start, t->start);
+            Token t = tokens_get(s);
+            Atom name = atoms_put(t.end - t.start, t.start);
 
             Expr* base = e;
             e = make_expr(tu);
@@ -566,16 +566,16 @@ static Expr* parse_expr_l1(TranslationUnit* tu, TokenStream* restrict s) {
         }
 
         // Member access
-        if (tokens_get(s)->type == '.') {
+        if (tokens_get_type(s) == '.') {
             tokens_next(s);
-            if (tokens_get(s)->type != TOKEN_IDENTIFIER) {
+            if (tokens_get_type(s) != TOKEN_IDENTIFIER) {
                 generic_error(s, "Expected identifier after member access a.b");
             }
 
             SourceLocIndex end_loc = tokens_get_location_index(s);
 
-            Token* t = tokens_get(s);
-            Atom name = atoms_put(t->end - t->start, t->start);
+            Token t = tokens_get(s);
+            Atom name = atoms_put(t.end - t.start, t.start);
 
             Expr* base = e;
             e = make_expr(tu);
@@ -590,7 +590,7 @@ static Expr* parse_expr_l1(TranslationUnit* tu, TokenStream* restrict s) {
         }
 
         // Function call
-        if (tokens_get(s)->type == '(') {
+        if (tokens_get_type(s) == '(') {
             tokens_next(s);
 
             Expr* target = e;
@@ -599,7 +599,7 @@ static Expr* parse_expr_l1(TranslationUnit* tu, TokenStream* restrict s) {
             size_t param_count = 0;
             void* params = tls_save();
 
-            while (tokens_get(s)->type != ')') {
+            while (tokens_get_type(s) != ')') {
                 if (param_count) {
                     expect(s, ',');
                 }
@@ -612,7 +612,7 @@ static Expr* parse_expr_l1(TranslationUnit* tu, TokenStream* restrict s) {
                 param_count++;
             }
 
-            if (tokens_get(s)->type != ')') {
+            if (tokens_get_type(s) != ')') {
                 generic_error(s, "Unclosed parameter list!");
             }
             tokens_next(s);
@@ -635,8 +635,8 @@ static Expr* parse_expr_l1(TranslationUnit* tu, TokenStream* restrict s) {
 
         // post fix, you can only put one and just after all the other operators
         // in this precendence.
-        if (tokens_get(s)->type == TOKEN_INCREMENT || tokens_get(s)->type == TOKEN_DECREMENT) {
-            bool is_inc = tokens_get(s)->type == TOKEN_INCREMENT;
+        if (tokens_get_type(s) == TOKEN_INCREMENT || tokens_get_type(s) == TOKEN_DECREMENT) {
+            bool is_inc = tokens_get_type(s) == TOKEN_INCREMENT;
             tokens_next(s);
 
             SourceLocIndex end_loc = tokens_get_last_location_index(s);
@@ -660,7 +660,7 @@ static Expr* parse_expr_l2(TranslationUnit* tu, TokenStream* restrict s) {
     // TODO(NeGate): just rewrite this in general...
     SourceLocIndex start_loc = tokens_get_location_index(s);
 
-    if (tokens_get(s)->type == '*') {
+    if (tokens_get_type(s) == '*') {
         tokens_next(s);
         Expr* value = parse_expr_l2(tu, s);
 
@@ -673,7 +673,7 @@ static Expr* parse_expr_l2(TranslationUnit* tu, TokenStream* restrict s) {
             .end_loc = end_loc,
             .unary_op.src = value};
         return e;
-    } else if (tokens_get(s)->type == '!') {
+    } else if (tokens_get_type(s) == '!') {
         tokens_next(s);
         Expr* value = parse_expr_l2(tu, s);
 
@@ -686,7 +686,7 @@ static Expr* parse_expr_l2(TranslationUnit* tu, TokenStream* restrict s) {
             .end_loc = end_loc,
             .unary_op.src = value};
         return e;
-    } else if (tokens_get(s)->type == TOKEN_DOUBLE_EXCLAMATION) {
+    } else if (tokens_get_type(s) == TOKEN_DOUBLE_EXCLAMATION) {
         tokens_next(s);
         Expr* value = parse_expr_l2(tu, s);
 
@@ -699,7 +699,7 @@ static Expr* parse_expr_l2(TranslationUnit* tu, TokenStream* restrict s) {
             .end_loc = end_loc,
             .cast = {&builtin_types[TYPE_BOOL], value}};
         return e;
-    } else if (tokens_get(s)->type == '-') {
+    } else if (tokens_get_type(s) == '-') {
         tokens_next(s);
         Expr* value = parse_expr_l2(tu, s);
 
@@ -712,7 +712,7 @@ static Expr* parse_expr_l2(TranslationUnit* tu, TokenStream* restrict s) {
             .end_loc = end_loc,
             .unary_op.src = value};
         return e;
-    } else if (tokens_get(s)->type == '~') {
+    } else if (tokens_get_type(s) == '~') {
         tokens_next(s);
         Expr* value = parse_expr_l2(tu, s);
 
@@ -725,10 +725,10 @@ static Expr* parse_expr_l2(TranslationUnit* tu, TokenStream* restrict s) {
             .end_loc = end_loc,
             .unary_op.src = value};
         return e;
-    } else if (tokens_get(s)->type == '+') {
+    } else if (tokens_get_type(s) == '+') {
         tokens_next(s);
         return parse_expr_l2(tu, s);
-    } else if (tokens_get(s)->type == TOKEN_INCREMENT) {
+    } else if (tokens_get_type(s) == TOKEN_INCREMENT) {
         tokens_next(s);
         Expr* value = parse_expr_l1(tu, s);
 
@@ -741,7 +741,7 @@ static Expr* parse_expr_l2(TranslationUnit* tu, TokenStream* restrict s) {
             .end_loc = end_loc,
             .unary_op.src = value};
         return e;
-    } else if (tokens_get(s)->type == TOKEN_DECREMENT) {
+    } else if (tokens_get_type(s) == TOKEN_DECREMENT) {
         tokens_next(s);
         Expr* value = parse_expr_l1(tu, s);
 
@@ -754,14 +754,14 @@ static Expr* parse_expr_l2(TranslationUnit* tu, TokenStream* restrict s) {
             .end_loc = end_loc,
             .unary_op.src = value};
         return e;
-    } else if (tokens_get(s)->type == TOKEN_KW_sizeof ||
-        tokens_get(s)->type == TOKEN_KW_Alignof) {
-        TknType operation_type = tokens_get(s)->type;
+    } else if (tokens_get_type(s) == TOKEN_KW_sizeof ||
+        tokens_get_type(s) == TOKEN_KW_Alignof) {
+        TknType operation_type = tokens_get_type(s);
         tokens_next(s);
 
         bool has_paren = false;
         SourceLocIndex opening_loc = 0;
-        if (tokens_get(s)->type == '(') {
+        if (tokens_get_type(s) == '(') {
             has_paren = true;
 
             opening_loc = tokens_get_location_index(s);
@@ -779,7 +779,7 @@ static Expr* parse_expr_l2(TranslationUnit* tu, TokenStream* restrict s) {
             // glorified backtracing on who own's the (
             // sizeof (int){ 0 } is a sizeof a compound list
             // not a sizeof(int) with a weird { 0 } laying around
-            if (tokens_get(s)->type == '{') {
+            if (tokens_get_type(s) == '{') {
                 tokens_next(s);
 
                 e = parse_initializer(tu, s, type);
@@ -810,7 +810,7 @@ static Expr* parse_expr_l2(TranslationUnit* tu, TokenStream* restrict s) {
         }
 
         return e;
-    } else if (tokens_get(s)->type == '&') {
+    } else if (tokens_get_type(s) == '&') {
         tokens_next(s);
         Expr* value = parse_expr_l1(tu, s);
 
@@ -884,7 +884,7 @@ static Expr* parse_expr_NEW(TranslationUnit* tu, TokenStream* restrict s, int mi
     TknType binop;
 
     // It's kinda weird but you don't have to read it because you're a bitch anyways
-    while (binop = tokens_get(s)->type,
+    while (binop = tokens_get_type(s),
         prec = get_precendence(binop),
         prec != 0 && prec >= min_prec) {
         tokens_next(s);
@@ -971,7 +971,7 @@ static Expr* parse_expr_l13(TranslationUnit* tu, TokenStream* restrict s) {
     SourceLocIndex start_loc = tokens_get_location_index(s);
     Expr* lhs = parse_expr_NEW(tu, s, 0);
 
-    if (tokens_get(s)->type == '?') {
+    if (tokens_get_type(s) == '?') {
         tokens_next(s);
 
         Expr* mhs = parse_expr(tu, s);
@@ -1001,21 +1001,21 @@ static Expr* parse_expr_l14(TranslationUnit* tu, TokenStream* restrict s) {
     SourceLocIndex start_loc = tokens_get_location_index(s);
     Expr* lhs = parse_expr_l13(tu, s);
 
-    if (tokens_get(s)->type == TOKEN_ASSIGN ||
-        tokens_get(s)->type == TOKEN_PLUS_EQUAL ||
-        tokens_get(s)->type == TOKEN_MINUS_EQUAL ||
-        tokens_get(s)->type == TOKEN_TIMES_EQUAL ||
-        tokens_get(s)->type == TOKEN_SLASH_EQUAL ||
-        tokens_get(s)->type == TOKEN_PERCENT_EQUAL ||
-        tokens_get(s)->type == TOKEN_AND_EQUAL ||
-        tokens_get(s)->type == TOKEN_OR_EQUAL ||
-        tokens_get(s)->type == TOKEN_XOR_EQUAL ||
-        tokens_get(s)->type == TOKEN_LEFT_SHIFT_EQUAL ||
-        tokens_get(s)->type == TOKEN_RIGHT_SHIFT_EQUAL) {
+    if (tokens_get_type(s) == TOKEN_ASSIGN ||
+        tokens_get_type(s) == TOKEN_PLUS_EQUAL ||
+        tokens_get_type(s) == TOKEN_MINUS_EQUAL ||
+        tokens_get_type(s) == TOKEN_TIMES_EQUAL ||
+        tokens_get_type(s) == TOKEN_SLASH_EQUAL ||
+        tokens_get_type(s) == TOKEN_PERCENT_EQUAL ||
+        tokens_get_type(s) == TOKEN_AND_EQUAL ||
+        tokens_get_type(s) == TOKEN_OR_EQUAL ||
+        tokens_get_type(s) == TOKEN_XOR_EQUAL ||
+        tokens_get_type(s) == TOKEN_LEFT_SHIFT_EQUAL ||
+        tokens_get_type(s) == TOKEN_RIGHT_SHIFT_EQUAL) {
         Expr* e = make_expr(tu);
 
         ExprOp op;
-        switch (tokens_get(s)->type) {
+        switch (tokens_get_type(s)) {
             case TOKEN_ASSIGN:
             op = EXPR_ASSIGN;
             break;
@@ -1072,7 +1072,7 @@ static Expr* parse_expr_l15(TranslationUnit* tu, TokenStream* restrict s) {
     SourceLocIndex start_loc = tokens_get_location_index(s);
     Expr* lhs = parse_expr_l14(tu, s);
 
-    while (tokens_get(s)->type == TOKEN_COMMA) {
+    while (tokens_get_type(s) == TOKEN_COMMA) {
         Expr* e = make_expr(tu);
         ExprOp op = EXPR_COMMA;
         tokens_next(s);
@@ -1094,11 +1094,11 @@ static Expr* parse_expr_l15(TranslationUnit* tu, TokenStream* restrict s) {
 }
 
 static Expr* parse_expr(TranslationUnit* tu, TokenStream* restrict s) {
-    if (tokens_get(s)->type == TOKEN_KW_Pragma) {
+    if (tokens_get_type(s) == TOKEN_KW_Pragma) {
         tokens_next(s);
         expect(s, '(');
 
-        if (tokens_get(s)->type != TOKEN_STRING_DOUBLE_QUOTE) {
+        if (tokens_get_type(s) != TOKEN_STRING_DOUBLE_QUOTE) {
             generic_error(s, "pragma declaration expects string literal");
         }
         tokens_next(s);
@@ -19,6 +19,10 @@ static void remove_weird_whitespace(size_t len, char* text) {
         test_ident = _mm_or_si128(test_ident, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\v')));
         test_ident = _mm_or_si128(test_ident, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(12)));
 
+        // don't touch the memory unless we have to, the file might be
+        // a copy-on-write mapping
+        if (_mm_movemask_epi8(test_ident) == 0) continue;
+
         bytes = _mm_blendv_epi8(bytes, _mm_set1_epi8(' '), test_ident);
         _mm_store_si128((__m128i*)&text[i], bytes);
     }
@@ -16,7 +16,8 @@
 #define OUT_OF_ORDER_CRAP 1
 
 // how big are the phase2 parse tasks
-#define PARSE_MUNCH_SIZE (32768)
+// the phase 3 tasks are split by the number of tokens in the function bodies
+#define PARSE_MIN_TASK_COST (4096)
 
 typedef struct {
     Atom key;
@@ -126,25 +127,25 @@ static Expr* make_expr(TranslationUnit* tu) {
     return ARENA_ALLOC(&local_ast_arena, Expr);
 }
 
-static Symbol* find_global_symbol(const char* name) {
+static Symbol* find_global_symbol(Atom name) {
     ptrdiff_t temp;
-    ptrdiff_t search = shgeti_ts(global_symbols, name, temp);
+    ptrdiff_t search = hmgeti_ts(global_symbols, name, temp);
 
     return (search >= 0) ? &global_symbols[search].value : NULL;
 }
 
-static Cuik_Type* find_tag(const char* name) {
+static Cuik_Type* find_tag(Atom name) {
     // try locals
     size_t i = local_tag_count;
     while (i--) {
-        if (strcmp((const char*)local_tags[i].key, name) == 0) {
+        if (local_tags[i].key == name) {
             return local_tags[i].value;
         }
     }
 
     // try globals
     ptrdiff_t temp;
-    ptrdiff_t search = shgeti_ts(global_tags, name, temp);
+    ptrdiff_t search = hmgeti_ts(global_tags, name, temp);
     return (search >= 0) ? global_tags[search].value : NULL;
 }
 
@@ -158,16 +159,16 @@ static size_t skip_expression_in_parens(TokenStream* restrict s, TknType* out_te
 
     int depth = 1;
     while (depth) {
-        Token* t = tokens_get(s);
+        Token t = tokens_get(s);
 
-        if (t->type == '\0') {
+        if (t.type == '\0') {
             *out_terminator = '\0';
             break;
-        } else if (t->type == '(') {
+        } else if (t.type == '(') {
             depth++;
-        } else if (t->type == ')') {
+        } else if (t.type == ')') {
             depth--;
-        } else if (t->type == ',' && depth == 1) {
+        } else if (t.type == ',' && depth == 1) {
             *out_terminator = ',';
             depth--;
         }
@@ -190,17 +191,17 @@ static size_t skip_expression_in_enum(TokenStream* restrict s, TknType* out_term
 
     int depth = 1;
     while (depth) {
-        Token* t = tokens_get(s);
+        Token t = tokens_get(s);
 
-        if (t->type == '\0') {
+        if (t.type == '\0') {
             *out_terminator = '\0';
             break;
-        } else if (t->type == '{') {
+        } else if (t.type == '{') {
             depth++;
-        } else if (t->type == '}' && depth == 1) {
+        } else if (t.type == '}' && depth == 1) {
             *out_terminator = '}';
             break;
-        } else if (t->type == ',' && depth == 1) {
+        } else if (t.type == ',' && depth == 1) {
             break;
         }
 
@@ -214,8 +215,6 @@ static size_t skip_expression_in_enum(TokenStream* restrict s, TknType* out_term
 #include "decl_parser.h"
 
 typedef struct {
-    // shared state, every run of phase2_parse_task will decrement this by one
-    atomic_size_t* tasks_remaining;
     size_t start, end;
 
     TranslationUnit* tu;
@@ -223,6 +222,10 @@ typedef struct {
     SymbolEntry* global_symbols; // stb_ds hash map
 
     const TokenStream* base_token_stream;
+
+    // the AST nodes the task made, these get stitched into the TU's
+    // arena once all the tasks are done so they don't fight over it.
+    Arena ast_arena;
 } ParserTaskInfo;
 
 // we have a bunch of thread locals and for the sake of it, we wanna reset em before
@@ -268,8 +271,77 @@ static void parse_global_symbols(TranslationUnit* tu, size_t start, size_t end,
     }
 }
 
+// a thread waiting on its own tasks will run jobs while it waits, those might be
+// the phase 3 tasks of another parser so we stash the thread local state and put
+// it back afterwards.
+typedef struct {
+    int local_symbol_start, local_symbol_count, local_tag_count;
+    Symbol* local_symbols;
+    TagEntry* local_tags;
+
+    PendingExpr* pending_exprs;
+    TagEntry* global_tags;
+    SymbolEntry* global_symbols;
+    LabelEntry* labels;
+
+    Stmt* current_switch_or_case;
+    Stmt* current_breakable;
+    Stmt* current_continuable;
+    Expr* symbol_chain_start;
+    Expr* symbol_chain_current;
+
+    Arena local_ast_arena;
+    bool out_of_order_mode;
+} ParserState;
+
+static ParserState save_parser_state(void) {
+    return (ParserState){
+        local_symbol_start, local_symbol_count, local_tag_count,
+        local_symbols, local_tags,
+        pending_exprs, global_tags, global_symbols, labels,
+        current_switch_or_case, current_breakable, current_continuable,
+        symbol_chain_start, symbol_chain_current,
+        local_ast_arena, out_of_order_mode
+    };
+}
+
+static void restore_parser_state(const ParserState* state) {
+    local_symbol_start = state->local_symbol_start;
+    local_symbol_count = state->local_symbol_count;
+    local_tag_count = state->local_tag_count;
+    local_symbols = state->local_symbols;
+    local_tags = state->local_tags;
+    pending_exprs = state->pending_exprs;
+    global_tags = state->global_tags;
+    global_symbols = state->global_symbols;
+    labels = state->labels;
+    current_switch_or_case = state->current_switch_or_case;
+    current_breakable = state->current_breakable;
+    current_continuable = state->current_continuable;
+    symbol_chain_start = state->symbol_chain_start;
+    symbol_chain_current = state->symbol_chain_current;
+    local_ast_arena = state->local_ast_arena;
+    out_of_order_mode = state->out_of_order_mode;
+}
+
+static uint64_t parse_cost(void* ctx, size_t i) {
+    SymbolEntry* symbols = ctx;
+    Symbol* sym = &symbols[i].value;
+
+    if (sym->current != 0 && (sym->storage_class == STORAGE_STATIC_FUNC || sym->storage_class == STORAGE_FUNC)) {
+        return 1 + sym->stmt->decl.body_tokens;
+    }
+
+    return 1;
+}
+
 static void phase3_parse_task(void* arg) {
     ParserTaskInfo task = *((ParserTaskInfo*)arg);
+
+    ParserState saved = save_parser_state();
+    local_symbols = NULL;
+    local_tags = NULL;
+    local_ast_arena = (Arena){0};
     reset_global_parser_state();
 
     // intitialize any thread local state that might not be set on this thread
@@ -280,18 +352,15 @@ static void phase3_parse_task(void* arg) {
     atoms_init();
 
     parse_global_symbols(task.tu, task.start, task.end, *task.base_token_stream);
-    *task.tasks_remaining -= 1;
 
-    // move local AST arena to TU's AST arena
-    {
-        mtx_lock(&task.tu->arena_mutex);
-
-        arena_trim(&local_ast_arena);
-        arena_append(&task.tu->ast_arena, &local_ast_arena);
-        local_ast_arena = (Arena){0};
+    // hand the local AST arena back, the TU picks it up after the wait
+    arena_trim(&local_ast_arena);
+    ((ParserTaskInfo*)arg)->ast_arena = local_ast_arena;
+    local_ast_arena = (Arena){0};
 
-        mtx_unlock(&task.tu->arena_mutex);
-    }
+    free(local_tags);
+    free(local_symbols);
+    restore_parser_state(&saved);
 }
 
 // 0 no cycles
@@ -544,21 +613,21 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
 
     // Phase 1: resolve all top level statements
     CUIK_TIMED_BLOCK("phase 1") {
-        while (tokens_get(s)->type) {
-            while (tokens_get(s)->type == ';') tokens_next(s);
+        while (tokens_get_type(s)) {
+            while (tokens_get_type(s) == ';') tokens_next(s);
 
             // TODO(NeGate): Correctly parse pragmas instead of ignoring them.
-            if (tokens_get(s)->type == TOKEN_KW_Pragma) {
+            if (tokens_get_type(s) == TOKEN_KW_Pragma) {
                 tokens_next(s);
                 expect(s, '(');
 
-                if (tokens_get(s)->type != TOKEN_STRING_DOUBLE_QUOTE) {
+                if (tokens_get_type(s) != TOKEN_STRING_DOUBLE_QUOTE) {
                     generic_error(s, "pragma declaration expects string literal");
                 }
                 tokens_next(s);
 
                 expect(s, ')');
-            } else if (tokens_get(s)->type == TOKEN_KW_Static_assert) {
+            } else if (tokens_get_type(s) == TOKEN_KW_Static_assert) {
                 tokens_next(s);
                 expect(s, '(');
 
@@ -567,11 +636,11 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
                 dyn_array_put(static_assertions, current);
 
                 tokens_prev(s);
-                if (tokens_get(s)->type == ',') {
+                if (tokens_get_type(s) == ',') {
                     tokens_next(s);
 
-                    Token* t = tokens_get(s);
-                    if (t->type != TOKEN_STRING_DOUBLE_QUOTE) {
+                    Token t = tokens_get(s);
+                    if (t.type != TOKEN_STRING_DOUBLE_QUOTE) {
                         generic_error(s, "static assertion expects string literal");
                     }
                     tokens_next(s);
@@ -605,7 +674,7 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
                             arrput(tu->top_level_stmts, n);
 
                             // check for collision
-                            Symbol* search = find_global_symbol((const char*)decl.name);
+                            Symbol* search = find_global_symbol(decl.name);
                             if (search != NULL) {
                                 if (search->storage_class != STORAGE_TYPEDEF) {
                                     report_two_spots(REPORT_ERROR, tu->errors, s, decl.loc, search->loc,
@@ -636,27 +705,27 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
                                     .loc = decl.loc,
                                     .storage_class = STORAGE_TYPEDEF,
                                 };
-                                shput(global_symbols, decl.name, sym);
+                                hmput(global_symbols, decl.name, sym);
                             }
                         }
 
-                        if (tokens_get(s)->type == 0) {
+                        if (tokens_get_type(s) == 0) {
                             REPORT(ERROR, loc, "declaration list ended with EOF instead of semicolon.");
                             abort();
-                        } else if (tokens_get(s)->type == '=') {
+                        } else if (tokens_get_type(s) == '=') {
                             REPORT(ERROR, loc, "why did you just try that goofy shit wit me. You cannot assign a typedef.");
 
                             // error recovery
-                        } else if (tokens_get(s)->type == ';') {
+                        } else if (tokens_get_type(s) == ';') {
                             tokens_next(s);
                             break;
-                        } else if (tokens_get(s)->type == ',') {
+                        } else if (tokens_get_type(s) == ',') {
                             tokens_next(s);
                             continue;
                         }
                     }
                 } else {
-                    if (tokens_get(s)->type == ';') {
+                    if (tokens_get_type(s) == ';') {
                         Stmt* n = make_stmt(tu, s, STMT_GLOBAL_DECL, sizeof(struct StmtDecl));
                         n->loc = loc;
                         n->decl = (struct StmtDecl){
@@ -697,7 +766,7 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
                             .stmt = n,
                         };
 
-                        Symbol* old_definition = find_global_symbol((const char*)decl.name);
+                        Symbol* old_definition = find_global_symbol(decl.name);
                         if (decl.type->kind == KIND_FUNC) {
                             sym.storage_class = (attr.is_static ? STORAGE_STATIC_FUNC : STORAGE_FUNC);
                         } else {
@@ -713,14 +782,21 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
                         // parse attributes... currently it doesn't but one day...
                         while (parse_attributes(tu, s, n)) {}
 
+                        // attributes like hot stick to the function no matter which of
+                        // its declarations had them so the body sees them too
+                        if (old_definition != NULL && old_definition->stmt != NULL) {
+                            n->decl.attrs.is_hot |= old_definition->stmt->decl.attrs.is_hot;
+                            old_definition->stmt->decl.attrs.is_hot = n->decl.attrs.is_hot;
+                        }
+
                         bool requires_terminator = true;
-                        if (tokens_get(s)->type == '=') {
+                        if (tokens_get_type(s) == '=') {
                             tokens_next(s);
 
                             // variables with definitions can be roots
                             n->decl.attrs.is_root = !(attr.is_static || attr.is_inline);
 
-                            if (tokens_get(s)->type == '{') {
+                            if (tokens_get_type(s) == '{') {
                                 sym.current = s->current;
                                 sym.terminator = '}';
 
@@ -728,14 +804,14 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
 
                                 int depth = 1;
                                 while (depth) {
-                                    Token* t = tokens_get(s);
+                                    Token t = tokens_get(s);
 
-                                    if (t->type == '\0') {
+                                    if (t.type == '\0') {
                                         REPORT(ERROR, decl.loc, "Declaration ended in EOF");
                                         abort();
-                                    } else if (t->type == '{') {
+                                    } else if (t.type == '{') {
                                         depth++;
-                                    } else if (t->type == '}') {
+                                    } else if (t.type == '}') {
                                         if (depth == 0) {
                                             REPORT(ERROR, decl.loc, "Unbalanced brackets");
                                             abort();
@@ -754,26 +830,26 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
 
                                 int depth = 1;
                                 while (depth) {
-                                    Token* t = tokens_get(s);
+                                    Token t = tokens_get(s);
 
-                                    if (t->type == '\0') {
+                                    if (t.type == '\0') {
                                         REPORT(ERROR, decl.loc, "Declaration ended in EOF");
                                         abort();
-                                    } else if (t->type == '(') {
+                                    } else if (t.type == '(') {
                                         depth++;
-                                    } else if (t->type == ')') {
+                                    } else if (t.type == ')') {
                                         depth--;
 
                                         if (depth == 0) {
                                             REPORT(ERROR, decl.loc, "Unbalanced parenthesis");
                                             abort();
                                         }
-                                    } else if (t->type == ';' || t->type == ',') {
-                                        if (depth > 1 && t->type == ';') {
+                                    } else if (t.type == ';' || t.type == ',') {
+                                        if (depth > 1 && t.type == ';') {
                                             REPORT(ERROR, decl.loc, "Declaration's expression has a weird semicolon");
                                             abort();
                                         } else if (depth == 1) {
-                                            sym.terminator = t->type;
+                                            sym.terminator = t.type;
                                             depth--;
                                         }
                                     }
@@ -785,7 +861,7 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
                                 // does need to know what it is...
                                 tokens_prev(s);
                             }
-                        } else if (tokens_get(s)->type == '{') {
+                        } else if (tokens_get_type(s) == '{') {
                             // function bodies dont end in semicolon or comma, it just terminates
                             // the declaration list
                             requires_terminator = false;
@@ -814,25 +890,28 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
                             // balance some brackets: '{' SOMETHING '}'
                             int depth = 1;
                             while (depth) {
-                                Token* t = tokens_get(s);
+                                Token t = tokens_get(s);
 
-                                if (t->type == '\0') {
+                                if (t.type == '\0') {
                                     SourceLocIndex l = tokens_get_last_location_index(s);
                                     report_fix(REPORT_ERROR, tu->errors, s, l, "}", "Function body ended in EOF");
                                     abort();
-                                } else if (t->type == '{') {
+                                } else if (t.type == '{') {
                                     depth++;
-                                } else if (t->type == '}') {
+                                } else if (t.type == '}') {
                                     depth--;
                                 }
 
                                 tokens_next(s);
                             }
+
+                            n->decl.body_tokens = s->current - sym.current;
                         }
 
-                        if (decl.name != NULL) {
-                            // slap that bad boy into the symbol table
-                            shput(global_symbols, decl.name, sym);
+                        // slap that bad boy into the symbol table, unless it's just
+                        // redeclaring something that already has a body
+                        if (decl.name != NULL && (old_definition == NULL || old_definition->current == 0 || sym.current != 0)) {
+                            hmput(global_symbols, decl.name, sym);
                         }
 
                         if (!requires_terminator) {
@@ -840,13 +919,13 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
                             break;
                         }
 
-                        if (tokens_get(s)->type == 0) {
+                        if (tokens_get_type(s) == 0) {
                             REPORT(ERROR, loc, "declaration list ended with EOF instead of semicolon.");
                             abort();
-                        } else if (tokens_get(s)->type == ';') {
+                        } else if (tokens_get_type(s) == ';') {
                             tokens_next(s);
                             break;
-                        } else if (tokens_get(s)->type == ',') {
+                        } else if (tokens_get_type(s) == ',') {
                             tokens_next(s);
                             continue;
                         }
@@ -901,7 +980,7 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
         if (has_reports(REPORT_ERROR, tu->errors)) goto parse_error;
 
         // parse all global declarations
-        for (size_t i = 0, count = shlen(global_symbols); i < count; i++) {
+        for (size_t i = 0, count = hmlen(global_symbols); i < count; i++) {
             Symbol* sym = &global_symbols[i].value;
 
             if (sym->current != 0 &&
@@ -914,13 +993,13 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
                 symbol_chain_start = symbol_chain_current = NULL;
 
                 Expr* e;
-                if (tokens_get(&mini_lex)->type == '@') {
+                if (tokens_get_type(&mini_lex) == '@') {
                     // function literals are a Cuik extension
                     // TODO(NeGate): error messages
                     tokens_next(&mini_lex);
 
                     e = parse_function_literal(tu, &mini_lex, sym->type);
-                } else if (tokens_get(&mini_lex)->type == '{') {
+                } else if (tokens_get_type(&mini_lex) == '{') {
                     tokens_next(&mini_lex);
 
                     e = parse_initializer(tu, &mini_lex, NULL);
@@ -966,17 +1045,17 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
             mini_lex.current = current_lex_pos;
 
             intmax_t condition = parse_const_expr(tu, &mini_lex);
-            if (tokens_get(&mini_lex)->type == ',') {
+            if (tokens_get_type(&mini_lex) == ',') {
                 tokens_next(&mini_lex);
 
-                Token* t = tokens_get(&mini_lex);
-                if (t->type != TOKEN_STRING_DOUBLE_QUOTE) {
+                Token t = tokens_get(&mini_lex);
+                if (t.type != TOKEN_STRING_DOUBLE_QUOTE) {
                     generic_error(&mini_lex, "static assertion expects string literal");
                 }
                 tokens_next(&mini_lex);
 
                 if (condition == 0) {
-                    REPORT(ERROR, tokens_get_location_index(&mini_lex), "Static assertion failed: %.*s", (int)(t->end - t->start), t->start);
+                    REPORT(ERROR, tokens_get_location_index(&mini_lex), "Static assertion failed: %.*s", (int)(t.end - t.start), t.start);
                 }
             } else {
                 if (condition == 0) {
@@ -999,24 +1078,19 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
         local_ast_arena = (Arena){0};
 
         if (desc->thread_pool != NULL) {
-            // disabled until we change the tables to arenas
-            size_t count = shlen(global_symbols);
-            size_t padded = (count + (PARSE_MUNCH_SIZE - 1)) & ~(PARSE_MUNCH_SIZE - 1);
+            size_t count = hmlen(global_symbols);
 
-            // passed to the threads to identify when things are done
-            atomic_size_t tasks_remaining = (count + (PARSE_MUNCH_SIZE - 1)) / PARSE_MUNCH_SIZE;
-            ParserTaskInfo* tasks = malloc(sizeof(ParserTaskInfo) * tasks_remaining);
+            size_t task_count;
+            size_t* ends = cuik__split_work(count, desc->thread_pool->thread_count, PARSE_MIN_TASK_COST, parse_cost, global_symbols, &task_count);
 
-            size_t j = 0;
-            for (size_t i = 0; i < padded; i += PARSE_MUNCH_SIZE) {
-                size_t limit = i + PARSE_MUNCH_SIZE;
-                if (limit > count) limit = count;
+            Cuik_TaskGroup group = { 0 };
+            ParserTaskInfo* tasks = malloc(sizeof(ParserTaskInfo) * task_count);
 
-                ParserTaskInfo* task = &tasks[j++];
+            for (size_t j = 0; j < task_count; j++) {
+                ParserTaskInfo* task = &tasks[j];
                 *task = (ParserTaskInfo){
-                    .tasks_remaining = &tasks_remaining,
-                    .start = i,
-                    .end = limit
+                    .start = j ? ends[j - 1] : 0,
+                    .end = ends[j]
                 };
 
                 // we transfer a bunch of our thread local state to the task
@@ -1027,18 +1101,20 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
                 task->global_symbols = global_symbols;
                 task->base_token_stream = s;
 
-                CUIK_CALL(desc->thread_pool, submit, phase3_parse_task, task);
+                CUIK_CALL(desc->thread_pool, submit, &group, phase3_parse_task, task);
             }
 
-            while (tasks_remaining != 0) {
-                CUIK_CALL(desc->thread_pool, work_one_job);
-                thrd_yield();
+            CUIK_CALL(desc->thread_pool, wait, &group);
+
+            for (size_t j = 0; j < task_count; j++) {
+                arena_append(&tu->ast_arena, &tasks[j].ast_arena);
             }
 
             free(tasks);
+            free(ends);
         } else {
             // single threaded mode
-            parse_global_symbols(tu, 0, shlen(global_symbols), *s);
+            parse_global_symbols(tu, 0, hmlen(global_symbols), *s);
         }
 
         if (has_reports(REPORT_ERROR, tu->errors)) goto parse_error;
@@ -1074,11 +1150,13 @@ CUIK_API TranslationUnit* cuik_parse_translation_unit(const Cuik_TranslationUnit
         // free parser crap
         free(local_tags);
         free(local_symbols);
-        shfree(global_tags);
-        shfree(global_symbols);
+        local_tags = NULL;
+        local_symbols = NULL;
+        hmfree(global_tags);
+        hmfree(global_symbols);
 
         // free tokens
-        arrfree(tu->tokens.tokens);
+        tokens_free(&tu->tokens);
     }
 
     // run type checker
@@ -1125,12 +1203,11 @@ CUIK_API bool cuik_is_in_main_file(TranslationUnit* restrict tu, SourceLocIndex
         return false;
     }
 
-    SourceLoc* l = &tu->tokens.locations[SOURCE_LOC_GET_DATA(loc)];
-    return l->line->filepath == tu->filepath;
+    return cuik_get_location(&tu->tokens, loc).line->filepath == tu->filepath;
 }
 
 Stmt* resolve_unknown_symbol(TranslationUnit* tu, Expr* e) {
-    Symbol* sym = find_global_symbol((char*)e->unknown_sym);
+    Symbol* sym = find_global_symbol(e->unknown_sym);
     if (sym != NULL) return 0;
 
     // Parameters are local and a special case how tf
@@ -1142,18 +1219,14 @@ Stmt* resolve_unknown_symbol(TranslationUnit* tu, Expr* e) {
 }
 
 static Symbol* find_local_symbol(TokenStream* restrict s) {
-    Token* t = tokens_get(s);
-    const unsigned char* name = t->start;
-    size_t length = t->end - t->start;
+    Token t = tokens_get(s);
+    Atom name = atoms_put(t.end - t.start, t.start);
 
     // Try local variables
     size_t i = local_symbol_count;
     size_t start = local_symbol_start;
     while (i-- > start) {
-        const unsigned char* sym = local_symbols[i].name;
-        size_t sym_length = strlen((const char*)sym);
-
-        if (sym_length == length && memcmp(name, sym, length) == 0) {
+        if (local_symbols[i].name == name) {
             return &local_symbols[i];
         }
     }
@@ -1199,7 +1272,7 @@ static void parse_function_definition(TranslationUnit* tu, TokenStream* restrict
 
     // hmm... how tf do labels operate in this case...
     // TODO(NeGate): redo the label look in a sec
-    shfree(labels);
+    hmfree(labels);
 }
 
 static Stmt* parse_compound_stmt(TranslationUnit* tu, TokenStream* restrict s) {
@@ -1211,8 +1284,8 @@ static Stmt* parse_compound_stmt(TranslationUnit* tu, TokenStream* restrict s) {
         size_t kid_count = 0;
         Stmt** kids = tls_save();
 
-        while (tokens_get(s)->type != '}') {
-            if (tokens_get(s)->type == ';') {
+        while (tokens_get_type(s) != '}') {
+            if (tokens_get_type(s) == ';') {
                 tokens_next(s);
             } else {
                 Stmt* stmt = parse_stmt(tu, s);
@@ -1243,7 +1316,7 @@ static Stmt* parse_compound_stmt(TranslationUnit* tu, TokenStream* restrict s) {
 
 // TODO(NeGate): Doesn't handle declarators or expression-statements
 static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
-    TknType peek = tokens_get(s)->type;
+    TknType peek = tokens_get_type(s);
 
     if (peek == '{') {
         tokens_next(s);
@@ -1252,7 +1325,7 @@ static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
         tokens_next(s);
 
         Expr* e = 0;
-        if (tokens_get(s)->type != ';') {
+        if (tokens_get_type(s) != ';') {
             e = parse_expr(tu, s);
         }
 
@@ -1283,7 +1356,7 @@ static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
             }
 
             Stmt* next = 0;
-            if (tokens_get(s)->type == TOKEN_KW_else) {
+            if (tokens_get_type(s) == TOKEN_KW_else) {
                 tokens_next(s);
 
                 LOCAL_SCOPE {
@@ -1333,7 +1406,7 @@ static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
         Stmt* top = n;
 
         intmax_t key = parse_const_expr(tu, s);
-        if (tokens_get(s)->type == TOKEN_TRIPLE_DOT) {
+        if (tokens_get_type(s) == TOKEN_TRIPLE_DOT) {
             // GNU extension, case ranges
             tokens_next(s);
             intmax_t key_max = parse_const_expr(tu, s);
@@ -1468,7 +1541,7 @@ static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
 
             // it's either nothing, a declaration, or an expression
             Stmt* first = NULL;
-            if (tokens_get(s)->type == ';') {
+            if (tokens_get_type(s) == ';') {
                 /* nothing */
                 tokens_next(s);
             } else {
@@ -1491,7 +1564,7 @@ static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
             }
 
             Expr* cond = NULL;
-            if (tokens_get(s)->type == ';') {
+            if (tokens_get_type(s) == ';') {
                 /* nothing */
                 tokens_next(s);
             } else {
@@ -1500,7 +1573,7 @@ static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
             }
 
             Expr* next = NULL;
-            if (tokens_get(s)->type == ')') {
+            if (tokens_get_type(s) == ')') {
                 /* nothing */
                 tokens_next(s);
             } else {
@@ -1550,10 +1623,10 @@ static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
                 current_continuable = old_continuable;
             }
 
-            if (tokens_get(s)->type != TOKEN_KW_while) {
-                Token* t = tokens_get(s);
+            if (tokens_get_type(s) != TOKEN_KW_while) {
+                Token t = tokens_get(s);
 
-                REPORT(ERROR, t->location, "%s:%d: error: expected 'while' got '%.*s'", (int)(t->end - t->start), t->start);
+                REPORT(ERROR, t.location, "%s:%d: error: expected 'while' got '%.*s'", (int)(t.end - t.start), t.start);
                 abort();
             }
             tokens_next(s);
@@ -1577,20 +1650,20 @@ static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
         Stmt* n = make_stmt(tu, s, STMT_GOTO, sizeof(struct StmtGoto));
 
         // read label name
-        Token* t = tokens_get(s);
-        SourceLocIndex loc = t->location;
-        if (t->type != TOKEN_IDENTIFIER) {
+        Token t = tokens_get(s);
+        SourceLocIndex loc = t.location;
+        if (t.type != TOKEN_IDENTIFIER) {
             REPORT(ERROR, loc, "expected identifier for goto target name");
             return n;
         }
 
-        Atom name = atoms_put(t->end - t->start, t->start);
+        Atom name = atoms_put(t.end - t.start, t.start);
 
         // skip to the semicolon
         tokens_next(s);
 
         Expr* target = make_expr(tu);
-        ptrdiff_t search = shgeti(labels, name);
+        ptrdiff_t search = hmgeti(labels, name);
         if (search >= 0) {
             *target = (Expr){
                 .op = EXPR_SYMBOL,
@@ -1603,7 +1676,7 @@ static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
             Stmt* label_decl = make_stmt(tu, s, STMT_LABEL, sizeof(struct StmtLabel));
             label_decl->label = (struct StmtLabel){
                 .name = name};
-            shput(labels, name, label_decl);
+            hmput(labels, name, label_decl);
 
             *target = (Expr){
                 .op = EXPR_SYMBOL,
@@ -1619,14 +1692,14 @@ static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
 
         expect(s, ';');
         return n;
-    } else if (peek == TOKEN_IDENTIFIER && tokens_peek(s)->type == TOKEN_COLON) {
+    } else if (peek == TOKEN_IDENTIFIER && tokens_peek(s).type == TOKEN_COLON) {
         // label amirite
         // IDENTIFIER COLON STMT
-        Token* t = tokens_get(s);
-        Atom name = atoms_put(t->end - t->start, t->start);
+        Token t = tokens_get(s);
+        Atom name = atoms_put(t.end - t.start, t.start);
 
         Stmt* n = NULL;
-        ptrdiff_t search = shgeti(labels, name);
+        ptrdiff_t search = hmgeti(labels, name);
         if (search >= 0) {
             n = labels[search].value;
         } else {
@@ -1634,7 +1707,7 @@ static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
             n->label = (struct StmtLabel){
                 .name = name,
             };
-            shput(labels, name, n);
+            hmput(labels, name, n);
         }
 
         n->label.placed = true;
@@ -1648,18 +1721,20 @@ static Stmt* parse_stmt(TranslationUnit* tu, TokenStream* restrict s) {
 }
 
 static void parse_decl_or_expr(TranslationUnit* tu, TokenStream* restrict s, size_t* body_count) {
-    if (tokens_get(s)->type == TOKEN_KW_Pragma) {
+    if (tokens_get_type(s) == TOKEN_KW_Pragma) {
         tokens_next(s);
         expect(s, '(');
 
-        if (tokens_get(s)->type != TOKEN_STRING_DOUBLE_QUOTE) {
+        if (tokens_get_type(s) != TOKEN_STRING_DOUBLE_QUOTE) {
             generic_error(s, "pragma declaration expects string literal");
         }
         tokens_next(s);
 
         expect(s, ')');
-    } else if (tokens_get(s)->type == ';') {
+    } else if (tokens_get_type(s) == ';') {
         tokens_next(s);
+    } else if (tokens_get_type(s) == TOKEN_KW_attribute && !is_typename(s)) {
+        skip_statement_attributes(s);
     } else if (is_typename(s)) {
         Attribs attr = {0};
         Cuik_Type* type = parse_declspec(tu, s, &attr);
@@ -1667,7 +1742,7 @@ static void parse_decl_or_expr(TranslationUnit* tu, TokenStream* restrict s, siz
         if (attr.is_typedef) {
             // don't expect one the first time
             bool expect_comma = false;
-            while (tokens_get(s)->type != ';') {
+            while (tokens_get_type(s) != ';') {
                 if (expect_comma) {
                     expect_with_reason(s, ',', "typedef");
                 } else
@@ -1702,11 +1777,11 @@ static void parse_decl_or_expr(TranslationUnit* tu, TokenStream* restrict s, siz
             // TODO(NeGate): Kinda ugly
             // don't expect one the first time
             bool expect_comma = false;
-            while (tokens_get(s)->type != ';') {
+            while (tokens_get_type(s) != ';') {
                 if (expect_comma) {
-                    if (tokens_get(s)->type == '{') {
+                    if (tokens_get_type(s) == '{') {
                         generic_error(s, "nested functions are not allowed... yet");
-                    } else if (tokens_get(s)->type != ',') {
+                    } else if (tokens_get_type(s) != ',') {
 				        SourceLocIndex loc = tokens_get_last_location_index(s);
 
 				        report_fix(REPORT_ERROR, tu->errors, s, loc, ";", "expected semicolon at the end of declaration");
@@ -1741,15 +1816,15 @@ static void parse_decl_or_expr(TranslationUnit* tu, TokenStream* restrict s, siz
                 };
 
                 Expr* initial = 0;
-                if (tokens_get(s)->type == '=') {
+                if (tokens_get_type(s) == '=') {
                     tokens_next(s);
 
-                    if (tokens_get(s)->type == '@') {
+                    if (tokens_get_type(s) == '@') {
                         // function literals are a Cuik extension
                         // TODO(NeGate): error messages
                         tokens_next(s);
                         initial = parse_function_literal(tu, s, decl.type);
-                    } else if (tokens_get(s)->type == '{') {
+                    } else if (tokens_get_type(s) == '{') {
                         tokens_next(s);
 
                         initial = parse_initializer(tu, s, NULL);
@@ -1778,20 +1853,23 @@ static void parse_decl_or_expr(TranslationUnit* tu, TokenStream* restrict s, siz
 }
 
 static Stmt* parse_stmt_or_expr(TranslationUnit* tu, TokenStream* restrict s) {
-    if (tokens_get(s)->type == TOKEN_KW_Pragma) {
+    if (tokens_get_type(s) == TOKEN_KW_Pragma) {
         tokens_next(s);
         expect(s, '(');
 
-        if (tokens_get(s)->type != TOKEN_STRING_DOUBLE_QUOTE) {
+        if (tokens_get_type(s) != TOKEN_STRING_DOUBLE_QUOTE) {
             generic_error(s, "pragma declaration expects string literal");
         }
         tokens_next(s);
 
         expect(s, ')');
         return 0;
-    } else if (tokens_get(s)->type == ';') {
+    } else if (tokens_get_type(s) == ';') {
         tokens_next(s);
         return 0;
+    } else if (tokens_get_type(s) == TOKEN_KW_attribute && !is_typename(s)) {
+        skip_statement_attributes(s);
+        return 0;
     } else {
         Stmt* stmt = parse_stmt(tu, s);
 
@@ -1831,11 +1909,11 @@ static _Noreturn void generic_error(TokenStream* restrict s, const char* msg) {
 }
 
 static void expect(TokenStream* restrict s, char ch) {
-    if (tokens_get(s)->type != ch) {
-        Token* t = tokens_get(s);
+    if (tokens_get_type(s) != ch) {
+        Token t = tokens_get(s);
         SourceLocIndex loc = tokens_get_location_index(s);
 
-        report(REPORT_ERROR, NULL, s, loc, "expected '%c' got '%.*s'", ch, (int)(t->end - t->start), t->start);
+        report(REPORT_ERROR, NULL, s, loc, "expected '%c' got '%.*s'", ch, (int)(t.end - t.start), t.start);
         abort();
     }
 
@@ -1843,7 +1921,7 @@ static void expect(TokenStream* restrict s, char ch) {
 }
 
 static void expect_closing_paren(TranslationUnit* tu, TokenStream* restrict s, SourceLocIndex opening) {
-    if (tokens_get(s)->type != ')') {
+    if (tokens_get_type(s) != ')') {
         SourceLocIndex loc = tokens_get_location_index(s);
 
         report_two_spots(REPORT_ERROR, tu->errors, s, opening, loc,
@@ -1857,7 +1935,7 @@ static void expect_closing_paren(TranslationUnit* tu, TokenStream* restrict s, S
 }
 
 static void expect_with_reason(TokenStream* restrict s, char ch, const char* reason) {
-    if (tokens_get(s)->type != ch) {
+    if (tokens_get_type(s) != ch) {
         SourceLocIndex loc = tokens_get_last_location_index(s);
 
         char fix[2] = { ch, '\0' };
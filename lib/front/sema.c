@@ -5,11 +5,10 @@
 #include <stdarg.h>
 #include <targets/targets.h>
 
-#define SEMA_MUNCH_SIZE (32768)
+// the type checking tasks are split by the number of tokens in the function bodies
+#define SEMA_MIN_TASK_COST (4096)
 
 typedef struct {
-    // shared state, every run of sema_task will decrement this by one
-    atomic_size_t* tasks_remaining;
     size_t start, end;
     TranslationUnit* tu;
 } SemaTaskInfo;
@@ -251,16 +250,16 @@ static int compute_initializer_bounds(Cuik_Type* type) {
     }
 }
 
-static InitSearchResult find_member_by_name(Cuik_Type* type, const unsigned char* name, int* base_index, int offset) {
+static InitSearchResult find_member_by_name(Cuik_Type* type, Atom name, int* base_index, int offset) {
     Member* kids = type->record.kids;
     size_t count = type->record.kid_count;
 
     for (size_t i = 0; i < count; i++) {
         Member* member = &kids[i];
 
-        // TODO(NeGate): String interning would be nice
+        // names are atoms so we can just compare pointers
         if (member->name != NULL) {
-            if (cstr_equals(name, member->name)) {
+            if (name == member->name) {
                 return (InitSearchResult){member, *base_index + i, offset + member->offset};
             }
         } else if (member->type->kind == KIND_STRUCT || member->type->kind == KIND_UNION) {
@@ -514,7 +513,7 @@ Member* sema_traverse_members(TranslationUnit* tu, Cuik_Type* record_type, Atom
     for (size_t i = 0; i < count; i++) {
         Member* member = &kids[i];
 
-        // TODO(NeGate): String interning would be nice
+        // names are atoms so we can just compare pointers
         if (member->name == NULL) {
             // unnamed fields are traversed as well
             Cuik_Type* child = member->type;
@@ -525,7 +524,7 @@ Member* sema_traverse_members(TranslationUnit* tu, Cuik_Type* record_type, Atom
                 *out_offset += member->offset;
                 return search;
             }
-        } else if (cstr_equals(name, member->name)) {
+        } else if (name == member->name) {
             *out_offset += member->offset;
             return member;
         }
@@ -1639,14 +1638,15 @@ static void sema_task(void* arg) {
     SemaTaskInfo task = *((SemaTaskInfo*)arg);
 
     CUIK_TIMED_BLOCK("sema: %zu-%zu", task.start, task.end) {
+        // we might be nested in some other job on this thread
+        bool old_in_the_semantic_phase = in_the_semantic_phase;
         in_the_semantic_phase = true;
 
         for (size_t i = task.start; i < task.end; i++) {
             sema_top_level(task.tu, task.tu->top_level_stmts[i]);
         }
 
-        in_the_semantic_phase = false;
-        *task.tasks_remaining -= 1;
+        in_the_semantic_phase = old_in_the_semantic_phase;
     }
 }
 
@@ -1675,28 +1675,28 @@ void cuik__sema_pass(TranslationUnit* restrict tu, Cuik_IThreadpool* restrict th
     // go through all top level statements and type check
     CUIK_TIMED_BLOCK("sema: type check") {
         if (thread_pool != NULL) {
-            // disabled until we change the tables to arenas
-            size_t padded = (count + (SEMA_MUNCH_SIZE - 1)) & ~(SEMA_MUNCH_SIZE - 1);
-
-            // passed to the threads to identify when things are done
-            atomic_size_t tasks_remaining = (count + (SEMA_MUNCH_SIZE - 1)) / SEMA_MUNCH_SIZE;
-
-            for (size_t i = 0; i < padded; i += SEMA_MUNCH_SIZE) {
-                size_t limit = i + SEMA_MUNCH_SIZE;
-                if (limit > count) limit = count;
-
-                SemaTaskInfo* task = tls_push(sizeof(SemaTaskInfo));
-                *task = (SemaTaskInfo){
-                    .tasks_remaining = &tasks_remaining,
-                    .start = i,
-                    .end = limit,
+            size_t task_count;
+            size_t* ends = cuik__split_work(count, thread_pool->thread_count, SEMA_MIN_TASK_COST, cuik__stmt_cost, tu->top_level_stmts, &task_count);
+
+            // the tasks can run on this thread while we wait so they don't
+            // go in the temporary storage (they'd reset it)
+            Cuik_TaskGroup group = { 0 };
+            SemaTaskInfo* tasks = malloc(sizeof(SemaTaskInfo) * task_count);
+
+            for (size_t j = 0; j < task_count; j++) {
+                tasks[j] = (SemaTaskInfo){
+                    .start = j ? ends[j - 1] : 0,
+                    .end = ends[j],
                     .tu = tu
                 };
 
-                CUIK_CALL(thread_pool, submit, sema_task, task);
+                CUIK_CALL(thread_pool, submit, &group, sema_task, &tasks[j]);
             }
 
-            while (tasks_remaining != 0) { thrd_yield(); }
+            CUIK_CALL(thread_pool, wait, &group);
+
+            free(tasks);
+            free(ends);
         } else {
             in_the_semantic_phase = true;
             for (size_t i = 0; i < count; i++) {
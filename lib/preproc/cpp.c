@@ -14,13 +14,31 @@
 #include <sys/stat.h>
 #include <stb_ds.h>
 
+#include <threads.h>
+#include <stdatomic.h>
+
 #if _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#else
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #endif
 
 #include <x86intrin.h>
 
+// everything needed to resolve an include
+typedef struct IncludeSearch {
+    const Cuik_IFileSystem* file_system;
+    char** dirs;
+    size_t dir_count;
+
+    // see get_include_dirs_signature
+    uint64_t signature;
+} IncludeSearch;
+
 static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_t parent_entry, SourceLocIndex include_loc, const char* directory, const char* filepath, int depth);
 static uint64_t hash_ident(const unsigned char* at, size_t length);
 static bool is_defined(Cuik_CPP* restrict c, const unsigned char* start, size_t length);
@@ -35,27 +53,28 @@ static SourceLocIndex get_source_location(Cuik_CPP* restrict c, Lexer* restrict
 
 static void expand(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l, SourceLocIndex parent_loc);
 static void expand_ident(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l, SourceLocIndex parent_loc);
-//static void expand_double_hash(Cuik_CPP* restrict c, TokenStream* restrict s, Token* last, Lexer* restrict l, SourceLocIndex loc);
+static const char* search_include(const IncludeSearch* restrict search, const char* directory, const char* filename, bool is_lib_include, bool* out_hit);
+static uint64_t get_include_dirs_signature(Cuik_CPP* restrict c);
+//static void expand_double_hash(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* restrict l, SourceLocIndex loc);
 
 // Basically a mini-unity build that takes up just the CPP module
 #include "cpp_symtab.h"
 #include "cpp_expand.h"
 #include "cpp_fs.h"
 #include "cpp_expr.h"
+#include "cpp_pch.h"
+#include "cpp_snapshot.h"
+#include "cpp_speculate.h"
 
 CUIK_API void cuikpp_init(Cuik_CPP* ctx, const Cuik_IFileSystem* fs) {
-    size_t sz = sizeof(void*) * MACRO_BUCKET_COUNT * SLOTS_PER_MACRO_BUCKET;
-    size_t sz2 = sizeof(SourceLocIndex) * MACRO_BUCKET_COUNT * SLOTS_PER_MACRO_BUCKET;
-
     *ctx = (Cuik_CPP){
-        .macro_bucket_keys         = cuik__valloc(sz),
-        .macro_bucket_keys_length  = cuik__valloc(sz),
-        .macro_bucket_values_start = cuik__valloc(sz),
-        .macro_bucket_values_end   = cuik__valloc(sz),
-        .macro_bucket_source_locs  = cuik__valloc(sz2),
-
         .the_shtuffs = cuik__valloc(THE_SHTUFFS_SIZE),
     };
+
+    if (!macro_table_alloc(ctx, MACRO_INIT_CAPACITY)) {
+        fprintf(stderr, "preprocessor error: could not allocate macro table!\n");
+        abort();
+    }
     ctx->file_system = fs;
     ctx->files = dyn_array_create(Cuik_FileEntry);
 
@@ -63,7 +82,7 @@ CUIK_API void cuikpp_init(Cuik_CPP* ctx, const Cuik_IFileSystem* fs) {
 }
 
 CUIK_API void cuikpp_deinit(Cuik_CPP* ctx) {
-    if (ctx->macro_bucket_keys) {
+    if (ctx->macro_tags) {
         cuikpp_finalize(ctx);
     }
 
@@ -71,33 +90,23 @@ CUIK_API void cuikpp_deinit(Cuik_CPP* ctx) {
         size_t count = dyn_array_length(ctx->files);
 
         for (size_t i = 0; i < count; i++) {
-            free(ctx->files[i].content);
+            if (!ctx->files[i].is_shared) free(ctx->files[i].content);
         }
 
         dyn_array_destroy(ctx->files);
         ctx->files = NULL;
     }
 
+    shfree(ctx->include_once);
+    shfree(ctx->include_guards);
+
     cuik__vfree((void*)ctx->the_shtuffs, THE_SHTUFFS_SIZE);
     ctx->the_shtuffs = NULL;
 }
 
 CUIK_API void cuikpp_finalize(Cuik_CPP* ctx) {
     CUIK_TIMED_BLOCK("cuikpp_finalize") {
-        size_t sz = sizeof(void*) * MACRO_BUCKET_COUNT * SLOTS_PER_MACRO_BUCKET;
-        size_t sz2 = sizeof(SourceLocIndex) * MACRO_BUCKET_COUNT * SLOTS_PER_MACRO_BUCKET;
-
-        cuik__vfree((void*)ctx->macro_bucket_keys, sz);
-        cuik__vfree((void*)ctx->macro_bucket_keys_length, sz);
-        cuik__vfree((void*)ctx->macro_bucket_values_start, sz);
-        cuik__vfree((void*)ctx->macro_bucket_values_end, sz);
-        cuik__vfree((void*)ctx->macro_bucket_source_locs, sz2);
-
-        ctx->macro_bucket_keys = NULL;
-        ctx->macro_bucket_keys_length = NULL;
-        ctx->macro_bucket_values_start = NULL;
-        ctx->macro_bucket_values_end = NULL;
-        ctx->macro_bucket_source_locs = NULL;
+        macro_table_free(ctx);
     }
 }
 
@@ -125,73 +134,69 @@ CUIK_API bool cuikpp_find_include_include(Cuik_CPP* ctx, char output[MAX_PATH],
 
 CUIK_API void cuikpp_add_include_directory(Cuik_CPP* ctx, const char dir[]) {
     arrput(ctx->system_include_dirs, strdup(dir));
+
+    // the search order changed, recompute later
+    ctx->include_dirs_signature = 0;
 }
 
+CUIK_API void cuikpp_set_prefix_header(Cuik_CPP* ctx, const char* header, const char* pch_path) {
+    ctx->prefix_header = header;
+    ctx->prefix_pch_path = pch_path;
+}
+
+CUIK_API void cuikpp_set_thread_pool(Cuik_CPP* ctx, const Cuik_IThreadpool* thread_pool) {
+    ctx->thread_pool = thread_pool;
+}
+
+// the bucket in the define ref is the slot in the macro table, the id is unused
 CUIK_API Cuik_DefineRef cuikpp_first_define(Cuik_CPP* ctx) {
-    for (int i = 0; i < MACRO_BUCKET_COUNT; i++) {
-        if (ctx->macro_bucket_count[i] != 0) {
-            // first slot in that non-empty bucket
+    for (size_t i = 0; i < ctx->macro_capacity; i++) {
+        if (MACRO_SLOT_FULL(ctx, i)) {
             return (Cuik_DefineRef){ i, 0 };
         }
     }
 
-    return (Cuik_DefineRef){ MACRO_BUCKET_COUNT, 0 };
+    return (Cuik_DefineRef){ ctx->macro_capacity, 0 };
 }
 
 CUIK_API bool cuikpp_next_define(Cuik_CPP* ctx, Cuik_DefineRef* src) {
     // we outta bounds
-    if (src->bucket >= MACRO_BUCKET_COUNT) return false;
+    if (src->bucket >= ctx->macro_capacity) return false;
 
-    // find next bucket
-    src->id += 1;
-    while (src->id >= ctx->macro_bucket_count[src->bucket]) {
-        src->id = 0;
+    // find next full slot
+    do {
         src->bucket += 1;
 
-        if (src->bucket >= MACRO_BUCKET_COUNT) {
+        if (src->bucket >= ctx->macro_capacity) {
             return false;
         }
-    }
+    } while (!MACRO_SLOT_FULL(ctx, src->bucket));
 
     return true;
 }
 
 CUIK_API Cuik_Define cuikpp_get_define(Cuik_CPP* ctx, Cuik_DefineRef src) {
-    size_t e = (src.bucket * SLOTS_PER_MACRO_BUCKET) + src.id;
-
-    size_t keylen = ctx->macro_bucket_keys_length[e];
-    const char* key = (const char*)ctx->macro_bucket_keys[e];
-
-    size_t vallen = ctx->macro_bucket_values_end[e] - ctx->macro_bucket_values_start[e];
-    const char* val = (const char*)ctx->macro_bucket_values_start[e];
+    const MacroEntry* def = &ctx->macros[src.bucket];
 
+    size_t vallen = def->value_end - def->value_start;
     return (Cuik_Define){
-        .loc = ctx->macro_bucket_source_locs[e],
-        .key = { keylen, key },
-        .value = { vallen, val },
+        .loc = def->loc,
+        .key = { def->key_length, (const char*)def->key },
+        .value = { vallen, (const char*)def->value_start },
     };
 }
 
 CUIK_API void cuikpp_dump(Cuik_CPP* ctx) {
-    int count = 0;
-
-    for (int i = 0; i < MACRO_BUCKET_COUNT; i++) {
-        for (int j = 0; j < ctx->macro_bucket_count[i]; j++) {
-            size_t e = (i * SLOTS_PER_MACRO_BUCKET) + j;
-
-            size_t keylen = ctx->macro_bucket_keys_length[e];
-            const char* key = (const char*)ctx->macro_bucket_keys[e];
+    for (size_t i = 0; i < ctx->macro_capacity; i++) {
+        if (!MACRO_SLOT_FULL(ctx, i)) continue;
 
-            size_t vallen = ctx->macro_bucket_values_end[e] - ctx->macro_bucket_values_start[e];
-            const char* val = (const char*)ctx->macro_bucket_values_start[e];
-
-            printf("  #define %.*s %.*s\n", (int)keylen, key, (int)vallen, val);
-        }
+        const MacroEntry* def = &ctx->macros[i];
+        size_t vallen = def->value_end - def->value_start;
 
-        count += ctx->macro_bucket_count[i];
+        printf("  #define %.*s %.*s\n", (int)def->key_length, def->key, (int)vallen, def->value_start);
     }
 
-    printf("\n// Macro defines active: %d\n", count);
+    printf("\n// Macro defines active: %zu\n", ctx->macro_count);
 }
 
 CUIK_API TokenStream cuikpp_run(Cuik_CPP* ctx, const char filepath[]) {
@@ -211,10 +216,39 @@ CUIK_API TokenStream cuikpp_run(Cuik_CPP* ctx, const char filepath[]) {
 
     TokenStream s = {0};
     s.filepath = filepath;
-    preprocess_file(ctx, &s, 0, 0, directory, filepath, 1);
 
-    Token t = {0, 0, NULL, NULL};
-    arrput(s.tokens, t);
+    if (ctx->snapshot != NULL) {
+        snapshot_copy_tokens(ctx->snapshot, &s);
+    }
+
+    CUIK_TIMED_BLOCK("cuikpp_run (include cache: %zu hits, %zu misses)", ctx->include_cache_hits, ctx->include_cache_misses) {
+        if (ctx->prefix_header != NULL) {
+            pch_run_prefix(ctx, &s);
+        }
+
+        // warm up the file & include caches for everything the main file might
+        // pull in while we walk it serially (see cpp_speculate.h)
+        SpeculativeScan* scan = NULL;
+        if (ctx->thread_pool != NULL && ctx->file_system == &cuik_default_fs) {
+            scan = speculate_includes(ctx, directory, filepath);
+        }
+
+        preprocess_file(ctx, &s, 0, 0, directory, filepath, 1);
+
+        if (scan != NULL) {
+            speculate_release(scan);
+        }
+    }
+
+    // the terminator just uses the first location, although that array might be
+    // empty since the tokens straight out of files don't go in there.
+    SourceLocIndex end_loc = 0;
+    if (arrlen(s.locations) == 0 && s.count > 0) {
+        end_loc = s.token_locs[s.count - 1];
+    }
+
+    Token t = {0, end_loc, NULL, NULL};
+    tokens_push(&s, t);
 
     return s;
 }
@@ -237,8 +271,7 @@ static void trim_the_shtuffs(Cuik_CPP* restrict c, void* new_top) {
     c->the_shtuffs_size = i;
 }
 
-static SourceLocIndex get_source_location(Cuik_CPP* restrict c, Lexer* restrict l, TokenStream* restrict s, SourceLocIndex parent_loc, SourceLocType loc_type) {
-    SourceLocIndex i = arrlen(s->locations);
+static SourceLine* get_source_line(Cuik_CPP* restrict c, Lexer* restrict l, SourceLocIndex parent_loc) {
     if (l->line_current == NULL) {
         l->line_current = l->start;
     }
@@ -249,7 +282,8 @@ static SourceLocIndex get_source_location(Cuik_CPP* restrict c, Lexer* restrict
     if (c->current_source_line == NULL ||
         c->current_source_line->filepath != l->filepath ||
         c->current_source_line->parent != parent_loc ||
-        c->current_source_line->line != l->current_line) {
+        c->current_source_line->line != l->current_line ||
+        c->current_source_line->line_str != l->line_current) {
         source_line = arena_alloc(&thread_arena, sizeof(SourceLine), _Alignof(SourceLine));
         source_line->filepath = l->filepath;
         source_line->line_str = l->line_current;
@@ -261,6 +295,13 @@ static SourceLocIndex get_source_location(Cuik_CPP* restrict c, Lexer* restrict
         source_line = c->current_source_line;
     }
 
+    return source_line;
+}
+
+static SourceLocIndex get_source_location(Cuik_CPP* restrict c, Lexer* restrict l, TokenStream* restrict s, SourceLocIndex parent_loc, SourceLocType loc_type) {
+    SourceLocIndex i = arrlen(s->locations);
+    SourceLine* source_line = get_source_line(c, l, parent_loc);
+
     ptrdiff_t columns = l->token_start - l->line_current;
     ptrdiff_t length = l->token_end - l->token_start;
     assert(columns >= 0 && columns < UINT_MAX && length >= 0 && length < UINT_MAX);
@@ -275,6 +316,31 @@ static SourceLocIndex get_source_location(Cuik_CPP* restrict c, Lexer* restrict
     return SOURCE_LOC_SET_TYPE(loc_type, i);
 }
 
+// for tokens which are read straight out of the file, the SourceLoc is only
+// made if someone asks for it (see cuik_get_location).
+static SourceLocIndex get_token_location(Cuik_CPP* restrict c, Lexer* restrict l, TokenStream* restrict s, SourceLocIndex parent_loc) {
+    SourceLine* source_line = get_source_line(c, l, parent_loc);
+
+    size_t i = arrlen(s->file_locs);
+    ptrdiff_t columns = l->token_start - l->line_current;
+    ptrdiff_t length = l->token_end - l->token_start;
+    assert(columns >= 0 && length >= 0);
+
+    // doesn't fit, it can just have a normal one
+    if (columns >= (1 << FILE_LOC_COLUMN_BITS) || length >= (1 << FILE_LOC_LENGTH_BITS) || i > SOURCE_LOC_GET_DATA(~0u)) {
+        return get_source_location(c, l, s, parent_loc, SOURCE_LOC_NORMAL);
+    }
+
+    size_t run_count = arrlen(s->file_runs);
+    if (run_count == 0 || s->file_runs[run_count - 1].line != source_line) {
+        FileLocRun run = { i, source_line };
+        arrput(s->file_runs, run);
+    }
+
+    arrput(s->file_locs, columns | (length << FILE_LOC_COLUMN_BITS));
+    return SOURCE_LOC_SET_TYPE(SOURCE_LOC_FILE, i);
+}
+
 static void push_scope(Cuik_CPP* restrict ctx, Lexer* restrict l, bool initial) {
     if (ctx->depth >= CPP_MAX_SCOPE_DEPTH - 1) {
         generic_error(l, "Exceeded max scope depth!");
@@ -290,17 +356,201 @@ static void pop_scope(Cuik_CPP* restrict ctx, Lexer* restrict l) {
     ctx->depth--;
 }
 
+// Process-wide memo of resolved #includes, (include kind, search paths, including
+// directory, name) -> canonical path. Most TUs in a project share the same
+// search paths so after the first one every header lookup is a hash probe.
+typedef struct ResolvedIncludeEntry {
+    char* key;
+    char* value;
+} ResolvedIncludeEntry;
+
+static once_flag resolved_includes_once = ONCE_FLAG_INIT;
+static mtx_t resolved_includes_mutex;
+static ResolvedIncludeEntry* resolved_includes;
+
+static void resolved_includes_init(void) {
+    mtx_init(&resolved_includes_mutex, mtx_plain);
+    sh_new_strdup(resolved_includes);
+}
+
+// identifies the search order (and file system) used to resolve includes
+static uint64_t get_include_dirs_signature(Cuik_CPP* restrict c) {
+    if (c->include_dirs_signature == 0) {
+        uint64_t hash = 0xcbf29ce484222325ull ^ (uintptr_t)c->file_system;
+
+        size_t num_system_include_dirs = arrlen(c->system_include_dirs);
+        for (size_t i = 0; i < num_system_include_dirs; i++) {
+            // include the null terminator so the boundaries are part of the hash
+            for (const char* p = c->system_include_dirs[i]; ; p++) {
+                hash ^= (uint8_t)*p;
+                hash *= 0x100000001b3ull;
+
+                if (*p == '\0') break;
+            }
+        }
+
+        c->include_dirs_signature = hash ? hash : 1;
+    }
+
+    return c->include_dirs_signature;
+}
+
+// returns the canonical path of the include or NULL if it couldn't be found, out_hit
+// is set if it came from the memo. This doesn't touch the preprocessor so the
+// speculative scanner can use it off-thread.
+static const char* search_include(const IncludeSearch* restrict search, const char* directory, const char* filename, bool is_lib_include, bool* out_hit) {
+    call_once(&resolved_includes_once, resolved_includes_init);
+
+    char key[FILENAME_MAX * 2 + 32];
+    snprintf(key, sizeof(key), "%c%016llx%s|%s", is_lib_include ? '<' : '"', (unsigned long long)search->signature, directory, filename);
+
+    mtx_lock(&resolved_includes_mutex);
+    ptrdiff_t memo = shgeti(resolved_includes, key);
+    char* result = memo >= 0 ? resolved_includes[memo].value : NULL;
+    mtx_unlock(&resolved_includes_mutex);
+
+    *out_hit = (result != NULL);
+    if (result != NULL) {
+        return result;
+    }
+
+    // Search for file in system libs
+    char path[FILENAME_MAX];
+    bool success = false;
+
+    if (!is_lib_include) {
+        // Try local includes
+        sprintf_s(path, FILENAME_MAX, "%s%s", directory, filename);
+        if (CUIK_CALL(search->file_system, get_file, true, path).found) success = true;
+    }
+
+    if (!success) {
+        for (size_t i = 0; i < search->dir_count; i++) {
+            sprintf_s(path, FILENAME_MAX, "%s%s", search->dirs[i], filename);
+
+            if (CUIK_CALL(search->file_system, get_file, true, path).found) {
+                success = true;
+                break;
+            }
+        }
+    }
+
+    if (!success && is_lib_include) {
+        // Try local includes
+        sprintf_s(path, FILENAME_MAX, "%s%s", directory, filename);
+        if (CUIK_CALL(search->file_system, get_file, true, path).found) {
+            success = true;
+        }
+    }
+
+    if (!success) {
+        return NULL;
+    }
+
+    // get me an absolute path, it's shared across the whole process
+    result = malloc(FILENAME_MAX);
+    CUIK_CALL(search->file_system, canonicalize, result, path);
+
+    mtx_lock(&resolved_includes_mutex);
+    memo = shgeti(resolved_includes, key);
+    if (memo >= 0) {
+        // someone else got here first
+        free(result);
+        result = resolved_includes[memo].value;
+    } else {
+        shput(resolved_includes, key, result);
+    }
+    mtx_unlock(&resolved_includes_mutex);
+
+    return result;
+}
+
+static const char* resolve_include(Cuik_CPP* restrict c, const char* directory, const char* filename, bool is_lib_include) {
+    IncludeSearch search = {
+        .file_system = c->file_system,
+        .dirs = c->system_include_dirs,
+        .dir_count = arrlen(c->system_include_dirs),
+        .signature = get_include_dirs_signature(c),
+    };
+
+    bool hit;
+    const char* result = search_include(&search, directory, filename, is_lib_include, &hit);
+    if (hit) {
+        c->include_cache_hits++;
+    } else {
+        c->include_cache_misses++;
+    }
+
+    return result;
+}
+
+CUIK_API void cuik_revalidate_fs_cache(void) {
+    call_once(&resolved_includes_once, resolved_includes_init);
+    bool changed = fs_cache_revalidate();
+
+    mtx_lock(&resolved_includes_mutex);
+    if (changed) {
+        // a header might resolve somewhere else now
+        shfree(resolved_includes);
+        sh_new_strdup(resolved_includes);
+    } else {
+        // includes from the main file are keyed by its (possibly relative) directory,
+        // the key is laid out like in search_include
+        for (ptrdiff_t i = 0; i < shlen(resolved_includes);) {
+            const char* key = resolved_includes[i].key;
+
+            if (is_relative_path(key + 17)) {
+                (void) shdel(resolved_includes, key);
+            } else {
+                i++;
+            }
+        }
+    }
+    mtx_unlock(&resolved_includes_mutex);
+}
+
+// tracks whether a file is entirely wrapped in a single #ifndef X ... #endif
+typedef enum {
+    // haven't seen anything but whitespace and comments
+    GUARD_START,
+    // inside the #ifndef X
+    GUARD_INSIDE,
+    // hit the matching #endif, anything past this point ruins it
+    GUARD_CLOSED,
+    // not include guarded
+    GUARD_NONE,
+} IncludeGuardState;
+
+// multiple-include optimization: if a file has a known include guard and the
+// controlling macro is still defined, reading it again would expand to nothing.
+static bool is_guarded_out(Cuik_CPP* restrict c, const char* path) {
+    ptrdiff_t search = shgeti(c->include_guards, path);
+    if (search < 0) {
+        return false;
+    }
+
+    IncludeGuard guard = c->include_guards[search].value;
+    return is_defined(c, guard.name, guard.length);
+}
+
 static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_t parent_entry, SourceLocIndex include_loc, const char* directory, const char* filepath, int depth) {
     // hacky but i don't wanna wrap it in a timed_block
     uint64_t timer_start = cuik_time_in_nanos();
 
+    IncludeGuardState guard_state = GUARD_START;
+    IncludeGuard guard = { 0 };
+    int guard_depth = 0;
+
     Cuik_File file = CUIK_CALL(c->file_system, get_file, false, filepath);
     if (!file.found) {
         panic("preprocessor error: could not read file! %s\n", filepath);
     }
 
-    // convert all the weird whitespace into something normal
-    remove_weird_whitespace(file.length, file.data);
+    // convert all the weird whitespace into something normal, shared buffers
+    // are already normalized (and read-only)
+    if (!file.is_shared) {
+        remove_weird_whitespace(file.length, file.data);
+    }
     unsigned char* text = (unsigned char*)file.data;
 
     size_t file_entry_id = dyn_array_length(c->files);
@@ -309,7 +559,8 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
         .depth = depth,
         .include_loc = include_loc,
         .filepath = filepath,
-        .content = text
+        .content = text,
+        .is_shared = file.is_shared,
     };
     dyn_array_put(c->files, file_entry);
 
@@ -318,35 +569,40 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
     do {
         l.hit_line = false;
 
-        if (l.token_type == TOKEN_IDENTIFIER) {
-            SourceLocIndex loc = get_source_location(c, &l, s, include_loc, SOURCE_LOC_NORMAL);
+        // anything outside of the #ifndef ... #endif pair means it's not guarded
+        if (guard_state == GUARD_CLOSED || (guard_state == GUARD_START && l.token_type != '#')) {
+            guard_state = GUARD_NONE;
+        }
 
+        if (l.token_type == TOKEN_IDENTIFIER) {
             if (!is_defined(c, l.token_start, l.token_end - l.token_start)) {
                 // FAST PATH
                 Token t = {
                     classify_ident(l.token_start, l.token_end - l.token_start),
-                    loc,
+                    get_token_location(c, &l, s, include_loc),
                     l.token_start, l.token_end,
                 };
-                arrput(s->tokens, t);
+                tokens_push(s, t);
 
                 lexer_read(&l);
             } else {
                 // SLOW PATH BECAUSE IT NEEDS TO SPAWN POSSIBLY METRIC SHIT LOADS
                 // OF TOKENS AND EXPAND WITH THE AVERAGE C PREPROCESSOR SPOOKIES
+                SourceLocIndex loc = get_source_location(c, &l, s, include_loc, SOURCE_LOC_NORMAL);
                 expand_ident(c, s, &l, loc);
             }
         } else if (l.token_type == TOKEN_DOUBLE_HASH) {
             int line = l.current_line;
             lexer_read(&l);
 
-            assert(arrlen(s->tokens) > 0);
-            Token* last = &s->tokens[arrlen(s->tokens) - 1];
-
-            expand_double_hash(c, s, last, &l, line);
+            expand_double_hash(c, s, &l, line);
         } else if (l.token_type == '#') {
             lexer_read(&l);
 
+            if (guard_state == GUARD_START && !lexer_match(&l, 6, "ifndef")) {
+                guard_state = GUARD_NONE;
+            }
+
             if (l.token_type == TOKEN_IDENTIFIER) {
                 if (lexer_match(&l, 2, "if")) {
                     SourceLocIndex loc = get_source_location(c, &l, s, include_loc, SOURCE_LOC_MACRO);
@@ -369,6 +625,12 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
                         generic_error(&l, "expected identifier!");
                     }
 
+                    if (guard_state == GUARD_START) {
+                        guard_state = GUARD_INSIDE;
+                        guard_depth = c->depth + 1;
+                        guard = (IncludeGuard){ l.token_start, l.token_end - l.token_start };
+                    }
+
                     if (!is_defined(c, l.token_start, l.token_end - l.token_start)) {
                         push_scope(c, &l, true);
                         lexer_read(&l);
@@ -397,6 +659,9 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
                     // if it didn't evaluate any of the other options
                     // do this
                     int last_scope = c->depth - 1;
+                    if (guard_state == GUARD_INSIDE && c->depth == guard_depth) {
+                        guard_state = GUARD_NONE;
+                    }
 
                     if (!c->scope_eval[last_scope]) {
                         c->scope_eval[last_scope] = true;
@@ -412,6 +677,9 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
                     // if it didn't evaluate any of the other options
                     // try to do this
                     int last_scope = c->depth - 1;
+                    if (guard_state == GUARD_INSIDE && c->depth == guard_depth) {
+                        guard_state = GUARD_NONE;
+                    }
 
                     if (!c->scope_eval[last_scope] && eval(c, s, &l, loc)) {
                         c->scope_eval[last_scope] = true;
@@ -430,6 +698,10 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
                         while (!l.hit_line) lexer_read(&l);
                     }
 
+                    if (guard_state == GUARD_INSIDE && c->depth == guard_depth) {
+                        guard_state = GUARD_CLOSED;
+                    }
+
                     pop_scope(c, &l);
                 } else if (lexer_match(&l, 6, "define")) {
                     lexer_read(&l);
@@ -439,20 +711,13 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
                         generic_error(&l, "expected identifier!");
                     }
 
-                    // Hash name
-                    uint64_t slot = hash_ident(l.token_start, l.token_end - l.token_start);
-                    uint64_t e = c->macro_bucket_count[slot] + (slot * SLOTS_PER_MACRO_BUCKET);
-
-                    // Insert into buckets
-                    if (c->macro_bucket_count[slot] >= SLOTS_PER_MACRO_BUCKET) {
+                    // redefinitions replace the old entry
+                    size_t token_length = l.token_end - l.token_start;
+                    MacroEntry* def = insert_define(c, l.token_start, token_length);
+                    if (def == NULL) {
                         generic_error(&l, "cannot store macro, out of memory!");
                     }
-
-                    c->macro_bucket_count[slot] += 1;
-                    c->macro_bucket_keys[e] = l.token_start;
-
-                    size_t token_length = l.token_end - l.token_start;
-                    c->macro_bucket_keys_length[e] = token_length;
+                    def->key = l.token_start;
 
                     // if there's a parenthesis directly after the identifier
                     // it's a macro function
@@ -484,15 +749,12 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
                     }
 
                     const unsigned char* start = l.token_start;
-                    const unsigned char* end = l.token_start;
-                    while (!l.hit_line) {
-                        end = l.token_end;
-                        lexer_read(&l);
-                    }
+                    const unsigned char* end;
+                    def->body = compile_macro_body(c, def->key + token_length, &l, &end);
 
-                    c->macro_bucket_values_start[e] = start;
-                    c->macro_bucket_values_end[e] = end;
-                    c->macro_bucket_source_locs[e] = macro_loc;
+                    def->value_start = start;
+                    def->value_end = end;
+                    def->loc = macro_loc;
                 } else if (lexer_match(&l, 7, "include")) {
                     SourceLocIndex new_include_loc = get_source_location(c, &l, s, include_loc, SOURCE_LOC_NORMAL);
                     lexer_read(&l);
@@ -529,25 +791,25 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
 
                         lexer_read(&l);
                     } else {
-                        size_t old_tokens_length = arrlen(s->tokens);
+                        size_t old_tokens_length = tokens_count(s);
                         s->current = old_tokens_length;
 
                         expand(c, s, &l, new_include_loc);
-                        assert(s->current != arrlen(s->tokens) && "Expected the macro expansion to add something");
+                        assert(s->current != tokens_count(s) && "Expected the macro expansion to add something");
 
                         // Insert a null token at the end
                         Token t = {0, arrlen(s->locations) - 1, NULL, NULL};
-                        arrput(s->tokens, t);
+                        tokens_push(s, t);
 
-                        if (tokens_get(s)->type == TOKEN_STRING_DOUBLE_QUOTE) {
-                            Token* t = tokens_get(s);
-                            size_t len = (t->end - t->start) - 2;
+                        if (tokens_get_type(s) == TOKEN_STRING_DOUBLE_QUOTE) {
+                            Token t = tokens_get(s);
+                            size_t len = (t.end - t.start) - 2;
                             if (len > MAX_PATH) {
-                                report(REPORT_ERROR, NULL, s, t->location, "Filename too long");
+                                report(REPORT_ERROR, NULL, s, t.location, "Filename too long");
                                 abort();
                             }
 
-                            memcpy(filename, t->start + 1, len);
+                            memcpy(filename, t.start + 1, len);
                             filename[len] = '\0';
 
                             tokens_next(s);
@@ -556,53 +818,22 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
                         }
 
                         // reset token stream
-                        arrsetlen(s->tokens, old_tokens_length);
+                        tokens_truncate(s, old_tokens_length);
                         s->current = 0;
                     }
 
-                    // Search for file in system libs
-                    char path[FILENAME_MAX];
-                    bool success = false;
-
-                    if (!is_lib_include) {
-                        // Try local includes
-                        sprintf_s(path, FILENAME_MAX, "%s%s", directory, filename);
-                        if (CUIK_CALL(c->file_system, get_file, true, path).found) success = true;
-                    }
-
-                    if (!success) {
-                        size_t num_system_include_dirs = arrlen(c->system_include_dirs);
-
-                        for (size_t i = 0; i < num_system_include_dirs; i++) {
-                            sprintf_s(path, FILENAME_MAX, "%s%s", c->system_include_dirs[i], filename);
-
-                            if (CUIK_CALL(c->file_system, get_file, true, path).found) {                                success = true;
-                                break;
-                            }
-                        }
-                    }
-
-                    if (!success && is_lib_include) {
-                        // Try local includes
-                        sprintf_s(path, FILENAME_MAX, "%s%s", directory, filename);
-                        if (CUIK_CALL(c->file_system, get_file, true, path).found) {
-                            success = true;
-                        }
-                    }
-
-                    if (!success) {
+                    const char* new_path = resolve_include(c, directory, (const char*)filename, is_lib_include);
+                    if (new_path == NULL) {
                         int loc = l.current_line;
                         fprintf(stderr, "error %s:%d: Could not find file! %s\n", l.filepath, loc, filename);
                         abort();
                     }
                     tls_restore(filename);
 
-                    // get me an absolute path
-                    char* new_path = arena_alloc(&thread_arena, FILENAME_MAX, 1);
-                    CUIK_CALL(c->file_system, canonicalize, new_path, path);
-
                     ptrdiff_t search = shgeti(c->include_once, new_path);
-                    if (search < 0) {
+                    if (depth == 1 && c->skip_includes > 0) {
+                        snapshot_skip_include(c, s, new_include_loc);
+                    } else if (search < 0 && !is_guarded_out(c, new_path)) {
                         // TODO(NeGate): Remove these heap allocations later
                         // they're... evil!!!
                         char* new_dir = strdup(new_path);
@@ -624,6 +855,11 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
 
                         preprocess_file(c, s, file_entry_id, new_include_loc, new_dir, new_path, depth + 1);
                     }
+
+                    if (depth == 1 && c->stop_includes > 0) {
+                        arrput(c->include_locs, new_include_loc);
+                        if (--c->stop_includes == 0) break;
+                    }
                 } else if (lexer_match(&l, 6, "pragma")) {
                     lexer_read(&l);
 
@@ -649,13 +885,13 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
                         unsigned char* str = gimme_the_shtuffs(c, sizeof("_Pragma"));
                         memcpy(str, "_Pragma", sizeof("_Pragma"));
                         Token t = (Token){TOKEN_KW_Pragma, loc, str, str + 7};
-                        arrput(s->tokens, t);
+                        tokens_push(s, t);
 
                         str = gimme_the_shtuffs(c, sizeof("("));
                         str[0] = '(';
                         str[1] = 0;
                         t = (Token){'(', loc, str, str + 1};
-                        arrput(s->tokens, t);
+                        tokens_push(s, t);
 
                         // Skip until we hit a newline
                         assert(!l.hit_line);
@@ -690,7 +926,7 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
                                 loc,
                                 str, curr - 1,
                             };
-                            arrput(s->tokens, t);
+                            tokens_push(s, t);
                         }
 
                         str = gimme_the_shtuffs(c, sizeof(")"));
@@ -701,7 +937,7 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
                             loc,
                             str, str + 1,
                         };
-                        arrput(s->tokens, t);
+                        tokens_push(s, t);
                     }
                 } else if (lexer_match(&l, 5, "undef")) {
                     lexer_read(&l);
@@ -715,31 +951,7 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
 
                     lexer_read(&l);
 
-                    // Hash name
-                    uint64_t slot = hash_ident(start, length);
-                    uint64_t base = slot * SLOTS_PER_MACRO_BUCKET;
-                    uint64_t count = c->macro_bucket_count[slot];
-
-                    // TODO(NeGate): We might wanna invest into a faster data structure.
-                    for (size_t i = 0; i < count; i++) {
-                        uint64_t e = base + i;
-
-                        if (c->macro_bucket_keys_length[e] == length &&
-                            memcmp(c->macro_bucket_keys[e], start, length) == 0) {
-                            // remove swap
-                            uint64_t last = base + (count - 1);
-
-                            if (i != last) {
-                                c->macro_bucket_keys_length[e] = c->macro_bucket_keys_length[last];
-                                c->macro_bucket_keys[e] = c->macro_bucket_keys[last];
-                                c->macro_bucket_values_start[e] = c->macro_bucket_values_start[last];
-                                c->macro_bucket_values_end[e] = c->macro_bucket_values_end[last];
-                                c->macro_bucket_source_locs[e] = c->macro_bucket_source_locs[last];
-                            }
-                            c->macro_bucket_count[slot]--;
-                            break;
-                        }
-                    }
+                    remove_define(c, start, length);
                 } else if (lexer_match(&l, 7, "warning")) {
                     lexer_read(&l);
 
@@ -776,16 +988,20 @@ static void preprocess_file(Cuik_CPP* restrict c, TokenStream* restrict s, size_
         } else {
             Token t = {
                 l.token_type,
-                get_source_location(c, &l, s, include_loc, SOURCE_LOC_NORMAL),
+                get_token_location(c, &l, s, include_loc),
                 l.token_start,
                 l.token_end,
             };
 
-            arrput(s->tokens, t);
+            tokens_push(s, t);
             lexer_read(&l);
         }
     } while (l.token_type);
 
+    if (guard_state == GUARD_CLOSED) {
+        shput(c->include_guards, (char*)filepath, guard);
+    }
+
     {
         char temp[256];
         snprintf(temp, sizeof(temp), "preprocess: %s", filepath);
@@ -1,13 +1,87 @@
-static Lexer make_temporary_lexer(const unsigned char* start) {
-    return (Lexer){"<temp>", start, start, 1};
+// the top level commas between macro arguments are tagged with this
+#define MACRO_ARG_SEPARATOR (-2)
+
+// replays the tokens of an expansion of the macro at def_index, the body text
+// is kept around so the tokens which came from it get their columns right.
+static Lexer make_replay_lexer(Cuik_CPP* restrict c, size_t def_index, const MacroToken* tokens, size_t count) {
+    return (Lexer){
+        "<temp>", c->macros[def_index].value_start, c->macros[def_index].value_end, 1,
+        .replay = tokens, .replay_end = tokens + count
+    };
 }
 
-static Token* get_last_token(TokenStream* restrict s) {
-    assert(arrlen(s->tokens) > 0);
-    return &s->tokens[arrlen(s->tokens) - 1];
+// writes out the spliced tokens of a function-like expansion as one line of text,
+// the tokens are moved to point into it. It's what diagnostics show when they
+// point into the expansion (with the argument tokens in place).
+static Lexer render_expansion(Cuik_CPP* restrict c, MacroToken* tokens, size_t count) {
+    size_t length = 1;
+    for (size_t i = 0; i < count; i++) {
+        length += tokens[i].length + 1;
+    }
+
+    unsigned char* out_start = gimme_the_shtuffs(c, length);
+    unsigned char* out = out_start;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(out, tokens[i].start, tokens[i].length);
+        tokens[i].start = out;
+
+        out += tokens[i].length;
+        *out++ = ' ';
+    }
+    *out++ = '\0';
+    trim_the_shtuffs(c, out);
+
+    return (Lexer){
+        "<temp>", out_start, out - 1, 1,
+        .replay = tokens, .replay_end = tokens + count
+    };
+}
+
+// #x on a macro argument, the spacing between the tokens is kept but comments and
+// newlines are dropped.
+static MacroToken stringify_tokens(Cuik_CPP* restrict c, size_t count, const MacroToken* tokens) {
+    size_t max_length = 3;
+    for (size_t i = 0; i < count; i++) {
+        max_length += 1 + (tokens[i].length * 2);
+    }
+
+    unsigned char* out_start = gimme_the_shtuffs(c, max_length);
+    unsigned char* out = out_start;
+
+    *out++ = '\"';
+    for (size_t i = 0; i < count; i++) {
+        const MacroToken* t = &tokens[i];
+        if (i > 0 && tokens[i - 1].start + tokens[i - 1].length != t->start) {
+            *out++ = ' ';
+        }
+
+        // Removes any funky characters like " into \"
+        // in string and character literals
+        bool is_literal = (t->type == TOKEN_STRING_SINGLE_QUOTE || t->type == TOKEN_STRING_DOUBLE_QUOTE ||
+                           t->type == TOKEN_STRING_WIDE_SINGLE_QUOTE || t->type == TOKEN_STRING_WIDE_DOUBLE_QUOTE);
+
+        for (size_t j = 0; j < t->length; j++) {
+            if (is_literal && (t->start[j] == '\"' || t->start[j] == '\\')) {
+                *out++ = '\\';
+            }
+
+            *out++ = t->start[j];
+        }
+    }
+    *out++ = '\"';
+    *out++ = '\0';
+    trim_the_shtuffs(c, out);
+
+    return (MacroToken){ TOKEN_STRING_DOUBLE_QUOTE, -1, (out - 1) - out_start, out_start };
 }
 
-static void expand_double_hash(Cuik_CPP* restrict c, TokenStream* restrict s, Token* last, Lexer* restrict l, SourceLocIndex loc) {
+// replaces the last token in the stream with the concatenation of itself
+// and the next token in the lexer.
+static void expand_double_hash(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* restrict l, SourceLocIndex loc) {
+    assert(tokens_count(s) > 0);
+    size_t last_index = tokens_count(s) - 1;
+    Token last = tokens_at(s, last_index);
+
     unsigned char* out_start = gimme_the_shtuffs(c, 256);
     unsigned char* out = out_start;
 
@@ -16,8 +90,8 @@ static void expand_double_hash(Cuik_CPP* restrict c, TokenStream* restrict s, To
     {
         // TODO(NeGate): possible buffer overflow here
         // with unchecked memcpys on static and small allocation
-        memcpy(out, last->start, last->end - last->start);
-        out += last->end - last->start;
+        memcpy(out, last.start, last.end - last.start);
+        out += last.end - last.start;
 
         memcpy(out, l->token_start, l->token_end - l->token_start);
         out += l->token_end - l->token_start;
@@ -35,23 +109,23 @@ static void expand_double_hash(Cuik_CPP* restrict c, TokenStream* restrict s, To
     // make nice joined token
     if (tmp_lex.token_type == TOKEN_IDENTIFIER) {
         if (!is_defined(c, tmp_lex.token_start, tmp_lex.token_end - tmp_lex.token_start)) {
-            *last = (Token){
+            tokens_set(s, last_index, (Token){
                 classify_ident(tmp_lex.token_start, tmp_lex.token_end - tmp_lex.token_start),
                 loc,
                 tmp_lex.token_start,
                 tmp_lex.token_end,
-            };
+            });
         } else {
-            arrdelswap(s->tokens, arrlen(s->tokens) - 1);
+            tokens_truncate(s, last_index);
             expand_ident(c, s, &tmp_lex, loc);
         }
     } else {
-        *last = (Token){
+        tokens_set(s, last_index, (Token){
             tmp_lex.token_type,
             loc,
             tmp_lex.token_start,
             tmp_lex.token_end,
-        };
+        });
     }
     lexer_read(&tmp_lex);
 
@@ -104,7 +178,7 @@ static void expand_ident(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l
             get_source_location(c, l, s, parent_loc, SOURCE_LOC_NORMAL),
             out_start,
             out};
-        arrput(s->tokens, t);
+        tokens_push(s, t);
         lexer_read(l);
     } else if (lexer_match(l, 8, "__LINE__")) {
         // line number as a string
@@ -117,7 +191,7 @@ static void expand_ident(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l
             get_source_location(c, l, s, parent_loc, SOURCE_LOC_NORMAL),
             out,
             out + length};
-        arrput(s->tokens, t);
+        tokens_push(s, t);
         lexer_read(l);
     } else if (lexer_match(l, 7, "defined")) {
         lexer_read(l);
@@ -160,12 +234,10 @@ static void expand_ident(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l
             get_source_location(c, l, s, parent_loc, SOURCE_LOC_NORMAL),
             out,
             out + 1};
-        arrput(s->tokens, t);
+        tokens_push(s, t);
     } else {
         size_t def_i;
         if (find_define(c, &def_i, token_data, token_length)) {
-            int line_of_expansion = l->current_line;
-
             SourceLocIndex expanded_loc = get_source_location(c, l, s,
                                                               parent_loc,
                                                               SOURCE_LOC_MACRO);
@@ -173,50 +245,37 @@ static void expand_ident(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l
             // Identify macro definition
             lexer_read(l);
 
-            String def = string_from_range(c->macro_bucket_values_start[def_i],
-                                           c->macro_bucket_values_end[def_i]);
-
-            const unsigned char* args = c->macro_bucket_keys[def_i] + c->macro_bucket_keys_length[def_i];
+            const MacroBody* def = c->macros[def_i].body;
 
             // Sometimes we have a layer of indirection when doing
             // preprocessor expansion:
             //   #define PEAR(X) X;
             //   #define APPLE PEAR
             //   APPLE(int a)
-            while (def.length && *args != '(' && l->token_type == '(') {
-                // expand and append
-                Lexer temp_lex = (Lexer){l->filepath, def.data, def.data};
-                lexer_read(&temp_lex);
-
-                size_t token_length = temp_lex.token_end - temp_lex.token_start;
-                const unsigned char* token_data = temp_lex.token_start;
-
-                if (!find_define(c, &def_i, token_data, token_length)) break;
+            while (def->count && def->param_count < 0 && l->token_type == '(') {
+                const MacroToken* first = &def->tokens[0];
+                if (!find_define(c, &def_i, first->start, first->length)) break;
 
-                def = string_from_range(c->macro_bucket_values_start[def_i],
-                                        c->macro_bucket_values_end[def_i]);
-
-                args = c->macro_bucket_keys[def_i] + c->macro_bucket_keys_length[def_i];
+                def = c->macros[def_i].body;
             }
 
             // function macro
-            if (*args == '(' && l->token_type == '(') {
+            if (def->param_count >= 0 && l->token_type == '(') {
                 ////////////////////////////////
-                // Parse the parameters into a map
+                // Collect the arguments
                 ////////////////////////////////
-                // make the start and end of the params, interleaved
-                // start: value_ranges[i*2 + 0], end: value_ranges[i*2 + 1]
-                const unsigned char** value_ranges = tls_save();
+                // the top level commas are kept (they're needed when
+                // the arguments get slapped into __VA_ARGS__) but they're
+                // tagged so we can find where each argument starts.
+                MacroToken* arg_tokens = tls_save();
+                size_t arg_token_count = 0;
                 int value_count = 0;
 
                 lexer_read(l);
                 while (l->token_type != ')') {
-                    tls_push(2 * sizeof(const unsigned char*));
-                    int i = value_count++;
+                    value_count++;
 
                     int paren_depth = 0;
-                    const unsigned char* start = l->token_start;
-                    const unsigned char* end = l->token_start;
                     while (true) {
                         if (l->token_type == '(') {
                             paren_depth++;
@@ -227,230 +286,107 @@ static void expand_ident(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l
                             if (paren_depth == 0) break;
                         }
 
-                        end = l->token_end;
+                        tls_push(sizeof(MacroToken));
+                        arg_tokens[arg_token_count++] = (MacroToken){ l->token_type, -1, l->token_end - l->token_start, l->token_start };
                         lexer_read(l);
                     }
 
-                    value_ranges[i * 2 + 0] = start;
-                    value_ranges[i * 2 + 1] = end;
-
-                    if (l->token_type == ',') lexer_read(l);
+                    if (l->token_type == ',') {
+                        tls_push(sizeof(MacroToken));
+                        arg_tokens[arg_token_count++] = (MacroToken){ ',', MACRO_ARG_SEPARATOR, 1, l->token_start };
+                        lexer_read(l);
+                    }
                     l->hit_line = false;
                 }
                 expect(l, ')');
 
                 // We dont need to parse this part if it expands into nothing
-                if (def.length) {
-                    // Parse macro function arg names
-                    const unsigned char** key_ranges = tls_save();
-                    int key_count = 0;
-                    bool has_varargs = false;
-
-                    {
-                        Lexer arg_lex = (Lexer){l->filepath, args, args};
-                        lexer_read(&arg_lex);
-                        expect(&arg_lex, '(');
-
-                        while (arg_lex.token_type != ')') {
-                            if (key_count) {
-                                expect(&arg_lex, ',');
-                            }
-
-                            if (arg_lex.token_type == TOKEN_TRIPLE_DOT) {
-                                has_varargs = true;
-                                lexer_read(&arg_lex);
-                                break;
-                            } else if (arg_lex.token_type == TOKEN_IDENTIFIER) {
-                                tls_push(2 * sizeof(const unsigned char*));
-
-                                int i = key_count++;
-                                key_ranges[i * 2 + 0] = arg_lex.token_start;
-                                key_ranges[i * 2 + 1] = arg_lex.token_end;
-
-                                lexer_read(&arg_lex);
-                            } else {
-                                generic_error(&arg_lex, "expected identifier or ...!");
-                            }
+                if (def->count) {
+                    // arg_bounds[i + 1] is the separator after the i-th argument
+                    size_t* arg_bounds = tls_push((value_count + 1) * sizeof(size_t));
+                    arg_bounds[value_count] = arg_token_count;
+
+                    int sep_count = 0;
+                    for (size_t i = 0; i < arg_token_count && sep_count < value_count; i++) {
+                        if (arg_tokens[i].param == MACRO_ARG_SEPARATOR) {
+                            arg_bounds[++sep_count] = i;
                         }
-
-                        expect(&arg_lex, ')');
                     }
 
                     ////////////////////////////////
-                    // Stream over the text hoping
-                    // to replace some identifiers
-                    // then expand the result one
-                    // more time
+                    // Splice the arguments into the body,
+                    // the result is expanded one more time
                     ////////////////////////////////
-                    unsigned char* temp_expansion_start = gimme_the_shtuffs(c, 4096);
-                    unsigned char* temp_expansion = temp_expansion_start;
+                    MacroToken* out = tls_save();
+                    size_t out_count = 0;
 
-                    Lexer def_lex = (Lexer){l->filepath, def.data, def.data, line_of_expansion};
-                    lexer_read(&def_lex);
+                    int key_count = def->param_count;
 
                     // set when a # happens, we expect a macro parameter afterwards
                     bool as_string = false;
-                    while (!def_lex.hit_line) {
-                        // shadowing...
-                        size_t token_length = def_lex.token_end - def_lex.token_start;
-                        const unsigned char* token_data = def_lex.token_start;
+                    for (size_t i = 0; i < def->count; i++) {
+                        const MacroToken* t = &def->tokens[i];
 
-                        if (def_lex.token_type == TOKEN_HASH) {
+                        if (t->type == TOKEN_HASH) {
                             // TODO(NeGate): Error message
                             if (as_string) abort();
 
                             as_string = true;
-                            lexer_read(&def_lex);
                             continue;
                         }
 
-                        if (def_lex.token_type == TOKEN_COMMA) {
-                            // we case our idea was dumb :p
-                            unsigned char* fallback = temp_expansion;
-
-                            *temp_expansion++ = ',';
-                            *temp_expansion++ = ' ';
-
-                            lexer_read(&def_lex);
-
-                            if (has_varargs &&
-                                token_length == sizeof("__VA_ARGS__") - 1 &&
-                                memcmp(token_data, "__VA_ARGS__", sizeof("__VA_ARGS__") - 1) == 0 &&
-                                key_count == value_count) {
-                                // we remove the comma since there's no varargs to chew
-                                temp_expansion = fallback;
+                        if (t->param < 0) {
+                            if (t->type != TOKEN_COMMA && t->type != TOKEN_IDENTIFIER) {
+                                // TODO(NeGate): Error message
+                                if (as_string) abort();
+                            } else if (t->type == TOKEN_IDENTIFIER && as_string) {
+                                // TODO(NeGate): Error message
+                                tls_push(sizeof(MacroToken));
+                                out[out_count++] = (MacroToken){ TOKEN_HASH, -1, 1, (const unsigned char*)"#" };
                             }
 
-                            continue;
-                        } else if (def_lex.token_type != TOKEN_IDENTIFIER) {
-                            // TODO(NeGate): Error message
-                            if (as_string) abort();
-
-                            memcpy(temp_expansion, token_data, token_length);
-                            temp_expansion += token_length;
-                            *temp_expansion++ = ' ';
-
-                            lexer_read(&def_lex);
+                            tls_push(sizeof(MacroToken));
+                            out[out_count++] = *t;
                             continue;
                         }
 
-                        if (has_varargs &&
-                            token_length == sizeof("__VA_ARGS__") - 1 &&
-                            memcmp(token_data, "__VA_ARGS__", sizeof("__VA_ARGS__") - 1) == 0) {
-                            *temp_expansion++ = ' ';
-
-                            // Just slap all the arguments that are after the 'key_count'
-                            if (key_count != value_count) {
-                                for (size_t i = key_count; i < value_count; i++) {
-                                    const unsigned char* end = value_ranges[i * 2 + 1];
-                                    const unsigned char* start = value_ranges[i * 2 + 0];
-                                    size_t count = end - start;
-
-                                    // slap a comma between var args
-                                    if (i != key_count) {
-                                        *temp_expansion++ = ',';
-                                        *temp_expansion++ = ' ';
-                                    }
-
-                                    for (size_t j = 0; j < count; j++) {
-                                        if (start[j] == '\r' || start[j] == '\n') {
-                                            *temp_expansion++ = ' ';
-                                        } else {
-                                            *temp_expansion++ = start[j];
-                                        }
-                                    }
-                                    *temp_expansion++ = ' ';
-                                }
-                            } else {
-                                // walk back any spaces to find a comma
-                                // if we find one, we should delete it
-                                unsigned char* p = temp_expansion - 1;
-                                while (p != temp_expansion_start) {
-                                    if (*p == ',') {
-                                        *p = ' ';
-                                        break;
-                                    } else if (*p != ' ')
-                                        break;
-
-                                    p--;
-                                }
-                            }
-                        } else {
-                            int index = -1;
-                            for (size_t i = 0; i < key_count; i++) {
-                                size_t key_length = key_ranges[i * 2 + 1] - key_ranges[i * 2 + 0];
-                                const unsigned char* key = key_ranges[i * 2 + 0];
-
-                                if (token_length == key_length &&
-                                    memcmp(key, token_data, token_length) == 0) {
-                                    index = i;
-                                    break;
+                        // figure out which tokens we're slapping in
+                        size_t start = 0, end = 0;
+                        if (t->param == key_count) {
+                            // __VA_ARGS__ is all the arguments after 'key_count'
+                            if (key_count < value_count) {
+                                start = key_count > 0 ? arg_bounds[key_count] + 1 : 0;
+                                end = arg_bounds[value_count];
+                            } else if (key_count == value_count && !as_string) {
+                                // we remove the comma since there's no varargs to chew
+                                if (out_count > 0 && out[out_count - 1].type == TOKEN_COMMA) {
+                                    out_count--;
+                                    tls_restore(&out[out_count]);
                                 }
+                                continue;
                             }
+                        } else if (t->param < value_count) {
+                            start = t->param > 0 ? arg_bounds[t->param] + 1 : 0;
+                            end = arg_bounds[t->param + 1];
+                        }
 
-                            if (index >= 0) {
-                                const unsigned char* end = value_ranges[index * 2 + 1];
-                                const unsigned char* start = value_ranges[index * 2 + 0];
-                                size_t count = end - start;
-
-                                // Removes any funky characters like " into \"
-                                // when stringifying
-                                if (as_string) {
-                                    *temp_expansion++ = '\"';
-                                    for (size_t i = 0; i < count; i++) {
-                                        if (start[i] == '\r' || start[i] == '\n') {
-                                            *temp_expansion++ = ' ';
-                                        } else if (start[i] == '\"' && as_string) {
-                                            if (i == 0 || (i > 0 && start[i - 1] != '\\')) {
-                                                *temp_expansion++ = '\\';
-                                                *temp_expansion++ = '\"';
-                                            }
-                                        } else {
-                                            *temp_expansion++ = start[i];
-                                        }
-                                    }
-                                    *temp_expansion++ = '\"';
-                                    *temp_expansion++ = ' ';
-                                } else {
-                                    for (size_t i = 0; i < count; i++) {
-                                        if (start[i] == '\r' || start[i] == '\n') {
-                                            *temp_expansion++ = ' ';
-                                        } else {
-                                            *temp_expansion++ = start[i];
-                                        }
-                                    }
-                                    *temp_expansion++ = ' ';
-                                }
-
-                                as_string = false;
-                            } else {
-                                // TODO(NeGate): Error message
-                                if (as_string) *temp_expansion++ = '#';
-
-                                for (size_t i = 0; i < token_length; i++) {
-                                    if (token_data[i] == '\r' || token_data[i] == '\n') {
-                                        *temp_expansion++ = ' ';
-                                    } else {
-                                        *temp_expansion++ = token_data[i];
-                                    }
-                                }
-                                *temp_expansion++ = ' ';
-                            }
+                        if (as_string) {
+                            tls_push(sizeof(MacroToken));
+                            out[out_count++] = stringify_tokens(c, end - start, &arg_tokens[start]);
+                        } else if (end > start) {
+                            tls_push((end - start) * sizeof(MacroToken));
+                            memcpy(&out[out_count], &arg_tokens[start], (end - start) * sizeof(MacroToken));
+                            out_count += end - start;
                         }
 
-                        lexer_read(&def_lex);
+                        as_string = false;
                     }
 
-                    *temp_expansion++ = '\0';
-                    trim_the_shtuffs(c, temp_expansion);
-
-                    if (temp_expansion_start != temp_expansion) {
+                    if (out_count) {
                         // expand and append
-                        Lexer temp_lex = make_temporary_lexer(temp_expansion_start);
+                        Lexer temp_lex = render_expansion(c, out, out_count);
                         lexer_read(&temp_lex);
 
-                        *temp_expansion++ = '\0';
-
                         // macro hide set
                         size_t hidden = hide_macro(c, def_i);
                         expand(c, s, &temp_lex, expanded_loc);
@@ -458,10 +394,10 @@ static void expand_ident(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l
                     }
                 }
 
-                tls_restore(value_ranges);
-            } else if (def.length) {
+                tls_restore(arg_tokens);
+            } else if (def->count) {
                 // expand and append
-                if (*args == '(' && l->token_type != '(') {
+                if (def->param_count >= 0 && l->token_type != '(') {
                     Token t = {
                         classify_ident(token_data, token_length),
                         expanded_loc,
@@ -469,9 +405,9 @@ static void expand_ident(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l
                         token_data + token_length,
                     };
 
-                    arrput(s->tokens, t);
+                    tokens_push(s, t);
                 } else {
-                    Lexer temp_lex = make_temporary_lexer(def.data);
+                    Lexer temp_lex = make_replay_lexer(c, def_i, def->tokens, def->count);
                     lexer_read(&temp_lex);
 
                     size_t hidden = hide_macro(c, def_i);
@@ -490,7 +426,7 @@ static void expand_ident(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l
                 token_data + token_length,
             };
 
-            arrput(s->tokens, t);
+            tokens_push(s, t);
             lexer_read(l);
         }
     }
@@ -508,8 +444,7 @@ static void expand(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l, Sour
             SourceLocIndex loc = get_source_location(c, l, s, parent_loc, SOURCE_LOC_NORMAL);
             lexer_read(l);
 
-            Token* last = get_last_token(s);
-            expand_double_hash(c, s, last, l, loc);
+            expand_double_hash(c, s, l, loc);
         } else if (l->token_type != TOKEN_IDENTIFIER) {
             Token t = {
                 l->token_type,
@@ -518,7 +453,7 @@ static void expand(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l, Sour
                 l->token_end,
             };
 
-            arrput(s->tokens, t);
+            tokens_push(s, t);
             lexer_read(l);
         } else {
             expand_ident(c, s, l, parent_loc);
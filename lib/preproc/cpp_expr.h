@@ -3,25 +3,26 @@ static intmax_t eval_l13(Cuik_CPP* restrict c, TokenStream* restrict s);
 static intmax_t eval(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l, SourceLocIndex parent_loc) {
     // Expand
     if (l) {
-        size_t old_tokens_length = arrlen(s->tokens);
+        size_t old_tokens_length = tokens_count(s);
         s->current = old_tokens_length;
 
         expand(c, s, l, SOURCE_LOC_SET_TYPE(SOURCE_LOC_UNKNOWN, 0));
-        assert(s->current != arrlen(s->tokens) && "Expected the macro expansion to add something");
+        assert(s->current != tokens_count(s) && "Expected the macro expansion to add something");
 
-        /*for (size_t k = old_tokens_length; k < arrlen(s->tokens); k++) {
-            printf("%.*s ", (int)(s->tokens[k].end - s->tokens[k].start), s->tokens[k].start);
+        /*for (size_t k = old_tokens_length; k < tokens_count(s); k++) {
+            Token t = tokens_at(s, k);
+            printf("%.*s ", (int)(t.end - t.start), t.start);
         }
         printf("\n\n");*/
 
         // Insert a null token at the end
         Token t = {0, arrlen(s->locations) - 1, NULL, NULL};
-        arrput(s->tokens, t);
+        tokens_push(s, t);
 
         // Evaluate
         intmax_t result = eval_l13(c, s);
 
-        arrsetlen(s->tokens, old_tokens_length);
+        tokens_truncate(s, old_tokens_length);
         s->current = 0;
         return result;
     } else {
@@ -31,46 +32,46 @@ static intmax_t eval(Cuik_CPP* restrict c, TokenStream* restrict s, Lexer* l, So
 
 static intmax_t eval_l0(Cuik_CPP* restrict c, TokenStream* restrict s) {
     bool flip = false;
-    while (tokens_get(s)->type == '!') {
+    while (tokens_get_type(s) == '!') {
         flip = !flip;
         tokens_next(s);
     }
 
     intmax_t val;
-    Token* t = tokens_get(s);
-    if (t->type == TOKEN_INTEGER) {
+    Token t = tokens_get(s);
+    if (t.type == TOKEN_INTEGER) {
         Cuik_IntSuffix suffix;
-        val = parse_int(t->end - t->start, (const char*)t->start, &suffix);
+        val = parse_int(t.end - t.start, (const char*)t.start, &suffix);
 
         tokens_next(s);
-    } else if (t->type == TOKEN_IDENTIFIER) {
-        assert(!is_defined(c, t->start, t->end - t->start));
+    } else if (t.type == TOKEN_IDENTIFIER) {
+        assert(!is_defined(c, t.start, t.end - t.start));
 
         val = 0;
         tokens_next(s);
-    } else if (t->type == TOKEN_STRING_SINGLE_QUOTE) {
+    } else if (t.type == TOKEN_STRING_SINGLE_QUOTE) {
         int ch;
-        intptr_t distance = parse_char(t->end - t->start, (const char*)t->start, &ch);
+        intptr_t distance = parse_char(t.end - t.start, (const char*)t.start, &ch);
         if (distance < 0) {
-            report(REPORT_ERROR, NULL, s, t->location, "could not parse char literal");
+            report(REPORT_ERROR, NULL, s, t.location, "could not parse char literal");
             abort();
         }
 
         val = ch;
         tokens_next(s);
-    } else if (t->type == '(') {
+    } else if (t.type == '(') {
         tokens_next(s);
-        val = eval(c, s, NULL, t->location);
+        val = eval(c, s, NULL, t.location);
 
-        if (tokens_get(s)->type != ')') {
-            report_two_spots(REPORT_ERROR, NULL, s, t->location, tokens_get(s)->location,
+        if (tokens_get_type(s) != ')') {
+            report_two_spots(REPORT_ERROR, NULL, s, t.location, tokens_get(s).location,
                 "expected closing parenthesis for macro subexpression",
                 "open", "close?", NULL);
             abort();
         }
         tokens_next(s);
     } else {
-        report(REPORT_ERROR, NULL, s, t->location, "could not parse expression");
+        report(REPORT_ERROR, NULL, s, t.location, "could not parse expression");
         abort();
     }
 
@@ -80,9 +81,9 @@ static intmax_t eval_l0(Cuik_CPP* restrict c, TokenStream* restrict s) {
 static intmax_t eval_l4(Cuik_CPP* restrict c, TokenStream* restrict s) {
     intmax_t left = eval_l0(c, s);
 
-    while (tokens_get(s)->type == '+' ||
-        tokens_get(s)->type == '-') {
-        int t = tokens_get(s)->type;
+    while (tokens_get_type(s) == '+' ||
+        tokens_get_type(s) == '-') {
+        int t = tokens_get_type(s);
         tokens_next(s);
 
         intmax_t right = eval_l0(c, s);
@@ -98,9 +99,9 @@ static intmax_t eval_l4(Cuik_CPP* restrict c, TokenStream* restrict s) {
 static intmax_t eval_l5(Cuik_CPP* restrict c, TokenStream* restrict s) {
     intmax_t left = eval_l4(c, s);
 
-    while (tokens_get(s)->type == TOKEN_LEFT_SHIFT ||
-        tokens_get(s)->type == TOKEN_RIGHT_SHIFT) {
-        int t = tokens_get(s)->type;
+    while (tokens_get_type(s) == TOKEN_LEFT_SHIFT ||
+        tokens_get_type(s) == TOKEN_RIGHT_SHIFT) {
+        int t = tokens_get_type(s);
         tokens_next(s);
 
         intmax_t right = eval_l4(c, s);
@@ -116,11 +117,11 @@ static intmax_t eval_l5(Cuik_CPP* restrict c, TokenStream* restrict s) {
 static intmax_t eval_l6(Cuik_CPP* restrict c, TokenStream* restrict s) {
     intmax_t left = eval_l5(c, s);
 
-    while (tokens_get(s)->type == '>' ||
-        tokens_get(s)->type == '<' ||
-        tokens_get(s)->type == TOKEN_GREATER_EQUAL ||
-        tokens_get(s)->type == TOKEN_LESS_EQUAL) {
-        int t = tokens_get(s)->type;
+    while (tokens_get_type(s) == '>' ||
+        tokens_get_type(s) == '<' ||
+        tokens_get_type(s) == TOKEN_GREATER_EQUAL ||
+        tokens_get_type(s) == TOKEN_LESS_EQUAL) {
+        int t = tokens_get_type(s);
         tokens_next(s);
 
         intmax_t right = eval_l5(c, s);
@@ -146,9 +147,9 @@ static intmax_t eval_l6(Cuik_CPP* restrict c, TokenStream* restrict s) {
 static intmax_t eval_l7(Cuik_CPP* restrict c, TokenStream* restrict s) {
     intmax_t left = eval_l6(c, s);
 
-    while (tokens_get(s)->type == TOKEN_NOT_EQUAL ||
-        tokens_get(s)->type == TOKEN_EQUALITY) {
-        int t = tokens_get(s)->type;
+    while (tokens_get_type(s) == TOKEN_NOT_EQUAL ||
+        tokens_get_type(s) == TOKEN_EQUALITY) {
+        int t = tokens_get_type(s);
         tokens_next(s);
 
         intmax_t right = eval_l6(c, s);
@@ -164,7 +165,7 @@ static intmax_t eval_l7(Cuik_CPP* restrict c, TokenStream* restrict s) {
 static intmax_t eval_l8(Cuik_CPP* restrict c, TokenStream* restrict s) {
     intmax_t left = eval_l7(c, s);
 
-    while (tokens_get(s)->type == '&') {
+    while (tokens_get_type(s) == '&') {
         tokens_next(s);
 
         intmax_t right = eval_l7(c, s);
@@ -177,7 +178,7 @@ static intmax_t eval_l8(Cuik_CPP* restrict c, TokenStream* restrict s) {
 static intmax_t eval_l9(Cuik_CPP* restrict c, TokenStream* restrict s) {
     intmax_t left = eval_l8(c, s);
 
-    while (tokens_get(s)->type == '^') {
+    while (tokens_get_type(s) == '^') {
         tokens_next(s);
 
         intmax_t right = eval_l8(c, s);
@@ -190,7 +191,7 @@ static intmax_t eval_l9(Cuik_CPP* restrict c, TokenStream* restrict s) {
 static intmax_t eval_l10(Cuik_CPP* restrict c, TokenStream* restrict s) {
     intmax_t left = eval_l9(c, s);
 
-    while (tokens_get(s)->type == '|') {
+    while (tokens_get_type(s) == '|') {
         tokens_next(s);
 
         intmax_t right = eval_l9(c, s);
@@ -203,7 +204,7 @@ static intmax_t eval_l10(Cuik_CPP* restrict c, TokenStream* restrict s) {
 static intmax_t eval_l11(Cuik_CPP* restrict c, TokenStream* restrict s) {
     intmax_t left = eval_l10(c, s);
 
-    while (tokens_get(s)->type == TOKEN_DOUBLE_AND) {
+    while (tokens_get_type(s) == TOKEN_DOUBLE_AND) {
         tokens_next(s);
 
         intmax_t right = eval_l10(c, s);
@@ -216,7 +217,7 @@ static intmax_t eval_l11(Cuik_CPP* restrict c, TokenStream* restrict s) {
 static intmax_t eval_l12(Cuik_CPP* restrict c, TokenStream* restrict s) {
     intmax_t left = eval_l11(c, s);
 
-    while (tokens_get(s)->type == TOKEN_DOUBLE_OR) {
+    while (tokens_get_type(s) == TOKEN_DOUBLE_OR) {
         tokens_next(s);
 
         intmax_t right = eval_l11(c, s);
@@ -229,11 +230,11 @@ static intmax_t eval_l12(Cuik_CPP* restrict c, TokenStream* restrict s) {
 static intmax_t eval_l13(Cuik_CPP* restrict c, TokenStream* restrict s) {
     intmax_t lhs = eval_l12(c, s);
 
-    if (tokens_get(s)->type == '?') {
+    if (tokens_get_type(s) == '?') {
         tokens_next(s);
 
         intmax_t mhs = eval_l13(c, s);
-        if (tokens_get(s)->type != ':') {
+        if (tokens_get_type(s) != ':') {
             report(REPORT_ERROR, NULL, s, tokens_get_location_index(s), "expected : for ternary");
             abort();
         }
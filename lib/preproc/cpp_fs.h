@@ -1,81 +1,350 @@
 //static size_t file_io_memory_usage = 0;
 
-static Cuik_File get_file(void* user_data, bool is_query, const char* path) {
+// The default file system keeps a process-wide cache of file contents keyed by
+// canonical path, every preprocessor instance shares the same read-only buffers
+// so a header included by 200 translation units is only read (and has its
+// whitespace normalized) once. Entries are revalidated by mtime & size.
+typedef struct CachedFile {
+    uint64_t mtime;
+    size_t length;
+    char* data;
+} CachedFile;
+
+typedef struct CachedFileEntry {
+    char* key;
+    CachedFile value;
+} CachedFileEntry;
+
+// It also caches the listing of every directory it's asked about, this way the
+// include search (which probes every include directory for every #include) is
+// a few hash lookups instead of a stat per directory. A missing directory is
+// just an empty listing.
+typedef struct DirNameEntry {
+    char* key;
+    int value;
+} DirNameEntry;
+
+typedef struct CachedDir {
+    // the directory's mtime when we listed it (0 if it was missing), long running
+    // hosts use it to throw away stale listings (see fs_cache_revalidate)
+    uint64_t mtime;
+    DirNameEntry* names;
+} CachedDir;
+
+typedef struct CachedDirEntry {
+    char* key;
+    CachedDir value;
+} CachedDirEntry;
+
+static once_flag fs_cache_once = ONCE_FLAG_INIT;
+
+static mtx_t file_cache_mutex;
+static CachedFileEntry* file_cache;
+
+static mtx_t dir_cache_mutex;
+static CachedDirEntry* dir_cache;
+
+static bool canonicalize(void* user_data, char output[FILENAME_MAX], const char* input);
+static bool get_file_stats(const char* path, uint64_t* out_mtime, size_t* out_length);
+
+static void fs_cache_init(void) {
+    mtx_init(&file_cache_mutex, mtx_plain);
+    sh_new_strdup(file_cache);
+
+    mtx_init(&dir_cache_mutex, mtx_plain);
+    sh_new_strdup(dir_cache);
+}
+
+static DirNameEntry* read_dir_listing(const char* dir) {
+    DirNameEntry* names = NULL;
+    sh_new_strdup(names);
+
     #ifdef _WIN32
-    if (is_query) {
-        return (Cuik_File){ .found = (GetFileAttributesA(path) != INVALID_FILE_ATTRIBUTES) };
+    char pattern[FILENAME_MAX];
+    snprintf(pattern, FILENAME_MAX, "%s*", dir);
+
+    WIN32_FIND_DATAA find_data;
+    HANDLE find_handle = FindFirstFileA(pattern, &find_data);
+    if (find_handle != INVALID_HANDLE_VALUE) {
+        do {
+            // windows file paths are case insensitive
+            for (char* p = find_data.cFileName; *p; p++) {
+                if (*p >= 'A' && *p <= 'Z') *p -= ('A' - 'a');
+            }
+
+            shput(names, find_data.cFileName, 0);
+        } while (FindNextFileA(find_handle, &find_data));
+
+        FindClose(find_handle);
     }
+    #else
+    DIR* d = opendir(dir[0] ? dir : ".");
+    if (d != NULL) {
+        struct dirent* e;
+        while ((e = readdir(d)) != NULL) {
+            shput(names, e->d_name, 0);
+        }
 
-    // actual file reading
-    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
-    if (file == INVALID_HANDLE_VALUE) {
-        fprintf(stderr, "error: could not open file '%s'!\n", path);
-        return (Cuik_File){ .found = false };
+        closedir(d);
     }
+    #endif
 
-    LARGE_INTEGER file_size;
-    if (!GetFileSizeEx(file, &file_size)) {
-        // must be a file stream
-        fprintf(stderr, "error: could not check file size of '%s'!\n", path);
-        return (Cuik_File){ .found = false };
+    return names;
+}
+
+static bool file_exists(const char* path) {
+    call_once(&fs_cache_once, fs_cache_init);
+
+    // split into the directory (slash included) and the name
+    const char* slash = NULL;
+    for (const char* p = path; *p; p++) {
+        if (*p == '/' || *p == '\\') slash = p;
+    }
+
+    size_t dir_len = slash ? (slash - path) + 1 : 0;
+    if (dir_len >= FILENAME_MAX) {
+        return false;
+    }
+
+    char dir[FILENAME_MAX];
+    memcpy(dir, path, dir_len);
+    dir[dir_len] = '\0';
+
+    char name[FILENAME_MAX];
+    size_t name_len = 0;
+    for (const char* p = path + dir_len; *p && name_len < FILENAME_MAX - 1; p++) {
+        #ifdef _WIN32
+        name[name_len++] = (*p >= 'A' && *p <= 'Z') ? *p - ('A' - 'a') : *p;
+        #else
+        name[name_len++] = *p;
+        #endif
+    }
+    name[name_len] = '\0';
+
+    mtx_lock(&dir_cache_mutex);
+    ptrdiff_t search = shgeti(dir_cache, dir);
+    DirNameEntry* names = search >= 0 ? dir_cache[search].value.names : NULL;
+    mtx_unlock(&dir_cache_mutex);
+
+    if (search < 0) {
+        // stat before listing so a change while we're reading it is caught
+        // by the next revalidation
+        size_t length;
+        uint64_t mtime = 0;
+        get_file_stats(dir[0] ? dir : ".", &mtime, &length);
+
+        // listings are immutable once they're in the cache so if we lost
+        // the race we just throw ours away
+        DirNameEntry* new_names = read_dir_listing(dir);
+
+        mtx_lock(&dir_cache_mutex);
+        search = shgeti(dir_cache, dir);
+        if (search >= 0) {
+            names = dir_cache[search].value.names;
+        } else {
+            names = new_names;
+            shput(dir_cache, dir, ((CachedDir){ mtime, names }));
+            new_names = NULL;
+        }
+        mtx_unlock(&dir_cache_mutex);
+
+        if (new_names != NULL) shfree(new_names);
     }
 
-    // normal file with a normal length
-    if (file_size.HighPart) {
+    return name_len > 0 && shgeti(names, name) >= 0;
+}
+
+// relative paths mean something else once the working directory changes
+static bool is_relative_path(const char* path) {
+    #ifdef _WIN32
+    return path[0] != '/' && path[0] != '\\' && !(path[0] && path[1] == ':');
+    #else
+    return path[0] != '/';
+    #endif
+}
+
+// drops every directory listing which has changed since we read it (or was relative),
+// returns true if any had changed. Nobody can be probing the cache while this runs
+// since the old listings are freed.
+static bool fs_cache_revalidate(void) {
+    call_once(&fs_cache_once, fs_cache_init);
+
+    bool changed = false;
+    mtx_lock(&dir_cache_mutex);
+    for (ptrdiff_t i = 0; i < shlen(dir_cache);) {
+        const char* dir = dir_cache[i].key;
+
+        size_t length;
+        uint64_t mtime = 0;
+        get_file_stats(dir[0] ? dir : ".", &mtime, &length);
+
+        bool is_stale = mtime != dir_cache[i].value.mtime;
+        if (is_stale || is_relative_path(dir)) {
+            shfree(dir_cache[i].value.names);
+
+            // deleting swaps the last entry into this slot
+            (void) shdel(dir_cache, dir);
+            changed |= is_stale;
+        } else {
+            i++;
+        }
+    }
+    mtx_unlock(&dir_cache_mutex);
+
+    return changed;
+}
+
+// fills in the mtime and length of a file, returns false if it doesn't exist
+static bool get_file_stats(const char* path, uint64_t* out_mtime, size_t* out_length) {
+    #ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attribs;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attribs)) {
+        return false;
+    }
+
+    if (attribs.nFileSizeHigh) {
         fprintf(stderr, "error: file '%s' is too big!\n", path);
-        return (Cuik_File){ .found = false };
+        return false;
+    }
+
+    *out_mtime = ((uint64_t)attribs.ftLastWriteTime.dwHighDateTime << 32ull) | attribs.ftLastWriteTime.dwLowDateTime;
+    *out_length = attribs.nFileSizeLow;
+    return true;
+    #else
+    struct stat file_stats;
+    if (stat(path, &file_stats) != 0) {
+        return false;
+    }
+
+    #ifdef __APPLE__
+    *out_mtime = (file_stats.st_mtimespec.tv_sec * 1000000000ull) + file_stats.st_mtimespec.tv_nsec;
+    #else
+    *out_mtime = (file_stats.st_mtim.tv_sec * 1000000000ull) + file_stats.st_mtim.tv_nsec;
+    #endif
+
+    *out_length = file_stats.st_size;
+    return true;
+    #endif
+}
+
+// maps the file with at least 16 zeroed bytes past the end (fat null terminator),
+// normalizes the whitespace and then makes it read-only.
+static char* load_file(const char* path, size_t len) {
+    #ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "error: could not open file '%s'!\n", path);
+        return NULL;
     }
 
-    char* buffer = malloc(file_size.QuadPart + 16);
+    size_t map_size = len + 16;
+    char* buffer = VirtualAlloc(NULL, map_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
     DWORD bytes_read;
-    if (!ReadFile(file, buffer, file_size.LowPart, &bytes_read, NULL)) {
+    if (!ReadFile(file, buffer, len, &bytes_read, NULL) || bytes_read != len) {
         fprintf(stderr, "error: could not read file '%s'!\n", path);
-        return (Cuik_File){ .found = false };
+        VirtualFree(buffer, 0, MEM_RELEASE);
+        CloseHandle(file);
+        return NULL;
     }
-
     CloseHandle(file);
 
-    // fat null terminator
-    memset(&buffer[file_size.QuadPart], 0, 16);
-    remove_weird_whitespace(file_size.QuadPart, buffer);
+    remove_weird_whitespace(len, buffer);
 
-    //file_io_memory_usage += (file_size.QuadPart + 16);
-    //printf("%f MiB of files\n", (double)file_io_memory_usage / 1048576.0);
-    return (Cuik_File){ .found = true, .length = file_size.QuadPart, buffer };
+    DWORD old_protect;
+    VirtualProtect(buffer, map_size, PAGE_READONLY, &old_protect);
+    return buffer;
     #else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not read file: %s\n", path);
+        return NULL;
+    }
+
+    // reserve enough zeroed pages for the file and its terminator then map
+    // the file over the front of it, the tail of the last page and any page
+    // past the file are guarenteed to be zeroes.
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t map_size = (len + 16 + page_size - 1) & ~(page_size - 1);
+
+    char* buffer = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        fprintf(stderr, "Could not allocate space for file: %s\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    if (len > 0 && mmap(buffer, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        fprintf(stderr, "Could not map file: %s\n", path);
+        munmap(buffer, map_size);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    // only the pages which actually had weird whitespace get copied
+    remove_weird_whitespace(len, buffer);
+    mprotect(buffer, map_size, PROT_READ);
+    return buffer;
+    #endif
+}
+
+static Cuik_File get_file(void* user_data, bool is_query, const char* path) {
     if (is_query) {
-        struct stat buffer;
-        return (Cuik_File){ .found = (stat(path, &buffer) == 0) };
+        return (Cuik_File){ .found = file_exists(path) };
     }
 
-    // actual file reading
-    FILE* file = fopen(path, "rb");
-    if (!file) {
-        fprintf(stderr, "Could not read file: %s\n", path);
+    call_once(&fs_cache_once, fs_cache_init);
+
+    char key[FILENAME_MAX];
+    if (!canonicalize(user_data, key, path)) {
+        fprintf(stderr, "error: could not resolve file path '%s'!\n", path);
         return (Cuik_File){ .found = false };
     }
 
-    int descriptor = fileno(file);
-
-    struct stat file_stats;
-    if (fstat(descriptor, &file_stats) == -1) {
-        fprintf(stderr, "Could not figure out file size: %s\n", path);
+    uint64_t mtime;
+    size_t length;
+    if (!get_file_stats(key, &mtime, &length)) {
+        fprintf(stderr, "error: could not open file '%s'!\n", path);
         return (Cuik_File){ .found = false };
     }
 
-    size_t len = file_stats.st_size;
-    char* text = malloc(len + 16);
+    mtx_lock(&file_cache_mutex);
+    ptrdiff_t search = shgeti(file_cache, key);
+    CachedFile cached = search >= 0 ? file_cache[search].value : (CachedFile){ 0 };
+    mtx_unlock(&file_cache_mutex);
 
-    fseek(file, 0, SEEK_SET);
-    size_t length_read = fread(text, 1, len, file);
+    if (search < 0 || cached.mtime != mtime || cached.length != length) {
+        // we don't hold the lock while loading, if someone else loaded the same file in the
+        // meantime we just use theirs. NOTE(NeGate): stale buffers are leaked on purpose, other
+        // preprocessor instances might still have tokens pointing into them.
+        char* data = load_file(key, length);
+        if (data == NULL) {
+            return (Cuik_File){ .found = false };
+        }
 
-    // fat null terminator
-    length_read = len;
-    memset(&text[length_read], 0, 16);
-    fclose(file);
+        mtx_lock(&file_cache_mutex);
+        search = shgeti(file_cache, key);
+        if (search >= 0 && file_cache[search].value.mtime == mtime && file_cache[search].value.length == length) {
+            cached = file_cache[search].value;
+        } else {
+            cached = (CachedFile){ mtime, length, data };
+            shput(file_cache, key, cached);
+            data = NULL;
+        }
+        mtx_unlock(&file_cache_mutex);
 
-    return (Cuik_File){ .found = true, .length = length_read, .data = text };
-    #endif
+        if (data != NULL) {
+            #ifdef _WIN32
+            VirtualFree(data, 0, MEM_RELEASE);
+            #else
+            size_t page_size = sysconf(_SC_PAGESIZE);
+            munmap(data, (length + 16 + page_size - 1) & ~(page_size - 1));
+            #endif
+        }
+    }
+
+    return (Cuik_File){ .found = true, .is_shared = true, .length = cached.length, .data = cached.data };
 }
 
 static bool canonicalize(void* user_data, char output[FILENAME_MAX], const char* input) {
@@ -0,0 +1,631 @@
+// Precompiled prefix headers
+//
+// The prefix header is preprocessed ahead of the main file, the resulting tokens,
+// source locations, macro table and include state are then written to a PCH file.
+// Later runs which start with the same defines and include paths map the file back
+// in as long as none of the files it read have changed (mtime & size), for big
+// headers like windows.h that's tens of thousands of lines we never look at again.
+//
+// Everything is stored as offsets into the text section at the end of the file,
+// it holds all the strings (token text, lines, macro keys & values, file paths)
+// and has a fat null terminator so the 16byte compares and hashes can overhang.
+//
+// NOTE(NeGate): the mapping is never released since the tokens, macros and source
+// lines all point into it, kinda like the file contents.
+#define PCH_MAGIC   "CUIKPCH"
+#define PCH_VERSION 2
+
+// offset used for NULL strings
+#define PCH_NULL UINT32_MAX
+
+typedef struct PCH_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+
+    // the preprocessor state we started with (see pch_signature)
+    uint64_t signature;
+
+    uint32_t dep_count, file_count, line_count, loc_count;
+    uint32_t token_count, macro_count, once_count, guard_count;
+
+    uint64_t text_offset, text_size;
+} PCH_Header;
+
+typedef struct PCH_Dep {
+    uint32_t path;
+    uint32_t length;
+    uint64_t mtime;
+} PCH_Dep;
+
+typedef struct PCH_File {
+    uint32_t filepath;
+    uint32_t parent_id;
+    SourceLocIndex include_loc;
+    int32_t depth;
+} PCH_File;
+
+typedef struct PCH_Line {
+    uint32_t filepath;
+    uint32_t line_str;
+    SourceLocIndex parent;
+    int32_t line;
+} PCH_Line;
+
+typedef struct PCH_Loc {
+    uint32_t line;
+    uint32_t columns;
+    uint32_t length;
+} PCH_Loc;
+
+typedef struct PCH_Token {
+    int32_t type;
+    SourceLocIndex location;
+    uint32_t start;
+    uint32_t length;
+} PCH_Token;
+
+typedef struct PCH_Macro {
+    // key_length is just the name, the text has the parameter list after it
+    uint32_t key, key_length;
+    uint32_t value, value_length;
+    SourceLocIndex loc;
+} PCH_Macro;
+
+typedef struct PCH_Guard {
+    uint32_t path;
+    uint32_t name, length;
+} PCH_Guard;
+
+typedef struct PCH_StringEntry {
+    char* key;
+    uint32_t value;
+} PCH_StringEntry;
+
+typedef struct PCH_LineEntry {
+    SourceLine* key;
+    uint32_t value;
+} PCH_LineEntry;
+
+typedef struct PCH_Writer {
+    // stb_ds arrays
+    uint8_t* data;
+    uint8_t* text;
+
+    // interned file paths
+    PCH_StringEntry* strings;
+} PCH_Writer;
+
+// the key of a function-like macro is followed by its parameter list, since
+// expansion reads it from there we need to keep it around.
+static size_t macro_key_extent(const unsigned char* key, size_t length) {
+    if (key[length] != '(') return length;
+
+    const unsigned char* end = key + length;
+    while (*end && *end != ')') end++;
+
+    return (*end == ')' ? end + 1 : end) - key;
+}
+
+static uint64_t pch_hash_bytes(uint64_t hash, const void* data, size_t length) {
+    const uint8_t* p = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+// __DATE__ & __TIME__ change every run so they're left out of the signature, the
+// values for this run are put back once the PCH's macro table is loaded. They're
+// padded out since the key compares read 16 bytes.
+static const unsigned char pch_time_macros[2][16] = { "__DATE__", "__TIME__" };
+
+static bool pch_is_time_macro(const MacroEntry* def) {
+    for (size_t i = 0; i < 2; i++) {
+        if (def->key_length == 8 && memcmp(def->key, pch_time_macros[i], 8) == 0) return true;
+    }
+
+    return false;
+}
+
+// identifies the preprocessor state before the prefix header is processed, the
+// PCH can only stand in for the header if it's the same.
+static uint64_t pch_signature(Cuik_CPP* restrict c, const char* header) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    uint32_t version = PCH_VERSION;
+
+    hash = pch_hash_bytes(hash, &version, sizeof(version));
+    hash = pch_hash_bytes(hash, header, strlen(header) + 1);
+
+    size_t num_system_include_dirs = arrlen(c->system_include_dirs);
+    for (size_t i = 0; i < num_system_include_dirs; i++) {
+        hash = pch_hash_bytes(hash, c->system_include_dirs[i], strlen(c->system_include_dirs[i]) + 1);
+    }
+
+    // the slot order only depends on the defines that went in so it's stable
+    for (size_t e = 0; e < c->macro_capacity; e++) {
+        if (!MACRO_SLOT_FULL(c, e)) continue;
+
+        const MacroEntry* def = &c->macros[e];
+        if (pch_is_time_macro(def)) continue;
+
+        hash = pch_hash_bytes(hash, def->key, macro_key_extent(def->key, def->key_length));
+        hash = pch_hash_bytes(hash, "", 1);
+
+        if (def->value_start != NULL) {
+            hash = pch_hash_bytes(hash, def->value_start, def->value_end - def->value_start);
+        }
+        hash = pch_hash_bytes(hash, "\n", 1);
+    }
+
+    return hash;
+}
+
+static void pch_put(PCH_Writer* w, const void* data, size_t size) {
+    memcpy(arraddnptr(w->data, size), data, size);
+}
+
+static uint32_t pch_text(PCH_Writer* w, const void* data, size_t length) {
+    if (data == NULL) return PCH_NULL;
+
+    size_t offset = arrlen(w->text);
+    if (offset + length + 1 >= PCH_NULL) {
+        panic("preprocessor error: precompiled header is too big!\n");
+    }
+
+    uint8_t* dst = arraddnptr(w->text, length + 1);
+    memcpy(dst, data, length);
+    dst[length] = '\0';
+
+    return offset;
+}
+
+static uint32_t pch_path(PCH_Writer* w, const char* path) {
+    ptrdiff_t search = shgeti(w->strings, path);
+    if (search >= 0) {
+        return w->strings[search].value;
+    }
+
+    uint32_t offset = pch_text(w, path, strlen(path));
+    shput(w->strings, path, offset);
+    return offset;
+}
+
+static bool pch_save(Cuik_CPP* restrict c, TokenStream* restrict s, const char* pch_path_str, uint64_t signature) {
+    PCH_Writer w = { 0 };
+    sh_new_strdup(w.strings);
+
+    size_t file_count = dyn_array_length(c->files);
+    size_t token_count = tokens_count(s);
+
+    // the token text is stored apart from the lines so the tokens straight out
+    // of the files get a normal SourceLoc in here.
+    SourceLoc* locs = NULL;
+    SourceLocIndex* token_locs = malloc(token_count * sizeof(SourceLocIndex));
+
+    arrsetlen(locs, arrlen(s->locations));
+    memcpy(locs, s->locations, arrlen(s->locations) * sizeof(SourceLoc));
+    for (size_t i = 0; i < token_count; i++) {
+        token_locs[i] = s->token_locs[i];
+
+        if (SOURCE_LOC_GET_TYPE(token_locs[i]) == SOURCE_LOC_FILE) {
+            arrput(locs, cuik_get_location(s, token_locs[i]));
+            token_locs[i] = SOURCE_LOC_SET_TYPE(SOURCE_LOC_NORMAL, arrlen(locs) - 1);
+        }
+    }
+    size_t loc_count = arrlen(locs);
+
+    PCH_Header header = {
+        .magic = PCH_MAGIC,
+        .version = PCH_VERSION,
+        .signature = signature,
+        .dep_count = file_count,
+        .file_count = file_count,
+        .loc_count = loc_count,
+        .token_count = token_count,
+        .once_count = shlen(c->include_once),
+        .guard_count = shlen(c->include_guards),
+    };
+
+    // every file we opened, if any of them change we need to regenerate
+    for (size_t i = 0; i < file_count; i++) {
+        uint64_t mtime;
+        size_t length;
+        if (!get_file_stats(c->files[i].filepath, &mtime, &length)) {
+            arrfree(locs);
+            free(token_locs);
+            arrfree(w.data);
+            arrfree(w.text);
+            shfree(w.strings);
+            return false;
+        }
+
+        PCH_Dep dep = { pch_path(&w, c->files[i].filepath), length, mtime };
+        pch_put(&w, &dep, sizeof(dep));
+    }
+
+    for (size_t i = 0; i < file_count; i++) {
+        Cuik_FileEntry* f = &c->files[i];
+
+        PCH_File file = { pch_path(&w, f->filepath), f->parent_id, f->include_loc, f->depth };
+        pch_put(&w, &file, sizeof(file));
+    }
+
+    // number the source lines and find out how much of each line we need
+    PCH_LineEntry* line_ids = NULL;
+    SourceLine** lines = NULL;
+    uint32_t* line_extents = NULL;
+
+    for (size_t i = 0; i < loc_count; i++) {
+        SourceLoc* loc = &locs[i];
+        if (loc->line == NULL) continue;
+
+        ptrdiff_t search = hmgeti(line_ids, loc->line);
+        if (search < 0) {
+            uint32_t extent = 0;
+            if (loc->line->line_str != NULL) {
+                const unsigned char* end = loc->line->line_str;
+                while (*end && *end != '\n') end++;
+                extent = end - loc->line->line_str;
+            }
+
+            search = arrlen(lines);
+            hmput(line_ids, loc->line, search);
+            arrput(lines, loc->line);
+            arrput(line_extents, extent);
+        }
+
+        uint32_t id = line_ids[hmgeti(line_ids, loc->line)].value;
+        if (line_extents[id] < loc->columns + loc->length) {
+            line_extents[id] = loc->columns + loc->length;
+        }
+    }
+
+    header.line_count = arrlen(lines);
+    for (size_t i = 0; i < header.line_count; i++) {
+        SourceLine* l = lines[i];
+
+        PCH_Line line = {
+            pch_path(&w, l->filepath),
+            pch_text(&w, l->line_str, line_extents[i]),
+            l->parent,
+            l->line
+        };
+        pch_put(&w, &line, sizeof(line));
+    }
+
+    for (size_t i = 0; i < loc_count; i++) {
+        SourceLoc* l = &locs[i];
+
+        PCH_Loc loc = {
+            l->line ? line_ids[hmgeti(line_ids, l->line)].value : PCH_NULL,
+            l->columns,
+            l->length
+        };
+        pch_put(&w, &loc, sizeof(loc));
+    }
+
+    hmfree(line_ids);
+    arrfree(lines);
+    arrfree(line_extents);
+
+    for (size_t i = 0; i < token_count; i++) {
+        PCH_Token token = {
+            s->types[i], token_locs[i],
+            pch_text(&w, s->starts[i], s->lengths[i]), s->lengths[i]
+        };
+        pch_put(&w, &token, sizeof(token));
+    }
+    arrfree(locs);
+    free(token_locs);
+
+    for (size_t e = 0; e < c->macro_capacity; e++) {
+        if (!MACRO_SLOT_FULL(c, e)) continue;
+
+        const MacroEntry* def = &c->macros[e];
+        size_t vallen = def->value_end - def->value_start;
+
+        PCH_Macro macro = {
+            pch_text(&w, def->key, macro_key_extent(def->key, def->key_length)), def->key_length,
+            pch_text(&w, def->value_start, vallen), vallen,
+            def->loc
+        };
+        pch_put(&w, &macro, sizeof(macro));
+        header.macro_count++;
+    }
+
+    for (size_t i = 0; i < header.once_count; i++) {
+        uint32_t path = pch_path(&w, c->include_once[i].key);
+        pch_put(&w, &path, sizeof(path));
+    }
+
+    for (size_t i = 0; i < header.guard_count; i++) {
+        IncludeGuard g = c->include_guards[i].value;
+
+        PCH_Guard guard = { pch_path(&w, c->include_guards[i].key), pch_text(&w, g.name, g.length), g.length };
+        pch_put(&w, &guard, sizeof(guard));
+    }
+
+    // fat null terminator
+    memset(arraddnptr(w.text, 16), 0, 16);
+
+    header.text_offset = sizeof(header) + arrlen(w.data);
+    header.text_size = arrlen(w.text);
+
+    // write to a temporary and swap it in, other instances might be reading the old one
+    char temp_path[FILENAME_MAX];
+    snprintf(temp_path, FILENAME_MAX, "%s.%llx.tmp", pch_path_str, (unsigned long long)((uintptr_t)c ^ cuik_time_in_nanos()));
+
+    bool success = false;
+    FILE* file = fopen(temp_path, "wb");
+    if (file != NULL) {
+        success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(w.data, arrlen(w.data), 1, file) == 1 &&
+            fwrite(w.text, arrlen(w.text), 1, file) == 1;
+
+        success &= (fclose(file) == 0);
+
+        #ifdef _WIN32
+        success = success && MoveFileExA(temp_path, pch_path_str, MOVEFILE_REPLACE_EXISTING);
+        #else
+        success = success && rename(temp_path, pch_path_str) == 0;
+        #endif
+
+        if (!success) remove(temp_path);
+    }
+
+    arrfree(w.data);
+    arrfree(w.text);
+    shfree(w.strings);
+    return success;
+}
+
+static const uint8_t* pch_map(const char* path, size_t* out_size) {
+    #ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) {
+        return NULL;
+    }
+
+    const uint8_t* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    *out_size = size.QuadPart;
+    return data;
+    #else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat file_stats;
+    if (fstat(fd, &file_stats) != 0 || file_stats.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, file_stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    *out_size = file_stats.st_size;
+    return data;
+    #endif
+}
+
+static void pch_unmap(const uint8_t* data, size_t size) {
+    #ifdef _WIN32
+    UnmapViewOfFile(data);
+    #else
+    munmap((void*)data, size);
+    #endif
+}
+
+static bool pch_load(Cuik_CPP* restrict c, TokenStream* restrict s, const char* pch_path_str, uint64_t signature) {
+    size_t size;
+    const uint8_t* data = pch_map(pch_path_str, &size);
+    if (data == NULL) {
+        return false;
+    }
+
+    PCH_Header header;
+    if (size < sizeof(header)) goto invalid;
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, PCH_MAGIC, sizeof(PCH_MAGIC)) != 0 ||
+        header.version != PCH_VERSION ||
+        header.signature != signature ||
+        header.text_offset > size || header.text_size != size - header.text_offset) {
+        goto invalid;
+    }
+
+    size_t records_size = (header.dep_count * sizeof(PCH_Dep)) +
+        (header.file_count * sizeof(PCH_File)) +
+        (header.line_count * sizeof(PCH_Line)) +
+        (header.loc_count * sizeof(PCH_Loc)) +
+        (header.token_count * sizeof(PCH_Token)) +
+        (header.macro_count * sizeof(PCH_Macro)) +
+        (header.once_count * sizeof(uint32_t)) +
+        (header.guard_count * sizeof(PCH_Guard));
+
+    if (sizeof(header) + records_size != header.text_offset) goto invalid;
+
+    const uint8_t* in = data + sizeof(header);
+    const char* text = (const char*)data + header.text_offset;
+
+    // check that nothing changed under us
+    const PCH_Dep* deps = (const PCH_Dep*)in;
+    in += header.dep_count * sizeof(PCH_Dep);
+
+    for (size_t i = 0; i < header.dep_count; i++) {
+        uint64_t mtime;
+        size_t length;
+        if (!get_file_stats(&text[deps[i].path], &mtime, &length) || mtime != deps[i].mtime || length != deps[i].length) {
+            goto invalid;
+        }
+    }
+
+    // the file contents aren't kept around, they're just there for the dependency list
+    const PCH_File* files = (const PCH_File*)in;
+    in += header.file_count * sizeof(PCH_File);
+
+    for (size_t i = 0; i < header.file_count; i++) {
+        Cuik_FileEntry file_entry = {
+            .parent_id = files[i].parent_id,
+            .depth = files[i].depth,
+            .include_loc = files[i].include_loc,
+            .filepath = &text[files[i].filepath],
+            .content = NULL,
+            .is_shared = true,
+        };
+        dyn_array_put(c->files, file_entry);
+    }
+
+    const PCH_Line* in_lines = (const PCH_Line*)in;
+    in += header.line_count * sizeof(PCH_Line);
+
+    SourceLine* lines = malloc(header.line_count * sizeof(SourceLine));
+    for (size_t i = 0; i < header.line_count; i++) {
+        lines[i] = (SourceLine){
+            .filepath = &text[in_lines[i].filepath],
+            .line_str = in_lines[i].line_str != PCH_NULL ? (const unsigned char*)&text[in_lines[i].line_str] : NULL,
+            .parent = in_lines[i].parent,
+            .line = in_lines[i].line,
+        };
+    }
+
+    const PCH_Loc* locs = (const PCH_Loc*)in;
+    in += header.loc_count * sizeof(PCH_Loc);
+
+    arrsetlen(s->locations, header.loc_count);
+    for (size_t i = 0; i < header.loc_count; i++) {
+        s->locations[i] = (SourceLoc){
+            .line = locs[i].line != PCH_NULL ? &lines[locs[i].line] : NULL,
+            .columns = locs[i].columns,
+            .length = locs[i].length,
+        };
+    }
+
+    const PCH_Token* tokens = (const PCH_Token*)in;
+    in += header.token_count * sizeof(PCH_Token);
+
+    tokens_reserve(s, header.token_count);
+    for (size_t i = 0; i < header.token_count; i++) {
+        const unsigned char* start = (const unsigned char*)&text[tokens[i].start];
+        tokens_push(s, (Token){ tokens[i].type, tokens[i].location, start, start + tokens[i].length });
+    }
+
+    // replace the macro table, the signature says we started with the same one
+    const PCH_Macro* macros = (const PCH_Macro*)in;
+    in += header.macro_count * sizeof(PCH_Macro);
+
+    MacroEntry time_macros[2];
+    bool has_time_macro[2];
+    for (size_t i = 0; i < 2; i++) {
+        size_t e;
+        has_time_macro[i] = find_define(c, &e, pch_time_macros[i], 8);
+        if (has_time_macro[i]) time_macros[i] = c->macros[e];
+    }
+
+    macro_table_clear(c);
+    for (size_t i = 0; i < header.macro_count; i++) {
+        const unsigned char* key = (const unsigned char*)&text[macros[i].key];
+        MacroEntry* def = insert_define_or_die(c, key, macros[i].key_length);
+
+        if (macros[i].value != PCH_NULL) {
+            const unsigned char* value = (const unsigned char*)&text[macros[i].value];
+            def->value_start = value;
+            def->value_end = value + macros[i].value_length;
+        } else {
+            def->value_start = NULL;
+            def->value_end = NULL;
+        }
+        def->body = compile_macro_text(c, key + macros[i].key_length, def->value_start);
+        def->loc = macros[i].loc;
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+        if (has_time_macro[i]) {
+            *insert_define_or_die(c, time_macros[i].key, 8) = time_macros[i];
+        }
+    }
+
+    const uint32_t* once = (const uint32_t*)in;
+    in += header.once_count * sizeof(uint32_t);
+
+    for (size_t i = 0; i < header.once_count; i++) {
+        shput(c->include_once, (char*)&text[once[i]], 0);
+    }
+
+    const PCH_Guard* guards = (const PCH_Guard*)in;
+    for (size_t i = 0; i < header.guard_count; i++) {
+        IncludeGuard guard = { (const unsigned char*)&text[guards[i].name], guards[i].length };
+        shput(c->include_guards, (char*)&text[guards[i].path], guard);
+    }
+
+    return true;
+
+    invalid:
+    pch_unmap(data, size);
+    return false;
+}
+
+// preprocesses the prefix header into the (empty) token stream or
+// loads it from the PCH if it's still valid
+static void pch_run_prefix(Cuik_CPP* restrict c, TokenStream* restrict s) {
+    assert(tokens_count(s) == 0 && dyn_array_length(c->files) == 0);
+
+    char* header = malloc(FILENAME_MAX);
+    if (!CUIK_CALL(c->file_system, canonicalize, header, c->prefix_header)) {
+        panic("preprocessor error: could not read file! %s\n", c->prefix_header);
+    }
+
+    // the PCH only knows how to revalidate files on disk
+    const char* pch_path_str = c->file_system == &cuik_default_fs ? c->prefix_pch_path : NULL;
+
+    uint64_t signature = pch_signature(c, header);
+    if (pch_path_str != NULL) {
+        bool loaded = false;
+        CUIK_TIMED_BLOCK("load PCH %s", pch_path_str) {
+            loaded = pch_load(c, s, pch_path_str, signature);
+        }
+
+        if (loaded) return;
+    }
+
+    char directory[FILENAME_MAX];
+    char* slash = strrchr(header, '/');
+    if (!slash) slash = strrchr(header, '\\');
+
+    if (slash) {
+        snprintf(directory, FILENAME_MAX, "%.*s", (int)(slash - header) + 1, header);
+    } else {
+        directory[0] = '\0';
+    }
+
+    preprocess_file(c, s, 0, 0, directory, header, 1);
+
+    if (pch_path_str != NULL) {
+        CUIK_TIMED_BLOCK("save PCH %s", pch_path_str) {
+            if (!pch_save(c, s, pch_path_str, signature)) {
+                fprintf(stderr, "warning: could not write precompiled header: %s\n", pch_path_str);
+            }
+        }
+    }
+}
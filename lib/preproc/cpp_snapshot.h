@@ -0,0 +1,142 @@
+// Preprocessor snapshots
+//
+// Most translation units in a build open with the same few #includes, a snapshot
+// is the preprocessor state right after them: the tokens, source locations, macro
+// table, file table and the #pragma once & include guard sets. It's made by running
+// the leading #includes of one file and then any number of contexts can start from
+// it (even in parallel), they skip those #includes in their own main file and pick
+// up where the snapshot left off.
+//
+// The snapshot's context owns everything the copies point at (file contents, macro
+// keys & bodies, source lines) and none of it is written again, so a fork only has
+// to copy the tables it's going to change: the macro table is two memcpys and the
+// tokens are appended to so those are copied too.
+//
+// The headers' source lines point at the #include locations by index and each fork
+// has its own copy of the locations, so when it skips an #include it overwrites the
+// snapshot's location with its own and diagnostics say the right file & line.
+struct Cuik_CPPSnapshot {
+    Cuik_CPP cpp;
+
+    // without the terminator, the forks put their own at the end
+    TokenStream tokens;
+
+    size_t include_count;
+    SourceLocIndex* include_locs;
+};
+
+static void snapshot_copy_tokens(const Cuik_CPPSnapshot* restrict snapshot, TokenStream* restrict s) {
+    const TokenStream* src = &snapshot->tokens;
+    assert(s->count == 0);
+
+    tokens_reserve(s, src->count);
+    memcpy(s->types, src->types, src->count * sizeof(uint16_t));
+    memcpy(s->token_locs, src->token_locs, src->count * sizeof(SourceLocIndex));
+    memcpy(s->starts, src->starts, src->count * sizeof(const unsigned char*));
+    memcpy(s->lengths, src->lengths, src->count * sizeof(uint32_t));
+    s->count = src->count;
+
+    size_t loc_count = arrlen(src->locations);
+    arrsetlen(s->locations, loc_count);
+    memcpy(s->locations, src->locations, loc_count * sizeof(SourceLoc));
+
+    size_t file_loc_count = arrlen(src->file_locs);
+    arrsetlen(s->file_locs, file_loc_count);
+    memcpy(s->file_locs, src->file_locs, file_loc_count * sizeof(uint32_t));
+
+    size_t run_count = arrlen(src->file_runs);
+    arrsetlen(s->file_runs, run_count);
+    memcpy(s->file_runs, src->file_runs, run_count * sizeof(FileLocRun));
+}
+
+static void snapshot_skip_include(Cuik_CPP* restrict c, TokenStream* restrict s, SourceLocIndex include_loc) {
+    const Cuik_CPPSnapshot* snapshot = c->snapshot;
+    size_t i = snapshot->include_count - c->skip_includes;
+    c->skip_includes -= 1;
+
+    SourceLocIndex snapshot_loc = SOURCE_LOC_GET_DATA(snapshot->include_locs[i]);
+    s->locations[snapshot_loc] = s->locations[SOURCE_LOC_GET_DATA(include_loc)];
+}
+
+CUIK_API Cuik_CPPSnapshot* cuikpp_make_snapshot(Cuik_CPP* ctx, const char* filepath, size_t include_count) {
+    assert(include_count > 0 && ctx->snapshot == NULL);
+
+    ctx->stop_includes = include_count;
+    TokenStream s = cuikpp_run(ctx, filepath);
+
+    if (ctx->stop_includes != 0 || ctx->depth != 0) {
+        // it ran out of #includes first (or one of them left a scope open)
+        tokens_free(&s);
+        arrfree(s.locations);
+        arrfree(s.file_locs);
+        arrfree(s.file_runs);
+        arrfree(ctx->include_locs);
+        ctx->stop_includes = 0;
+        return NULL;
+    }
+
+    Cuik_CPPSnapshot* snapshot = malloc(sizeof(Cuik_CPPSnapshot));
+    snapshot->cpp = *ctx;
+    snapshot->tokens = s;
+    snapshot->tokens.count -= 1;
+    snapshot->include_count = include_count;
+    snapshot->include_locs = ctx->include_locs;
+    snapshot->cpp.include_locs = NULL;
+
+    // the context lives in the snapshot now
+    *ctx = (Cuik_CPP){ 0 };
+    return snapshot;
+}
+
+CUIK_API void cuikpp_init_from_snapshot(Cuik_CPP* ctx, const Cuik_CPPSnapshot* snapshot) {
+    const Cuik_CPP* src = &snapshot->cpp;
+
+    *ctx = (Cuik_CPP){
+        .the_shtuffs = cuik__valloc(THE_SHTUFFS_SIZE),
+        .file_system = src->file_system,
+        .include_dirs_signature = src->include_dirs_signature,
+        .snapshot = snapshot,
+        .skip_includes = snapshot->include_count,
+    };
+
+    if (!macro_table_copy(ctx, src)) {
+        fprintf(stderr, "preprocessor error: could not allocate macro table!\n");
+        abort();
+    }
+
+    // the strings belong to the snapshot
+    size_t num_system_include_dirs = arrlen(src->system_include_dirs);
+    for (size_t i = 0; i < num_system_include_dirs; i++) {
+        arrput(ctx->system_include_dirs, src->system_include_dirs[i]);
+    }
+
+    for (size_t i = 0, count = shlen(src->include_once); i < count; i++) {
+        shput(ctx->include_once, src->include_once[i].key, 0);
+    }
+
+    for (size_t i = 0, count = shlen(src->include_guards); i < count; i++) {
+        shput(ctx->include_guards, src->include_guards[i].key, src->include_guards[i].value);
+    }
+
+    size_t file_count = dyn_array_length(src->files);
+    ctx->files = dyn_array_create(Cuik_FileEntry);
+    for (size_t i = 0; i < file_count; i++) {
+        Cuik_FileEntry file_entry = src->files[i];
+        file_entry.is_shared = true;
+
+        dyn_array_put(ctx->files, file_entry);
+    }
+
+    tls_init();
+}
+
+CUIK_API void cuikpp_free_snapshot(Cuik_CPPSnapshot* snapshot) {
+    tokens_free(&snapshot->tokens);
+    arrfree(snapshot->tokens.locations);
+    arrfree(snapshot->tokens.file_locs);
+    arrfree(snapshot->tokens.file_runs);
+    arrfree(snapshot->include_locs);
+
+    cuikpp_deinit(&snapshot->cpp);
+    free(snapshot);
+}
@@ -0,0 +1,185 @@
+// Speculative include scanning
+//
+// The preprocessor walks a translation unit serially since every macro defined
+// before an #include can change what it expands into (or whether it's reached at
+// all), so we can't just preprocess the headers in parallel and glue the results
+// together. What we can do is guess: each header that is textually #included gets
+// loaded (and its whitespace normalized) on the thread pool, then its #include
+// directives are resolved and the headers they name are scanned the same way. By
+// the time the serial walk gets to them the file cache and the resolved include
+// memo are already warm.
+//
+// The guesses don't care about #if or macros so they might load a few headers the
+// real walk never touches, that's fine since the output never depends on the scan.
+//
+// NOTE(NeGate): the scan isn't waited on, cuikpp_run just drops its reference and
+// any tasks still in flight clean it up when they're done.
+
+// we don't wanna fill the thread pool queue with guesses (it spins when it's full)
+#define SPECULATE_MAX_IN_FLIGHT 64
+
+typedef struct SpeculatedEntry {
+    char* key;
+    int value;
+} SpeculatedEntry;
+
+typedef struct SpeculativeScan {
+    atomic_int ref_count;
+    atomic_int in_flight;
+
+    const Cuik_IThreadpool* thread_pool;
+
+    // owns a copy of the include dirs since the preprocessor might be
+    // torn down before the scan is done
+    IncludeSearch search;
+
+    // canonical paths of every file we've scanned or queued
+    mtx_t lock;
+    SpeculatedEntry* seen;
+} SpeculativeScan;
+
+typedef struct SpeculativeTask {
+    SpeculativeScan* scan;
+
+    // the directory is where the "quoted" includes are searched first
+    char* directory;
+    char* path;
+} SpeculativeTask;
+
+static void speculate_release(SpeculativeScan* scan) {
+    if (atomic_fetch_sub(&scan->ref_count, 1) != 1) {
+        return;
+    }
+
+    for (size_t i = 0; i < scan->search.dir_count; i++) {
+        free(scan->search.dirs[i]);
+    }
+    free(scan->search.dirs);
+
+    shfree(scan->seen);
+    mtx_destroy(&scan->lock);
+    free(scan);
+}
+
+static void speculate_task(void* arg);
+
+// queues up the file if we haven't seen it yet
+static void speculate_file(SpeculativeScan* scan, const char* directory, const char* path) {
+    mtx_lock(&scan->lock);
+    bool is_new = shgeti(scan->seen, path) < 0;
+    if (is_new) shput(scan->seen, path, 0);
+    mtx_unlock(&scan->lock);
+
+    if (!is_new) {
+        return;
+    }
+
+    if (atomic_fetch_add(&scan->in_flight, 1) >= SPECULATE_MAX_IN_FLIGHT) {
+        // it's only a guess, the serial walk will get it anyways
+        atomic_fetch_sub(&scan->in_flight, 1);
+        return;
+    }
+
+    SpeculativeTask* task = malloc(sizeof(SpeculativeTask));
+    task->scan = scan;
+    task->directory = strdup(directory);
+    task->path = strdup(path);
+
+    atomic_fetch_add(&scan->ref_count, 1);
+    CUIK_CALL(scan->thread_pool, submit, NULL, speculate_task, task);
+}
+
+static void speculate_task(void* arg) {
+    SpeculativeTask* task = arg;
+    SpeculativeScan* scan = task->scan;
+
+    CUIK_TIMED_BLOCK("speculate %s", task->path) {
+        // a missing file is just an empty one here, the serial walk reports it
+        Cuik_File file = CUIK_CALL(scan->search.file_system, get_file, false, task->path);
+
+        const char* text = file.found ? file.data : NULL;
+        const char* end = file.found ? file.data + file.length : NULL;
+
+        char filename[FILENAME_MAX];
+        char new_dir[FILENAME_MAX];
+        while (text < end) {
+            // find the start of the next line that begins with #include
+            const char* line_end = memchr(text, '\n', end - text);
+            if (line_end == NULL) line_end = end;
+
+            const char* p = text;
+            text = line_end + 1;
+
+            while (p < line_end && (*p == ' ' || *p == '\t')) p++;
+            if (p >= line_end || *p != '#') continue;
+            p++;
+
+            while (p < line_end && (*p == ' ' || *p == '\t')) p++;
+            if (line_end - p < 8 || memcmp(p, "include", 7) != 0) continue;
+            p += 7;
+
+            while (p < line_end && (*p == ' ' || *p == '\t')) p++;
+            if (p >= line_end || (*p != '"' && *p != '<')) continue;
+
+            bool is_lib_include = (*p == '<');
+            char terminator = is_lib_include ? '>' : '"';
+            p++;
+
+            const char* name_end = memchr(p, terminator, line_end - p);
+            if (name_end == NULL || name_end == p || name_end - p >= FILENAME_MAX) continue;
+
+            memcpy(filename, p, name_end - p);
+            filename[name_end - p] = '\0';
+
+            bool hit;
+            const char* new_path = search_include(&scan->search, task->directory, filename, is_lib_include, &hit);
+            if (new_path == NULL) {
+                continue;
+            }
+
+            // same as the directory that preprocess_file passes along
+            const char* slash = strrchr(new_path, '/');
+            if (!slash) slash = strrchr(new_path, '\\');
+
+            if (slash) {
+                snprintf(new_dir, FILENAME_MAX, "%.*s/", (int)(slash - new_path), new_path);
+            } else {
+                strcpy(new_dir, "/");
+            }
+
+            speculate_file(scan, new_dir, new_path);
+        }
+    }
+
+    atomic_fetch_sub(&scan->in_flight, 1);
+
+    free(task->directory);
+    free(task->path);
+    free(task);
+    speculate_release(scan);
+}
+
+// the caller owns a reference to the result, release it with speculate_release
+static SpeculativeScan* speculate_includes(Cuik_CPP* restrict c, const char* directory, const char* filepath) {
+    SpeculativeScan* scan = calloc(1, sizeof(SpeculativeScan));
+    scan->ref_count = 1;
+    scan->thread_pool = c->thread_pool;
+
+    size_t dir_count = arrlen(c->system_include_dirs);
+    scan->search = (IncludeSearch){
+        .file_system = c->file_system,
+        .dirs = malloc((dir_count ? dir_count : 1) * sizeof(char*)),
+        .dir_count = dir_count,
+        .signature = get_include_dirs_signature(c),
+    };
+
+    for (size_t i = 0; i < dir_count; i++) {
+        scan->search.dirs[i] = strdup(c->system_include_dirs[i]);
+    }
+
+    mtx_init(&scan->lock, mtx_plain);
+    sh_new_strdup(scan->seen);
+
+    speculate_file(scan, directory, filepath);
+    return scan;
+}
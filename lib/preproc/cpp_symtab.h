@@ -1,70 +1,125 @@
 
-CUIK_API void cuikpp_define_empty(Cuik_CPP* ctx, const char* key) {
-    size_t len = strlen(key);
+// the macro body as it's stored in the symbol table, it's lexed once when the
+// macro is defined and the parameters are resolved to indices so expanding it
+// doesn't need to look at the text again (see expand_ident).
+typedef struct MacroBody {
+    // -1 for object-like macros
+    int param_count;
+    bool has_varargs;
+
+    size_t count;
+    MacroToken tokens[];
+} MacroBody;
+
+// `params` is the text right after the macro name (it's a function-like macro if
+// that's a parenthesis), the body is read from the lexer until the end of the line.
+static MacroBody* compile_macro_body(Cuik_CPP* restrict c, const unsigned char* params, Lexer* restrict l, const unsigned char** out_end) {
+    const unsigned char** key_ranges = tls_save();
+    int key_count = -1;
+    bool has_varargs = false;
+
+    if (*params == '(') {
+        Lexer arg_lex = (Lexer){l->filepath, params, params};
+        lexer_read(&arg_lex);
+        expect(&arg_lex, '(');
+
+        key_count = 0;
+        while (arg_lex.token_type != ')') {
+            if (key_count) {
+                expect(&arg_lex, ',');
+            }
 
-    // TODO(NeGate): Work around to get any of the macro bucket
-    // keys to be at 16bytes aligned
-    size_t pad_len = (len + 15) & ~15;
-    char* newkey = gimme_the_shtuffs(ctx, pad_len);
-    memcpy(newkey, key, len);
+            if (arg_lex.token_type == TOKEN_TRIPLE_DOT) {
+                has_varargs = true;
+                lexer_read(&arg_lex);
+                break;
+            } else if (arg_lex.token_type == TOKEN_IDENTIFIER) {
+                tls_push(2 * sizeof(const unsigned char*));
 
-    // Hash name, name doesn't include parenthesis part btw
-    const char* paren = newkey;
-    while ((paren - newkey) < len && *paren != '(') paren++;
-    len = *paren == '(' ? paren - newkey : len;
+                int i = key_count++;
+                key_ranges[i * 2 + 0] = arg_lex.token_start;
+                key_ranges[i * 2 + 1] = arg_lex.token_end;
 
-    uint64_t slot = hash_ident((const unsigned char*)newkey, len);
-    uint64_t e = ctx->macro_bucket_count[slot] + (slot * SLOTS_PER_MACRO_BUCKET);
+                lexer_read(&arg_lex);
+            } else {
+                generic_error(&arg_lex, "expected identifier or ...!");
+            }
+        }
+    }
 
-    // Insert into buckets
-    ctx->macro_bucket_count[slot] += 1;
-    ctx->macro_bucket_keys[e] = (const unsigned char*)newkey;
-    ctx->macro_bucket_keys_length[e] = len;
+    MacroToken* tokens = tls_save();
+    size_t count = 0;
 
-    ctx->macro_bucket_values_start[e] = NULL;
-    ctx->macro_bucket_values_end[e] = NULL;
-    ctx->macro_bucket_source_locs[e] = SOURCE_LOC_SET_TYPE(SOURCE_LOC_UNKNOWN, 0);
-}
+    const unsigned char* end = l->token_start;
+    while (!l->hit_line) {
+        size_t length = l->token_end - l->token_start;
+        if (length > UINT32_MAX) {
+            generic_error(l, "macro token is too long!");
+        }
 
-CUIK_API void cuikpp_define(Cuik_CPP* ctx, const char* key, const char* value) {
-    // TODO(NeGate): Fix up this code a bit because i really dislike how the
-    // parenthesis are detected
-    size_t len = strlen(key);
+        int param = -1;
+        if (l->token_type == TOKEN_IDENTIFIER) {
+            if (has_varargs && lexer_match(l, sizeof("__VA_ARGS__") - 1, "__VA_ARGS__")) {
+                param = key_count;
+            } else {
+                for (int i = 0; i < key_count; i++) {
+                    size_t key_length = key_ranges[i * 2 + 1] - key_ranges[i * 2 + 0];
+                    if (length == key_length && memcmp(key_ranges[i * 2 + 0], l->token_start, length) == 0) {
+                        param = i;
+                        break;
+                    }
+                }
+            }
+        }
 
-    // TODO(NeGate): Work around to get any of the macro bucket
-    // keys to be at 16bytes aligned
-    size_t pad_len = (len + 15) & ~15;
-    char* newkey = gimme_the_shtuffs(ctx, pad_len);
-    memcpy(newkey, key, len);
+        tls_push(sizeof(MacroToken));
+        tokens[count++] = (MacroToken){ l->token_type, param, length, l->token_start };
 
-    // Hash name, name doesn't include parenthesis part btw
-    const char* paren = newkey;
-    while ((paren - newkey) < len && *paren != '(') paren++;
-    len = *paren == '(' ? paren - newkey : len;
+        end = l->token_end;
+        lexer_read(l);
+    }
 
-    uint64_t slot = hash_ident((const unsigned char*)newkey, len);
-    uint64_t e = ctx->macro_bucket_count[slot] + (slot * SLOTS_PER_MACRO_BUCKET);
+    // keep it in the_shtuffs with the rest of the macro text
+    size_t pad = -(uintptr_t)(c->the_shtuffs + c->the_shtuffs_size) & (_Alignof(MacroBody) - 1);
+    MacroBody* body = (MacroBody*)((unsigned char*)gimme_the_shtuffs(c, pad + sizeof(MacroBody) + count * sizeof(MacroToken)) + pad);
+    body->param_count = key_count;
+    body->has_varargs = has_varargs;
+    body->count = count;
+    memcpy(body->tokens, tokens, count * sizeof(MacroToken));
+
+    tls_restore(key_ranges);
+    *out_end = end;
+    return body;
+}
 
-    // Insert into buckets
-    ctx->macro_bucket_count[slot] += 1;
-    ctx->macro_bucket_keys[e] = (const unsigned char*)newkey;
-    ctx->macro_bucket_keys_length[e] = len;
+// same as compile_macro_body but for a NULL terminated body (or NULL if it's empty)
+static MacroBody* compile_macro_text(Cuik_CPP* restrict c, const unsigned char* params, const unsigned char* value) {
+    if (value == NULL) {
+        value = (const unsigned char*)"";
+    }
 
-    {
-        len = strlen(value);
+    Lexer l = { "<temp>", value, value, 1 };
+    lexer_read(&l);
 
-        size_t pad_len = (len + 15) & ~15;
-        char* newvalue = gimme_the_shtuffs(ctx, pad_len);
-        memcpy(newvalue, value, len);
+    const unsigned char* end;
+    return compile_macro_body(c, params, &l, &end);
+}
 
-        size_t rem = pad_len - len;
-        memset(newvalue + len, 0, rem);
+////////////////////////////////
+// Macro table
+////////////////////////////////
+// It's a Swiss table: every slot has a tag byte and those get probed 16 at a time,
+// only the slots with a matching tag need their key compared. The groups are probed
+// in a triangular sequence which visits every group since the group count is a
+// power of two.
+#define MACRO_TAG_EMPTY     0x80
+#define MACRO_TAG_TOMBSTONE 0xFE
 
-        ctx->macro_bucket_values_start[e] = (const unsigned char*)newvalue;
-        ctx->macro_bucket_values_end[e] = (const unsigned char*)newvalue + len;
-        ctx->macro_bucket_source_locs[e] = SOURCE_LOC_SET_TYPE(SOURCE_LOC_UNKNOWN, 0);
-    }
-}
+#define MACRO_GROUP_SIZE    16
+#define MACRO_INIT_CAPACITY 256
+
+// full slots have the top bit cleared
+#define MACRO_SLOT_FULL(c, e) ((c)->macro_tags[e] < 0x80)
 
 static char unsigned overhang_mask[32] = {
     255, 255, 255, 255, 255, 255, 255, 255,
@@ -80,14 +135,14 @@ static char unsigned default_seed[16] = {
 
 static uint64_t hash_ident(const unsigned char* at, size_t length) {
 #if !USE_INTRIN
-    uint32_t hash = 0x811c9dc5;
+    uint64_t hash = 0xcbf29ce484222325ull;
 
     for (size_t i = 0; i < length; i++) {
-        hash ^= (uint32_t)at[i];
-        hash *= 0x01000193; // 32bit magic shit
+        hash ^= (uint64_t)at[i];
+        hash *= 0x100000001b3ull; // 64bit magic shit
     }
 
-    return hash % MACRO_BUCKET_COUNT;
+    return hash;
 #else
     __m128i hash = _mm_cvtsi64_si128(length);
     hash = _mm_xor_si128(hash, _mm_loadu_si128((__m128i*)default_seed));
@@ -114,7 +169,7 @@ static uint64_t hash_ident(const unsigned char* at, size_t length) {
     hash = _mm_aesdec_si128(hash, _mm_setzero_si128());
     hash = _mm_aesdec_si128(hash, _mm_setzero_si128());
 
-    return ((size_t)_mm_extract_epi32(hash, 0)) % MACRO_BUCKET_COUNT;
+    return _mm_cvtsi128_si64(hash);
 #endif
 }
 
@@ -147,26 +202,157 @@ static bool memory_equals16(const unsigned char* src1, const unsigned char* src2
 #endif
 }
 
+// bit i is set if the i-th tag in the group is `tag`
+static uint32_t macro_group_match(const uint8_t* group, uint8_t tag) {
+#if !USE_INTRIN
+    uint32_t mask = 0;
+    for (int i = 0; i < MACRO_GROUP_SIZE; i++) {
+        mask |= (uint32_t)(group[i] == tag) << i;
+    }
+
+    return mask;
+#else
+    __m128i tags = _mm_loadu_si128((__m128i*)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(tags, _mm_set1_epi8(tag)));
+#endif
+}
+
+// bit i is set if the i-th slot in the group is empty or a tombstone
+static uint32_t macro_group_match_free(const uint8_t* group) {
+#if !USE_INTRIN
+    uint32_t mask = 0;
+    for (int i = 0; i < MACRO_GROUP_SIZE; i++) {
+        mask |= (uint32_t)(group[i] >= 0x80) << i;
+    }
+
+    return mask;
+#else
+    return _mm_movemask_epi8(_mm_loadu_si128((__m128i*)group));
+#endif
+}
+
+static bool macro_table_alloc(Cuik_CPP* restrict c, size_t capacity) {
+    assert((capacity & (capacity - 1)) == 0 && capacity >= MACRO_GROUP_SIZE);
+
+    uint8_t* tags = malloc(capacity);
+    MacroEntry* macros = malloc(capacity * sizeof(MacroEntry));
+    if (tags == NULL || macros == NULL) {
+        free(tags), free(macros);
+        return false;
+    }
+    memset(tags, MACRO_TAG_EMPTY, capacity);
+
+    c->macro_capacity = capacity;
+    c->macro_count = 0;
+    c->macro_used = 0;
+    c->macro_tags = tags;
+    c->macros = macros;
+    return true;
+}
+
+static void macro_table_free(Cuik_CPP* restrict c) {
+    free(c->macro_tags);
+    free(c->macros);
+
+    c->macro_capacity = c->macro_count = c->macro_used = 0;
+    c->macro_tags = NULL;
+    c->macros = NULL;
+}
+
+static void macro_table_clear(Cuik_CPP* restrict c) {
+    memset(c->macro_tags, MACRO_TAG_EMPTY, c->macro_capacity);
+    c->macro_count = 0;
+    c->macro_used = 0;
+}
+
+// the entries only point at the keys, values and bodies so it's a shallow copy
+static bool macro_table_copy(Cuik_CPP* restrict c, const Cuik_CPP* restrict src) {
+    if (!macro_table_alloc(c, src->macro_capacity)) {
+        return false;
+    }
+
+    memcpy(c->macro_tags, src->macro_tags, src->macro_capacity);
+    memcpy(c->macros, src->macros, src->macro_capacity * sizeof(MacroEntry));
+    c->macro_count = src->macro_count;
+    c->macro_used = src->macro_used;
+    return true;
+}
+
+// first free slot on the probe sequence, doesn't check if the key is already in there
+static size_t macro_find_free(Cuik_CPP* restrict c, uint64_t hash) {
+    size_t group_mask = (c->macro_capacity / MACRO_GROUP_SIZE) - 1;
+    size_t g = (hash >> 7) & group_mask;
+
+    for (size_t step = 1;; step++) {
+        uint32_t free_slots = macro_group_match_free(&c->macro_tags[g * MACRO_GROUP_SIZE]);
+        if (free_slots) {
+            return (g * MACRO_GROUP_SIZE) + __builtin_ctz(free_slots);
+        }
+
+        g = (g + step) & group_mask;
+    }
+}
+
+// rebuilds the table without the tombstones, it grows if it's getting full
+static bool macro_table_rehash(Cuik_CPP* restrict c) {
+    size_t old_capacity = c->macro_capacity;
+    size_t old_count = c->macro_count;
+    uint8_t* old_tags = c->macro_tags;
+    MacroEntry* old_macros = c->macros;
+
+    size_t capacity = old_capacity;
+    if (old_count * 2 >= capacity) capacity *= 2;
+
+    // the old table is left alone if this fails
+    if (!macro_table_alloc(c, capacity)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_tags[i] >= 0x80) continue;
+
+        uint64_t hash = hash_ident(old_macros[i].key, old_macros[i].key_length);
+        size_t e = macro_find_free(c, hash);
+
+        c->macro_tags[e] = hash & 0x7F;
+        c->macros[e] = old_macros[i];
+    }
+    c->macro_count = old_count;
+    c->macro_used = old_count;
+
+    free(old_tags);
+    free(old_macros);
+    return true;
+}
+
 static bool find_define(Cuik_CPP* restrict c, size_t* out_index, const unsigned char* start, size_t length) {
-    uint64_t slot = hash_ident(start, length);
-    size_t count = c->macro_bucket_count[slot];
-    size_t base = (slot * SLOTS_PER_MACRO_BUCKET);
+    uint64_t hash = hash_ident(start, length);
+    uint8_t tag = hash & 0x7F;
 
-    size_t i = 0;
-    while (i < count) {
-        size_t e = base + i;
+    size_t group_mask = (c->macro_capacity / MACRO_GROUP_SIZE) - 1;
+    size_t g = (hash >> 7) & group_mask;
 
-        if (c->macro_bucket_keys_length[e] == length) {
-            if (memory_equals16(c->macro_bucket_keys[e], start, length)) {
+    for (size_t step = 1;; step++) {
+        const uint8_t* group = &c->macro_tags[g * MACRO_GROUP_SIZE];
+
+        uint32_t matches = macro_group_match(group, tag);
+        while (matches) {
+            size_t e = (g * MACRO_GROUP_SIZE) + __builtin_ctz(matches);
+            matches &= matches - 1;
+
+            if (c->macros[e].key_length == length && memory_equals16(c->macros[e].key, start, length)) {
                 *out_index = e;
                 return true;
             }
         }
 
-        i++;
-    }
+        // the key would've been placed in the first empty slot we ran into
+        if (macro_group_match(group, MACRO_TAG_EMPTY)) {
+            return false;
+        }
 
-    return false;
+        g = (g + step) & group_mask;
+    }
 }
 
 static bool is_defined(Cuik_CPP* restrict c, const unsigned char* start, size_t length) {
@@ -174,12 +360,127 @@ static bool is_defined(Cuik_CPP* restrict c, const unsigned char* start, size_t
     return find_define(c, &garbage, start, length);
 }
 
+// returns the entry for the key, redefinitions replace the old entry. It's
+// NULL if the table couldn't grow.
+static MacroEntry* insert_define(Cuik_CPP* restrict c, const unsigned char* key, size_t length) {
+    size_t e;
+    if (find_define(c, &e, key, length)) {
+        return &c->macros[e];
+    }
+
+    // keep it at most 7/8ths full (tombstones count)
+    if ((c->macro_used + 1) * 8 > c->macro_capacity * 7 && !macro_table_rehash(c)) {
+        return NULL;
+    }
+
+    uint64_t hash = hash_ident(key, length);
+    e = macro_find_free(c, hash);
+
+    c->macro_used += (c->macro_tags[e] == MACRO_TAG_EMPTY);
+    c->macro_count += 1;
+    c->macro_tags[e] = hash & 0x7F;
+
+    c->macros[e] = (MacroEntry){ .key = key, .key_length = length };
+    return &c->macros[e];
+}
+
+static bool remove_define(Cuik_CPP* restrict c, const unsigned char* key, size_t length) {
+    size_t e;
+    if (!find_define(c, &e, key, length)) {
+        return false;
+    }
+
+    // if the group still has an empty slot the probes for anything else would've
+    // stopped here anyways so we don't need a tombstone.
+    const uint8_t* group = &c->macro_tags[e & -MACRO_GROUP_SIZE];
+    if (macro_group_match(group, MACRO_TAG_EMPTY)) {
+        c->macro_tags[e] = MACRO_TAG_EMPTY;
+        c->macro_used -= 1;
+    } else {
+        c->macro_tags[e] = MACRO_TAG_TOMBSTONE;
+    }
+
+    c->macro_count -= 1;
+    return true;
+}
+
+static MacroEntry* insert_define_or_die(Cuik_CPP* restrict c, const unsigned char* key, size_t length) {
+    MacroEntry* def = insert_define(c, key, length);
+    if (def == NULL) {
+        fprintf(stderr, "preprocessor error: cannot store macro '%.*s', out of memory!\n", (int)length, key);
+        abort();
+    }
+
+    return def;
+}
+
 static size_t hide_macro(Cuik_CPP* restrict c, size_t def_index) {
-    size_t saved = c->macro_bucket_keys_length[def_index];
-    c->macro_bucket_keys_length[def_index] = 0;
+    size_t saved = c->macros[def_index].key_length;
+    c->macros[def_index].key_length = 0;
     return saved;
 }
 
 static void unhide_macro(Cuik_CPP* restrict c, size_t def_index, size_t saved) {
-    c->macro_bucket_keys_length[def_index] = saved;
+    c->macros[def_index].key_length = saved;
+}
+
+CUIK_API void cuikpp_define_empty(Cuik_CPP* ctx, const char* key) {
+    size_t len = strlen(key);
+
+    // TODO(NeGate): Work around to get any of the macro bucket
+    // keys to be at 16bytes aligned
+    size_t pad_len = (len + 16) & ~15;
+    char* newkey = gimme_the_shtuffs(ctx, pad_len);
+    memcpy(newkey, key, len);
+    memset(newkey + len, 0, pad_len - len);
+
+    // Hash name, name doesn't include parenthesis part btw
+    const char* paren = newkey;
+    while ((paren - newkey) < len && *paren != '(') paren++;
+    len = *paren == '(' ? paren - newkey : len;
+
+    MacroEntry* def = insert_define_or_die(ctx, (const unsigned char*)newkey, len);
+    def->key = (const unsigned char*)newkey;
+    def->value_start = NULL;
+    def->value_end = NULL;
+    def->body = compile_macro_text(ctx, def->key + len, NULL);
+    def->loc = SOURCE_LOC_SET_TYPE(SOURCE_LOC_UNKNOWN, 0);
+}
+
+CUIK_API void cuikpp_define(Cuik_CPP* ctx, const char* key, const char* value) {
+    // TODO(NeGate): Fix up this code a bit because i really dislike how the
+    // parenthesis are detected
+    size_t len = strlen(key);
+
+    // TODO(NeGate): Work around to get any of the macro bucket
+    // keys to be at 16bytes aligned
+    size_t pad_len = (len + 16) & ~15;
+    char* newkey = gimme_the_shtuffs(ctx, pad_len);
+    memcpy(newkey, key, len);
+    memset(newkey + len, 0, pad_len - len);
+
+    // Hash name, name doesn't include parenthesis part btw
+    const char* paren = newkey;
+    while ((paren - newkey) < len && *paren != '(') paren++;
+    len = *paren == '(' ? paren - newkey : len;
+
+    MacroEntry* def = insert_define_or_die(ctx, (const unsigned char*)newkey, len);
+    def->key = (const unsigned char*)newkey;
+
+    {
+        size_t len = strlen(value);
+
+        size_t pad_len = (len + 16) & ~15;
+        char* newvalue = gimme_the_shtuffs(ctx, pad_len);
+        memcpy(newvalue, value, len);
+
+        size_t rem = pad_len - len;
+        memset(newvalue + len, 0, rem);
+
+        def->value_start = (const unsigned char*)newvalue;
+        def->value_end = (const unsigned char*)newvalue + len;
+        def->loc = SOURCE_LOC_SET_TYPE(SOURCE_LOC_UNKNOWN, 0);
+    }
+
+    def->body = compile_macro_text(ctx, def->key + len, def->value_start);
 }
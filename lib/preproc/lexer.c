@@ -1,5 +1,10 @@
 #include "lexer.h"
 #include <x86intrin.h>
+#include <stdatomic.h>
+
+#if USE_INTRIN
+#include <cpuid.h>
+#endif
 
 #ifdef __CUIKC__
 #define ALWAYS_INLINE inline
@@ -196,44 +201,324 @@ TknType classify_ident(const unsigned char* restrict str, size_t len) {
     #endif
 }
 
-static int line_counter(size_t len, const unsigned char* str) {
-    #if 1
+////////////////////////////////
+// Scanning kernels
+////////////////////////////////
+// The long scans (comments, string literals and counting the lines they cover) go
+// through a table that's picked the first time we need it: AVX2 if the CPU and OS
+// support it, SSE2 otherwise and plain loops if we're built without intrinsics.
+// Identifiers and numbers are rarely longer than 16 bytes so the call would cost
+// more than the wider loads save, those are done inline with SSE.
+//
+// NOTE(NeGate): the kernels which look for a terminator only do aligned loads, they
+// can't cross into the next page so it's fine to read past the end (or before the
+// start) of the buffer but ASan doesn't know that.
+typedef struct {
+    // first '\n' or '\0' at or after p
+    const unsigned char* (*find_newline)(const unsigned char* p);
+    // first quote, '\n' or '\0' at or after p
+    const unsigned char* (*find_quote)(const unsigned char* p, unsigned char quote);
+    // p is the '*' in the "/*", returns the '/' which closes it (or the '\0')
+    const unsigned char* (*find_comment_end)(const unsigned char* p);
+    int (*count_lines)(size_t len, const unsigned char* str);
+} LexerKernels;
+
+static const unsigned char* scalar_find_newline(const unsigned char* p) {
+    while (*p && *p != '\n') p++;
+    return p;
+}
+
+static const unsigned char* scalar_find_quote(const unsigned char* p, unsigned char quote) {
+    while (*p && *p != quote && *p != '\n') p++;
+    return p;
+}
+
+static const unsigned char* scalar_find_comment_end(const unsigned char* p) {
+    do {
+        p++;
+    } while (*p && !(p[0] == '/' && p[-1] == '*'));
+
+    return p;
+}
+
+static int scalar_count_lines(size_t len, const unsigned char* str) {
     int line_count = 0;
     for (size_t i = 0; i < len; i++) {
         line_count += (str[i] == '\n');
     }
 
     return line_count;
-    #else
-    // TODO(NeGate): Test this out a bit before using it
-    static unsigned char overhang_mask[32] = {
-        255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
-    };
+}
 
-    size_t line_count = 0;
-    size_t chunk_count = len / 16;
-    while (chunk_count) {
-        __m128i str128 = _mm_loadu_si128((__m128i*)str);
-        str += 16;
+#if !USE_INTRIN
+static const unsigned char* skip_ident(const unsigned char* p) {
+    while (char_classes[*p] == CHAR_CLASS_IDENT || char_classes[*p] == CHAR_CLASS_NUMBER) p++;
+    return p;
+}
+
+static const unsigned char* skip_digits(const unsigned char* p) {
+    while (char_classes[*p] == CHAR_CLASS_NUMBER) p++;
+    return p;
+}
 
-        unsigned int lf_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(str128, _mm_set1_epi8('\n')));
-        line_count += __builtin_popcount(lf_mask);
+static const unsigned char* skip_hex_digits(const unsigned char* p) {
+    while ((*p >= '0' && *p <= '9') || (*p >= 'A' && *p <= 'F') || (*p >= 'a' && *p <= 'f')) p++;
+    return p;
+}
+
+static const LexerKernels scalar_kernels = {
+    scalar_find_newline, scalar_find_quote, scalar_find_comment_end, scalar_count_lines
+};
+#endif
+
+#if USE_INTRIN
+#define LEXER_KERNEL __attribute__((no_sanitize_address))
+#define LEXER_KERNEL_AVX2 __attribute__((no_sanitize_address, target("avx2")))
+
+// A-Z a-z 0-9 _ $ and anything past ASCII
+static inline __m128i sse2_ident_mask(__m128i c) {
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_cmplt_epi8(_mm_add_epi8(lower, _mm_set1_epi8(128 - 'a')), _mm_set1_epi8(-128 + 26));
+    __m128i digit = _mm_cmplt_epi8(_mm_add_epi8(c, _mm_set1_epi8(128 - '0')), _mm_set1_epi8(-128 + 10));
+    __m128i other = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('_')), _mm_cmpeq_epi8(c, _mm_set1_epi8('$')));
+    __m128i unicode = _mm_cmplt_epi8(c, _mm_setzero_si128());
+
+    return _mm_or_si128(_mm_or_si128(alpha, digit), _mm_or_si128(other, unicode));
+}
+
+static inline __m128i sse2_digit_mask(__m128i c) {
+    return _mm_cmplt_epi8(_mm_add_epi8(c, _mm_set1_epi8(128 - '0')), _mm_set1_epi8(-128 + 10));
+}
+
+static inline __m128i sse2_hex_mask(__m128i c) {
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_cmplt_epi8(_mm_add_epi8(lower, _mm_set1_epi8(128 - 'a')), _mm_set1_epi8(-128 + 6));
+    return _mm_or_si128(sse2_digit_mask(c), alpha);
+}
+
+// these rely on the fat null terminator, they stop at the first byte which
+// doesn't match (the '\0' never does) and that's at most 16 bytes back.
+static inline const unsigned char* skip_ident(const unsigned char* p) {
+    for (;;) {
+        uint32_t mask = ~_mm_movemask_epi8(sse2_ident_mask(_mm_loadu_si128((const __m128i*)p))) & 0xFFFF;
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
     }
+}
 
-    size_t overhang = len % 16;
-    __m128 str128 = _mm_and_si128(str, _mm_loadu_si128((__m128i*)&overhang_mask[16 - overhang]));
-    unsigned int lf_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(str128, _mm_set1_epi8('\n')));
-    line_count += __builtin_popcount(lf_mask);
+static inline const unsigned char* skip_digits(const unsigned char* p) {
+    for (;;) {
+        uint32_t mask = ~_mm_movemask_epi8(sse2_digit_mask(_mm_loadu_si128((const __m128i*)p))) & 0xFFFF;
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+}
 
-    return line_count;
-    #endif
+static inline const unsigned char* skip_hex_digits(const unsigned char* p) {
+    for (;;) {
+        uint32_t mask = ~_mm_movemask_epi8(sse2_hex_mask(_mm_loadu_si128((const __m128i*)p))) & 0xFFFF;
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+}
+
+LEXER_KERNEL static const unsigned char* sse2_find_newline(const unsigned char* p) {
+    const unsigned char* block = (const unsigned char*)((uintptr_t)p & ~(uintptr_t)15);
+    uint32_t valid = 0xFFFFu << (p - block);
+
+    for (;;) {
+        __m128i bytes = _mm_load_si128((const __m128i*)block);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+
+        uint32_t mask = _mm_movemask_epi8(hit) & valid;
+        if (mask) return block + __builtin_ctz(mask);
+
+        block += 16, valid = 0xFFFF;
+    }
+}
+
+LEXER_KERNEL static const unsigned char* sse2_find_quote(const unsigned char* p, unsigned char quote) {
+    const unsigned char* block = (const unsigned char*)((uintptr_t)p & ~(uintptr_t)15);
+    uint32_t valid = 0xFFFFu << (p - block);
+
+    for (;;) {
+        __m128i bytes = _mm_load_si128((const __m128i*)block);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(quote)), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+
+        uint32_t mask = _mm_movemask_epi8(hit) & valid;
+        if (mask) return block + __builtin_ctz(mask);
+
+        block += 16, valid = 0xFFFF;
+    }
+}
+
+LEXER_KERNEL static const unsigned char* sse2_find_comment_end(const unsigned char* p) {
+    const unsigned char* block = (const unsigned char*)((uintptr_t)p & ~(uintptr_t)15);
+
+    // the first place it can close is right after the '*', that might be in the next block
+    uint32_t valid = 0xFFFFu << ((p + 1) - block);
+    uint32_t carry = 0;
+
+    for (;;) {
+        __m128i bytes = _mm_load_si128((const __m128i*)block);
+        uint32_t star = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('*')));
+        uint32_t slash = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('/')));
+        uint32_t null = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+
+        uint32_t mask = ((slash & ((star << 1) | carry)) | null) & valid & 0xFFFF;
+        if (mask) return block + __builtin_ctz(mask);
+
+        carry = (star >> 15) & 1;
+        block += 16, valid = 0xFFFF;
+    }
+}
+
+static int sse2_count_lines(size_t len, const unsigned char* str) {
+    int line_count = 0;
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)&str[i]);
+        line_count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'))));
+    }
+
+    return line_count + scalar_count_lines(len - i, &str[i]);
+}
+
+LEXER_KERNEL_AVX2 static const unsigned char* avx2_find_newline(const unsigned char* p) {
+    const unsigned char* block = (const unsigned char*)((uintptr_t)p & ~(uintptr_t)31);
+    uint32_t valid = 0xFFFFFFFFu << (p - block);
+
+    for (;;) {
+        __m256i bytes = _mm256_load_si256((const __m256i*)block);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(bytes, _mm256_setzero_si256()));
+
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit) & valid;
+        if (mask) return block + __builtin_ctz(mask);
+
+        block += 32, valid = 0xFFFFFFFFu;
+    }
+}
+
+LEXER_KERNEL_AVX2 static const unsigned char* avx2_find_quote(const unsigned char* p, unsigned char quote) {
+    const unsigned char* block = (const unsigned char*)((uintptr_t)p & ~(uintptr_t)31);
+    uint32_t valid = 0xFFFFFFFFu << (p - block);
+
+    for (;;) {
+        __m256i bytes = _mm256_load_si256((const __m256i*)block);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(quote)), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(bytes, _mm256_setzero_si256()));
+
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit) & valid;
+        if (mask) return block + __builtin_ctz(mask);
+
+        block += 32, valid = 0xFFFFFFFFu;
+    }
+}
+
+LEXER_KERNEL_AVX2 static const unsigned char* avx2_find_comment_end(const unsigned char* p) {
+    const unsigned char* block = (const unsigned char*)((uintptr_t)p & ~(uintptr_t)31);
+
+    // same as the SSE2 one, this shift can be a full 32 so it's done in 64bits
+    uint32_t valid = (uint32_t)(0xFFFFFFFFull << ((p + 1) - block));
+    uint32_t carry = 0;
+
+    for (;;) {
+        __m256i bytes = _mm256_load_si256((const __m256i*)block);
+        uint32_t star = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('*')));
+        uint32_t slash = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('/')));
+        uint32_t null = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_setzero_si256()));
+
+        uint32_t mask = ((slash & ((star << 1) | carry)) | null) & valid;
+        if (mask) return block + __builtin_ctz(mask);
+
+        carry = star >> 31;
+        block += 32, valid = 0xFFFFFFFFu;
+    }
+}
+
+LEXER_KERNEL_AVX2 static int avx2_count_lines(size_t len, const unsigned char* str) {
+    int line_count = 0;
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)&str[i]);
+        line_count += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'))));
+    }
+
+    return line_count + scalar_count_lines(len - i, &str[i]);
+}
+
+static const LexerKernels sse2_kernels = {
+    sse2_find_newline, sse2_find_quote, sse2_find_comment_end, sse2_count_lines
+};
+
+static const LexerKernels avx2_kernels = {
+    avx2_find_newline, avx2_find_quote, avx2_find_comment_end, avx2_count_lines
+};
+
+static bool cpu_has_avx2(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) {
+        return false;
+    }
+
+    // the OS has to save the YMM registers for us
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__ volatile ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6) {
+        return false;
+    }
+
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2);
+}
+#endif
+
+static _Atomic(const LexerKernels*) lexer_kernels;
+
+static const LexerKernels* get_lexer_kernels(void) {
+    const LexerKernels* k = atomic_load_explicit(&lexer_kernels, memory_order_acquire);
+    if (k == NULL) {
+        #if USE_INTRIN
+        k = cpu_has_avx2() ? &avx2_kernels : &sse2_kernels;
+        #else
+        k = &scalar_kernels;
+        #endif
+
+        // everyone racing here picks the same thing
+        atomic_store_explicit(&lexer_kernels, k, memory_order_release);
+    }
+
+    return k;
 }
 
 // NOTE(NeGate): The input string has a fat null terminator of 16bytes to allow
 // for some optimizations overall, one of the important ones is being able to read
 // a whole 16byte SIMD register at once for any SIMD optimizations.
+static void lexer_replay(Lexer* restrict l) {
+    if (l->replay == l->replay_end) {
+        l->hit_line = true;
+        l->token_type = '\0';
+        return;
+    }
+
+    const MacroToken* t = l->replay++;
+    l->token_type = t->type;
+    l->token_start = t->start;
+    l->token_end = t->start + t->length;
+
+    // tokens which aren't in the text we're replaying (made up during the expansion)
+    // just get their own line.
+    l->line_current = (t->start >= l->start && t->start < l->current) ? l->start : t->start;
+}
+
 void lexer_read(Lexer* restrict l) {
+    if (l->replay != NULL) {
+        lexer_replay(l);
+        return;
+    }
+
     if (l->line_current2) {
         l->line_current = l->line_current2;
         l->line_current2 = NULL;
@@ -274,9 +559,7 @@ void lexer_read(Lexer* restrict l) {
             goto redo_lex;
         } else if (*current == '/') {
             if (current[1] == '/') {
-                do {
-                    current++;
-                } while (*current && *current != '\n');
+                current = get_lexer_kernels()->find_newline(current + 2);
 
                 current += 1;
                 l->line_current = current;
@@ -286,13 +569,12 @@ void lexer_read(Lexer* restrict l) {
             } else if (current[1] == '*') {
                 current++;
 
+                const LexerKernels* kernels = get_lexer_kernels();
                 const unsigned char* start = current;
-                do {
-                    current++;
-                } while (*current && !(current[0] == '/' && current[-1] == '*'));
+                current = kernels->find_comment_end(current);
                 current++;
 
-                int lines_elapsed = line_counter(current - start, start);
+                int lines_elapsed = kernels->count_lines(current - start, start);
 
                 l->line_current = current;
                 l->current_line += lines_elapsed;
@@ -336,20 +618,9 @@ void lexer_read(Lexer* restrict l) {
         case CHAR_CLASS_IDENT: {
             l->token_type = TOKEN_IDENTIFIER;
 
-            while (char_classes[*current] == CHAR_CLASS_IDENT ||
-                char_classes[*current] == CHAR_CLASS_NUMBER ||
-                *current == '\\') {
-                if (current[0] == '\\') {
-                    if (current[0] == 'U' || current[0] == 'u') {
-                        slow_identifier_lexing = true;
-                    } else {
-                        // exit... it's a wonky identifier
-                        break;
-                    }
-                }
-
-                current++;
-            }
+            // it stops at a backslash, \U and \u are only handled at the start
+            // (which slow_identifier_lexing has already seen)
+            current = skip_ident(current);
 
             if (!slow_identifier_lexing) break;
 
@@ -430,11 +701,7 @@ void lexer_read(Lexer* restrict l) {
             } else if (current[-1] == '0' && current[0] == 'x') {
                 current++;
 
-                while ((*current >= '0' && *current <= '9') ||
-                    (*current >= 'A' && *current <= 'F')    ||
-                    (*current >= 'a' && *current <= 'f')) {
-                    current++;
-                }
+                current = skip_hex_digits(current);
 
                 l->token_type = TOKEN_INTEGER;
                 if (*current == '.') {
@@ -442,25 +709,17 @@ void lexer_read(Lexer* restrict l) {
                     l->token_type = TOKEN_FLOAT;
                     current++;
 
-                    while ((*current >= '0' && *current <= '9') ||
-                        (*current >= 'A' && *current <= 'F')    ||
-                        (*current >= 'a' && *current <= 'f')) {
-                        current++;
-                    }
+                    current = skip_hex_digits(current);
 
                     if (*current == 'p') {
                         current++;
                         if (*current == '+' || *current == '-') current++;
 
-                        while (char_classes[*current] == CHAR_CLASS_NUMBER) {
-                            current++;
-                        }
+                        current = skip_digits(current);
                     }
                 }
             } else {
-                while (char_classes[*current] == CHAR_CLASS_NUMBER) {
-                    current++;
-                }
+                current = skip_digits(current);
                 l->token_type = TOKEN_INTEGER;
 
                 if (*current == '.') {
@@ -468,9 +727,7 @@ void lexer_read(Lexer* restrict l) {
                     l->token_type = TOKEN_FLOAT;
                     current++;
 
-                    while (char_classes[*current] == CHAR_CLASS_NUMBER) {
-                        current++;
-                    }
+                    current = skip_digits(current);
                 }
 
                 if (*current == 'e') {
@@ -480,9 +737,7 @@ void lexer_read(Lexer* restrict l) {
                     current++;
                     if (*current == '+' || *current == '-') current++;
 
-                    while (char_classes[*current] == CHAR_CLASS_NUMBER) {
-                        current++;
-                    }
+                    current = skip_digits(current);
                 }
 
                 if (*current == 'f' || *current == 'd') {
@@ -564,42 +819,24 @@ void lexer_read(Lexer* restrict l) {
         case CHAR_CLASS_STRING: {
             char quote_type = current[-1] == '\'' ? '\'' : '\"';
 
-            #if !USE_INTRIN
-            do {
-                if (*current == quote_type && current[-1] == '\\') break;
-                if (*current == '\n') l->current_line += 1;
+            // strings either end at the quote or are cut off early via a
+            // newline unless you put a backslash-newline joiner.
+            const LexerKernels* kernels = get_lexer_kernels();
+            for (;;) {
+                current = kernels->find_quote(current, quote_type);
+                if (*current == '\0') break;
 
                 current += 1;
-            } while (*current);
-            #else
-            __m128i pattern = _mm_set1_epi8(quote_type);
+                l->current_line += (current[-1] == '\n');
 
-            do {
-                __m128i bytes = _mm_loadu_si128((__m128i*)current);
+                // backslash join
+                if (current[-1] == '\n' && current[-2] == '\\') continue;
 
-                // strings either end at the quote or are cut off early via a
-                // newline unless you put a backslash-newline joiner.
-                __m128i test_quote = _mm_cmpeq_epi8(bytes, pattern);
-                __m128i test_newline = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'));
-                __m128i test = _mm_or_si128(test_quote, test_newline);
-                int len = __builtin_ffs(_mm_movemask_epi8(test));
+                // escape + quote like \"
+                if (current[-1] == quote_type && current[-2] == '\\' && current[-3] != '\\') continue;
 
-                if (len) {
-                    current += len;
-                    l->current_line += (current[-1] == '\n');
-
-                    // backslash join
-                    if (current[-1] == '\n' && current[-2] == '\\') continue;
-
-                    // escape + quote like \"
-                    if (current[-1] == quote_type && current[-2] == '\\' && current[-3] != '\\') continue;
-
-                    break;
-                } else {
-                    current += 16;
-                }
-            } while (*current);
-            #endif
+                break;
+            }
 
             l->token_type = quote_type;
 
@@ -661,7 +898,7 @@ void lexer_read(Lexer* restrict l) {
         }
 
         // tally up lines
-        l->current_line += line_counter(current - start, start);
+        l->current_line += get_lexer_kernels()->count_lines(current - start, start);
 
         // generate buffer with conjoined string
         unsigned char* conjoined_buffer;
@@ -859,3 +1096,36 @@ intptr_t parse_char(size_t len, const char* str, int* output) {
     *output = ch;
     return i;
 }
+
+void tokens_reserve(TokenStream* restrict s, size_t extra) {
+    size_t needed = s->count + extra;
+    if (needed <= s->capacity) return;
+
+    size_t new_cap = s->capacity ? s->capacity * 2 : 4096;
+    while (new_cap < needed) new_cap *= 2;
+
+    s->types = realloc(s->types, new_cap * sizeof(uint16_t));
+    s->token_locs = realloc(s->token_locs, new_cap * sizeof(SourceLocIndex));
+    s->starts = realloc(s->starts, new_cap * sizeof(const unsigned char*));
+    s->lengths = realloc(s->lengths, new_cap * sizeof(uint32_t));
+
+    if (s->types == NULL || s->token_locs == NULL || s->starts == NULL || s->lengths == NULL) {
+        printf("Lexer: out of memory!\n");
+        abort();
+    }
+
+    s->capacity = new_cap;
+}
+
+void tokens_free(TokenStream* restrict s) {
+    free(s->types);
+    free(s->token_locs);
+    free(s->starts);
+    free(s->lengths);
+
+    s->types = NULL;
+    s->token_locs = NULL;
+    s->starts = NULL;
+    s->lengths = NULL;
+    s->count = s->capacity = 0;
+}
@@ -141,6 +141,19 @@ enum TknType {
     TOKEN_KW_declspec,
 };
 
+// macro bodies are lexed once when they're defined (see cpp_symtab.h), expansions
+// just splice these together and replay them through a Lexer.
+typedef struct MacroToken {
+    uint16_t type;
+
+    // which macro parameter this names, -1 if it's not one. __VA_ARGS__ comes
+    // after the named parameters.
+    int16_t param;
+
+    uint32_t length;
+    const unsigned char* start;
+} MacroToken;
+
 typedef struct {
     ////////////////////////////////
     // USER-PROVIDED
@@ -165,6 +178,11 @@ typedef struct {
     TknType token_type;
     const unsigned char* token_start;
     const unsigned char* token_end;
+
+    // if set, lexer_read walks these instead of the text. start & current
+    // are the macro body text in that case so the columns can be computed.
+    const MacroToken* replay;
+    const MacroToken* replay_end;
 } Lexer;
 
 // this is used by the preprocessor to scan tokens in
@@ -185,31 +203,67 @@ inline static bool lexer_match(Lexer* restrict l, size_t len, const char* str) {
     return memcmp(l->token_start, str, len) == 0;
 }
 
-inline static SourceLocIndex tokens_get_last_location_index(TokenStream* restrict s) {
-    return s->tokens[s->current - 1].location;
+// resizes all the token arrays so they can fit `extra` more tokens
+void tokens_reserve(TokenStream* restrict s, size_t extra);
+void tokens_free(TokenStream* restrict s);
+
+inline static size_t tokens_count(TokenStream* restrict s) {
+    return s->count;
 }
 
-inline static SourceLocIndex tokens_get_location_index(TokenStream* restrict s) {
-    return s->tokens[s->current].location;
+inline static Token tokens_at(TokenStream* restrict s, size_t i) {
+    assert(i < s->count);
+    const unsigned char* start = s->starts[i];
+    return (Token){ s->types[i], s->token_locs[i], start, start + s->lengths[i] };
+}
+
+inline static void tokens_set(TokenStream* restrict s, size_t i, Token t) {
+    assert(i < s->count);
+    assert((size_t)(t.end - t.start) <= UINT32_MAX && t.type >= 0 && t.type <= UINT16_MAX);
+
+    s->types[i] = t.type;
+    s->token_locs[i] = t.location;
+    s->starts[i] = t.start;
+    s->lengths[i] = t.end - t.start;
+}
+
+inline static void tokens_push(TokenStream* restrict s, Token t) {
+    if (s->count >= s->capacity) {
+        tokens_reserve(s, 1);
+    }
+
+    s->count += 1;
+    tokens_set(s, s->count - 1, t);
+}
+
+// drops everything past the first `count` tokens
+inline static void tokens_truncate(TokenStream* restrict s, size_t count) {
+    assert(count <= s->count);
+    s->count = count;
 }
 
-inline static SourceLoc* tokens_get_last_location(TokenStream* restrict s) {
-    return &s->locations[s->tokens[s->current - 1].location];
+inline static SourceLocIndex tokens_get_last_location_index(TokenStream* restrict s) {
+    return s->token_locs[s->current - 1];
+}
+
+inline static SourceLocIndex tokens_get_location_index(TokenStream* restrict s) {
+    return s->token_locs[s->current];
 }
 
-inline static SourceLoc* tokens_get_location(TokenStream* restrict s) {
-    return &s->locations[s->tokens[s->current].location];
+// this is used by the parser to get the next token, if you only need
+// the type this is just a load from the types array.
+inline static Token tokens_get(TokenStream* restrict s) {
+    return tokens_at(s, s->current);
 }
 
-// this is used by the parser to get the next token
-inline static Token* tokens_get(TokenStream* restrict s) {
-    return &s->tokens[s->current];
+inline static int tokens_get_type(TokenStream* restrict s) {
+    return s->types[s->current];
 }
 
 // there should be a NULL token so as long as we can read [current]
 // we can read one ahead.
-inline static Token* tokens_peek(TokenStream* restrict s) {
-    return &s->tokens[s->current + 1];
+inline static Token tokens_peek(TokenStream* restrict s) {
+    return tokens_at(s, s->current + 1);
 }
 
 inline static void tokens_prev(TokenStream* restrict s) {
@@ -218,6 +272,6 @@ inline static void tokens_prev(TokenStream* restrict s) {
 }
 
 inline static void tokens_next(TokenStream* restrict s) {
-    assert(s->current < arrlen(s->tokens));
+    assert(s->current < s->count);
     s->current += 1;
 }
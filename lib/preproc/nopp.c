@@ -48,7 +48,7 @@ TokenStream nopp_invoke(Lexer* restrict l) {
             t.type = classify_ident(l->token_start, l->token_end - l->token_start);
         }
 
-        arrput(s.tokens, t);
+        tokens_push(&s, t);
         lexer_read(l);
     }
 
@@ -1,4 +1,5 @@
 #pragma once
+#include <cuik.h>
 #include <tb.h>
 #include <stdatomic.h>
 
@@ -50,7 +51,17 @@ typedef struct CompilerSettings {
     bool static_crt : 1;
 
     int num_of_worker_threads;
+
+    Cuik_CompileTier tier;
+
+    // names of functions which should be treated as hot (stb_ds string set)
+    struct HotFunctionEntry* hot_functions;
 } CompilerSettings;
 
+typedef struct HotFunctionEntry {
+    char* key;
+    int value;
+} HotFunctionEntry;
+
 extern Warnings warnings;
 extern CompilerSettings settings;
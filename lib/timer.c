@@ -21,7 +21,7 @@ static const Cuik_IProfiler* profiler;
 
 CUIK_API void cuik_start_global_profiler(const Cuik_IProfiler* p, bool lock_on_plot) {
     assert(p != NULL);
-    assert(profiler != NULL);
+    assert(profiler == NULL);
 
     profiler = p;
     should_lock_profiler = lock_on_plot;
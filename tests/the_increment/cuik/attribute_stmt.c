@@ -0,0 +1,16 @@
+// __attribute__ at the start of a statement is only a declaration if a type follows
+// it, otherwise it's a statement attribute which we parse as a null statement.
+__attribute__((hot)) int hot_leading(int x);
+
+int attribute_stmt(int x) {
+    switch (x) {
+        case 0: x++; __attribute__((fallthrough));
+        case 1: x += 2; break;
+        case 2: __attribute__((fallthrough));
+        default: if (x) __attribute__((fallthrough)); else x = 3;
+    }
+
+    __attribute__((unused)) int y = x;
+    __attribute__((unused)) __attribute__((aligned(8))) typeof(x) z = y;
+    return z;
+}
@@ -0,0 +1,19 @@
+// --gc leaves the functions main can't reach without a real body, the object
+// still has to link against the externals (puts) that the rest of it calls.
+#include <stdio.h>
+
+int unreachable_1(int x) {
+    return x * 7;
+}
+
+int unreachable_2(const char* str) {
+    return printf("%s\n", str);
+}
+
+int helper(int x) {
+    return puts("hi") + x;
+}
+
+int main(void) {
+    return helper(2) < 0;
+}
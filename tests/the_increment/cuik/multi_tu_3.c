@@ -0,0 +1,15 @@
+// one of several files compiled together (see multi_tu_main.c)
+#include <stdio.h>
+
+#define FUNC(n) int tu3_##n(int x) { int y = x * n + 3; if (y > 10) { y -= 3; } else { y += n; } return y; }
+#define FUNC10(n) FUNC(n##0) FUNC(n##1) FUNC(n##2) FUNC(n##3) FUNC(n##4) FUNC(n##5) FUNC(n##6) FUNC(n##7) FUNC(n##8) FUNC(n##9)
+#define FUNC100(n) FUNC10(n##0) FUNC10(n##1) FUNC10(n##2) FUNC10(n##3) FUNC10(n##4) FUNC10(n##5) FUNC10(n##6) FUNC10(n##7) FUNC10(n##8) FUNC10(n##9)
+
+FUNC100(1)
+FUNC100(2)
+FUNC100(3)
+FUNC100(4)
+
+void tu3_print(void) {
+    printf("%d ", tu3_123(2));
+}
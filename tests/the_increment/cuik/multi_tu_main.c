@@ -0,0 +1,15 @@
+// Several translation units compiled together, each one is big enough that its
+// parsing and type checking get split into multiple jobs so the files end up
+// interleaved on the thread pool.
+#include <stdio.h>
+
+void tu1_print(void);
+void tu2_print(void);
+void tu3_print(void);
+
+int main(void) {
+    tu1_print();
+    tu2_print();
+    tu3_print();
+    return 0;
+}